@@ -0,0 +1,312 @@
+/*
+ * bench.c — throughput benchmark for the standalone 6502 core
+ *
+ * Each workload is a 64 KB memory image plus a start address, run on
+ * bus_flat_t for a fixed number of cycles through both execution entry
+ * points (cpu6502_step in a loop, and cpu6502_run). A workload that halts
+ * or traps before the budget is used up is reloaded and restarted, so
+ * every repetition does the same work; the number of restarts is
+ * reported so a test that fails early is visible.
+ *
+ *   bench6502 [-w warmup] [-r reps] [-c cycles] [-klaus bin] [-nestest nes]
+ *
+ * A built-in synthetic loop always runs. Klaus Dormann's functional test
+ * (the 64 KB .bin, entered at $0400) and nestest (the .nes, PRG mapped at
+ * $8000/$C000, entered at $C000 in automation mode) are added when given.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bus.h"
+#include "cpu6502.h"
+#include "bench.h"
+
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPS   5
+#define DEFAULT_CYCLES 50000000ULL
+
+typedef struct {
+    const char *name;
+    uint8_t *image;      /* 64 KB pristine memory */
+    uint16_t start;
+} workload_t;
+
+typedef enum { ENGINE_STEP, ENGINE_RUN } engine_t;
+
+static const char *const engine_names[] = { "step", "run" };
+
+/* Loads, indexed stores, (zp),Y, read-modify-write and JSR/RTS at $0400 */
+static const uint8_t synthetic_code[] = {
+    0xA2, 0x00,             /* 0400  LDX #$00     */
+    0xBD, 0x00, 0x10,       /* 0402  LDA $1000,X  */
+    0x18,                   /* 0405  CLC          */
+    0x69, 0x03,             /* 0406  ADC #$03     */
+    0x9D, 0x00, 0x11,       /* 0408  STA $1100,X  */
+    0xB1, 0x10,             /* 040B  LDA ($10),Y  */
+    0x45, 0x20,             /* 040D  EOR $20      */
+    0x85, 0x20,             /* 040F  STA $20      */
+    0x20, 0x1C, 0x04,       /* 0411  JSR $041C    */
+    0xE8,                   /* 0414  INX          */
+    0xD0, 0xEB,             /* 0415  BNE $0402    */
+    0xE6, 0x21,             /* 0417  INC $21      */
+    0x4C, 0x00, 0x04,       /* 0419  JMP $0400    */
+    0x06, 0x22,             /* 041C  ASL $22      */
+    0x2A,                   /* 041E  ROL A        */
+    0x46, 0x23,             /* 041F  LSR $23      */
+    0x60,                   /* 0421  RTS          */
+};
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -w N            warm-up runs per benchmark (default: %d)\n"
+        "  -r N            measured repetitions (default: %d, max %d)\n"
+        "  -c N            CPU cycles per run (default: %llu)\n"
+        "  -klaus FILE     add Klaus Dormann's 6502_functional_test.bin\n"
+        "  -nestest FILE   add nestest.nes (automation mode)\n",
+        prog, DEFAULT_WARMUP, DEFAULT_REPS, BENCH_MAX_REPS,
+        (unsigned long long)DEFAULT_CYCLES);
+}
+
+static uint8_t *read_file(const char *path, long *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open '%s'\n", path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *buf = *size > 0 ? malloc((size_t)*size) : NULL;
+    if (!buf || fread(buf, 1, (size_t)*size, fp) != (size_t)*size) {
+        fprintf(stderr, "Cannot read '%s'\n", path);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    return buf;
+}
+
+static bool make_synthetic(workload_t *w)
+{
+    w->name = "synthetic";
+    w->start = 0x0400;
+    w->image = calloc(1, 65536);
+    if (!w->image)
+        return false;
+    memcpy(w->image + 0x0400, synthetic_code, sizeof(synthetic_code));
+    w->image[0x10] = 0x00;   /* ($10) -> $1200 */
+    w->image[0x11] = 0x12;
+    for (int i = 0; i < 256; i++)
+        w->image[0x1000 + i] = (uint8_t)(i * 7);
+    return true;
+}
+
+static bool make_klaus(workload_t *w, const char *path)
+{
+    long size;
+    uint8_t *data = read_file(path, &size);
+    if (!data)
+        return false;
+    if (size != 65536) {
+        fprintf(stderr, "'%s': expected a 64 KB image, got %ld bytes\n", path, size);
+        free(data);
+        return false;
+    }
+    w->name = "klaus";
+    w->start = 0x0400;
+    w->image = data;
+    return true;
+}
+
+static bool make_nestest(workload_t *w, const char *path)
+{
+    long size;
+    uint8_t *data = read_file(path, &size);
+    if (!data)
+        return false;
+
+    long prg_offset = 16 + ((size > 6 && (data[6] & 0x04)) ? 512 : 0);
+    long prg_size = size > 4 ? (long)data[4] * 16384 : 0;
+    if (size < 16 || memcmp(data, "NES\x1A", 4) != 0 || prg_size == 0 ||
+        prg_offset + prg_size > size) {
+        fprintf(stderr, "'%s': not an iNES file\n", path);
+        free(data);
+        return false;
+    }
+
+    w->name = "nestest";
+    w->start = 0xC000;
+    w->image = calloc(1, 65536);
+    if (!w->image) {
+        free(data);
+        return false;
+    }
+    /* First 16 KB bank at $8000, last at $C000 (NROM-128 mirrors) */
+    memcpy(w->image + 0x8000, data + prg_offset, 16384);
+    memcpy(w->image + 0xC000, data + prg_offset + prg_size - 16384, 16384);
+    free(data);
+    return true;
+}
+
+static void start_workload(const workload_t *w, bus_flat_t *bus, cpu6502_t *cpu)
+{
+    memcpy(bus->ram, w->image, sizeof(bus->ram));
+    cpu6502_init(cpu, bus_flat_read, bus_flat_write, bus);
+    bus_flat_map(bus, cpu);
+    cpu6502_reset(cpu);
+    cpu->pc = w->start;
+}
+
+typedef struct {
+    double seconds;
+    uint64_t instructions;   /* counted by the step engine only */
+    uint64_t restarts;
+} run_result_t;
+
+static run_result_t run_once(const workload_t *w, engine_t engine, uint64_t budget,
+                             bus_flat_t *bus)
+{
+    cpu6502_t cpu;
+    run_result_t r = { 0.0, 0, 0 };
+    uint64_t done = 0;
+
+    start_workload(w, bus, &cpu);
+    double t0 = bench_now();
+
+    while (done < budget) {
+        bool stopped;
+        if (engine == ENGINE_RUN) {
+            done += cpu6502_run(&cpu, budget - done);
+            stopped = cpu.halted || cpu.trapped;
+        } else {
+            uint16_t pc = cpu.pc;
+            uint64_t before = cpu.cycles;
+            cpu6502_step(&cpu);
+            done += cpu.cycles - before;
+            r.instructions++;
+            /* Same stop rules as cpu6502_run */
+            stopped = cpu.halted || cpu.pc == pc;
+        }
+        if (stopped && done < budget) {
+            r.restarts++;
+            start_workload(w, bus, &cpu);
+        }
+    }
+
+    r.seconds = bench_now() - t0;
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    long warmup = DEFAULT_WARMUP, reps = DEFAULT_REPS;
+    unsigned long long budget = DEFAULT_CYCLES;
+    workload_t workloads[3];
+    int nworkloads = 0;
+
+    if (!make_synthetic(&workloads[nworkloads++])) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        const char *flag = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if ((strcmp(flag, "-klaus") == 0 || strcmp(flag, "-nestest") == 0) &&
+            nworkloads == 3) {
+            fprintf(stderr, "At most one -klaus and one -nestest\n");
+            return 1;
+        }
+        if (strcmp(flag, "-w") == 0) {
+            warmup = strtol(val, NULL, 10);
+        } else if (strcmp(flag, "-r") == 0) {
+            reps = strtol(val, NULL, 10);
+        } else if (strcmp(flag, "-c") == 0) {
+            budget = strtoull(val, NULL, 10);
+        } else if (strcmp(flag, "-klaus") == 0) {
+            if (!make_klaus(&workloads[nworkloads++], val))
+                return 1;
+        } else if (strcmp(flag, "-nestest") == 0) {
+            if (!make_nestest(&workloads[nworkloads++], val))
+                return 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (warmup < 0 || reps < 1 || reps > BENCH_MAX_REPS || budget == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    bus_flat_t *bus = malloc(sizeof(bus_flat_t));
+    if (!bus) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("{\n  \"suite\": \"6502\",\n  \"warmup\": %ld,\n  \"reps\": %ld,\n"
+           "  \"cycles\": %llu,\n  \"results\": [", warmup, reps, budget);
+
+    bool first = true;
+    for (int wi = 0; wi < nworkloads; wi++) {
+        const workload_t *w = &workloads[wi];
+        uint64_t instructions = 0;
+
+        for (int e = ENGINE_STEP; e <= ENGINE_RUN; e++) {
+            double seconds[BENCH_MAX_REPS], mips[BENCH_MAX_REPS], mcps[BENCH_MAX_REPS];
+            run_result_t r = { 0.0, 0, 0 };
+
+            fprintf(stderr, "%s/%s: ", w->name, engine_names[e]);
+            for (long k = 0; k < warmup; k++) {
+                r = run_once(w, (engine_t)e, budget, bus);
+                if (e == ENGINE_STEP)
+                    instructions = r.instructions;
+            }
+            for (long k = 0; k < reps; k++) {
+                r = run_once(w, (engine_t)e, budget, bus);
+                /* Execution is deterministic, so the step engine's count
+                 * applies to the run engine as well */
+                if (e == ENGINE_STEP)
+                    instructions = r.instructions;
+                seconds[k] = r.seconds;
+                mips[k] = (double)instructions / r.seconds / 1e6;
+                mcps[k] = (double)budget / r.seconds / 1e6;
+            }
+            fprintf(stderr, "%.1f Mcycles/s\n", bench_summarize(mcps, (int)reps).mean);
+
+            printf("%s\n    {\"workload\": \"%s\", \"engine\": \"%s\", "
+                   "\"instructions\": %llu, \"restarts\": %llu,\n     ",
+                   first ? "" : ",", w->name, engine_names[e],
+                   (unsigned long long)instructions, (unsigned long long)r.restarts);
+            bench_json_stats(stdout, "seconds", seconds, (int)reps);
+            printf(",\n     ");
+            bench_json_stats(stdout, "mips", mips, (int)reps);
+            printf(",\n     ");
+            bench_json_stats(stdout, "mcycles_per_sec", mcps, (int)reps);
+            printf("}");
+            first = false;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    for (int wi = 0; wi < nworkloads; wi++)
+        free(workloads[wi].image);
+    free(bus);
+    return 0;
+}
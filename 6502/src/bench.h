@@ -0,0 +1,70 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Timing and summary helpers shared by the benchmark drivers (bench6502,
+ * nes_bench). Results are printed as JSON on stdout; progress goes to
+ * stderr. Includers must request POSIX (for clock_gettime) before any
+ * system header. */
+
+#define BENCH_MAX_REPS 100
+
+typedef struct {
+    double mean;
+    double stddev;   /* sample standard deviation; 0 for a single run */
+    double min;
+    double max;
+} bench_stats_t;
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline bench_stats_t bench_summarize(const double *v, int n)
+{
+    bench_stats_t s = { 0.0, 0.0, v[0], v[0] };
+    for (int i = 0; i < n; i++) {
+        s.mean += v[i];
+        if (v[i] < s.min) s.min = v[i];
+        if (v[i] > s.max) s.max = v[i];
+    }
+    s.mean /= n;
+    if (n > 1) {
+        double ss = 0.0;
+        for (int i = 0; i < n; i++)
+            ss += (v[i] - s.mean) * (v[i] - s.mean);
+        s.stddev = sqrt(ss / (n - 1));
+    }
+    return s;
+}
+
+/* "key": {"mean": ..., "stddev": ..., "min": ..., "max": ...} */
+static inline void bench_json_stats(FILE *fp, const char *key, const double *v, int n)
+{
+    bench_stats_t s = bench_summarize(v, n);
+    fprintf(fp, "\"%s\": {\"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f, \"max\": %.4f}",
+            key, s.mean, s.stddev, s.min, s.max);
+}
+
+/* JSON string with quotes, backslashes and control characters escaped */
+static inline void bench_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(fp, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(fp, "\\u%04x", *p);
+        else
+            fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "bus.h"
+#include "cpu6502.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -57,3 +58,8 @@ void bus_flat_write(void *ctx, uint16_t addr, uint8_t val)
     bus_flat_t *bus = (bus_flat_t *)ctx;
     bus->ram[addr] = val;
 }
+
+void bus_flat_map(bus_flat_t *bus, cpu6502_t *cpu)
+{
+    cpu6502_map_pages(cpu, 0x00, 256, bus->ram, bus->ram);
+}
@@ -23,4 +23,9 @@ bool bus_flat_load(bus_flat_t *bus, const char *path, uint16_t base_addr);
 uint8_t bus_flat_read(void *ctx, uint16_t addr);
 void bus_flat_write(void *ctx, uint16_t addr, uint8_t val);
 
+/* Map all 256 pages of the flat RAM into the CPU's page table so every
+ * access bypasses the callbacks. Call after cpu6502_init. */
+struct cpu6502_t;
+void bus_flat_map(bus_flat_t *bus, struct cpu6502_t *cpu);
+
 #endif
@@ -1,5 +1,7 @@
 #include "cpu6502.h"
 #include "opcodes.h"
+#include "profile.h"
+#include <string.h>
 
 void cpu6502_init(cpu6502_t *cpu, bus_read_fn read, bus_write_fn write, void *ctx)
 {
@@ -12,6 +14,13 @@ void cpu6502_init(cpu6502_t *cpu, bus_read_fn read, bus_write_fn write, void *ct
     cpu->cycles = 0;
     cpu->halted = false;
     cpu->page_crossed = false;
+    cpu->run_break = false;
+    cpu->trapped = false;
+    cpu->spin_detect = false;
+    cpu->spinning = false;
+    cpu->spin_pc = 0;
+    cpu->spin_ignore = 0;
+    cpu->irq_line = false;
 
     /* Bit 5 (unused) is always set; I flag set at init */
     cpu->status = CPU_FLAG_U | CPU_FLAG_I;
@@ -20,6 +29,19 @@ void cpu6502_init(cpu6502_t *cpu, bus_read_fn read, bus_write_fn write, void *ct
     cpu->read = read;
     cpu->write = write;
     cpu->bus_ctx = ctx;
+
+    /* No direct pages until the bus maps some */
+    memset(cpu->read_page, 0, sizeof(cpu->read_page));
+    memset(cpu->write_page, 0, sizeof(cpu->write_page));
+}
+
+void cpu6502_map_pages(cpu6502_t *cpu, uint8_t page, int count,
+                       uint8_t *read_mem, uint8_t *write_mem)
+{
+    for (int i = 0; i < count && page + i < 256; i++) {
+        cpu->read_page[page + i] = read_mem ? read_mem + i * 256 : NULL;
+        cpu->write_page[page + i] = write_mem ? write_mem + i * 256 : NULL;
+    }
 }
 
 void cpu6502_reset(cpu6502_t *cpu)
@@ -48,6 +70,11 @@ void cpu6502_step(cpu6502_t *cpu)
 
     cpu->page_crossed = false;
 
+#ifdef CPU6502_PROFILE
+    uint16_t start_pc = cpu->pc;
+    uint64_t start_cycles = cpu->cycles;
+#endif
+
     uint8_t opcode = cpu_read(cpu, cpu->pc++);
 
     /* Add base cycle count for this opcode */
@@ -55,6 +82,8 @@ void cpu6502_step(cpu6502_t *cpu)
 
     /* Dispatch to the opcode handler */
     opcode_table[opcode](cpu);
+
+    CPU6502_PROFILE_INSN(start_pc, opcode, cpu->cycles - start_cycles);
 }
 
 void cpu6502_irq(cpu6502_t *cpu)
@@ -105,3 +134,28 @@ void cpu6502_nmi(cpu6502_t *cpu)
 
     cpu->cycles += 7;
 }
+
+void cpu6502_save_state(const cpu6502_t *cpu, state_writer_t *w)
+{
+    state_put_u8(w, cpu->a);
+    state_put_u8(w, cpu->x);
+    state_put_u8(w, cpu->y);
+    state_put_u8(w, cpu->sp);
+    state_put_u16(w, cpu->pc);
+    state_put_u8(w, cpu->status);
+    state_put_u64(w, cpu->cycles);
+    state_put_u8(w, cpu->halted);
+}
+
+void cpu6502_load_state(cpu6502_t *cpu, state_reader_t *r)
+{
+    cpu->a = state_get_u8(r);
+    cpu->x = state_get_u8(r);
+    cpu->y = state_get_u8(r);
+    cpu->sp = state_get_u8(r);
+    cpu->pc = state_get_u16(r);
+    cpu->status = state_get_u8(r) | CPU_FLAG_U;
+    cpu->cycles = state_get_u64(r);
+    cpu->halted = state_get_u8(r) != 0;
+    cpu->page_crossed = false;
+}
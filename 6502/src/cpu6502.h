@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "bus.h"
+#include "state.h"
 
 /* Status flag bit positions (match 6502 hardware layout) */
 #define CPU_FLAG_C 0x01  /* bit 0: carry */
@@ -15,7 +16,11 @@
 #define CPU_FLAG_V 0x40  /* bit 6: overflow */
 #define CPU_FLAG_N 0x80  /* bit 7: negative */
 
-typedef struct {
+/* Longest loop, in bytes from its start to the end of the jump back,
+ * that spin detection watches */
+#define CPU6502_SPIN_BYTES 16
+
+typedef struct cpu6502_t {
     /* Registers */
     uint8_t a;       /* accumulator */
     uint8_t x;       /* X index */
@@ -29,21 +34,70 @@ typedef struct {
 
     /* State */
     bool halted;
+    bool run_break;     /* set by cpu6502_break; ends cpu6502_run */
+    bool trapped;       /* last cpu6502_run stopped on a jump-to-self */
     bool page_crossed;  /* set by addressing helpers, consumed by handlers */
+    bool irq_line;      /* IRQ input level, driven by the bus owner; not saved */
+
+    /* Spin-loop detection, for owners that fast-forward idle loops (see
+     * cpu6502_run). Off by default; none of it is saved. */
+    bool spin_detect;       /* set by the owner to enable */
+    bool spinning;          /* last cpu6502_run stopped at a loop start */
+    uint16_t spin_pc;       /* start of the last short loop jumped back to */
+    uint16_t spin_ignore;   /* a loop start the owner declined to skip */
 
     /* Bus access */
     bus_read_fn read;
     bus_write_fn write;
     void *bus_ctx;
+
+    /* Optional direct-access page table, one entry per 256-byte page.
+     * A non-NULL entry points at the backing memory for that page and
+     * bypasses the callbacks; NULL pages (I/O, mapper registers) go
+     * through read/write. Cleared by cpu6502_init. */
+    uint8_t *read_page[256];
+    uint8_t *write_page[256];
 } cpu6502_t;
 
 /* Core API */
 void cpu6502_init(cpu6502_t *cpu, bus_read_fn read, bus_write_fn write, void *ctx);
 void cpu6502_reset(cpu6502_t *cpu);
 void cpu6502_step(cpu6502_t *cpu);
+
+/* Execute whole instructions until at least max_cycles have elapsed, or
+ * earlier if the CPU halts, cpu6502_break is called (e.g. from a bus
+ * callback that raised an interrupt), or an instruction branches to
+ * itself (cpu->trapped). Returns the cycles consumed; the last
+ * instruction may overrun the budget. Interrupts are delivered by the
+ * caller between runs; while irq_line is set, CLI, PLP or RTI clearing
+ * the I flag also ends the run so a masked IRQ is taken promptly.
+ *
+ * With spin_detect set, a branch or JMP back to the start of a loop of
+ * at most CPU6502_SPIN_BYTES, taken twice in a row to the same start
+ * (other than spin_ignore), also ends the run with PC at that start and
+ * cpu->spinning set. The owner can then check whether the loop is one
+ * that only an interrupt or a device can end, and skip ahead. An
+ * instruction at spin_ignore that jumps to itself does not trap either,
+ * until PC leaves it. */
+uint64_t cpu6502_run(cpu6502_t *cpu, uint64_t max_cycles);
+
+static inline void cpu6502_break(cpu6502_t *cpu) {
+    cpu->run_break = true;
+}
 void cpu6502_irq(cpu6502_t *cpu);
 void cpu6502_nmi(cpu6502_t *cpu);
 
+/* Map `count` pages starting at `page` to consecutive 256-byte blocks of
+ * read_mem / write_mem. Either pointer may be NULL to route that
+ * direction through the bus callbacks. */
+void cpu6502_map_pages(cpu6502_t *cpu, uint8_t page, int count,
+                       uint8_t *read_mem, uint8_t *write_mem);
+
+/* Save states: registers, cycle count and halt flag. Bus pointers are
+ * not part of the state and are left untouched by load. */
+void cpu6502_save_state(const cpu6502_t *cpu, state_writer_t *w);
+void cpu6502_load_state(cpu6502_t *cpu, state_reader_t *r);
+
 /* Flag helpers (used by opcodes.c) */
 static inline void cpu_set_flag(cpu6502_t *cpu, uint8_t flag, bool val) {
     if (val) cpu->status |= flag;
@@ -59,15 +113,64 @@ static inline void cpu_set_nz(cpu6502_t *cpu, uint8_t val) {
     cpu_set_flag(cpu, CPU_FLAG_Z, val == 0);
 }
 
+/* Bus access helpers: page table first, callback for unmapped pages.
+ * Forced inline: they sit on every memory access, and GCC stops inlining
+ * them inside the large cpu6502_run body otherwise.
+ *
+ * A file that defines CPU6502_BUS_READ and CPU6502_BUS_WRITE as the names
+ * of a bus_read_fn and a bus_write_fn before including this header gets
+ * helpers that call those directly, with cpu->bus_ctx, instead of going
+ * through cpu->read and cpu->write; the compiler can then inline the bus
+ * into the core. The callbacks must still be installed for code built
+ * without the binding. */
+#if defined(__GNUC__)
+#define CPU6502_ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+#define CPU6502_ALWAYS_INLINE static inline
+#endif
+
+#ifdef CPU6502_BUS_READ
+uint8_t CPU6502_BUS_READ(void *ctx, uint16_t addr);
+void    CPU6502_BUS_WRITE(void *ctx, uint16_t addr, uint8_t val);
+#define CPU6502_CALL_READ(cpu, addr)       CPU6502_BUS_READ((cpu)->bus_ctx, addr)
+#define CPU6502_CALL_WRITE(cpu, addr, val) CPU6502_BUS_WRITE((cpu)->bus_ctx, addr, val)
+#else
+#define CPU6502_CALL_READ(cpu, addr)       (cpu)->read((cpu)->bus_ctx, addr)
+#define CPU6502_CALL_WRITE(cpu, addr, val) (cpu)->write((cpu)->bus_ctx, addr, val)
+#endif
+
+CPU6502_ALWAYS_INLINE uint8_t cpu_read(cpu6502_t *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->read_page[addr >> 8];
+    if (page)
+        return page[addr & 0xFF];
+    return CPU6502_CALL_READ(cpu, addr);
+}
+
+CPU6502_ALWAYS_INLINE void cpu_write(cpu6502_t *cpu, uint16_t addr, uint8_t val) {
+    uint8_t *page = cpu->write_page[addr >> 8];
+    if (page) {
+        page[addr & 0xFF] = val;
+        return;
+    }
+    CPU6502_CALL_WRITE(cpu, addr, val);
+}
+
+/* Read without side effects: mapped pages only, 0 for I/O pages. For
+ * debuggers and tracers that must not disturb device registers. */
+static inline uint8_t cpu_peek(const cpu6502_t *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->read_page[addr >> 8];
+    return page ? page[addr & 0xFF] : 0;
+}
+
 /* Stack helpers */
 static inline void cpu_push(cpu6502_t *cpu, uint8_t val) {
-    cpu->write(cpu->bus_ctx, 0x0100 + cpu->sp, val);
+    cpu_write(cpu, 0x0100 + cpu->sp, val);
     cpu->sp--;
 }
 
 static inline uint8_t cpu_pull(cpu6502_t *cpu) {
     cpu->sp++;
-    return cpu->read(cpu->bus_ctx, 0x0100 + cpu->sp);
+    return cpu_read(cpu, 0x0100 + cpu->sp);
 }
 
 static inline void cpu_push16(cpu6502_t *cpu, uint16_t val) {
@@ -81,13 +184,4 @@ static inline uint16_t cpu_pull16(cpu6502_t *cpu) {
     return (hi << 8) | lo;
 }
 
-/* Bus read helper */
-static inline uint8_t cpu_read(cpu6502_t *cpu, uint16_t addr) {
-    return cpu->read(cpu->bus_ctx, addr);
-}
-
-static inline void cpu_write(cpu6502_t *cpu, uint16_t addr, uint8_t val) {
-    cpu->write(cpu->bus_ctx, addr, val);
-}
-
 #endif
@@ -6,17 +6,21 @@
 #include "bus.h"
 #include "cpu6502.h"
 #include "opcodes.h"
+#include "trace.h"
+#include "profile.h"
 
 #define CYCLE_LIMIT 100000000ULL  /* 100 million cycles */
+#define TRACE_RING  (1u << 20)    /* records buffered for the -t writer */
 
 static void print_usage(const char *prog)
 {
     fprintf(stderr,
-        "Usage: %s [-v] <binary> [base_addr] [start_addr]\n"
+        "Usage: %s [-v] [-t trace.bin] <binary> [base_addr] [start_addr]\n"
         "  binary      Path to 6502 binary file\n"
         "  base_addr   Load address in hex (default: 0000)\n"
         "  start_addr  Override PC in hex (default: read reset vector)\n"
-        "  -v          Verbose per-instruction trace\n",
+        "  -v          Verbose per-instruction trace\n"
+        "  -t FILE     Write a binary per-instruction trace (see trace6502)\n",
         prog);
 }
 
@@ -44,120 +48,32 @@ static void print_registers(cpu6502_t *cpu)
  * PC  OPCODE OPERANDS  MNEMONIC  A:XX X:XX Y:XX P:XX SP:XX CYC:NNNNN */
 static void trace_instruction(cpu6502_t *cpu)
 {
-    uint8_t opcode = cpu_read(cpu, cpu->pc);
-    const char *name = opcode_names[opcode] ? opcode_names[opcode] : "???";
-
-    printf("%04X  %02X", cpu->pc, opcode);
-
-    /* Peek at next bytes for display (do not advance PC) */
-    uint8_t b1 = cpu_read(cpu, cpu->pc + 1);
-    uint8_t b2 = cpu_read(cpu, cpu->pc + 2);
-
-    /* Determine instruction length from addressing mode heuristics.
-     * This is approximate -- accurate enough for trace output.
-     * Most common sizes based on opcode patterns. */
-    int len = 1;
-
-    /* Use the cycle count as a rough proxy for instruction length:
-     * - 2-cycle instructions are mostly implied/accumulator (1 byte)
-     * - Instructions with immediate/zeropage operands are 2 bytes
-     * - Absolute/indirect operands are 3 bytes
-     * A more accurate approach would use an addressing mode table,
-     * but this works for trace output. */
-    uint8_t cyc = opcode_cycles[opcode];
-    (void)cyc;
-
-    /* Determine length by opcode group patterns.
-     * Low nibble patterns that indicate instruction length: */
-    uint8_t lo = opcode & 0x1F;
-    if (opcode == 0x00 || opcode == 0x20 || opcode == 0x4C ||
-        opcode == 0x6C || opcode == 0x40 || opcode == 0x60) {
-        /* BRK=1(+padding), JSR=3, JMP abs=3, JMP ind=3, RTI=1, RTS=1 */
-        if (opcode == 0x20 || opcode == 0x4C || opcode == 0x6C)
-            len = 3;
-        else
-            len = 1;
-    } else if ((lo & 0x0F) == 0x09 || (lo & 0x0F) == 0x0B) {
-        /* Immediate modes for many instructions */
-        len = 2;
-    } else {
-        /* General heuristic based on addressing mode grouping */
-        uint8_t aaa = (opcode >> 5) & 0x07;
-        uint8_t bbb = (opcode >> 2) & 0x07;
-        uint8_t cc = opcode & 0x03;
-        (void)aaa;
-
-        if (cc == 0x01) {
-            /* cc=01 group: ORA, AND, EOR, ADC, STA, LDA, CMP, SBC */
-            switch (bbb) {
-                case 0: len = 2; break;  /* (zp,X) */
-                case 1: len = 2; break;  /* zp */
-                case 2: len = 2; break;  /* #imm */
-                case 3: len = 3; break;  /* abs */
-                case 4: len = 2; break;  /* (zp),Y */
-                case 5: len = 2; break;  /* zp,X */
-                case 6: len = 3; break;  /* abs,Y */
-                case 7: len = 3; break;  /* abs,X */
-                default: len = 1; break;
-            }
-        } else if (cc == 0x02) {
-            /* cc=10 group: ASL, ROL, LSR, ROR, STX, LDX, DEC, INC */
-            switch (bbb) {
-                case 0: len = 2; break;  /* #imm */
-                case 1: len = 2; break;  /* zp */
-                case 2: len = 1; break;  /* accumulator/implied */
-                case 3: len = 3; break;  /* abs */
-                case 5: len = 2; break;  /* zp,X (or zp,Y) */
-                case 7: len = 3; break;  /* abs,X (or abs,Y) */
-                default: len = 1; break;
-            }
-        } else if (cc == 0x00) {
-            /* cc=00 group: BIT, JMP, STY, LDY, CPY, CPX + branches */
-            switch (bbb) {
-                case 0: len = 2; break;  /* #imm */
-                case 1: len = 2; break;  /* zp */
-                case 2: len = 1; break;  /* implied */
-                case 3: len = 3; break;  /* abs */
-                case 4: len = 2; break;  /* relative (branches) */
-                case 5: len = 2; break;  /* zp,X */
-                case 7: len = 3; break;  /* abs,X */
-                default: len = 1; break;
-            }
-        } else {
-            /* cc=11: illegal opcodes, default to 1 */
-            len = 1;
-        }
-    }
+    trace_record_t rec;
+    char line[128];
 
-    /* Print operand bytes */
-    if (len == 1)
-        printf("        ");
-    else if (len == 2)
-        printf(" %02X     ", b1);
-    else
-        printf(" %02X %02X  ", b1, b2);
-
-    /* Mnemonic */
-    printf("%s", name);
-
-    /* Pad to register column */
-    printf("%*s", 28 - (int)strlen(name), "");
-
-    /* Register state BEFORE execution */
-    printf("A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
-        cpu->a, cpu->x, cpu->y, cpu->status, cpu->sp,
-        (unsigned long long)cpu->cycles);
+    trace_fill(&rec, cpu);
+    trace_format(&rec, line, sizeof(line));
+    puts(line);
 }
 
 int main(int argc, char *argv[])
 {
     bool verbose = false;
+    const char *trace_path = NULL;
     int arg_start = 1;
 
-    /* Parse -v flag */
-    if (argc > 1 && strcmp(argv[1], "-v") == 0) {
-        verbose = true;
-        arg_start = 2;
+    /* Parse -v and -t flags */
+    while (arg_start < argc && argv[arg_start][0] == '-') {
+        if (strcmp(argv[arg_start], "-v") == 0) {
+            verbose = true;
+            arg_start++;
+        } else if (strcmp(argv[arg_start], "-t") == 0 && arg_start + 1 < argc) {
+            trace_path = argv[arg_start + 1];
+            arg_start += 2;
+        } else {
+            print_usage(argv[0]);
+            exit(1);
+        }
     }
 
     int remaining = argc - arg_start;
@@ -201,6 +117,7 @@ int main(int argc, char *argv[])
     /* Initialize and reset CPU */
     cpu6502_t cpu;
     cpu6502_init(&cpu, bus_flat_read, bus_flat_write, &bus);
+    bus_flat_map(&bus, &cpu);
     cpu6502_reset(&cpu);
 
     /* Override PC if start address was provided */
@@ -210,15 +127,31 @@ int main(int argc, char *argv[])
 
     printf("Loaded '%s' at $%04X, PC=$%04X\n", binary_path, base_addr, cpu.pc);
 
+    trace_ring_t *trace = NULL;
+    if (trace_path) {
+        trace = trace_open(trace_path, TRACE_RING);
+        if (!trace)
+            exit(1);
+    }
+
     /* Main execution loop */
     uint16_t prev_pc;
     while (!cpu.halted && cpu.cycles < CYCLE_LIMIT) {
-        prev_pc = cpu.pc;
-
-        if (verbose) {
-            trace_instruction(&cpu);
+        if (!verbose && !trace) {
+            /* No per-instruction output: run the whole budget in one go */
+            cpu6502_run(&cpu, CYCLE_LIMIT - cpu.cycles);
+            if (cpu.trapped) {
+                printf("Trap detected at $%04X\n", cpu.pc);
+                break;
+            }
+            continue;
         }
 
+        prev_pc = cpu.pc;
+        if (verbose)
+            trace_instruction(&cpu);
+        if (trace)
+            trace_capture(trace, &cpu);
         cpu6502_step(&cpu);
 
         /* Detect trap: PC pointing to itself (e.g., JMP *) */
@@ -237,9 +170,17 @@ int main(int argc, char *argv[])
         printf("CPU halted\n");
     }
 
+    if (trace && !trace_close(trace))
+        fprintf(stderr, "Trace '%s' is incomplete\n", trace_path);
+
     /* Final register dump */
     printf("\nFinal state:\n");
     print_registers(&cpu);
 
+#ifdef CPU6502_PROFILE
+    printf("\n");
+    cpu6502_profile_dump(stdout);
+#endif
+
     return 0;
 }
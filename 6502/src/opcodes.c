@@ -5,13 +5,20 @@
  *   1. Addressing mode helpers (static)
  *   2. Shared instruction core functions (static)
  *   3. Individual opcode handler functions (static)
- *   4. Exported tables: opcode_table, opcode_cycles, opcode_names
+ *   4. Exported tables: opcode_table, opcode_cycles, opcode_names,
+ *      opcode_modes, addr_mode_lengths
+ *   5. cpu6502_run, the batched interpreter loop
+ *
+ * Build-time variants: CPU6502_NO_DECIMAL drops BCD arithmetic, and
+ * CPU6502_BUS_READ / CPU6502_BUS_WRITE bind the bus statically (see
+ * cpu6502.h). The NES compiles this file into nes.c with all three.
  */
 
 #include <stdio.h>
 #include <stdint.h>
 #include "cpu6502.h"
 #include "opcodes.h"
+#include "profile.h"
 
 /* ======================================================================
  * 1. Addressing mode helpers
@@ -86,8 +93,10 @@ static uint16_t addr_izy(cpu6502_t *cpu) {
  * 2. Shared instruction core functions
  * ====================================================================== */
 
-/* ADC: add with carry, handles both binary and decimal (BCD) modes */
+/* ADC: add with carry, handles both binary and decimal (BCD) modes.
+ * CPU6502_NO_DECIMAL builds (the NES 2A03) ignore the D flag. */
 static void do_adc(cpu6502_t *cpu, uint8_t val) {
+#ifndef CPU6502_NO_DECIMAL
     if (cpu_get_flag(cpu, CPU_FLAG_D)) {
         /* Decimal mode (NMOS 6502 behavior) */
         uint8_t a = cpu->a;
@@ -112,18 +121,21 @@ static void do_adc(cpu6502_t *cpu, uint8_t val) {
         if (ah > 9) ah += 6;
         cpu_set_flag(cpu, CPU_FLAG_C, ah > 0x0F);
         cpu->a = (uint8_t)(((ah & 0x0F) << 4) | (al & 0x0F));
-    } else {
-        /* Binary mode */
-        uint16_t sum = cpu->a + val + (cpu_get_flag(cpu, CPU_FLAG_C) ? 1 : 0);
-        cpu_set_flag(cpu, CPU_FLAG_V, (~(cpu->a ^ val) & (cpu->a ^ sum) & 0x80));
-        cpu_set_flag(cpu, CPU_FLAG_C, sum > 0xFF);
-        cpu->a = (uint8_t)(sum & 0xFF);
-        cpu_set_nz(cpu, cpu->a);
+        return;
     }
+#endif
+
+    /* Binary mode */
+    uint16_t sum = cpu->a + val + (cpu_get_flag(cpu, CPU_FLAG_C) ? 1 : 0);
+    cpu_set_flag(cpu, CPU_FLAG_V, (~(cpu->a ^ val) & (cpu->a ^ sum) & 0x80));
+    cpu_set_flag(cpu, CPU_FLAG_C, sum > 0xFF);
+    cpu->a = (uint8_t)(sum & 0xFF);
+    cpu_set_nz(cpu, cpu->a);
 }
 
 /* SBC: subtract with borrow, handles both binary and decimal modes */
 static void do_sbc(cpu6502_t *cpu, uint8_t val) {
+#ifndef CPU6502_NO_DECIMAL
     if (cpu_get_flag(cpu, CPU_FLAG_D)) {
         /* Decimal mode (NMOS 6502 behavior) */
         uint8_t a = cpu->a;
@@ -141,10 +153,12 @@ static void do_sbc(cpu6502_t *cpu, uint8_t val) {
         int ah = (a >> 4) - (val >> 4) + (al < 0 ? -1 : 0);
         if (ah < 0) ah -= 6;
         cpu->a = (uint8_t)(((ah & 0x0F) << 4) | (al & 0x0F));
-    } else {
-        /* Binary mode: SBC is ADC with complement */
-        do_adc(cpu, ~val);
+        return;
     }
+#endif
+
+    /* Binary mode: SBC is ADC with complement */
+    do_adc(cpu, ~val);
 }
 
 /* CMP: compare register with value, set N/Z/C */
@@ -867,98 +881,73 @@ static void op_dey(cpu6502_t *cpu) {
 
 /* ===== Branch instructions ===== */
 
-static void op_bpl(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (!cpu_get_flag(cpu, CPU_FLAG_N)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
+/* Spin-loop detection (cpu6502_t.spin_detect): a jump from `from` back
+ * to a loop start at most CPU6502_SPIN_BYTES before it, taken twice in a
+ * row to the same start, ends cpu6502_run there */
+static inline void note_loop(cpu6502_t *cpu, uint16_t from) {
+    uint16_t to = cpu->pc;
+    if (!cpu->spin_detect || to >= from || from - to > CPU6502_SPIN_BYTES ||
+        to == cpu->spin_ignore)
+        return;
+    if (to == cpu->spin_pc) {
+        cpu->spinning = true;
+        cpu->run_break = true;
     }
+    cpu->spin_pc = to;
 }
 
-static void op_bmi(cpu6502_t *cpu) {
+/* A taken branch costs a cycle, and one more if it crosses a page */
+static inline void branch(cpu6502_t *cpu, bool taken) {
     int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (cpu_get_flag(cpu, CPU_FLAG_N)) {
+    if (taken) {
         uint16_t old_pc = cpu->pc;
         cpu->pc = (uint16_t)(cpu->pc + offset);
         cpu->cycles++;
         if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
             cpu->cycles++;
+        note_loop(cpu, old_pc);
     }
 }
 
+static void op_bpl(cpu6502_t *cpu) {
+    branch(cpu, !cpu_get_flag(cpu, CPU_FLAG_N));
+}
+
+static void op_bmi(cpu6502_t *cpu) {
+    branch(cpu, cpu_get_flag(cpu, CPU_FLAG_N));
+}
+
 static void op_bvc(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (!cpu_get_flag(cpu, CPU_FLAG_V)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
-    }
+    branch(cpu, !cpu_get_flag(cpu, CPU_FLAG_V));
 }
 
 static void op_bvs(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (cpu_get_flag(cpu, CPU_FLAG_V)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
-    }
+    branch(cpu, cpu_get_flag(cpu, CPU_FLAG_V));
 }
 
 static void op_bcc(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (!cpu_get_flag(cpu, CPU_FLAG_C)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
-    }
+    branch(cpu, !cpu_get_flag(cpu, CPU_FLAG_C));
 }
 
 static void op_bcs(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (cpu_get_flag(cpu, CPU_FLAG_C)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
-    }
+    branch(cpu, cpu_get_flag(cpu, CPU_FLAG_C));
 }
 
 static void op_bne(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (!cpu_get_flag(cpu, CPU_FLAG_Z)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
-    }
+    branch(cpu, !cpu_get_flag(cpu, CPU_FLAG_Z));
 }
 
 static void op_beq(cpu6502_t *cpu) {
-    int8_t offset = (int8_t)cpu_read(cpu, cpu->pc++);
-    if (cpu_get_flag(cpu, CPU_FLAG_Z)) {
-        uint16_t old_pc = cpu->pc;
-        cpu->pc = (uint16_t)(cpu->pc + offset);
-        cpu->cycles++;
-        if ((old_pc & 0xFF00) != (cpu->pc & 0xFF00))
-            cpu->cycles++;
-    }
+    branch(cpu, cpu_get_flag(cpu, CPU_FLAG_Z));
 }
 
 /* ===== JMP ===== */
 
 static void op_jmp_abs(cpu6502_t *cpu) {
-    cpu->pc = addr_abs(cpu);
+    uint16_t target = addr_abs(cpu);
+    uint16_t from = cpu->pc;
+    cpu->pc = target;
+    note_loop(cpu, from);
 }
 
 /* JMP indirect with NMOS page boundary bug */
@@ -992,11 +981,19 @@ static void op_brk(cpu6502_t *cpu) {
     cpu->pc = cpu_read(cpu, 0xFFFE) | (cpu_read(cpu, 0xFFFF) << 8);
 }
 
+/* Instructions that can clear I end the batch while an IRQ is waiting
+ * on it, so cpu6502_run's caller gets to deliver it */
+static inline void irq_unmasked(cpu6502_t *cpu) {
+    if (cpu->irq_line && !(cpu->status & CPU_FLAG_I))
+        cpu->run_break = true;
+}
+
 static void op_rti(cpu6502_t *cpu) {
     cpu->status = cpu_pull(cpu);
     cpu->status |= CPU_FLAG_U;    /* bit 5 always 1 */
     cpu->status &= ~CPU_FLAG_B;   /* B is not a real flag */
     cpu->pc = cpu_pull16(cpu);     /* no +1 unlike RTS */
+    irq_unmasked(cpu);
 }
 
 /* ===== Stack ===== */
@@ -1018,6 +1015,7 @@ static void op_plp(cpu6502_t *cpu) {
     cpu->status = cpu_pull(cpu);
     cpu->status |= CPU_FLAG_U;
     cpu->status &= ~CPU_FLAG_B;
+    irq_unmasked(cpu);
 }
 
 /* ===== Transfers ===== */
@@ -1064,6 +1062,7 @@ static void op_sec(cpu6502_t *cpu) {
 
 static void op_cli(cpu6502_t *cpu) {
     cpu_set_flag(cpu, CPU_FLAG_I, false);
+    irq_unmasked(cpu);
 }
 
 static void op_sei(cpu6502_t *cpu) {
@@ -1092,102 +1091,109 @@ static void op_nop(cpu6502_t *cpu) {
  * 4. Exported tables
  * ====================================================================== */
 
+/* Every opcode and its handler, in opcode order. Expands into the
+ * function-pointer table below and the label table in cpu6502_run. */
+#define OPCODE_LIST(X) \
+    /* 0x00-0x0F */ \
+    X(0x00, op_brk)      X(0x01, op_ora_izx)  X(0x02, op_ill)      X(0x03, op_ill) \
+    X(0x04, op_ill)      X(0x05, op_ora_zpg)  X(0x06, op_asl_zpg)  X(0x07, op_ill) \
+    X(0x08, op_php)      X(0x09, op_ora_imm)  X(0x0A, op_asl_acc)  X(0x0B, op_ill) \
+    X(0x0C, op_ill)      X(0x0D, op_ora_abs)  X(0x0E, op_asl_abs)  X(0x0F, op_ill) \
+    \
+    /* 0x10-0x1F */ \
+    X(0x10, op_bpl)      X(0x11, op_ora_izy)  X(0x12, op_ill)      X(0x13, op_ill) \
+    X(0x14, op_ill)      X(0x15, op_ora_zpx)  X(0x16, op_asl_zpx)  X(0x17, op_ill) \
+    X(0x18, op_clc)      X(0x19, op_ora_aby)  X(0x1A, op_ill)      X(0x1B, op_ill) \
+    X(0x1C, op_ill)      X(0x1D, op_ora_abx)  X(0x1E, op_asl_abx)  X(0x1F, op_ill) \
+    \
+    /* 0x20-0x2F */ \
+    X(0x20, op_jsr)      X(0x21, op_and_izx)  X(0x22, op_ill)      X(0x23, op_ill) \
+    X(0x24, op_bit_zpg)  X(0x25, op_and_zpg)  X(0x26, op_rol_zpg)  X(0x27, op_ill) \
+    X(0x28, op_plp)      X(0x29, op_and_imm)  X(0x2A, op_rol_acc)  X(0x2B, op_ill) \
+    X(0x2C, op_bit_abs)  X(0x2D, op_and_abs)  X(0x2E, op_rol_abs)  X(0x2F, op_ill) \
+    \
+    /* 0x30-0x3F */ \
+    X(0x30, op_bmi)      X(0x31, op_and_izy)  X(0x32, op_ill)      X(0x33, op_ill) \
+    X(0x34, op_ill)      X(0x35, op_and_zpx)  X(0x36, op_rol_zpx)  X(0x37, op_ill) \
+    X(0x38, op_sec)      X(0x39, op_and_aby)  X(0x3A, op_ill)      X(0x3B, op_ill) \
+    X(0x3C, op_ill)      X(0x3D, op_and_abx)  X(0x3E, op_rol_abx)  X(0x3F, op_ill) \
+    \
+    /* 0x40-0x4F */ \
+    X(0x40, op_rti)      X(0x41, op_eor_izx)  X(0x42, op_ill)      X(0x43, op_ill) \
+    X(0x44, op_ill)      X(0x45, op_eor_zpg)  X(0x46, op_lsr_zpg)  X(0x47, op_ill) \
+    X(0x48, op_pha)      X(0x49, op_eor_imm)  X(0x4A, op_lsr_acc)  X(0x4B, op_ill) \
+    X(0x4C, op_jmp_abs)  X(0x4D, op_eor_abs)  X(0x4E, op_lsr_abs)  X(0x4F, op_ill) \
+    \
+    /* 0x50-0x5F */ \
+    X(0x50, op_bvc)      X(0x51, op_eor_izy)  X(0x52, op_ill)      X(0x53, op_ill) \
+    X(0x54, op_ill)      X(0x55, op_eor_zpx)  X(0x56, op_lsr_zpx)  X(0x57, op_ill) \
+    X(0x58, op_cli)      X(0x59, op_eor_aby)  X(0x5A, op_ill)      X(0x5B, op_ill) \
+    X(0x5C, op_ill)      X(0x5D, op_eor_abx)  X(0x5E, op_lsr_abx)  X(0x5F, op_ill) \
+    \
+    /* 0x60-0x6F */ \
+    X(0x60, op_rts)      X(0x61, op_adc_izx)  X(0x62, op_ill)      X(0x63, op_ill) \
+    X(0x64, op_ill)      X(0x65, op_adc_zpg)  X(0x66, op_ror_zpg)  X(0x67, op_ill) \
+    X(0x68, op_pla)      X(0x69, op_adc_imm)  X(0x6A, op_ror_acc)  X(0x6B, op_ill) \
+    X(0x6C, op_jmp_ind)  X(0x6D, op_adc_abs)  X(0x6E, op_ror_abs)  X(0x6F, op_ill) \
+    \
+    /* 0x70-0x7F */ \
+    X(0x70, op_bvs)      X(0x71, op_adc_izy)  X(0x72, op_ill)      X(0x73, op_ill) \
+    X(0x74, op_ill)      X(0x75, op_adc_zpx)  X(0x76, op_ror_zpx)  X(0x77, op_ill) \
+    X(0x78, op_sei)      X(0x79, op_adc_aby)  X(0x7A, op_ill)      X(0x7B, op_ill) \
+    X(0x7C, op_ill)      X(0x7D, op_adc_abx)  X(0x7E, op_ror_abx)  X(0x7F, op_ill) \
+    \
+    /* 0x80-0x8F */ \
+    X(0x80, op_ill)      X(0x81, op_sta_izx)  X(0x82, op_ill)      X(0x83, op_ill) \
+    X(0x84, op_sty_zpg)  X(0x85, op_sta_zpg)  X(0x86, op_stx_zpg)  X(0x87, op_ill) \
+    X(0x88, op_dey)      X(0x89, op_ill)      X(0x8A, op_txa)      X(0x8B, op_ill) \
+    X(0x8C, op_sty_abs)  X(0x8D, op_sta_abs)  X(0x8E, op_stx_abs)  X(0x8F, op_ill) \
+    \
+    /* 0x90-0x9F */ \
+    X(0x90, op_bcc)      X(0x91, op_sta_izy)  X(0x92, op_ill)      X(0x93, op_ill) \
+    X(0x94, op_sty_zpx)  X(0x95, op_sta_zpx)  X(0x96, op_stx_zpy)  X(0x97, op_ill) \
+    X(0x98, op_tya)      X(0x99, op_sta_aby)  X(0x9A, op_txs)      X(0x9B, op_ill) \
+    X(0x9C, op_ill)      X(0x9D, op_sta_abx)  X(0x9E, op_ill)      X(0x9F, op_ill) \
+    \
+    /* 0xA0-0xAF */ \
+    X(0xA0, op_ldy_imm)  X(0xA1, op_lda_izx)  X(0xA2, op_ldx_imm)  X(0xA3, op_ill) \
+    X(0xA4, op_ldy_zpg)  X(0xA5, op_lda_zpg)  X(0xA6, op_ldx_zpg)  X(0xA7, op_ill) \
+    X(0xA8, op_tay)      X(0xA9, op_lda_imm)  X(0xAA, op_tax)      X(0xAB, op_ill) \
+    X(0xAC, op_ldy_abs)  X(0xAD, op_lda_abs)  X(0xAE, op_ldx_abs)  X(0xAF, op_ill) \
+    \
+    /* 0xB0-0xBF */ \
+    X(0xB0, op_bcs)      X(0xB1, op_lda_izy)  X(0xB2, op_ill)      X(0xB3, op_ill) \
+    X(0xB4, op_ldy_zpx)  X(0xB5, op_lda_zpx)  X(0xB6, op_ldx_zpy)  X(0xB7, op_ill) \
+    X(0xB8, op_clv)      X(0xB9, op_lda_aby)  X(0xBA, op_tsx)      X(0xBB, op_ill) \
+    X(0xBC, op_ldy_abx)  X(0xBD, op_lda_abx)  X(0xBE, op_ldx_aby)  X(0xBF, op_ill) \
+    \
+    /* 0xC0-0xCF */ \
+    X(0xC0, op_cpy_imm)  X(0xC1, op_cmp_izx)  X(0xC2, op_ill)      X(0xC3, op_ill) \
+    X(0xC4, op_cpy_zpg)  X(0xC5, op_cmp_zpg)  X(0xC6, op_dec_zpg)  X(0xC7, op_ill) \
+    X(0xC8, op_iny)      X(0xC9, op_cmp_imm)  X(0xCA, op_dex)      X(0xCB, op_ill) \
+    X(0xCC, op_cpy_abs)  X(0xCD, op_cmp_abs)  X(0xCE, op_dec_abs)  X(0xCF, op_ill) \
+    \
+    /* 0xD0-0xDF */ \
+    X(0xD0, op_bne)      X(0xD1, op_cmp_izy)  X(0xD2, op_ill)      X(0xD3, op_ill) \
+    X(0xD4, op_ill)      X(0xD5, op_cmp_zpx)  X(0xD6, op_dec_zpx)  X(0xD7, op_ill) \
+    X(0xD8, op_cld)      X(0xD9, op_cmp_aby)  X(0xDA, op_ill)      X(0xDB, op_ill) \
+    X(0xDC, op_ill)      X(0xDD, op_cmp_abx)  X(0xDE, op_dec_abx)  X(0xDF, op_ill) \
+    \
+    /* 0xE0-0xEF */ \
+    X(0xE0, op_cpx_imm)  X(0xE1, op_sbc_izx)  X(0xE2, op_ill)      X(0xE3, op_ill) \
+    X(0xE4, op_cpx_zpg)  X(0xE5, op_sbc_zpg)  X(0xE6, op_inc_zpg)  X(0xE7, op_ill) \
+    X(0xE8, op_inx)      X(0xE9, op_sbc_imm)  X(0xEA, op_nop)      X(0xEB, op_ill) \
+    X(0xEC, op_cpx_abs)  X(0xED, op_sbc_abs)  X(0xEE, op_inc_abs)  X(0xEF, op_ill) \
+    \
+    /* 0xF0-0xFF */ \
+    X(0xF0, op_beq)      X(0xF1, op_sbc_izy)  X(0xF2, op_ill)      X(0xF3, op_ill) \
+    X(0xF4, op_ill)      X(0xF5, op_sbc_zpx)  X(0xF6, op_inc_zpx)  X(0xF7, op_ill) \
+    X(0xF8, op_sed)      X(0xF9, op_sbc_aby)  X(0xFA, op_ill)      X(0xFB, op_ill) \
+    X(0xFC, op_ill)      X(0xFD, op_sbc_abx)  X(0xFE, op_inc_abx)  X(0xFF, op_ill)
+
+#define OPCODE_TABLE_ENTRY(n, fn) [n] = fn,
+
 const opcode_fn opcode_table[256] = {
-    /* 0x00-0x0F */
-    [0x00] = op_brk,     [0x01] = op_ora_izx, [0x02] = op_ill,     [0x03] = op_ill,
-    [0x04] = op_ill,     [0x05] = op_ora_zpg, [0x06] = op_asl_zpg, [0x07] = op_ill,
-    [0x08] = op_php,     [0x09] = op_ora_imm, [0x0A] = op_asl_acc, [0x0B] = op_ill,
-    [0x0C] = op_ill,     [0x0D] = op_ora_abs, [0x0E] = op_asl_abs, [0x0F] = op_ill,
-
-    /* 0x10-0x1F */
-    [0x10] = op_bpl,     [0x11] = op_ora_izy, [0x12] = op_ill,     [0x13] = op_ill,
-    [0x14] = op_ill,     [0x15] = op_ora_zpx, [0x16] = op_asl_zpx, [0x17] = op_ill,
-    [0x18] = op_clc,     [0x19] = op_ora_aby, [0x1A] = op_ill,     [0x1B] = op_ill,
-    [0x1C] = op_ill,     [0x1D] = op_ora_abx, [0x1E] = op_asl_abx, [0x1F] = op_ill,
-
-    /* 0x20-0x2F */
-    [0x20] = op_jsr,     [0x21] = op_and_izx, [0x22] = op_ill,     [0x23] = op_ill,
-    [0x24] = op_bit_zpg, [0x25] = op_and_zpg, [0x26] = op_rol_zpg, [0x27] = op_ill,
-    [0x28] = op_plp,     [0x29] = op_and_imm, [0x2A] = op_rol_acc, [0x2B] = op_ill,
-    [0x2C] = op_bit_abs, [0x2D] = op_and_abs, [0x2E] = op_rol_abs, [0x2F] = op_ill,
-
-    /* 0x30-0x3F */
-    [0x30] = op_bmi,     [0x31] = op_and_izy, [0x32] = op_ill,     [0x33] = op_ill,
-    [0x34] = op_ill,     [0x35] = op_and_zpx, [0x36] = op_rol_zpx, [0x37] = op_ill,
-    [0x38] = op_sec,     [0x39] = op_and_aby, [0x3A] = op_ill,     [0x3B] = op_ill,
-    [0x3C] = op_ill,     [0x3D] = op_and_abx, [0x3E] = op_rol_abx, [0x3F] = op_ill,
-
-    /* 0x40-0x4F */
-    [0x40] = op_rti,     [0x41] = op_eor_izx, [0x42] = op_ill,     [0x43] = op_ill,
-    [0x44] = op_ill,     [0x45] = op_eor_zpg, [0x46] = op_lsr_zpg, [0x47] = op_ill,
-    [0x48] = op_pha,     [0x49] = op_eor_imm, [0x4A] = op_lsr_acc, [0x4B] = op_ill,
-    [0x4C] = op_jmp_abs, [0x4D] = op_eor_abs, [0x4E] = op_lsr_abs, [0x4F] = op_ill,
-
-    /* 0x50-0x5F */
-    [0x50] = op_bvc,     [0x51] = op_eor_izy, [0x52] = op_ill,     [0x53] = op_ill,
-    [0x54] = op_ill,     [0x55] = op_eor_zpx, [0x56] = op_lsr_zpx, [0x57] = op_ill,
-    [0x58] = op_cli,     [0x59] = op_eor_aby, [0x5A] = op_ill,     [0x5B] = op_ill,
-    [0x5C] = op_ill,     [0x5D] = op_eor_abx, [0x5E] = op_lsr_abx, [0x5F] = op_ill,
-
-    /* 0x60-0x6F */
-    [0x60] = op_rts,     [0x61] = op_adc_izx, [0x62] = op_ill,     [0x63] = op_ill,
-    [0x64] = op_ill,     [0x65] = op_adc_zpg, [0x66] = op_ror_zpg, [0x67] = op_ill,
-    [0x68] = op_pla,     [0x69] = op_adc_imm, [0x6A] = op_ror_acc, [0x6B] = op_ill,
-    [0x6C] = op_jmp_ind, [0x6D] = op_adc_abs, [0x6E] = op_ror_abs, [0x6F] = op_ill,
-
-    /* 0x70-0x7F */
-    [0x70] = op_bvs,     [0x71] = op_adc_izy, [0x72] = op_ill,     [0x73] = op_ill,
-    [0x74] = op_ill,     [0x75] = op_adc_zpx, [0x76] = op_ror_zpx, [0x77] = op_ill,
-    [0x78] = op_sei,     [0x79] = op_adc_aby, [0x7A] = op_ill,     [0x7B] = op_ill,
-    [0x7C] = op_ill,     [0x7D] = op_adc_abx, [0x7E] = op_ror_abx, [0x7F] = op_ill,
-
-    /* 0x80-0x8F */
-    [0x80] = op_ill,     [0x81] = op_sta_izx, [0x82] = op_ill,     [0x83] = op_ill,
-    [0x84] = op_sty_zpg, [0x85] = op_sta_zpg, [0x86] = op_stx_zpg, [0x87] = op_ill,
-    [0x88] = op_dey,     [0x89] = op_ill,     [0x8A] = op_txa,     [0x8B] = op_ill,
-    [0x8C] = op_sty_abs, [0x8D] = op_sta_abs, [0x8E] = op_stx_abs, [0x8F] = op_ill,
-
-    /* 0x90-0x9F */
-    [0x90] = op_bcc,     [0x91] = op_sta_izy, [0x92] = op_ill,     [0x93] = op_ill,
-    [0x94] = op_sty_zpx, [0x95] = op_sta_zpx, [0x96] = op_stx_zpy, [0x97] = op_ill,
-    [0x98] = op_tya,     [0x99] = op_sta_aby, [0x9A] = op_txs,     [0x9B] = op_ill,
-    [0x9C] = op_ill,     [0x9D] = op_sta_abx, [0x9E] = op_ill,     [0x9F] = op_ill,
-
-    /* 0xA0-0xAF */
-    [0xA0] = op_ldy_imm, [0xA1] = op_lda_izx, [0xA2] = op_ldx_imm, [0xA3] = op_ill,
-    [0xA4] = op_ldy_zpg, [0xA5] = op_lda_zpg, [0xA6] = op_ldx_zpg, [0xA7] = op_ill,
-    [0xA8] = op_tay,     [0xA9] = op_lda_imm, [0xAA] = op_tax,     [0xAB] = op_ill,
-    [0xAC] = op_ldy_abs, [0xAD] = op_lda_abs, [0xAE] = op_ldx_abs, [0xAF] = op_ill,
-
-    /* 0xB0-0xBF */
-    [0xB0] = op_bcs,     [0xB1] = op_lda_izy, [0xB2] = op_ill,     [0xB3] = op_ill,
-    [0xB4] = op_ldy_zpx, [0xB5] = op_lda_zpx, [0xB6] = op_ldx_zpy, [0xB7] = op_ill,
-    [0xB8] = op_clv,     [0xB9] = op_lda_aby, [0xBA] = op_tsx,     [0xBB] = op_ill,
-    [0xBC] = op_ldy_abx, [0xBD] = op_lda_abx, [0xBE] = op_ldx_aby, [0xBF] = op_ill,
-
-    /* 0xC0-0xCF */
-    [0xC0] = op_cpy_imm, [0xC1] = op_cmp_izx, [0xC2] = op_ill,     [0xC3] = op_ill,
-    [0xC4] = op_cpy_zpg, [0xC5] = op_cmp_zpg, [0xC6] = op_dec_zpg, [0xC7] = op_ill,
-    [0xC8] = op_iny,     [0xC9] = op_cmp_imm, [0xCA] = op_dex,     [0xCB] = op_ill,
-    [0xCC] = op_cpy_abs, [0xCD] = op_cmp_abs, [0xCE] = op_dec_abs, [0xCF] = op_ill,
-
-    /* 0xD0-0xDF */
-    [0xD0] = op_bne,     [0xD1] = op_cmp_izy, [0xD2] = op_ill,     [0xD3] = op_ill,
-    [0xD4] = op_ill,     [0xD5] = op_cmp_zpx, [0xD6] = op_dec_zpx, [0xD7] = op_ill,
-    [0xD8] = op_cld,     [0xD9] = op_cmp_aby, [0xDA] = op_ill,     [0xDB] = op_ill,
-    [0xDC] = op_ill,     [0xDD] = op_cmp_abx, [0xDE] = op_dec_abx, [0xDF] = op_ill,
-
-    /* 0xE0-0xEF */
-    [0xE0] = op_cpx_imm, [0xE1] = op_sbc_izx, [0xE2] = op_ill,     [0xE3] = op_ill,
-    [0xE4] = op_cpx_zpg, [0xE5] = op_sbc_zpg, [0xE6] = op_inc_zpg, [0xE7] = op_ill,
-    [0xE8] = op_inx,     [0xE9] = op_sbc_imm, [0xEA] = op_nop,     [0xEB] = op_ill,
-    [0xEC] = op_cpx_abs, [0xED] = op_sbc_abs, [0xEE] = op_inc_abs, [0xEF] = op_ill,
-
-    /* 0xF0-0xFF */
-    [0xF0] = op_beq,     [0xF1] = op_sbc_izy, [0xF2] = op_ill,     [0xF3] = op_ill,
-    [0xF4] = op_ill,     [0xF5] = op_sbc_zpx, [0xF6] = op_inc_zpx, [0xF7] = op_ill,
-    [0xF8] = op_sed,     [0xF9] = op_sbc_aby, [0xFA] = op_ill,     [0xFB] = op_ill,
-    [0xFC] = op_ill,     [0xFD] = op_sbc_abx, [0xFE] = op_inc_abx, [0xFF] = op_ill,
+    OPCODE_LIST(OPCODE_TABLE_ENTRY)
 };
 
 const uint8_t opcode_cycles[256] = {
@@ -1243,3 +1249,139 @@ const char *opcode_names[256] = {
     /* 0xF0 */ "BEQ", "SBC", "???", "???", "???", "SBC", "INC", "???",
     /* 0xF8 */ "SED", "SBC", "???", "???", "???", "SBC", "INC", "???",
 };
+
+/* Addressing mode of each opcode; illegal opcodes are AM_IMP */
+const uint8_t opcode_modes[256] = {
+    /* 0x00 */ AM_IMP, AM_IZX, AM_IMP, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_ACC, AM_IMP, AM_IMP, AM_ABS, AM_ABS, AM_IMP,
+    /* 0x10 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_IMP,
+    /* 0x20 */ AM_ABS, AM_IZX, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_ACC, AM_IMP, AM_ABS, AM_ABS, AM_ABS, AM_IMP,
+    /* 0x30 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_IMP,
+    /* 0x40 */ AM_IMP, AM_IZX, AM_IMP, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_ACC, AM_IMP, AM_ABS, AM_ABS, AM_ABS, AM_IMP,
+    /* 0x50 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_IMP,
+    /* 0x60 */ AM_IMP, AM_IZX, AM_IMP, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_ACC, AM_IMP, AM_IND, AM_ABS, AM_ABS, AM_IMP,
+    /* 0x70 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_IMP,
+    /* 0x80 */ AM_IMP, AM_IZX, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMP, AM_IMP, AM_IMP, AM_ABS, AM_ABS, AM_ABS, AM_IMP,
+    /* 0x90 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_ZPY, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_IMP, AM_IMP,
+    /* 0xA0 */ AM_IMM, AM_IZX, AM_IMM, AM_IMP, AM_ZPG, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_IMP, AM_IMP, AM_ABS, AM_ABS, AM_ABS, AM_IMP,
+    /* 0xB0 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_ZPY, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_ABY, AM_IMP,
+    /* 0xC0 */ AM_IMM, AM_IZX, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_IMP, AM_IMP, AM_ABS, AM_ABS, AM_ABS, AM_IMP,
+    /* 0xD0 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_IMP,
+    /* 0xE0 */ AM_IMM, AM_IZX, AM_IMP, AM_IMP, AM_ZPG, AM_ZPG, AM_ZPG, AM_IMP,
+               AM_IMP, AM_IMM, AM_IMP, AM_IMP, AM_ABS, AM_ABS, AM_ABS, AM_IMP,
+    /* 0xF0 */ AM_REL, AM_IZY, AM_IMP, AM_IMP, AM_IMP, AM_ZPX, AM_ZPX, AM_IMP,
+               AM_IMP, AM_ABY, AM_IMP, AM_IMP, AM_IMP, AM_ABX, AM_ABX, AM_IMP,
+};
+
+const uint8_t addr_mode_lengths[AM_COUNT] = {
+    [AM_IMP] = 1, [AM_ACC] = 1, [AM_IMM] = 2, [AM_ZPG] = 2, [AM_ZPX] = 2,
+    [AM_ZPY] = 2, [AM_REL] = 2, [AM_IZX] = 2, [AM_IZY] = 2, [AM_ABS] = 3,
+    [AM_ABX] = 3, [AM_ABY] = 3, [AM_IND] = 3,
+};
+
+/* ======================================================================
+ * 5. Batched execution
+ *
+ * cpu6502_run dispatches straight from one handler to the next without
+ * returning to the caller. With GCC/Clang each opcode gets its own label
+ * and ends in its own indirect jump (threaded code), which gives the
+ * branch predictor one history per opcode instead of one shared switch.
+ * Other compilers, or -DCPU6502_NO_COMPUTED_GOTO, get a switch.
+ *
+ * The run ends at the first instruction boundary where the budget is
+ * spent, the CPU halted, cpu6502_break was called, or an instruction
+ * left PC where it started (JMP *, BNE * ...): such a loop can only be
+ * left by an interrupt, which the caller delivers between runs. With
+ * spin_detect, longer loops are caught by the branch and JMP handlers,
+ * which set run_break (note_loop), and a jump-to-self at spin_ignore
+ * runs on like any other declined loop rather than ending every run
+ * after one instruction.
+ * ====================================================================== */
+
+#if defined(__GNUC__) && !defined(CPU6502_NO_COMPUTED_GOTO)
+#define CPU6502_THREADED 1
+#endif
+
+uint64_t cpu6502_run(cpu6502_t *cpu, uint64_t max_cycles)
+{
+    const uint64_t start = cpu->cycles;
+    const uint64_t end = start + max_cycles;
+    uint32_t insn_pc = 0x10000;   /* never equals a real PC */
+    uint8_t opcode;
+#ifdef CPU6502_PROFILE
+    uint64_t insn_cycles = 0;
+#define RUN_PROFILE() \
+    CPU6502_PROFILE_INSN((uint16_t)insn_pc, opcode, cpu->cycles - insn_cycles)
+#define RUN_PROFILE_START() (insn_cycles = cpu->cycles)
+#else
+#define RUN_PROFILE() ((void)0)
+#define RUN_PROFILE_START() ((void)0)
+#endif
+
+    cpu->run_break = false;
+    cpu->trapped = false;
+    cpu->spinning = false;
+
+#define RUN_FETCH()                                             \
+    do {                                                        \
+        if (cpu->cycles >= end || cpu->halted || cpu->run_break) \
+            goto done;                                          \
+        if (cpu->pc == insn_pc && (cpu->pc != cpu->spin_ignore  \
+                                   || !cpu->spin_detect)) {     \
+            cpu->trapped = true;                                \
+            goto done;                                          \
+        }                                                       \
+        insn_pc = cpu->pc;                                      \
+        RUN_PROFILE_START();                                    \
+        cpu->page_crossed = false;                              \
+        opcode = cpu_read(cpu, cpu->pc++);                      \
+        cpu->cycles += opcode_cycles[opcode];                   \
+    } while (0)
+
+#ifdef CPU6502_THREADED
+#define OPCODE_LABEL_ENTRY(n, fn) [n] = &&L_##n,
+#define OPCODE_LABEL_BODY(n, fn) \
+    L_##n: fn(cpu); RUN_PROFILE(); RUN_FETCH(); goto *labels[opcode];
+
+    static void *const labels[256] = {
+        OPCODE_LIST(OPCODE_LABEL_ENTRY)
+    };
+
+    RUN_FETCH();
+    goto *labels[opcode];
+    OPCODE_LIST(OPCODE_LABEL_BODY)
+
+#undef OPCODE_LABEL_ENTRY
+#undef OPCODE_LABEL_BODY
+#else
+#define OPCODE_CASE(n, fn) case n: fn(cpu); RUN_PROFILE(); break;
+
+    for (;;) {
+        RUN_FETCH();
+        switch (opcode) {
+        OPCODE_LIST(OPCODE_CASE)
+        }
+    }
+
+#undef OPCODE_CASE
+#endif
+#undef RUN_FETCH
+#undef RUN_PROFILE
+#undef RUN_PROFILE_START
+
+done:
+    return cpu->cycles - start;
+}
@@ -14,4 +14,31 @@ extern const uint8_t opcode_cycles[256];
 /* Mnemonic names for debug/disassembly */
 extern const char *opcode_names[256];
 
+/* Addressing modes */
+typedef enum {
+    AM_IMP,   /* implied (and illegal opcodes) */
+    AM_ACC,   /* accumulator: ASL A */
+    AM_IMM,   /* #$nn */
+    AM_ZPG,   /* $nn */
+    AM_ZPX,   /* $nn,X */
+    AM_ZPY,   /* $nn,Y */
+    AM_REL,   /* branch offset */
+    AM_IZX,   /* ($nn,X) */
+    AM_IZY,   /* ($nn),Y */
+    AM_ABS,   /* $nnnn */
+    AM_ABX,   /* $nnnn,X */
+    AM_ABY,   /* $nnnn,Y */
+    AM_IND,   /* ($nnnn) */
+    AM_COUNT
+} addr_mode_t;
+
+/* Addressing mode of each opcode, and instruction length in bytes
+ * (opcode included) for each mode */
+extern const uint8_t opcode_modes[256];
+extern const uint8_t addr_mode_lengths[AM_COUNT];
+
+static inline int opcode_length(uint8_t opcode) {
+    return addr_mode_lengths[opcode_modes[opcode]];
+}
+
 #endif
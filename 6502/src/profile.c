@@ -0,0 +1,130 @@
+/*
+ * profile.c — report and signal plumbing for the CPU6502_PROFILE counters
+ *
+ * The counting itself is inline in profile.h; this file is empty unless
+ * the profiler is compiled in.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "profile.h"
+
+#ifdef CPU6502_PROFILE
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opcodes.h"
+
+#define HOT_PCS 24
+
+cpu6502_profile_t cpu6502_profile;
+
+static volatile sig_atomic_t dump_requested;
+
+static const char *const mode_names[AM_COUNT] = {
+    [AM_IMP] = "imp", [AM_ACC] = "acc", [AM_IMM] = "imm", [AM_ZPG] = "zpg",
+    [AM_ZPX] = "zpx", [AM_ZPY] = "zpy", [AM_REL] = "rel", [AM_IZX] = "izx",
+    [AM_IZY] = "izy", [AM_ABS] = "abs", [AM_ABX] = "abx", [AM_ABY] = "aby",
+    [AM_IND] = "ind",
+};
+
+static double percent(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+void cpu6502_profile_dump(FILE *fp)
+{
+    const cpu6502_profile_t *p = &cpu6502_profile;
+    uint64_t insns = 0, cycles = 0;
+    int order[256], n = 0;
+
+    for (int op = 0; op < 256; op++) {
+        insns += p->count[op];
+        cycles += p->cycles[op];
+        if (p->count[op])
+            order[n++] = op;
+    }
+
+    /* Opcodes by cycles spent, descending (insertion sort, n <= 256) */
+    for (int i = 1; i < n; i++) {
+        int op = order[i], j = i;
+        while (j > 0 && p->cycles[order[j - 1]] < p->cycles[op]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = op;
+    }
+
+    fprintf(fp, "CPU profile: %llu instructions, %llu cycles\n",
+            (unsigned long long)insns, (unsigned long long)cycles);
+    fprintf(fp, "  op  name mode        count       %%        cycles       %%  cyc/op\n");
+    for (int i = 0; i < n; i++) {
+        int op = order[i];
+        fprintf(fp, "  %02X  %-4s %-4s %12llu  %5.1f%% %13llu  %5.1f%%  %6.2f\n",
+                op, opcode_names[op], mode_names[opcode_modes[op]],
+                (unsigned long long)p->count[op], percent(p->count[op], insns),
+                (unsigned long long)p->cycles[op], percent(p->cycles[op], cycles),
+                (double)p->cycles[op] / (double)p->count[op]);
+    }
+
+    /* Hottest PCs: keep a small sorted top list while scanning */
+    uint32_t top[HOT_PCS];
+    int ntop = 0;
+    for (uint32_t pc = 0; pc < 65536; pc++) {
+        uint64_t hits = p->pc_hits[pc];
+        if (!hits || (ntop == HOT_PCS && hits <= p->pc_hits[top[ntop - 1]]))
+            continue;
+        int j = ntop < HOT_PCS ? ntop++ : ntop - 1;
+        while (j > 0 && p->pc_hits[top[j - 1]] < hits) {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = pc;
+    }
+
+    fprintf(fp, "Hot PCs (top %d):\n", ntop);
+    for (int i = 0; i < ntop; i++) {
+        fprintf(fp, "  $%04X  %12llu  %5.1f%%\n", (unsigned)top[i],
+                (unsigned long long)p->pc_hits[top[i]],
+                percent(p->pc_hits[top[i]], insns));
+    }
+}
+
+void cpu6502_profile_reset(void)
+{
+    memset(&cpu6502_profile, 0, sizeof(cpu6502_profile));
+}
+
+static void on_dump_signal(int sig)
+{
+    (void)sig;
+    dump_requested = 1;
+}
+
+void cpu6502_profile_install_signal(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_dump_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGUSR1, &sa, NULL) != 0)
+        fprintf(stderr, "profile: cannot install SIGUSR1 handler\n");
+}
+
+int cpu6502_profile_signalled(void)
+{
+    if (!dump_requested)
+        return 0;
+    dump_requested = 0;
+    return 1;
+}
+
+#else
+
+/* ISO C forbids an empty translation unit */
+typedef int profile_unused_t;
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Compile-time instruction profiler.
+ *
+ * Build with -DCPU6502_PROFILE (make PROFILE=1) to count, for every
+ * executed instruction, its opcode, the cycles it really took (page-cross
+ * and branch penalties included) and its PC. Without the define the hook
+ * below expands to nothing and nothing else in this header is declared.
+ *
+ * The counters are global: the profiler answers "where does this process
+ * spend its emulated time", whichever CPU instance ran the code. */
+
+#ifdef CPU6502_PROFILE
+
+typedef struct {
+    uint64_t count[256];       /* executions per opcode */
+    uint64_t cycles[256];      /* cycles per opcode, penalties included */
+    uint64_t pc_hits[65536];   /* instructions started at each PC */
+} cpu6502_profile_t;
+
+extern cpu6502_profile_t cpu6502_profile;
+
+static inline void cpu6502_profile_insn(uint16_t pc, uint8_t opcode, uint64_t cycles)
+{
+    cpu6502_profile.count[opcode]++;
+    cpu6502_profile.cycles[opcode] += cycles;
+    cpu6502_profile.pc_hits[pc]++;
+}
+
+#define CPU6502_PROFILE_INSN(pc, opcode, cycles) \
+    cpu6502_profile_insn((pc), (opcode), (cycles))
+
+/* Print the opcode table sorted by cycles and the hottest PCs */
+void cpu6502_profile_dump(FILE *fp);
+void cpu6502_profile_reset(void);
+
+/* Dump-on-signal: install a SIGUSR1 handler that only sets a flag, then
+ * poll cpu6502_profile_signalled from the main loop; it returns 1 (and
+ * clears the flag) once per signal, and the caller prints its report. */
+void cpu6502_profile_install_signal(void);
+int  cpu6502_profile_signalled(void);
+
+#else
+
+#define CPU6502_PROFILE_INSN(pc, opcode, cycles) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Little-endian byte stream helpers for save states.
+ *
+ * A writer with buf == NULL only counts bytes, which is how callers size
+ * their buffers. Writing past cap or reading past len sets the error flag
+ * and turns further accesses into no-ops (reads return zeros), so callers
+ * only need to check once at the end. */
+
+typedef struct {
+    uint8_t *buf;
+    size_t   cap;
+    size_t   len;
+    bool     error;
+} state_writer_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t         len;
+    size_t         pos;
+    bool           error;
+} state_reader_t;
+
+static inline void state_writer_init(state_writer_t *w, uint8_t *buf, size_t cap) {
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->error = false;
+}
+
+static inline void state_reader_init(state_reader_t *r, const uint8_t *buf, size_t len) {
+    r->buf = buf;
+    r->len = len;
+    r->pos = 0;
+    r->error = false;
+}
+
+static inline void state_put(state_writer_t *w, const void *src, size_t n) {
+    if (w->buf) {
+        if (w->error || n > w->cap - w->len) {
+            w->error = true;
+            return;
+        }
+        memcpy(w->buf + w->len, src, n);
+    }
+    w->len += n;
+}
+
+static inline void state_get(state_reader_t *r, void *dst, size_t n) {
+    if (r->error || n > r->len - r->pos) {
+        r->error = true;
+        memset(dst, 0, n);
+        return;
+    }
+    memcpy(dst, r->buf + r->pos, n);
+    r->pos += n;
+}
+
+static inline void state_put_u8(state_writer_t *w, uint8_t v) {
+    state_put(w, &v, 1);
+}
+
+static inline void state_put_u16(state_writer_t *w, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+    state_put(w, b, 2);
+}
+
+static inline void state_put_u32(state_writer_t *w, uint32_t v) {
+    uint8_t b[4];
+    for (int i = 0; i < 4; i++) b[i] = (uint8_t)(v >> (8 * i));
+    state_put(w, b, 4);
+}
+
+static inline void state_put_u64(state_writer_t *w, uint64_t v) {
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++) b[i] = (uint8_t)(v >> (8 * i));
+    state_put(w, b, 8);
+}
+
+static inline uint8_t state_get_u8(state_reader_t *r) {
+    uint8_t v;
+    state_get(r, &v, 1);
+    return v;
+}
+
+static inline uint16_t state_get_u16(state_reader_t *r) {
+    uint8_t b[2];
+    state_get(r, b, 2);
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static inline uint32_t state_get_u32(state_reader_t *r) {
+    uint8_t b[4];
+    state_get(r, b, 4);
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)b[i] << (8 * i);
+    return v;
+}
+
+static inline uint64_t state_get_u64(state_reader_t *r) {
+    uint8_t b[8];
+    state_get(r, b, 8);
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)b[i] << (8 * i);
+    return v;
+}
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * trace.c — binary instruction trace: SPSC ring, writer thread, formatter
+ *
+ * The ring indices are free-running 64-bit counters; the producer owns
+ * `head`, the writer thread owns `tail`, and each only reads the other's
+ * with acquire ordering. They live on separate cache lines so the
+ * emulation thread does not bounce a line with the writer on every
+ * record.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "trace.h"
+#include "opcodes.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+
+struct trace_ring_t {
+    /* Producer side */
+    uint64_t head;
+    uint64_t tail_cache;     /* last tail seen, re-read only when full */
+    uint64_t stalls;
+    char pad0[CACHE_LINE - 3 * sizeof(uint64_t)];
+
+    /* Consumer side */
+    uint64_t tail;
+    char pad1[CACHE_LINE - sizeof(uint64_t)];
+
+    trace_record_t *records;
+    uint64_t mask;
+    FILE *fp;
+    bool stop;
+    bool write_error;
+    pthread_t thread;
+};
+
+static uint64_t load_acquire(const uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(uint64_t *p, uint64_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/* ======================================================================
+ * Writer thread
+ * ====================================================================== */
+
+static void *writer_main(void *arg)
+{
+    trace_ring_t *ring = (trace_ring_t *)arg;
+    const struct timespec idle = { 0, 1000000 };   /* 1 ms */
+
+    for (;;) {
+        /* Read stop before head: once stop is seen, head is final */
+        bool stop = __atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE);
+        uint64_t head = load_acquire(&ring->head);
+        uint64_t tail = ring->tail;
+
+        if (head == tail) {
+            if (stop)
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        /* Write up to the end of the buffer; the wrapped part goes next
+         * time round */
+        uint64_t start = tail & ring->mask;
+        uint64_t n = head - tail;
+        if (n > ring->mask + 1 - start)
+            n = ring->mask + 1 - start;
+
+        if (!ring->write_error &&
+            fwrite(&ring->records[start], sizeof(trace_record_t), (size_t)n, ring->fp) != n) {
+            fprintf(stderr, "trace: write failed, further records are discarded\n");
+            ring->write_error = true;
+        }
+        store_release(&ring->tail, tail + n);
+    }
+    return NULL;
+}
+
+/* ======================================================================
+ * Public API
+ * ====================================================================== */
+
+trace_ring_t *trace_open(const char *path, size_t capacity)
+{
+    size_t cap = 1024;
+    while (cap < capacity)
+        cap <<= 1;
+
+    trace_ring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        fprintf(stderr, "trace_open: out of memory\n");
+        return NULL;
+    }
+    ring->records = malloc(cap * sizeof(trace_record_t));
+    ring->mask = cap - 1;
+    if (!ring->records) {
+        fprintf(stderr, "trace_open: cannot allocate %zu-record ring\n", cap);
+        free(ring);
+        return NULL;
+    }
+
+    ring->fp = fopen(path, "wb");
+    if (!ring->fp) {
+        fprintf(stderr, "trace_open: cannot create '%s'\n", path);
+        free(ring->records);
+        free(ring);
+        return NULL;
+    }
+
+    trace_file_header_t hdr = { TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record_t) };
+    if (fwrite(&hdr, sizeof(hdr), 1, ring->fp) != 1 ||
+        pthread_create(&ring->thread, NULL, writer_main, ring) != 0) {
+        fprintf(stderr, "trace_open: cannot start trace writer for '%s'\n", path);
+        fclose(ring->fp);
+        free(ring->records);
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+bool trace_close(trace_ring_t *ring)
+{
+    if (!ring)
+        return true;
+
+    __atomic_store_n(&ring->stop, true, __ATOMIC_RELEASE);
+    pthread_join(ring->thread, NULL);
+
+    bool ok = !ring->write_error;
+    if (fclose(ring->fp) != 0)
+        ok = false;
+
+    fprintf(stderr, "trace: %llu records", (unsigned long long)ring->head);
+    if (ring->stalls)
+        fprintf(stderr, ", writer fell behind %llu times",
+                (unsigned long long)ring->stalls);
+    fprintf(stderr, "\n");
+
+    free(ring->records);
+    free(ring);
+    return ok;
+}
+
+void trace_fill(trace_record_t *rec, const cpu6502_t *cpu)
+{
+    rec->cycles = cpu->cycles;
+    rec->pc = cpu->pc;
+    rec->opcode = cpu_peek(cpu, cpu->pc);
+    rec->operand[0] = cpu_peek(cpu, (uint16_t)(cpu->pc + 1));
+    rec->operand[1] = cpu_peek(cpu, (uint16_t)(cpu->pc + 2));
+    rec->a = cpu->a;
+    rec->x = cpu->x;
+    rec->y = cpu->y;
+    rec->p = cpu->status;
+    rec->sp = cpu->sp;
+    memset(rec->pad, 0, sizeof(rec->pad));
+}
+
+void trace_capture(trace_ring_t *ring, const cpu6502_t *cpu)
+{
+    uint64_t head = ring->head;
+
+    if (head - ring->tail_cache > ring->mask) {
+        ring->tail_cache = load_acquire(&ring->tail);
+        if (head - ring->tail_cache > ring->mask) {
+            ring->stalls++;
+            do {
+                sched_yield();
+                ring->tail_cache = load_acquire(&ring->tail);
+            } while (head - ring->tail_cache > ring->mask);
+        }
+    }
+
+    trace_fill(&ring->records[head & ring->mask], cpu);
+    store_release(&ring->head, head + 1);
+}
+
+int trace_format(const trace_record_t *rec, char *buf, size_t cap)
+{
+    uint8_t op = rec->opcode;
+    uint8_t lo = rec->operand[0];
+    uint16_t word = (uint16_t)(lo | (rec->operand[1] << 8));
+    int len = opcode_length(op);
+    char bytes[12];
+    char operand[16];
+
+    if (len == 1)
+        snprintf(bytes, sizeof(bytes), "%02X", op);
+    else if (len == 2)
+        snprintf(bytes, sizeof(bytes), "%02X %02X", op, lo);
+    else
+        snprintf(bytes, sizeof(bytes), "%02X %02X %02X", op, lo, rec->operand[1]);
+
+    switch (opcode_modes[op]) {
+    case AM_ACC: snprintf(operand, sizeof(operand), "A"); break;
+    case AM_IMM: snprintf(operand, sizeof(operand), "#$%02X", lo); break;
+    case AM_ZPG: snprintf(operand, sizeof(operand), "$%02X", lo); break;
+    case AM_ZPX: snprintf(operand, sizeof(operand), "$%02X,X", lo); break;
+    case AM_ZPY: snprintf(operand, sizeof(operand), "$%02X,Y", lo); break;
+    case AM_REL:
+        snprintf(operand, sizeof(operand), "$%04X",
+                 (uint16_t)(rec->pc + 2 + (int8_t)lo));
+        break;
+    case AM_IZX: snprintf(operand, sizeof(operand), "($%02X,X)", lo); break;
+    case AM_IZY: snprintf(operand, sizeof(operand), "($%02X),Y", lo); break;
+    case AM_ABS: snprintf(operand, sizeof(operand), "$%04X", word); break;
+    case AM_ABX: snprintf(operand, sizeof(operand), "$%04X,X", word); break;
+    case AM_ABY: snprintf(operand, sizeof(operand), "$%04X,Y", word); break;
+    case AM_IND: snprintf(operand, sizeof(operand), "($%04X)", word); break;
+    default:     operand[0] = '\0'; break;
+    }
+
+    char instr[32];
+    snprintf(instr, sizeof(instr), "%s%s%s", opcode_names[op],
+             operand[0] ? " " : "", operand);
+
+    /* Column layout matches nestest.log: instruction at 16, A: at 48 */
+    int n = snprintf(buf, cap, "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu",
+                     rec->pc, bytes, instr, rec->a, rec->x, rec->y, rec->p, rec->sp,
+                     (unsigned long long)rec->cycles);
+    if (n < 0)
+        return 0;
+    return (size_t)n < cap ? n : (int)cap - 1;
+}
+
+bool trace_read_header(FILE *fp)
+{
+    trace_file_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TRACE_MAGIC) {
+        fprintf(stderr, "trace: not a trace file\n");
+        return false;
+    }
+    if (hdr.version != TRACE_VERSION || hdr.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "trace: unsupported trace version %u (record size %u)\n",
+                hdr.version, hdr.record_size);
+        return false;
+    }
+    return true;
+}
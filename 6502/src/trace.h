@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "cpu6502.h"
+
+/* Per-instruction execution trace.
+ *
+ * trace_capture records the CPU state before an instruction executes into
+ * a single-producer/single-consumer ring; a background thread drains the
+ * ring to a binary file in large writes. The emulation thread never
+ * formats or does I/O, so tracing costs a few stores per instruction and
+ * does not perturb emulated timing. If the writer falls behind, the
+ * producer waits rather than dropping records (counted as stalls).
+ *
+ * File format: trace_file_header_t, then trace_record_t records in host
+ * byte order. trace_format renders one record as a nestest.log line. */
+
+#define TRACE_MAGIC   0x45435254u   /* "TRCE" */
+#define TRACE_VERSION 1
+
+typedef struct {
+    uint64_t cycles;     /* before the instruction */
+    uint16_t pc;
+    uint8_t  opcode;
+    uint8_t  operand[2];
+    uint8_t  a, x, y, p, sp;
+    uint8_t  pad[4];
+} trace_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+} trace_file_header_t;
+
+typedef struct trace_ring_t trace_ring_t;
+
+/* Open `path` for writing and start the writer thread. `capacity` is the
+ * ring size in records and is rounded up to a power of two. */
+trace_ring_t *trace_open(const char *path, size_t capacity);
+
+/* Drain remaining records, stop the thread and close the file. Reports
+ * the record count (and stalls, if any) on stderr. Returns false if any
+ * write failed. */
+bool trace_close(trace_ring_t *ring);
+
+/* Record the instruction at cpu->pc. Operand bytes are read with
+ * cpu_peek, so I/O registers are never touched. */
+void trace_capture(trace_ring_t *ring, const cpu6502_t *cpu);
+
+/* Fill a record from the CPU without queueing it */
+void trace_fill(trace_record_t *rec, const cpu6502_t *cpu);
+
+/* Format as "PC  OP B1 B2  MNE OPERAND   A:XX X:XX Y:XX P:XX SP:XX CYC:N".
+ * Returns the string length (truncated to cap - 1). */
+int trace_format(const trace_record_t *rec, char *buf, size_t cap);
+
+/* Check the header of a trace file opened for reading */
+bool trace_read_header(FILE *fp);
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * tracetool.c — offline viewer for binary traces written by trace.c
+ *
+ *   trace6502 <trace.bin>                 print as nestest.log-style text
+ *   trace6502 -diff <trace.bin> <log>     compare against a reference log
+ *
+ * The diff compares PC, instruction bytes, A/X/Y/P/SP and CYC field by
+ * field, so disassembly details and extra columns in the reference
+ * (nestest's "= XX" memory values, PPU position) do not matter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "trace.h"
+#include "opcodes.h"
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s <trace.bin>\n"
+        "       %s -diff <trace.bin> <reference.log>\n",
+        prog, prog);
+}
+
+static FILE *open_trace(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open trace '%s'\n", path);
+        return NULL;
+    }
+    if (!trace_read_header(fp)) {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+static int dump(const char *path)
+{
+    FILE *fp = open_trace(path);
+    if (!fp)
+        return 1;
+
+    trace_record_t rec;
+    char line[128];
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        trace_format(&rec, line, sizeof(line));
+        puts(line);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* Fields of one reference log line */
+typedef struct {
+    uint16_t pc;
+    uint8_t  bytes[3];
+    int      nbytes;
+    uint8_t  a, x, y, p, sp;
+    bool     has_cycles;
+    unsigned long long cycles;
+} ref_line_t;
+
+static bool parse_ref_line(const char *line, ref_line_t *ref)
+{
+    unsigned pc;
+    if (sscanf(line, "%4x", &pc) != 1 || strlen(line) < 16)
+        return false;
+    ref->pc = (uint16_t)pc;
+
+    /* Instruction bytes in columns 6, 9 and 12 */
+    ref->nbytes = 0;
+    for (int i = 0; i < 3; i++) {
+        unsigned b;
+        if (line[6 + 3 * i] == ' ' || sscanf(line + 6 + 3 * i, "%2x", &b) != 1)
+            break;
+        ref->bytes[ref->nbytes++] = (uint8_t)b;
+    }
+
+    unsigned a, x, y, p, sp;
+    const char *regs = strstr(line, " A:");
+    if (!regs || sscanf(regs, " A:%2x X:%2x Y:%2x P:%2x SP:%2x", &a, &x, &y, &p, &sp) != 5)
+        return false;
+    ref->a = (uint8_t)a;
+    ref->x = (uint8_t)x;
+    ref->y = (uint8_t)y;
+    ref->p = (uint8_t)p;
+    ref->sp = (uint8_t)sp;
+
+    const char *cyc = strstr(regs, "CYC:");
+    ref->has_cycles = cyc != NULL;
+    ref->cycles = 0;
+    if (cyc)
+        ref->cycles = strtoull(cyc + 4, NULL, 10);
+    return true;
+}
+
+static const char *first_mismatch(const trace_record_t *rec, const ref_line_t *ref)
+{
+    if (rec->pc != ref->pc)
+        return "PC";
+    if (ref->nbytes != opcode_length(rec->opcode) || rec->opcode != ref->bytes[0])
+        return "opcode";
+    for (int i = 1; i < ref->nbytes; i++) {
+        if (rec->operand[i - 1] != ref->bytes[i])
+            return "operand";
+    }
+    if (rec->a != ref->a)   return "A";
+    if (rec->x != ref->x)   return "X";
+    if (rec->y != ref->y)   return "Y";
+    if (rec->p != ref->p)   return "P";
+    if (rec->sp != ref->sp) return "SP";
+    if (ref->has_cycles && rec->cycles != ref->cycles)
+        return "CYC";
+    return NULL;
+}
+
+static int diff(const char *trace_path, const char *ref_path)
+{
+    FILE *fp = open_trace(trace_path);
+    if (!fp)
+        return 1;
+    FILE *ref_fp = fopen(ref_path, "r");
+    if (!ref_fp) {
+        fprintf(stderr, "Cannot open reference log '%s'\n", ref_path);
+        fclose(fp);
+        return 1;
+    }
+
+    char ref_text[512], ours[128], prev[128] = "";
+    unsigned long matched = 0, lineno = 0;
+    trace_record_t rec;
+    int status = 0;
+
+    while (fgets(ref_text, sizeof(ref_text), ref_fp)) {
+        lineno++;
+        ref_text[strcspn(ref_text, "\r\n")] = '\0';
+
+        ref_line_t ref;
+        if (!parse_ref_line(ref_text, &ref))
+            continue;   /* blank or comment line */
+
+        if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+            printf("Trace ended after %lu instructions; reference continues at line %lu:\n"
+                   "  ref:  %s\n", matched, lineno, ref_text);
+            status = 1;
+            break;
+        }
+
+        const char *field = first_mismatch(&rec, &ref);
+        trace_format(&rec, ours, sizeof(ours));
+        if (field) {
+            printf("Mismatch in %s at instruction %lu (reference line %lu):\n",
+                   field, matched + 1, lineno);
+            if (prev[0])
+                printf("  prev: %s\n", prev);
+            printf("  ours: %s\n  ref:  %s\n", ours, ref_text);
+            status = 1;
+            break;
+        }
+        memcpy(prev, ours, sizeof(prev));
+        matched++;
+    }
+
+    if (status == 0)
+        printf("%lu instructions match\n", matched);
+
+    fclose(ref_fp);
+    fclose(fp);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2)
+        return dump(argv[1]);
+    if (argc == 4 && strcmp(argv[1], "-diff") == 0)
+        return diff(argv[2], argv[3]);
+
+    print_usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,686 @@
+/*
+ * singlestep.c — bulk runner for the per-opcode single-step JSON tests
+ *
+ *   singlestep [-j threads] [-v] <dir | file.json>...
+ *
+ * Each test file (one per opcode in the public sets, e.g. "a9.json") is
+ * an array of cases of the form
+ *
+ *   { "name": "...",
+ *     "initial": { "pc": N, "s": N, "a": N, "x": N, "y": N, "p": N,
+ *                  "ram": [[addr, val], ...] },
+ *     "final":   { ...same... },
+ *     "cycles":  [[addr, val, "read"|"write"], ...] }
+ *
+ * Worker threads claim whole files and parse them as a stream, running
+ * each case as soon as it has been read; no file is ever held in memory.
+ * Every worker owns one bus and one CPU for its whole life. Reads go
+ * through the page table straight into the worker's RAM; writes go
+ * through a callback that logs the address, so after a case only the
+ * bytes it touched are cleared, and a write to an address the final
+ * state does not list is caught as a failure.
+ *
+ * A case passes when registers, the listed RAM bytes and the cycle count
+ * all match. The bus-level cycle log is not compared: the core does not
+ * model dummy reads.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/cpu6502.h"
+
+#define MAX_RAM    64      /* RAM entries per state; the sets use <= 8 */
+#define MAX_WRITES 32      /* logged writes per case */
+#define NAME_LEN   48
+#define READ_BUF   (64 * 1024)
+#define MAX_THREADS 64
+
+/* ------------------------------------------------------------------ */
+/*  Test case                                                         */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint16_t pc;
+    uint8_t s, a, x, y, p;
+    int nram;
+    uint16_t addr[MAX_RAM];
+    uint8_t val[MAX_RAM];
+} cpu_state_t;
+
+typedef struct {
+    char name[NAME_LEN];
+    cpu_state_t initial;
+    cpu_state_t final;
+    int ncycles;
+} test_case_t;
+
+/* ------------------------------------------------------------------ */
+/*  Streaming JSON reader                                             */
+/*                                                                    */
+/*  Just enough JSON for the test format: objects, arrays, strings    */
+/*  without escapes that matter, and non-negative integers. Unknown   */
+/*  keys are skipped.                                                 */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    FILE *fp;
+    const char *path;
+    size_t pos, len;
+    long long consumed;   /* bytes before buf[0], for error offsets */
+    bool error;
+    char buf[READ_BUF];
+} reader_t;
+
+static int rd_peek(reader_t *r)
+{
+    if (r->pos == r->len) {
+        r->consumed += (long long)r->len;
+        r->len = fread(r->buf, 1, sizeof(r->buf), r->fp);
+        r->pos = 0;
+        if (r->len == 0)
+            return EOF;
+    }
+    return (unsigned char)r->buf[r->pos];
+}
+
+static int rd_next(reader_t *r)
+{
+    int c = rd_peek(r);
+    if (c != EOF)
+        r->pos++;
+    return c;
+}
+
+static void rd_fail(reader_t *r, const char *what)
+{
+    if (!r->error)
+        fprintf(stderr, "%s: %s at byte %lld\n", r->path, what,
+                r->consumed + (long long)r->pos);
+    r->error = true;
+}
+
+static int rd_skip_ws(reader_t *r)
+{
+    int c;
+    while ((c = rd_peek(r)) == ' ' || c == '\n' || c == '\r' || c == '\t')
+        r->pos++;
+    return c;
+}
+
+static bool rd_expect(reader_t *r, int want)
+{
+    if (rd_skip_ws(r) != want) {
+        char msg[32];
+        snprintf(msg, sizeof(msg), "expected '%c'", want);
+        rd_fail(r, msg);
+        return false;
+    }
+    r->pos++;
+    return true;
+}
+
+/* After an element: true if another follows (','), false at `close` */
+static bool rd_more(reader_t *r, int close)
+{
+    int c = rd_skip_ws(r);
+    if (c == ',') {
+        r->pos++;
+        return true;
+    }
+    if (c != close)
+        rd_fail(r, "expected ',' or closing bracket");
+    else
+        r->pos++;
+    return false;
+}
+
+/* String into out (truncated to cap - 1); escapes are kept verbatim */
+static bool rd_string(reader_t *r, char *out, size_t cap)
+{
+    size_t n = 0;
+    if (!rd_expect(r, '"'))
+        return false;
+    for (;;) {
+        int c = rd_next(r);
+        if (c == '"')
+            break;
+        if (c == '\\') {
+            if (n + 1 < cap)
+                out[n++] = (char)c;
+            c = rd_next(r);
+        }
+        if (c == EOF) {
+            rd_fail(r, "unterminated string");
+            return false;
+        }
+        if (n + 1 < cap)
+            out[n++] = (char)c;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+static bool rd_uint(reader_t *r, unsigned long *out)
+{
+    int c = rd_skip_ws(r);
+    if (c < '0' || c > '9') {
+        rd_fail(r, "expected a number");
+        return false;
+    }
+    unsigned long v = 0;
+    while ((c = rd_peek(r)) >= '0' && c <= '9') {
+        v = v * 10 + (unsigned long)(c - '0');
+        r->pos++;
+    }
+    *out = v;
+    return true;
+}
+
+static bool rd_skip_value(reader_t *r)
+{
+    int c = rd_skip_ws(r);
+    char scratch[8];
+
+    if (c == '"')
+        return rd_string(r, scratch, sizeof(scratch));
+    if (c == '{' || c == '[') {
+        int close = c == '{' ? '}' : ']';
+        r->pos++;
+        if (rd_skip_ws(r) == close) {
+            r->pos++;
+            return true;
+        }
+        do {
+            if (close == '}' && (!rd_string(r, scratch, sizeof(scratch)) || !rd_expect(r, ':')))
+                return false;
+            if (!rd_skip_value(r))
+                return false;
+        } while (rd_more(r, close));
+        return !r->error;
+    }
+    /* Number, true, false or null */
+    while ((c = rd_peek(r)) != EOF && c != ',' && c != '}' && c != ']' &&
+           c != ' ' && c != '\n' && c != '\r' && c != '\t')
+        r->pos++;
+    return true;
+}
+
+/* [[addr, val], ...] */
+static bool rd_ram(reader_t *r, cpu_state_t *st)
+{
+    st->nram = 0;
+    if (!rd_expect(r, '['))
+        return false;
+    if (rd_skip_ws(r) == ']') {
+        r->pos++;
+        return true;
+    }
+    do {
+        unsigned long addr, val;
+        if (!rd_expect(r, '[') || !rd_uint(r, &addr) || !rd_expect(r, ',') ||
+            !rd_uint(r, &val) || !rd_expect(r, ']'))
+            return false;
+        if (st->nram == MAX_RAM) {
+            rd_fail(r, "too many RAM entries");
+            return false;
+        }
+        st->addr[st->nram] = (uint16_t)addr;
+        st->val[st->nram] = (uint8_t)val;
+        st->nram++;
+    } while (rd_more(r, ']'));
+    return !r->error;
+}
+
+static bool rd_state(reader_t *r, cpu_state_t *st)
+{
+    char key[16];
+    memset(st, 0, sizeof(*st));
+    if (!rd_expect(r, '{'))
+        return false;
+    do {
+        unsigned long v = 0;
+        if (!rd_string(r, key, sizeof(key)) || !rd_expect(r, ':'))
+            return false;
+        if (strcmp(key, "ram") == 0) {
+            if (!rd_ram(r, st))
+                return false;
+            continue;
+        }
+        if (strcmp(key, "pc") != 0 && strcmp(key, "s") != 0 && strcmp(key, "a") != 0 &&
+            strcmp(key, "x") != 0 && strcmp(key, "y") != 0 && strcmp(key, "p") != 0) {
+            if (!rd_skip_value(r))
+                return false;
+            continue;
+        }
+        if (!rd_uint(r, &v))
+            return false;
+        switch (key[0]) {
+        case 'p': if (key[1] == 'c') st->pc = (uint16_t)v; else st->p = (uint8_t)v; break;
+        case 's': st->s = (uint8_t)v; break;
+        case 'a': st->a = (uint8_t)v; break;
+        case 'x': st->x = (uint8_t)v; break;
+        case 'y': st->y = (uint8_t)v; break;
+        }
+    } while (rd_more(r, '}'));
+    return !r->error;
+}
+
+/* Count the entries of the "cycles" array without storing them */
+static bool rd_cycles(reader_t *r, int *count)
+{
+    *count = 0;
+    if (!rd_expect(r, '['))
+        return false;
+    if (rd_skip_ws(r) == ']') {
+        r->pos++;
+        return true;
+    }
+    do {
+        if (!rd_skip_value(r))
+            return false;
+        (*count)++;
+    } while (rd_more(r, ']'));
+    return !r->error;
+}
+
+static bool rd_case(reader_t *r, test_case_t *tc)
+{
+    char key[16];
+    tc->name[0] = '\0';
+    tc->ncycles = -1;
+    if (!rd_expect(r, '{'))
+        return false;
+    do {
+        if (!rd_string(r, key, sizeof(key)) || !rd_expect(r, ':'))
+            return false;
+        bool ok;
+        if (strcmp(key, "name") == 0)
+            ok = rd_string(r, tc->name, sizeof(tc->name));
+        else if (strcmp(key, "initial") == 0)
+            ok = rd_state(r, &tc->initial);
+        else if (strcmp(key, "final") == 0)
+            ok = rd_state(r, &tc->final);
+        else if (strcmp(key, "cycles") == 0)
+            ok = rd_cycles(r, &tc->ncycles);
+        else
+            ok = rd_skip_value(r);
+        if (!ok)
+            return false;
+    } while (rd_more(r, '}'));
+    return !r->error;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Execution                                                         */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    unsigned long cases;
+    unsigned long failed;
+    double seconds;
+} opcode_stats_t;
+
+typedef struct {
+    uint8_t ram[65536];
+    uint16_t writes[MAX_WRITES];
+    int nwrites;
+    bool write_overflow;
+    cpu6502_t cpu;
+    opcode_stats_t stats[256];
+    bool reported[256];   /* first failure per opcode already printed */
+    bool io_error;
+} worker_t;
+
+static uint8_t worker_read(void *ctx, uint16_t addr)
+{
+    /* Every page is mapped; only reached if that ever changes */
+    return ((worker_t *)ctx)->ram[addr];
+}
+
+static void worker_write(void *ctx, uint16_t addr, uint8_t val)
+{
+    worker_t *w = (worker_t *)ctx;
+    w->ram[addr] = val;
+    if (w->nwrites < MAX_WRITES)
+        w->writes[w->nwrites++] = addr;
+    else
+        w->write_overflow = true;
+}
+
+static bool verbose;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool listed(const cpu_state_t *st, uint16_t addr)
+{
+    for (int i = 0; i < st->nram; i++) {
+        if (st->addr[i] == addr)
+            return true;
+    }
+    return false;
+}
+
+/* Run one case; returns NULL on a pass, otherwise a description */
+static const char *run_case(worker_t *w, const test_case_t *tc, char *detail, size_t cap)
+{
+    cpu6502_t *cpu = &w->cpu;
+    const cpu_state_t *in = &tc->initial, *out = &tc->final;
+    const char *why = NULL;
+
+    for (int i = 0; i < in->nram; i++)
+        w->ram[in->addr[i]] = in->val[i];
+    cpu->pc = in->pc;
+    cpu->sp = in->s;
+    cpu->a = in->a;
+    cpu->x = in->x;
+    cpu->y = in->y;
+    cpu->status = in->p;
+    cpu->cycles = 0;
+    cpu->halted = false;
+    w->nwrites = 0;
+    w->write_overflow = false;
+
+    cpu6502_step(cpu);
+
+    if (cpu->pc != out->pc || cpu->sp != out->s || cpu->a != out->a ||
+        cpu->x != out->x || cpu->y != out->y || cpu->status != out->p) {
+        why = "registers";
+        snprintf(detail, cap,
+                 "got PC=%04X S=%02X A=%02X X=%02X Y=%02X P=%02X, "
+                 "want PC=%04X S=%02X A=%02X X=%02X Y=%02X P=%02X",
+                 cpu->pc, cpu->sp, cpu->a, cpu->x, cpu->y, cpu->status,
+                 out->pc, out->s, out->a, out->x, out->y, out->p);
+    }
+    for (int i = 0; !why && i < out->nram; i++) {
+        if (w->ram[out->addr[i]] != out->val[i]) {
+            why = "memory";
+            snprintf(detail, cap, "$%04X = %02X, want %02X",
+                     out->addr[i], w->ram[out->addr[i]], out->val[i]);
+        }
+    }
+    for (int i = 0; !why && i < w->nwrites; i++) {
+        if (!listed(out, w->writes[i])) {
+            why = "stray write";
+            snprintf(detail, cap, "wrote $%04X", w->writes[i]);
+        }
+    }
+    if (!why && w->write_overflow) {
+        why = "stray write";
+        snprintf(detail, cap, "more than %d writes", MAX_WRITES);
+    }
+    if (!why && tc->ncycles >= 0 && cpu->cycles != (uint64_t)tc->ncycles) {
+        why = "cycles";
+        snprintf(detail, cap, "took %llu cycles, want %d",
+                 (unsigned long long)cpu->cycles, tc->ncycles);
+    }
+
+    /* The final state lists every byte the instruction touches, so these
+     * two sets cover everything this case changed */
+    for (int i = 0; i < in->nram; i++)
+        w->ram[in->addr[i]] = 0;
+    for (int i = 0; i < w->nwrites; i++)
+        w->ram[w->writes[i]] = 0;
+    if (w->write_overflow)
+        memset(w->ram, 0, sizeof(w->ram));
+    return why;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void run_file(worker_t *w, reader_t *r, const char *path)
+{
+    test_case_t tc;
+    char detail[160];
+    int opcode = -1;
+    double start = now_seconds();
+
+    r->fp = fopen(path, "rb");
+    r->path = path;
+    r->pos = r->len = 0;
+    r->consumed = 0;
+    r->error = false;
+    if (!r->fp) {
+        fprintf(stderr, "Cannot open '%s'\n", path);
+        w->io_error = true;
+        return;
+    }
+
+    if (rd_expect(r, '[') && rd_skip_ws(r) != ']') {
+        do {
+            if (!rd_case(r, &tc))
+                break;
+            uint8_t op = 0;
+            for (int i = 0; i < tc.initial.nram; i++) {
+                if (tc.initial.addr[i] == tc.initial.pc)
+                    op = tc.initial.val[i];
+            }
+            if (opcode < 0)
+                opcode = op;
+
+            const char *why = run_case(w, &tc, detail, sizeof(detail));
+            w->stats[op].cases++;
+            if (why) {
+                w->stats[op].failed++;
+                if (verbose || !w->reported[op]) {
+                    w->reported[op] = true;
+                    pthread_mutex_lock(&report_lock);
+                    fprintf(stderr, "FAIL %02x \"%s\": %s: %s\n", op, tc.name, why, detail);
+                    pthread_mutex_unlock(&report_lock);
+                }
+            }
+        } while (rd_more(r, ']'));
+    }
+    if (r->error)
+        w->io_error = true;
+    fclose(r->fp);
+
+    if (opcode >= 0)
+        w->stats[opcode].seconds += now_seconds() - start;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Work distribution                                                 */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    char **files;
+    int nfiles;
+    int next;            /* next unclaimed file, taken atomically */
+} job_t;
+
+typedef struct {
+    job_t *job;
+    worker_t *worker;
+    reader_t *reader;
+} thread_arg_t;
+
+static void *worker_main(void *arg)
+{
+    thread_arg_t *t = (thread_arg_t *)arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&t->job->next, 1, __ATOMIC_RELAXED);
+        if (i >= t->job->nfiles)
+            break;
+        run_file(t->worker, t->reader, t->job->files[i]);
+    }
+    return NULL;
+}
+
+static bool add_file(job_t *job, int *cap, const char *path)
+{
+    if (job->nfiles == *cap) {
+        int ncap = *cap ? *cap * 2 : 256;
+        char **grown = realloc(job->files, (size_t)ncap * sizeof(char *));
+        if (!grown)
+            return false;
+        job->files = grown;
+        *cap = ncap;
+    }
+    size_t len = strlen(path) + 1;
+    job->files[job->nfiles] = malloc(len);
+    if (!job->files[job->nfiles])
+        return false;
+    memcpy(job->files[job->nfiles++], path, len);
+    return true;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* A directory contributes its *.json files; anything else is a file */
+static bool collect(job_t *job, int *cap, const char *path)
+{
+    DIR *dir = opendir(path);
+    if (!dir)
+        return add_file(job, cap, path);
+
+    int first = job->nfiles;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t n = strlen(ent->d_name);
+        if (n < 6 || strcmp(ent->d_name + n - 5, ".json") != 0)
+            continue;
+        char full[4096];
+        snprintf(full, sizeof(full), "%s/%s", path, ent->d_name);
+        if (!add_file(job, cap, full)) {
+            closedir(dir);
+            return false;
+        }
+    }
+    closedir(dir);
+    qsort(job->files + first, (size_t)(job->nfiles - first), sizeof(char *), compare_paths);
+    return true;
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-j threads] [-v] <dir | file.json>...\n"
+        "  -j N   worker threads (default: online CPUs)\n"
+        "  -v     report every failing case, not just the first per opcode\n",
+        prog);
+}
+
+int main(int argc, char *argv[])
+{
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    job_t job = { NULL, 0, 0 };
+    int cap = 0;
+    int argi = 1;
+
+    while (argi < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-v") == 0) {
+            verbose = true;
+            argi++;
+        } else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+            nthreads = strtol(argv[argi + 1], NULL, 10);
+            argi += 2;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argi >= argc || nthreads < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    for (; argi < argc; argi++) {
+        if (!collect(&job, &cap, argv[argi])) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    if (job.nfiles == 0) {
+        fprintf(stderr, "No test files found\n");
+        return 1;
+    }
+    if (nthreads > job.nfiles)
+        nthreads = job.nfiles;
+
+    worker_t *workers = calloc((size_t)nthreads, sizeof(worker_t));
+    reader_t *readers = calloc((size_t)nthreads, sizeof(reader_t));
+    thread_arg_t args[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    if (!workers || !readers) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    bool created[MAX_THREADS] = { false };
+    double start = now_seconds();
+    for (long t = 0; t < nthreads; t++) {
+        worker_t *w = &workers[t];
+        cpu6502_init(&w->cpu, worker_read, worker_write, w);
+        cpu6502_map_pages(&w->cpu, 0x00, 256, w->ram, NULL);
+        args[t].job = &job;
+        args[t].worker = w;
+        args[t].reader = &readers[t];
+        /* Thread 0 is the caller */
+        if (t > 0)
+            created[t] = pthread_create(&threads[t], NULL, worker_main, &args[t]) == 0;
+    }
+    worker_main(&args[0]);
+    for (long t = 1; t < nthreads; t++) {
+        if (created[t])
+            pthread_join(threads[t], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    /* Merge per-worker results */
+    opcode_stats_t total[256];
+    bool io_error = false;
+    memset(total, 0, sizeof(total));
+    for (long t = 0; t < nthreads; t++) {
+        io_error |= workers[t].io_error;
+        for (int op = 0; op < 256; op++) {
+            total[op].cases += workers[t].stats[op].cases;
+            total[op].failed += workers[t].stats[op].failed;
+            total[op].seconds += workers[t].stats[op].seconds;
+        }
+    }
+
+    unsigned long cases = 0, failed = 0;
+    int ops = 0, ops_failed = 0;
+    printf("op   cases  failed      ms\n");
+    for (int op = 0; op < 256; op++) {
+        if (total[op].cases == 0)
+            continue;
+        printf("%02x %7lu %7lu %7.1f%s\n", op, total[op].cases, total[op].failed,
+               total[op].seconds * 1000.0, total[op].failed ? "  FAIL" : "");
+        cases += total[op].cases;
+        failed += total[op].failed;
+        ops++;
+        if (total[op].failed)
+            ops_failed++;
+    }
+    printf("%lu cases in %d opcodes: %lu passed, %lu failed (%d opcodes); "
+           "%.2fs on %ld threads, %.0f cases/s\n",
+           cases, ops, cases - failed, failed, ops_failed, elapsed, nthreads,
+           elapsed > 0 ? (double)cases / elapsed : 0.0);
+
+    for (int i = 0; i < job.nfiles; i++)
+        free(job.files[i]);
+    free(job.files);
+    free(workers);
+    free(readers);
+    return failed || io_error ? 1 : 0;
+}
@@ -84,6 +84,27 @@ extern int test_indirect_indexed(void);
 extern int test_nop_cycles(void);
 extern int test_lda_abs_cycles(void);
 
+/* Save states */
+extern int test_state_roundtrip(void);
+extern int test_state_short_buffer(void);
+
+/* Page table */
+extern int test_page_table_bypass(void);
+extern int test_page_table_unmapped(void);
+extern int test_page_table_matches_bus(void);
+
+/* Batched execution */
+extern int test_run_matches_step(void);
+extern int test_run_budget(void);
+extern int test_run_break(void);
+extern int test_run_irq_unmask(void);
+extern int test_run_spin(void);
+extern int test_run_spin_ignored_trap(void);
+
+/* Tracing */
+extern int test_opcode_lengths(void);
+extern int test_trace_format(void);
+
 /* ------------------------------------------------------------------ */
 /*  Test runner                                                       */
 /* ------------------------------------------------------------------ */
@@ -177,6 +198,27 @@ int main(void)
         /* Cycle counting */
         {"nop_cycles",          test_nop_cycles},
         {"lda_abs_cycles",      test_lda_abs_cycles},
+
+        /* Save states */
+        {"state_roundtrip",     test_state_roundtrip},
+        {"state_short_buffer",  test_state_short_buffer},
+
+        /* Page table */
+        {"page_table_bypass",   test_page_table_bypass},
+        {"page_table_unmapped", test_page_table_unmapped},
+        {"page_table_matches_bus", test_page_table_matches_bus},
+
+        /* Batched execution */
+        {"run_matches_step",    test_run_matches_step},
+        {"run_budget",          test_run_budget},
+        {"run_break",           test_run_break},
+        {"run_irq_unmask",      test_run_irq_unmask},
+        {"run_spin",            test_run_spin},
+        {"run_spin_ignored_trap", test_run_spin_ignored_trap},
+
+        /* Tracing */
+        {"opcode_lengths",      test_opcode_lengths},
+        {"trace_format",        test_trace_format},
     };
 
     int total = (int)(sizeof(tests) / sizeof(tests[0]));
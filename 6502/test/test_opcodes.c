@@ -3,6 +3,8 @@
 #include <string.h>
 #include "../src/bus.h"
 #include "../src/cpu6502.h"
+#include "../src/opcodes.h"
+#include "../src/trace.h"
 
 /* ------------------------------------------------------------------ */
 /*  Helpers                                                           */
@@ -11,7 +13,8 @@
 #define ASSERT(cond, ...) \
     do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); return 1; } } while (0)
 
-/* Initialize bus+cpu with reset vector pointing to $0600 */
+/* Initialize bus+cpu with reset vector pointing to $0600. Every access
+ * goes through the bus callbacks. */
 static void setup(bus_flat_t *bus, cpu6502_t *cpu)
 {
     bus_flat_init(bus);
@@ -21,6 +24,14 @@ static void setup(bus_flat_t *bus, cpu6502_t *cpu)
     cpu6502_reset(cpu);
 }
 
+/* setup with the whole RAM in the CPU page table, so accesses bypass the
+ * callbacks (tests of the page table and of what relies on it) */
+static void setup_mapped(bus_flat_t *bus, cpu6502_t *cpu)
+{
+    setup(bus, cpu);
+    bus_flat_map(bus, cpu);
+}
+
 /* ================================================================== */
 /*  Load / Store                                                      */
 /* ================================================================== */
@@ -943,3 +954,395 @@ int test_lda_abs_cycles(void)
            (unsigned long long)elapsed);
     return 0;
 }
+
+/* ================================================================== */
+/*  Save states                                                       */
+/* ================================================================== */
+
+int test_state_roundtrip(void)
+{
+    bus_flat_t bus; cpu6502_t cpu, restored;
+    setup(&bus, &cpu);
+    bus.ram[0x0600] = 0xA2;   /* LDX #$80 */
+    bus.ram[0x0601] = 0x80;
+    bus.ram[0x0602] = 0x38;   /* SEC */
+    cpu6502_step(&cpu);
+    cpu6502_step(&cpu);
+
+    uint8_t buf[64];
+    state_writer_t w;
+    state_writer_init(&w, buf, sizeof(buf));
+    cpu6502_save_state(&cpu, &w);
+    ASSERT(!w.error, "test_state_roundtrip: save failed\n");
+
+    setup(&bus, &restored);
+    state_reader_t r;
+    state_reader_init(&r, buf, w.len);
+    cpu6502_load_state(&restored, &r);
+    ASSERT(!r.error && r.pos == w.len, "test_state_roundtrip: load failed\n");
+    ASSERT(restored.x == 0x80 && restored.pc == 0x0603,
+           "test_state_roundtrip: X=%02X PC=%04X\n", restored.x, restored.pc);
+    ASSERT(cpu_get_flag(&restored, CPU_FLAG_C) && cpu_get_flag(&restored, CPU_FLAG_N),
+           "test_state_roundtrip: flags=%02X\n", restored.status);
+    ASSERT(restored.cycles == cpu.cycles,
+           "test_state_roundtrip: cycles=%llu expected %llu\n",
+           (unsigned long long)restored.cycles, (unsigned long long)cpu.cycles);
+    return 0;
+}
+
+int test_state_short_buffer(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup(&bus, &cpu);
+
+    state_writer_t w;
+    state_writer_init(&w, NULL, 0);
+    cpu6502_save_state(&cpu, &w);
+    size_t size = w.len;
+
+    uint8_t buf[64];
+    state_writer_init(&w, buf, size - 1);
+    cpu6502_save_state(&cpu, &w);
+    ASSERT(w.error, "test_state_short_buffer: short write not flagged\n");
+
+    state_writer_init(&w, buf, sizeof(buf));
+    cpu6502_save_state(&cpu, &w);
+    state_reader_t r;
+    state_reader_init(&r, buf, size - 1);
+    cpu6502_load_state(&cpu, &r);
+    ASSERT(r.error, "test_state_short_buffer: short read not flagged\n");
+    return 0;
+}
+
+/* ================================================================== */
+/*  Page table                                                        */
+/* ================================================================== */
+
+/* Flat RAM that counts callback accesses */
+typedef struct {
+    bus_flat_t flat;
+    int reads;
+    int writes;
+} counting_bus_t;
+
+static uint8_t counting_read(void *ctx, uint16_t addr)
+{
+    counting_bus_t *bus = (counting_bus_t *)ctx;
+    bus->reads++;
+    return bus->flat.ram[addr];
+}
+
+static void counting_write(void *ctx, uint16_t addr, uint8_t val)
+{
+    counting_bus_t *bus = (counting_bus_t *)ctx;
+    bus->writes++;
+    bus->flat.ram[addr] = val;
+}
+
+/* setup_mapped over a counting bus */
+static void setup_counting(counting_bus_t *bus, cpu6502_t *cpu)
+{
+    memset(bus, 0, sizeof(*bus));
+    bus->flat.ram[0xFFFC] = 0x00;
+    bus->flat.ram[0xFFFD] = 0x06;
+    cpu6502_init(cpu, counting_read, counting_write, bus);
+    bus_flat_map(&bus->flat, cpu);
+    cpu6502_reset(cpu);
+}
+
+int test_page_table_bypass(void)
+{
+    counting_bus_t bus; cpu6502_t cpu;
+    setup_counting(&bus, &cpu);
+
+    bus.flat.ram[0x0600] = 0xA9;   /* LDA #$5A */
+    bus.flat.ram[0x0601] = 0x5A;
+    bus.flat.ram[0x0602] = 0x8D;   /* STA $0300 */
+    bus.flat.ram[0x0603] = 0x00;
+    bus.flat.ram[0x0604] = 0x03;
+    cpu6502_step(&cpu);
+    cpu6502_step(&cpu);
+    ASSERT(bus.flat.ram[0x0300] == 0x5A,
+           "test_page_table_bypass: $0300=%02X expected 5A\n", bus.flat.ram[0x0300]);
+    ASSERT(bus.reads == 0 && bus.writes == 0,
+           "test_page_table_bypass: %d reads, %d writes via callback\n",
+           bus.reads, bus.writes);
+    return 0;
+}
+
+int test_page_table_unmapped(void)
+{
+    counting_bus_t bus; cpu6502_t cpu;
+    setup_counting(&bus, &cpu);
+    cpu6502_map_pages(&cpu, 0x20, 1, NULL, NULL);          /* I/O page */
+    cpu6502_map_pages(&cpu, 0x40, 1, bus.flat.ram + 0x4000, NULL);  /* ROM */
+
+    bus.flat.ram[0x2005] = 0x77;
+    bus.flat.ram[0x0600] = 0xAD;   /* LDA $2005 */
+    bus.flat.ram[0x0601] = 0x05;
+    bus.flat.ram[0x0602] = 0x20;
+    bus.flat.ram[0x0603] = 0x8D;   /* STA $4010 */
+    bus.flat.ram[0x0604] = 0x10;
+    bus.flat.ram[0x0605] = 0x40;
+    cpu6502_step(&cpu);
+    cpu6502_step(&cpu);
+    ASSERT(cpu.a == 0x77, "test_page_table_unmapped: A=%02X expected 77\n", cpu.a);
+    ASSERT(bus.reads == 1 && bus.writes == 1,
+           "test_page_table_unmapped: %d reads, %d writes via callback, expected 1/1\n",
+           bus.reads, bus.writes);
+    return 0;
+}
+
+int test_page_table_matches_bus(void)
+{
+    /* LDX #$10; loop: DEX; TXA; PHA; STA $0200,X; PLA; STA ($10),Y; INY;
+     * CPX #$00; BNE loop; JMP * */
+    static const uint8_t prog[] = {
+        0xA2, 0x10, 0xCA, 0x8A, 0x48, 0x9D, 0x00, 0x02, 0x68, 0x91, 0x10,
+        0xC8, 0xE0, 0x00, 0xD0, 0xF2, 0x4C, 0x10, 0x06,
+    };
+    bus_flat_t bus_a, bus_b; cpu6502_t viabus, mapped;
+    setup(&bus_a, &viabus);
+    setup_mapped(&bus_b, &mapped);
+    memcpy(bus_a.ram + 0x0600, prog, sizeof(prog));
+    memcpy(bus_b.ram + 0x0600, prog, sizeof(prog));
+    bus_a.ram[0x0011] = bus_b.ram[0x0011] = 0x03;   /* ($10) = $0300 */
+
+    while (viabus.pc != 0x0610)
+        cpu6502_step(&viabus);
+    while (mapped.pc != 0x0610)
+        cpu6502_step(&mapped);
+    ASSERT(viabus.cycles == mapped.cycles && viabus.a == mapped.a &&
+           viabus.y == mapped.y && viabus.sp == mapped.sp &&
+           viabus.status == mapped.status,
+           "test_page_table_matches_bus: registers differ\n");
+    ASSERT(memcmp(bus_a.ram, bus_b.ram, sizeof(bus_a.ram)) == 0 &&
+           bus_a.ram[0x0300] == 0x0F && bus_a.ram[0x030F] == 0x00,
+           "test_page_table_matches_bus: RAM differs\n");
+    return 0;
+}
+
+/* ================================================================== */
+/*  Batched execution                                                 */
+/* ================================================================== */
+
+int test_run_matches_step(void)
+{
+    /* LDX #$10; loop: DEX; STX $0200,X; BNE loop; JMP * */
+    static const uint8_t prog[] = {
+        0xA2, 0x10, 0xCA, 0x9D, 0x00, 0x02, 0xD0, 0xFA, 0x4C, 0x08, 0x06,
+    };
+    bus_flat_t bus_a, bus_b; cpu6502_t stepped, batched;
+    setup(&bus_a, &stepped);
+    setup(&bus_b, &batched);
+    memcpy(bus_a.ram + 0x0600, prog, sizeof(prog));
+    memcpy(bus_b.ram + 0x0600, prog, sizeof(prog));
+
+    while (stepped.pc != 0x0608)
+        cpu6502_step(&stepped);
+
+    uint64_t before = batched.cycles;
+    uint64_t ran = cpu6502_run(&batched, 100000);
+    ASSERT(batched.trapped && batched.pc == 0x0608,
+           "test_run_matches_step: trapped=%d PC=%04X\n", batched.trapped, batched.pc);
+    /* The run also executed the JMP * once before noticing the trap */
+    ASSERT(ran == batched.cycles - before && batched.cycles == stepped.cycles + 3,
+           "test_run_matches_step: cycles=%llu stepped=%llu\n",
+           (unsigned long long)batched.cycles, (unsigned long long)stepped.cycles);
+    ASSERT(batched.x == 0 && memcmp(bus_a.ram, bus_b.ram, sizeof(bus_a.ram)) == 0,
+           "test_run_matches_step: state differs\n");
+    return 0;
+}
+
+int test_run_budget(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup(&bus, &cpu);
+    memset(bus.ram + 0x0600, 0xEA, 16);   /* NOPs */
+    uint64_t ran = cpu6502_run(&cpu, 5);
+    ASSERT(ran == 6 && cpu.pc == 0x0603,
+           "test_run_budget: ran=%llu PC=%04X expected 6/$0603\n",
+           (unsigned long long)ran, cpu.pc);
+    ASSERT(!cpu.trapped, "test_run_budget: trapped set\n");
+    return 0;
+}
+
+static void breaking_write(void *ctx, uint16_t addr, uint8_t val)
+{
+    cpu6502_t *cpu = (cpu6502_t *)ctx;
+    (void)addr;
+    (void)val;
+    cpu6502_break(cpu);
+}
+
+int test_run_break(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup_mapped(&bus, &cpu);
+    /* Page $40 writes go to a callback that ends the run */
+    cpu.write = breaking_write;
+    cpu.bus_ctx = &cpu;
+    cpu6502_map_pages(&cpu, 0x40, 1, bus.ram + 0x4000, NULL);
+    bus.ram[0x0600] = 0xEA;                           /* NOP */
+    bus.ram[0x0601] = 0x8D;                           /* STA $4000 */
+    bus.ram[0x0602] = 0x00;
+    bus.ram[0x0603] = 0x40;
+    memset(bus.ram + 0x0604, 0xEA, 16);
+    uint64_t ran = cpu6502_run(&cpu, 1000);
+    ASSERT(ran == 6 && cpu.pc == 0x0604,
+           "test_run_break: ran=%llu PC=%04X expected 6/$0604\n",
+           (unsigned long long)ran, cpu.pc);
+
+    /* Halting (illegal opcode) also ends the run */
+    bus.ram[0x0606] = 0x02;
+    cpu6502_run(&cpu, 1000);
+    ASSERT(cpu.halted && cpu.pc == 0x0607,
+           "test_run_break: halted=%d PC=%04X\n", cpu.halted, cpu.pc);
+    return 0;
+}
+
+int test_run_irq_unmask(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup(&bus, &cpu);
+    bus.ram[0x0600] = 0x78;                           /* SEI */
+    bus.ram[0x0601] = 0xEA;                           /* NOP */
+    bus.ram[0x0602] = 0x58;                           /* CLI */
+    memset(bus.ram + 0x0603, 0xEA, 16);
+
+    /* No IRQ waiting: CLI is just another instruction */
+    uint64_t ran = cpu6502_run(&cpu, 8);
+    ASSERT(ran == 8 && cpu.pc == 0x0604,
+           "test_run_irq_unmask: ran=%llu PC=%04X expected 8/$0604\n",
+           (unsigned long long)ran, cpu.pc);
+
+    /* With the line held, the run ends right after CLI clears I */
+    cpu.pc = 0x0600;
+    cpu.irq_line = true;
+    ran = cpu6502_run(&cpu, 1000);
+    ASSERT(ran == 6 && cpu.pc == 0x0603 && !(cpu.status & CPU_FLAG_I),
+           "test_run_irq_unmask: ran=%llu PC=%04X P=%02X expected 6/$0603, I clear\n",
+           (unsigned long long)ran, cpu.pc, cpu.status);
+    return 0;
+}
+
+int test_run_spin(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup(&bus, &cpu);
+    bus.ram[0x0600] = 0xA5;                           /* loop: LDA $10 */
+    bus.ram[0x0601] = 0x10;
+    bus.ram[0x0602] = 0xF0;                           /* BEQ loop */
+    bus.ram[0x0603] = 0xFC;
+
+    /* Off by default: the loop runs out the budget */
+    uint64_t ran = cpu6502_run(&cpu, 100);
+    ASSERT(ran >= 100 && !cpu.spinning,
+           "test_run_spin: ran=%llu spinning=%d without spin_detect\n",
+           (unsigned long long)ran, cpu.spinning);
+
+    /* The second time round ends the run at the loop start. Each
+     * iteration is LDA zp (3) + taken BEQ (3). */
+    cpu.pc = 0x0600;
+    cpu.spin_detect = true;
+    cpu.spin_pc = 0;
+    ran = cpu6502_run(&cpu, 1000);
+    ASSERT(cpu.spinning && cpu.pc == 0x0600 && ran == 12,
+           "test_run_spin: spinning=%d PC=%04X ran=%llu expected 1/$0600/12\n",
+           cpu.spinning, cpu.pc, (unsigned long long)ran);
+
+    /* A declined loop is left alone */
+    cpu.spin_ignore = 0x0600;
+    ran = cpu6502_run(&cpu, 100);
+    ASSERT(ran >= 100 && !cpu.spinning,
+           "test_run_spin: ran=%llu spinning=%d with the loop ignored\n",
+           (unsigned long long)ran, cpu.spinning);
+    return 0;
+}
+
+int test_run_spin_ignored_trap(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup(&bus, &cpu);
+    bus.ram[0x0600] = 0x6C;                           /* JMP ($0300) */
+    bus.ram[0x0601] = 0x00;
+    bus.ram[0x0602] = 0x03;
+    bus.ram[0x0300] = 0x00;                           /* -> $0600 */
+    bus.ram[0x0301] = 0x06;
+    bus.ram[0x0610] = 0x4C;                           /* JMP * */
+    bus.ram[0x0611] = 0x10;
+    bus.ram[0x0612] = 0x06;
+    cpu.spin_detect = true;
+
+    /* A jump to itself traps after one pass (JMP ind is 5 cycles) */
+    uint64_t ran = cpu6502_run(&cpu, 1000);
+    ASSERT(cpu.trapped && cpu.pc == 0x0600 && ran == 5,
+           "test_run_spin_ignored_trap: trapped=%d PC=%04X ran=%llu expected 1/$0600/5\n",
+           cpu.trapped, cpu.pc, (unsigned long long)ran);
+
+    /* Declined by the owner, it runs out the budget instead of stopping
+     * after every instruction */
+    cpu.spin_ignore = 0x0600;
+    ran = cpu6502_run(&cpu, 1000);
+    ASSERT(!cpu.trapped && ran >= 1000 && ran < 1005,
+           "test_run_spin_ignored_trap: trapped=%d ran=%llu with the loop ignored\n",
+           cpu.trapped, (unsigned long long)ran);
+
+    /* Once PC leaves it, other jumps to self trap as before */
+    bus.ram[0x0300] = 0x10;                           /* -> $0610 */
+    ran = cpu6502_run(&cpu, 1000);
+    ASSERT(cpu.trapped && cpu.pc == 0x0610 && ran == 8,
+           "test_run_spin_ignored_trap: trapped=%d PC=%04X ran=%llu expected 1/$0610/8\n",
+           cpu.trapped, cpu.pc, (unsigned long long)ran);
+    return 0;
+}
+
+/* ================================================================== */
+/*  Addressing modes table and trace formatting                       */
+/* ================================================================== */
+
+int test_opcode_lengths(void)
+{
+    static const struct { uint8_t op; int len; } cases[] = {
+        {0x00, 1}, {0x20, 3}, {0x40, 1}, {0x60, 1}, {0x6C, 3}, {0x4C, 3},
+        {0x0A, 1}, {0xA9, 2}, {0xB1, 2}, {0xA1, 2}, {0x96, 2}, {0xBE, 3},
+        {0xD0, 2}, {0x24, 2}, {0x2C, 3}, {0xEA, 1}, {0x02, 1},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        ASSERT(opcode_length(cases[i].op) == cases[i].len,
+               "test_opcode_lengths: $%02X length %d expected %d\n",
+               cases[i].op, opcode_length(cases[i].op), cases[i].len);
+    }
+    ASSERT(opcode_modes[0x96] == AM_ZPY && opcode_modes[0x6C] == AM_IND &&
+           opcode_modes[0xF0] == AM_REL,
+           "test_opcode_lengths: wrong modes\n");
+    return 0;
+}
+
+int test_trace_format(void)
+{
+    bus_flat_t bus; cpu6502_t cpu;
+    setup_mapped(&bus, &cpu);
+    bus.ram[0xC000] = 0x4C;   /* JMP $C5F5 */
+    bus.ram[0xC001] = 0xF5;
+    bus.ram[0xC002] = 0xC5;
+    cpu.pc = 0xC000;
+    cpu.status = 0x24;
+
+    trace_record_t rec;
+    char line[128];
+    trace_fill(&rec, &cpu);
+    trace_format(&rec, line, sizeof(line));
+    const char *expect =
+        "C000  4C F5 C5  JMP $C5F5                       "
+        "A:00 X:00 Y:00 P:24 SP:FD CYC:7";
+    ASSERT(strcmp(line, expect) == 0, "test_trace_format: got '%s'\n", line);
+
+    bus.ram[0xC000] = 0xD0;   /* BNE -4 */
+    bus.ram[0xC001] = 0xFC;
+    trace_fill(&rec, &cpu);
+    trace_format(&rec, line, sizeof(line));
+    ASSERT(strncmp(line, "C000  D0 FC     BNE $BFFE ", 26) == 0,
+           "test_trace_format: got '%s'\n", line);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * audio.c — SDL audio device fed from a lock-free sample ring
+ *
+ * `head` and `tail` are free-running counters; their difference is the
+ * fill level and masking either gives a ring index. The producer
+ * publishes samples with a release store of head and the callback hands
+ * the space back with a release store of tail, so each side sees the
+ * other's data before the counter that covers it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+
+#define AUDIO_DEVICE_SAMPLES 512   /* callback period: ~11 ms at 48 kHz */
+
+static void audio_callback(void *userdata, Uint8 *stream, int len)
+{
+    audio_t *a = (audio_t *)userdata;
+    int16_t *out = (int16_t *)stream;
+    uint32_t want = (uint32_t)len / sizeof(int16_t);
+
+    uint32_t tail = a->tail;
+    uint32_t avail = __atomic_load_n(&a->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t n = avail < want ? avail : want;
+    for (uint32_t i = 0; i < n; i++)
+        out[i] = a->buf[(tail + i) & a->mask];
+    if (n)
+        a->last = out[n - 1];
+    /* Underrun: hold the last level rather than click to zero */
+    for (uint32_t i = n; i < want; i++)
+        out[i] = a->last;
+    __atomic_store_n(&a->tail, tail + n, __ATOMIC_RELEASE);
+}
+
+bool audio_open(audio_t *a, int rate, uint32_t capacity)
+{
+    memset(a, 0, sizeof(*a));
+
+    uint32_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+    a->buf = calloc(cap, sizeof(int16_t));
+    if (!a->buf) {
+        fprintf(stderr, "audio_open: out of memory\n");
+        return false;
+    }
+    a->mask = cap - 1;
+    a->rate = rate;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        fprintf(stderr, "SDL audio init failed: %s\n", SDL_GetError());
+        free(a->buf);
+        a->buf = NULL;
+        return false;
+    }
+
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(want));
+    want.freq = rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_DEVICE_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = a;
+
+    /* No allowed changes: SDL converts if the hardware differs, so the
+     * ring's rate is always the one asked for */
+    a->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (a->device == 0) {
+        fprintf(stderr, "SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        free(a->buf);
+        a->buf = NULL;
+        return false;
+    }
+    SDL_PauseAudioDevice(a->device, 0);
+    return true;
+}
+
+void audio_close(audio_t *a)
+{
+    if (!a->buf)
+        return;
+    SDL_CloseAudioDevice(a->device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    free(a->buf);
+    a->buf = NULL;
+}
+
+uint32_t audio_write(audio_t *a, const int16_t *samples, uint32_t n)
+{
+    uint32_t head = a->head;
+    uint32_t space = a->mask + 1 - (head - __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE));
+    if (n > space)
+        n = space;
+    for (uint32_t i = 0; i < n; i++)
+        a->buf[(head + i) & a->mask] = samples[i];
+    __atomic_store_n(&a->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+uint32_t audio_queued(const audio_t *a)
+{
+    return a->head - __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+}
+
+double audio_rate_ratio(const audio_t *a, uint32_t target)
+{
+    double error = ((double)target - (double)audio_queued(a)) / target;
+    if (error > 1.0)
+        error = 1.0;
+    else if (error < -1.0)
+        error = -1.0;
+    return 1.0 + AUDIO_MAX_DRIFT * error;
+}
+
+void audio_wait(const audio_t *a, uint32_t target)
+{
+    /* One sleep for the whole excess in the common case; the loop only
+     * repeats if the device consumed less than expected */
+    uint32_t queued;
+    while ((queued = audio_queued(a)) > target) {
+        Uint32 ms = (Uint32)((queued - target) * 1000u / (uint32_t)a->rate);
+        SDL_Delay(ms ? ms : 1);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+
+/* Audio output and the clock that paces emulation.
+ *
+ * Samples pass from the emulation thread to SDL's audio callback through
+ * a lock-free single-producer, single-consumer ring of mono 16-bit
+ * samples. The producer only advances `head` and the callback only
+ * advances `tail`, so neither side ever waits on the other.
+ *
+ * The fill level doubles as the emulation clock: the emulation thread
+ * sleeps while more than a target amount is queued, and stretches or
+ * shrinks what it produces by up to AUDIO_MAX_DRIFT to hold the fill near
+ * the target, so the emulated frame rate follows the sound card's clock
+ * instead of drifting against it. The samples themselves come from the
+ * frontend: the NES APU, or the CHIP-8 beeper. */
+
+#define AUDIO_MAX_DRIFT  0.005   /* largest rate adjustment, +/-0.5% */
+
+typedef struct {
+    int16_t  *buf;
+    uint32_t  mask;      /* capacity - 1; capacity is a power of two */
+    uint32_t  head;      /* samples written; stored by the producer */
+    uint32_t  tail;      /* samples played; stored by the callback */
+    int16_t   last;      /* callback: repeated when the ring runs dry */
+    int       rate;      /* device sample rate */
+    SDL_AudioDeviceID device;
+} audio_t;
+
+/* Open the default output device at `rate` Hz with a ring of at least
+ * `capacity` samples, and start playback. Returns false, with the reason
+ * on stderr, if there is no usable device. */
+bool audio_open(audio_t *a, int rate, uint32_t capacity);
+void audio_close(audio_t *a);
+
+/* Producer: queue up to n samples; returns how many fit */
+uint32_t audio_write(audio_t *a, const int16_t *samples, uint32_t n);
+
+/* Samples queued and not yet played */
+uint32_t audio_queued(const audio_t *a);
+
+/* Output rate ratio that steers the fill level toward `target` samples */
+double audio_rate_ratio(const audio_t *a, uint32_t target);
+
+/* Sleep until no more than `target` samples are queued */
+void audio_wait(const audio_t *a, uint32_t target);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * framebuf.c — triple-buffered frame handoff between two threads
+ *
+ * `shared` holds the index of the slot neither side owns, plus a flag
+ * saying whether it holds a frame the consumer has not seen. The
+ * exchanges are acquire/release so the pixels written before a publish
+ * are visible to the thread that acquires them.
+ */
+
+#include <stdlib.h>
+
+#include "framebuf.h"
+
+#define FRAMEBUF_FRESH 0x04
+#define FRAMEBUF_INDEX 0x03
+
+bool framebuf_init(framebuf_t *fb, size_t bytes)
+{
+    for (int i = 0; i < 3; i++) {
+        fb->slot[i] = calloc(1, bytes);
+        if (!fb->slot[i]) {
+            while (i-- > 0)
+                free(fb->slot[i]);
+            return false;
+        }
+    }
+    fb->back = 0;
+    fb->shared = 1;
+    fb->front = 2;
+    return true;
+}
+
+void framebuf_destroy(framebuf_t *fb)
+{
+    for (int i = 0; i < 3; i++) {
+        free(fb->slot[i]);
+        fb->slot[i] = NULL;
+    }
+}
+
+void *framebuf_back(framebuf_t *fb)
+{
+    return fb->slot[fb->back];
+}
+
+void framebuf_publish(framebuf_t *fb)
+{
+    uint8_t prev = __atomic_exchange_n(&fb->shared, fb->back | FRAMEBUF_FRESH,
+                                       __ATOMIC_ACQ_REL);
+    fb->back = prev & FRAMEBUF_INDEX;
+}
+
+const void *framebuf_acquire(framebuf_t *fb)
+{
+    if (!(__atomic_load_n(&fb->shared, __ATOMIC_RELAXED) & FRAMEBUF_FRESH))
+        return NULL;
+    uint8_t prev = __atomic_exchange_n(&fb->shared, fb->front, __ATOMIC_ACQ_REL);
+    fb->front = prev & FRAMEBUF_INDEX;
+    return fb->slot[fb->front];
+}
+
+bool framebuf_pending(const framebuf_t *fb)
+{
+    return (__atomic_load_n(&fb->shared, __ATOMIC_RELAXED) & FRAMEBUF_FRESH) != 0;
+}
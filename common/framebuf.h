@@ -0,0 +1,43 @@
+#ifndef FRAMEBUF_H
+#define FRAMEBUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Lock-free triple buffer handing finished frames from the emulation
+ * thread to the presentation thread.
+ *
+ * The producer owns one slot and the consumer another; the third is the
+ * latest published frame. Publishing and acquiring each swap a slot with
+ * the shared one in a single atomic exchange, so neither side ever waits:
+ * the producer overwrites frames the consumer has not picked up, and the
+ * consumer simply sees the newest complete one.
+ *
+ * Slots are plain bytes; the CHIP-8 frontend stores display rows in them
+ * and the NES frontend ARGB pixels. */
+
+typedef struct {
+    void    *slot[3];
+    uint8_t  shared;    /* slot index | FRAMEBUF_FRESH; accessed atomically */
+    uint8_t  back;      /* producer's slot */
+    uint8_t  front;     /* consumer's slot */
+} framebuf_t;
+
+/* Allocates three zeroed slots of `bytes` each; returns false if out of
+ * memory */
+bool framebuf_init(framebuf_t *fb, size_t bytes);
+void framebuf_destroy(framebuf_t *fb);
+
+/* Producer: the slot to draw the next frame into, then hand it over */
+void *framebuf_back(framebuf_t *fb);
+void  framebuf_publish(framebuf_t *fb);
+
+/* Consumer: the newest frame if one was published since the last call,
+ * otherwise NULL. The pointer stays valid until the next call. */
+const void *framebuf_acquire(framebuf_t *fb);
+
+/* Consumer: true if framebuf_acquire would return a frame */
+bool framebuf_pending(const framebuf_t *fb);
+
+#endif
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+/* ---------------------------------------------------------------------------
+ * Encoding
+ *
+ *   0x00-0x7F  literal run: (t + 1) bytes follow
+ *   0x80-0xFE  zero run of (t - 0x7F) bytes
+ *   0xFF       zero run, u16 little-endian length follows
+ *
+ * XOR deltas are mostly zeros, so an unchanged 12 KB state encodes in a
+ * handful of bytes.
+ * ------------------------------------------------------------------------- */
+#define MAX_LITERAL   128
+#define MAX_SHORT_RUN 127
+#define MAX_LONG_RUN  65535
+
+static size_t rle_bound(size_t n)
+{
+    return n + n / MAX_LITERAL + 4;
+}
+
+static size_t rle_encode(const uint8_t *src, size_t n, uint8_t *out)
+{
+    size_t i = 0, o = 0;
+
+    while (i < n) {
+        size_t j = i;
+        if (src[i] == 0) {
+            while (j < n && src[j] == 0 && j - i < MAX_LONG_RUN)
+                j++;
+            size_t run = j - i;
+            if (run <= MAX_SHORT_RUN) {
+                out[o++] = (uint8_t)(0x80 + run - 1);
+            } else {
+                out[o++] = 0xFF;
+                out[o++] = (uint8_t)run;
+                out[o++] = (uint8_t)(run >> 8);
+            }
+        } else {
+            /* Single zeros stay in the literal; a pair starts a run */
+            while (j < n && j - i < MAX_LITERAL &&
+                   !(src[j] == 0 && (j + 1 >= n || src[j + 1] == 0)))
+                j++;
+            out[o++] = (uint8_t)(j - i - 1);
+            memcpy(out + o, src + i, j - i);
+            o += j - i;
+        }
+        i = j;
+    }
+    return o;
+}
+
+/* Decode into out (n bytes); if `base` is given, XOR with it on the way */
+static bool rle_decode(const uint8_t *in, size_t len, uint8_t *out, size_t n,
+                       const uint8_t *base)
+{
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        uint8_t t = in[i++];
+        size_t run;
+        if (t < 0x80) {
+            run = (size_t)t + 1;
+            if (run > len - i || run > n - o)
+                return false;
+            for (size_t k = 0; k < run; k++)
+                out[o + k] = base ? in[i + k] ^ base[o + k] : in[i + k];
+            i += run;
+        } else {
+            if (t == 0xFF) {
+                if (len - i < 2)
+                    return false;
+                run = (size_t)in[i] | ((size_t)in[i + 1] << 8);
+                i += 2;
+            } else {
+                run = (size_t)t - 0x7F;
+            }
+            if (run > n - o)
+                return false;
+            if (base)
+                memcpy(out + o, base + o, run);
+            else
+                memset(out + o, 0, run);
+        }
+        o += run;
+    }
+    return o == n;
+}
+
+/* ---------------------------------------------------------------------------
+ * History ring
+ * ------------------------------------------------------------------------- */
+typedef struct {
+    size_t offset;     /* into ring */
+    size_t len;
+    bool   key;
+} entry_t;
+
+struct rewind_t {
+    size_t state_size;
+    int    keyframe_interval;
+
+    uint8_t *ring;
+    size_t   ring_size;
+
+    /* Entries by sequence number; slot = seq % max_entries */
+    entry_t  *entries;
+    uint64_t  max_entries;
+    uint64_t  first_seq;
+    uint64_t  next_seq;
+
+    /* Newest keyframe, decoded: deltas are taken against it */
+    uint8_t  *key;
+    uint64_t  key_seq;
+    bool      have_key;
+
+    uint8_t  *scratch;    /* encoder output */
+    uint8_t  *delta;      /* XOR of state and key */
+};
+
+static entry_t *entry_at(const rewind_t *rw, uint64_t seq)
+{
+    return &rw->entries[seq % rw->max_entries];
+}
+
+rewind_t *rewind_create(size_t state_size, size_t ring_bytes, int keyframe_interval)
+{
+    if (state_size == 0 || keyframe_interval < 1 || rle_bound(state_size) > ring_bytes) {
+        fprintf(stderr, "rewind_create: ring too small for %zu-byte states\n", state_size);
+        return NULL;
+    }
+
+    rewind_t *rw = calloc(1, sizeof(*rw));
+    if (!rw)
+        return NULL;
+
+    rw->state_size = state_size;
+    rw->keyframe_interval = keyframe_interval;
+    rw->ring_size = ring_bytes;
+    /* An unchanged frame encodes in a few bytes; allow one entry per 16 */
+    rw->max_entries = ring_bytes / 16 + 1;
+
+    rw->ring = malloc(ring_bytes);
+    rw->entries = calloc((size_t)rw->max_entries, sizeof(entry_t));
+    rw->key = malloc(state_size);
+    rw->scratch = malloc(rle_bound(state_size));
+    rw->delta = malloc(state_size);
+    if (!rw->ring || !rw->entries || !rw->key || !rw->scratch || !rw->delta) {
+        fprintf(stderr, "rewind_create: out of memory\n");
+        rewind_destroy(rw);
+        return NULL;
+    }
+    return rw;
+}
+
+void rewind_destroy(rewind_t *rw)
+{
+    if (!rw)
+        return;
+    free(rw->ring);
+    free(rw->entries);
+    free(rw->key);
+    free(rw->scratch);
+    free(rw->delta);
+    free(rw);
+}
+
+void rewind_clear(rewind_t *rw)
+{
+    rw->first_seq = rw->next_seq = 0;
+    rw->have_key = false;
+}
+
+int rewind_count(const rewind_t *rw)
+{
+    return (int)(rw->next_seq - rw->first_seq);
+}
+
+size_t rewind_bytes_used(const rewind_t *rw)
+{
+    size_t total = 0;
+    for (uint64_t s = rw->first_seq; s < rw->next_seq; s++)
+        total += entry_at(rw, s)->len;
+    return total;
+}
+
+/* Drop the oldest entry, then any deltas orphaned by it */
+static void evict_oldest(rewind_t *rw)
+{
+    rw->first_seq++;
+    while (rw->first_seq < rw->next_seq && !entry_at(rw, rw->first_seq)->key)
+        rw->first_seq++;
+    if (rw->have_key && rw->key_seq < rw->first_seq)
+        rw->have_key = false;
+}
+
+/* Find room for `len` bytes after the newest entry, evicting as needed */
+static size_t ring_alloc(rewind_t *rw, size_t len)
+{
+    for (;;) {
+        if (rw->next_seq - rw->first_seq >= rw->max_entries) {
+            evict_oldest(rw);
+            continue;
+        }
+        if (rw->first_seq == rw->next_seq)
+            return 0;
+
+        const entry_t *oldest = entry_at(rw, rw->first_seq);
+        const entry_t *newest = entry_at(rw, rw->next_seq - 1);
+        size_t tail = newest->offset + newest->len;
+
+        if (newest->offset >= oldest->offset) {
+            /* Live data is [oldest, tail): free space at the end, then
+             * wrapped around before oldest */
+            if (rw->ring_size - tail >= len)
+                return tail;
+            if (oldest->offset >= len)
+                return 0;
+        } else if (oldest->offset - tail >= len) {
+            return tail;
+        }
+        evict_oldest(rw);
+    }
+}
+
+void rewind_push(rewind_t *rw, const uint8_t *state)
+{
+    bool key = !rw->have_key ||
+               rw->next_seq - rw->key_seq >= (uint64_t)rw->keyframe_interval;
+    size_t len;
+
+    for (;;) {
+        if (key) {
+            len = rle_encode(state, rw->state_size, rw->scratch);
+        } else {
+            for (size_t i = 0; i < rw->state_size; i++)
+                rw->delta[i] = state[i] ^ rw->key[i];
+            len = rle_encode(rw->delta, rw->state_size, rw->scratch);
+        }
+
+        size_t off = ring_alloc(rw, len);
+        if (!key && !rw->have_key) {
+            /* Making room evicted the keyframe this delta refers to */
+            key = true;
+            continue;
+        }
+
+        memcpy(rw->ring + off, rw->scratch, len);
+        entry_t *e = entry_at(rw, rw->next_seq);
+        e->offset = off;
+        e->len = len;
+        e->key = key;
+        if (key) {
+            memcpy(rw->key, state, rw->state_size);
+            rw->key_seq = rw->next_seq;
+            rw->have_key = true;
+        }
+        rw->next_seq++;
+        return;
+    }
+}
+
+bool rewind_pop(rewind_t *rw, uint8_t *state)
+{
+    if (rw->first_seq == rw->next_seq)
+        return false;
+
+    uint64_t seq = rw->next_seq - 1;
+    const entry_t *e = entry_at(rw, seq);
+    bool ok = rle_decode(rw->ring + e->offset, e->len, state, rw->state_size,
+                         e->key ? NULL : rw->key);
+    rw->next_seq--;
+
+    if (e->key) {
+        /* The previous group's keyframe becomes current again */
+        rw->have_key = false;
+        for (uint64_t s = rw->next_seq; s > rw->first_seq; s--) {
+            const entry_t *k = entry_at(rw, s - 1);
+            if (k->key) {
+                rw->have_key = rle_decode(rw->ring + k->offset, k->len, rw->key,
+                                          rw->state_size, NULL);
+                rw->key_seq = s - 1;
+                break;
+            }
+        }
+        if (!rw->have_key)
+            rw->first_seq = rw->next_seq;   /* nothing decodable remains */
+    }
+
+    if (!ok)
+        fprintf(stderr, "rewind_pop: corrupt history entry\n");
+    return ok;
+}
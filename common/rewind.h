@@ -0,0 +1,31 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Rewind history over fixed-size save-state blobs.
+ *
+ * Every `keyframe_interval` pushes a keyframe is stored; the pushes in
+ * between store only their XOR against that keyframe. Both are run-length
+ * encoded (zero runs and literals), so a frame that changed a few hundred
+ * bytes costs a few hundred bytes. Entries live in one preallocated byte
+ * ring; when it is full the oldest keyframe and its deltas are dropped.
+ * Each push is a single pass over the state, whatever the history length. */
+typedef struct rewind_t rewind_t;
+
+rewind_t *rewind_create(size_t state_size, size_t ring_bytes, int keyframe_interval);
+void rewind_destroy(rewind_t *rw);
+
+void rewind_push(rewind_t *rw, const uint8_t *state);
+
+/* Remove the newest entry and reconstruct it into `state`.
+ * Returns false if the history is empty. */
+bool rewind_pop(rewind_t *rw, uint8_t *state);
+
+int    rewind_count(const rewind_t *rw);
+size_t rewind_bytes_used(const rewind_t *rw);
+void   rewind_clear(rewind_t *rw);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+void telemetry_init(telemetry_t *tel, const tel_metric_desc_t *metrics, int count,
+                    uint64_t ticks_per_sec, bool overlay)
+{
+    memset(tel, 0, sizeof(*tel));
+    tel->metrics = metrics;
+    tel->count = count < TELEMETRY_MAX_METRICS ? count : TELEMETRY_MAX_METRICS;
+    tel->ticks_per_sec = ticks_per_sec;
+    tel->overlay = overlay;
+}
+
+/* ---------------------------------------------------------------------------
+ * Histogram
+ *
+ * Bucket b < 2 * SUB holds exactly b us. Above that, values with top bit
+ * `log` fall in SUB buckets from (log - SUB_BITS + 1) * SUB, each
+ * 1 << (log - SUB_BITS) wide.
+ * ------------------------------------------------------------------------- */
+#define SUB_BITS 6
+#define SUB      (1 << SUB_BITS)
+#define MAX_US   ((1u << 26) - 1)
+
+static int bucket_of(uint32_t us)
+{
+    if (us < 2 * SUB)
+        return (int)us;
+    int log = SUB_BITS + 1;
+    while (us >> (log + 1))
+        log++;
+    return (log - SUB_BITS + 1) * SUB + (int)((us >> (log - SUB_BITS)) & (SUB - 1));
+}
+
+/* Largest duration that lands in bucket b */
+static uint32_t bucket_top(int b)
+{
+    if (b < 2 * SUB)
+        return (uint32_t)b;
+    int shift = b / SUB - 1;
+    return ((uint32_t)(SUB + b % SUB + 1) << shift) - 1;
+}
+
+void telemetry_add(telemetry_t *tel, int metric, uint64_t ticks)
+{
+    uint64_t tps = tel->ticks_per_sec;
+    uint64_t us = ticks / tps * 1000000 + ticks % tps * 1000000 / tps;
+    if (us > MAX_US)
+        us = MAX_US;
+
+    /* Single writer: plain read-modify-write, atomic stores for the
+     * overlay on the other thread */
+    tel_hist_t *h = &tel->hist[metric];
+    uint32_t *bucket = &h->buckets[bucket_of((uint32_t)us)];
+    __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->total_us, h->total_us + us, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->last_us, (uint32_t)us, __ATOMIC_RELAXED);
+    if (us > h->max_us)
+        __atomic_store_n(&h->max_us, (uint32_t)us, __ATOMIC_RELAXED);
+}
+
+uint32_t telemetry_percentile(const tel_hist_t *h, double p)
+{
+    uint32_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+    if (count == 0)
+        return 0;
+
+    /* The sample at rank ceil(p * count), counting from 1 */
+    double want = p * count;
+    uint64_t rank = (uint64_t)want;
+    if (rank < want || rank == 0)
+        rank++;
+    uint64_t seen = 0;
+    for (int b = 0; b < TELEMETRY_BUCKETS; b++) {
+        seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            uint32_t top = bucket_top(b);
+            return top < max ? top : max;
+        }
+    }
+    return max;   /* buckets still catching up with count */
+}
+
+/* ---------------------------------------------------------------------------
+ * Report
+ * ------------------------------------------------------------------------- */
+static double ms(uint32_t us)
+{
+    return us / 1000.0;
+}
+
+bool telemetry_write(const telemetry_t *tel, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "telemetry: cannot write '%s'\n", path);
+        return false;
+    }
+
+    size_t len = strlen(path);
+    bool json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+    if (json)
+        fprintf(fp, "{\"budget_ms\": %.3f, \"metrics\": {", ms(TELEMETRY_BUDGET_US));
+    else
+        fprintf(fp, "metric,count,mean_ms,p50_ms,p90_ms,p99_ms,max_ms\n");
+
+    for (int m = 0; m < tel->count; m++) {
+        const tel_hist_t *h = &tel->hist[m];
+        double mean = h->count ? (double)h->total_us / h->count / 1000.0 : 0.0;
+        double p50 = ms(telemetry_percentile(h, 0.50));
+        double p90 = ms(telemetry_percentile(h, 0.90));
+        double p99 = ms(telemetry_percentile(h, 0.99));
+        if (json)
+            fprintf(fp, "%s\n  \"%s\": {\"count\": %u, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+                    "\"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+                    m ? "," : "", tel->metrics[m].name, (unsigned)h->count, mean, p50, p90, p99,
+                    ms(h->max_us));
+        else
+            fprintf(fp, "%s,%u,%.3f,%.3f,%.3f,%.3f,%.3f\n", tel->metrics[m].name, (unsigned)h->count,
+                    mean, p50, p90, p99, ms(h->max_us));
+    }
+    if (json)
+        fprintf(fp, "\n}}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "telemetry: cannot write '%s'\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* ---------------------------------------------------------------------------
+ * Overlay
+ * ------------------------------------------------------------------------- */
+
+/* 3x5 glyphs, one row per byte, bit 2 = left column */
+static const char font_chars[] = "0123456789.ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const uint8_t font[][5] = {
+    {7,5,5,5,7}, {2,6,2,2,7}, {7,1,7,4,7}, {7,1,3,1,7}, {5,5,7,1,1},
+    {7,4,7,1,7}, {7,4,7,5,7}, {7,1,1,2,2}, {7,5,7,5,7}, {7,5,7,1,7},
+    {0,0,0,0,2},
+    {2,5,7,5,5}, {6,5,6,5,6}, {3,4,4,4,3}, {6,5,5,5,6}, {7,4,6,4,7},
+    {7,4,6,4,4}, {3,4,5,5,3}, {5,5,7,5,5}, {7,2,2,2,7}, {1,1,1,5,2},
+    {5,5,6,5,5}, {4,4,4,4,7}, {5,7,7,5,5}, {6,5,5,5,5}, {2,5,5,5,2},
+    {6,5,6,4,4}, {2,5,5,6,3}, {6,5,6,5,5}, {3,4,2,1,6}, {7,2,2,2,2},
+    {5,5,5,5,7}, {5,5,5,5,2}, {5,5,7,7,5}, {5,5,2,5,5}, {5,5,2,2,2},
+    {7,1,2,4,7},
+};
+
+#define CELL_W 4
+#define CELL_H 6
+
+typedef struct {
+    uint32_t *pixels;
+    int pitch, width, height;
+    uint32_t fg;
+} surface_t;
+
+/* Text at cell column `col` (one pixel in from the left edge), pixel
+ * row `y`; clipped to the surface */
+static void draw_text(const surface_t *s, int col, int y, const char *text)
+{
+    for (int x0 = 1 + col * CELL_W; *text; text++, x0 += CELL_W) {
+        const char *c = strchr(font_chars, *text);
+        if (*text == ' ' || !c)
+            continue;
+        const uint8_t *glyph = font[c - font_chars];
+        for (int row = 0; row < 5 && y + row < s->height; row++) {
+            for (int bit = 0; bit < 3 && x0 + bit < s->width; bit++) {
+                if (glyph[row] & (4 >> bit))
+                    s->pixels[(y + row) * s->pitch + x0 + bit] = s->fg;
+            }
+        }
+    }
+}
+
+/* Milliseconds right-aligned in `width` characters, with as many
+ * decimals as fit */
+static void format_ms(char *out, size_t cap, uint32_t us, int width)
+{
+    double v = ms(us);
+    int digits = v < 10 ? 1 : v < 100 ? 2 : v < 1000 ? 3 : 4;
+    int decimals = width - digits - 1;
+    if (decimals < 1)
+        snprintf(out, cap, "%*.0f", width, v);
+    else
+        snprintf(out, cap, "%*.*f", width, decimals, v);
+}
+
+void telemetry_draw(const telemetry_t *tel, uint32_t *pixels, int pitch,
+                    int width, int height, uint32_t fg, uint32_t alpha)
+{
+    surface_t s = { pixels, pitch, width, height, fg };
+
+    /* Wide surfaces get last, p50, p99 and max; narrow ones p99 and max */
+    bool wide = width >= (3 + 4 * 6) * CELL_W;
+    int fields = wide ? 4 : 2;
+    int field_w = wide ? 5 : 4;
+    bool header = (tel->count + 1) * CELL_H <= height;
+
+    int cols = 3 + fields * (field_w + 1);
+    int rows = tel->count + (header ? 1 : 0);
+    int box_w = cols * CELL_W + 1 < width ? cols * CELL_W + 1 : width;
+    int box_h = rows * CELL_H + 1 < height ? rows * CELL_H + 1 : height;
+    for (int y = 0; y < box_h; y++) {
+        uint32_t *line = pixels + y * pitch;
+        for (int x = 0; x < box_w; x++)
+            line[x] = (((line[x] & ~alpha) >> 1) & 0x7F7F7F7F) | alpha;
+    }
+
+    int y = 1;
+    if (header) {
+        draw_text(&s, 0, y, wide ? "MS   LAST   P50   P99   MAX" : "MS   P99  MAX");
+        y += CELL_H;
+    }
+    for (int m = 0; m < tel->count; m++, y += CELL_H) {
+        const tel_hist_t *h = &tel->hist[m];
+        uint32_t values[4] = {
+            __atomic_load_n(&h->last_us, __ATOMIC_RELAXED),
+            telemetry_percentile(h, 0.50),
+            telemetry_percentile(h, 0.99),
+            __atomic_load_n(&h->max_us, __ATOMIC_RELAXED),
+        };
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%s", tel->metrics[m].label);
+        for (int f = 4 - fields; f < 4; f++) {
+            char field[16];
+            format_ms(field, sizeof(field), values[f], field_w);
+            len += snprintf(line + len, sizeof(line) - (size_t)len, " %s", field);
+        }
+        draw_text(&s, 0, y, line);
+    }
+}
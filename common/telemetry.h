@@ -0,0 +1,71 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Frame-time telemetry (-stats, -overlay).
+ *
+ * Each metric is a fixed-size histogram of durations in microseconds:
+ * exact below 128 us, then 64 buckets per power of two, so percentiles
+ * are within about 1.6% and recording never allocates. Every metric has a
+ * single writer, the emulation thread or the SDL thread; the overlay
+ * reads the other thread's metrics with relaxed atomics, which is good
+ * enough for a display. The full report is written after both threads
+ * are done.
+ *
+ * The metrics themselves belong to the frontend, which passes a table of
+ * them to telemetry_init; see platform.h and platform_nes.h. */
+
+#define TELEMETRY_BUCKETS   1344  /* covers up to 2^26 us (67 s) */
+#define TELEMETRY_BUDGET_US 16667 /* one 60 Hz frame */
+
+/* Frontends number their metrics from 0 and describe each one here */
+#define TELEMETRY_MAX_METRICS 8
+
+typedef struct {
+    const char *name;       /* report key */
+    const char *label;      /* overlay label, three characters */
+} tel_metric_desc_t;
+
+typedef struct {
+    uint32_t buckets[TELEMETRY_BUCKETS];
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint64_t total_us;
+} tel_hist_t;
+
+typedef struct {
+    tel_hist_t               hist[TELEMETRY_MAX_METRICS];
+    const tel_metric_desc_t *metrics;
+    int                      count;           /* metrics in use */
+    uint64_t                 ticks_per_sec;   /* clock of telemetry_add's durations */
+    bool                     overlay;         /* draw the overlay over each frame */
+} telemetry_t;
+
+/* `metrics` holds `count` (at most TELEMETRY_MAX_METRICS) entries and must
+ * outlive `tel` */
+void telemetry_init(telemetry_t *tel, const tel_metric_desc_t *metrics, int count,
+                    uint64_t ticks_per_sec, bool overlay);
+
+/* Record one sample of metric number `metric` lasting `ticks` */
+void telemetry_add(telemetry_t *tel, int metric, uint64_t ticks);
+
+/* Duration (us) that a fraction `p` of the samples do not exceed; 0
+ * without samples */
+uint32_t telemetry_percentile(const tel_hist_t *h, double p);
+
+/* Write count, mean, p50, p90, p99 and max of every metric to `path`:
+ * JSON if it ends in ".json", CSV otherwise */
+bool telemetry_write(const telemetry_t *tel, const char *path);
+
+/* Draw a table of the last, p50, p99 and max milliseconds of every
+ * metric in the top-left corner of a `width` x `height` surface of
+ * 32-bit pixels (`pitch` pixels per row), in a 3x5 font over a darkened
+ * background. `fg` is the text colour and `alpha` the pixel format's
+ * alpha bits, which are left opaque. */
+void telemetry_draw(const telemetry_t *tel, uint32_t *pixels, int pitch,
+                    int width, int height, uint32_t fg, uint32_t alpha);
+
+#endif
@@ -0,0 +1,813 @@
+/*
+ * apu.c — 2A03 APU: channels, frame counter and band-limited synthesis
+ *
+ * Each channel's timer is a count of CPU cycles to its next expiry.
+ * apu_run jumps from one expiry (or frame-counter step) to the next and
+ * does the work of that clock; between events nothing is touched. A
+ * channel whose output cannot change at an expiry (length counter out,
+ * volume zero, muted by its sweep) is not an event at all: its timer and
+ * sequencer are advanced arithmetically alongside the others. That keeps
+ * a silent channel with a tiny period, such as the power-on state, from
+ * costing an event every two cycles.
+ *
+ * Whenever the mixed output changes, the difference is added to `blip`
+ * as a band-limited step (a windowed-sinc kernel picked by the fractional
+ * sample position), so square edges do not alias at any output rate.
+ * apu_end_frame integrates the frame's steps into samples with a gentle
+ * DC-removing leak.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+
+/* ---------------------------------------------------------------------------
+ * Tables
+ * ------------------------------------------------------------------------- */
+static const uint8_t length_table[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+/* Pulse duty cycles, one bit per sequencer step */
+static const uint8_t duty_table[4] = { 0x02, 0x06, 0x1E, 0xF9 };
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+};
+
+static const uint16_t noise_periods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const uint16_t dmc_rates[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+/* Frame-counter step positions in CPU cycles; the last entry restarts
+ * the sequence */
+#define FRAME_STEPS 5
+static const uint32_t frame_steps[2][FRAME_STEPS] = {
+    { 7457, 14913, 22371, 29829, 29830 },   /* 4-step */
+    { 7457, 14913, 22371, 37281, 37282 },   /* 5-step */
+};
+#define FRAME_IRQ_STEP 3
+
+/* Band-limited step: 32 sub-sample phases of a 16-tap windowed sinc
+ * (Blackman, cutoff 0.45 of the sample rate). Each phase sums to
+ * BLIP_UNIT, so integrating the buffer recovers the amplitude. */
+#define BLIP_PHASES  32
+#define BLIP_UNIT_BITS 12
+#define BLIP_BASS_SHIFT 9    /* DC leak: about 15 Hz at 48 kHz */
+
+static const int16_t blip_kernel[BLIP_PHASES][APU_BLIP_TAPS] = {
+    {    2,   -14,    45,  -105,   195,  -296,   378,  3687,   377,  -296,   195,  -105,    45,   -14,     2,     0},
+    {    2,   -14,    43,   -99,   178,  -253,   265,  3682,   496,  -339,   212,  -111,    46,   -14,     2,     0},
+    {    2,   -13,    41,   -93,   160,  -210,   157,  3666,   621,  -381,   227,  -116,    47,   -14,     2,     0},
+    {    2,   -13,    39,   -86,   141,  -167,    54,  3642,   748,  -422,   242,  -120,    48,   -14,     2,     0},
+    {    2,   -12,    37,   -78,   122,  -125,   -42,  3607,   879,  -462,   254,  -123,    48,   -13,     2,     0},
+    {    2,   -12,    35,   -71,   103,   -83,  -132,  3562,  1014,  -499,   266,  -125,    47,   -13,     2,     0},
+    {    2,   -11,    32,   -63,    84,   -43,  -215,  3509,  1149,  -534,   276,  -126,    46,   -12,     2,     0},
+    {    2,   -10,    29,   -55,    65,    -4,  -292,  3446,  1289,  -566,   283,  -126,    45,   -11,     1,     0},
+    {    1,    -9,    26,   -47,    47,    33,  -361,  3374,  1430,  -596,   289,  -125,    43,   -10,     1,     0},
+    {    1,    -9,    24,   -39,    29,    68,  -424,  3294,  1571,  -621,   292,  -123,    41,    -9,     1,     0},
+    {    1,    -8,    21,   -31,    11,   101,  -480,  3206,  1714,  -643,   294,  -120,    38,    -8,     0,     0},
+    {    1,    -7,    18,   -23,    -5,   131,  -529,  3110,  1855,  -660,   292,  -116,    35,    -6,     0,     0},
+    {    1,    -6,    15,   -16,   -21,   160,  -571,  3007,  1996,  -673,   288,  -110,    31,    -4,    -1,     0},
+    {    1,    -5,    12,    -8,   -36,   185,  -606,  2897,  2135,  -681,   282,  -103,    27,    -3,    -1,     0},
+    {    1,    -5,     9,    -1,   -50,   208,  -634,  2782,  2271,  -683,   273,   -95,    22,     0,    -2,     0},
+    {    1,    -4,     7,     5,   -63,   229,  -656,  2661,  2404,  -680,   261,   -86,    17,     2,    -2,     0},
+    {    0,    -3,     4,    11,   -75,   246,  -671,  2537,  2535,  -671,   246,   -75,    11,     4,    -3,     0},
+    {    0,    -2,     2,    17,   -86,   261,  -680,  2404,  2661,  -656,   229,   -63,     5,     7,    -4,     1},
+    {    0,    -2,     0,    22,   -95,   273,  -683,  2271,  2782,  -634,   208,   -50,    -1,     9,    -5,     1},
+    {    0,    -1,    -3,    27,  -103,   282,  -681,  2135,  2897,  -606,   185,   -36,    -8,    12,    -5,     1},
+    {    0,    -1,    -4,    31,  -110,   288,  -673,  1996,  3007,  -571,   160,   -21,   -16,    15,    -6,     1},
+    {    0,     0,    -6,    35,  -116,   292,  -660,  1855,  3110,  -529,   131,    -5,   -23,    18,    -7,     1},
+    {    0,     0,    -8,    38,  -120,   294,  -643,  1714,  3206,  -480,   101,    11,   -31,    21,    -8,     1},
+    {    0,     1,    -9,    41,  -123,   292,  -621,  1571,  3294,  -424,    68,    29,   -39,    24,    -9,     1},
+    {    0,     1,   -10,    43,  -125,   289,  -596,  1430,  3374,  -361,    33,    47,   -47,    26,    -9,     1},
+    {    0,     1,   -11,    45,  -126,   283,  -566,  1289,  3446,  -292,    -4,    65,   -55,    29,   -10,     2},
+    {    0,     2,   -12,    46,  -126,   276,  -534,  1149,  3509,  -215,   -43,    84,   -63,    32,   -11,     2},
+    {    0,     2,   -13,    47,  -125,   266,  -499,  1014,  3562,  -132,   -83,   103,   -71,    35,   -12,     2},
+    {    0,     2,   -13,    48,  -123,   254,  -462,   879,  3607,   -42,  -125,   122,   -78,    37,   -12,     2},
+    {    0,     2,   -14,    48,  -120,   242,  -422,   748,  3642,    54,  -167,   141,   -86,    39,   -13,     2},
+    {    0,     2,   -14,    47,  -116,   227,  -381,   621,  3666,   157,  -210,   160,   -93,    41,   -13,     2},
+    {    0,     2,   -14,    46,  -111,   212,  -339,   496,  3682,   265,  -253,   178,   -99,    43,   -14,     2},
+};
+
+/* Output level of the mixer at full scale, before DC removal */
+#define MIX_SCALE 24000
+
+/* ---------------------------------------------------------------------------
+ * Channel outputs and the mixer
+ * ------------------------------------------------------------------------- */
+static int envelope_volume(const apu_envelope_t *env)
+{
+    return env->constant ? env->volume : env->decay;
+}
+
+static int sweep_target(const apu_pulse_t *p, int channel)
+{
+    int change = p->period >> p->sweep_shift;
+    if (p->sweep_negate)
+        return p->period - change - (channel == 0);   /* pulse 1: ones' complement */
+    return p->period + change;
+}
+
+static bool pulse_muted(const apu_pulse_t *p, int channel)
+{
+    return p->period < 8 || sweep_target(p, channel) > 0x7FF;
+}
+
+static bool pulse_active(const apu_pulse_t *p, int channel)
+{
+    return p->length > 0 && !pulse_muted(p, channel) && envelope_volume(&p->env) > 0;
+}
+
+static int pulse_output(const apu_pulse_t *p, int channel)
+{
+    if (!pulse_active(p, channel) || !(duty_table[p->duty] >> p->step & 1))
+        return 0;
+    return envelope_volume(&p->env);
+}
+
+/* The sequencer only moves while both counters are non-zero. Periods
+ * below 2 are ultrasonic and are held rather than stepped. */
+static bool triangle_active(const apu_triangle_t *t)
+{
+    return t->length > 0 && t->linear > 0 && t->period >= 2;
+}
+
+static bool noise_active(const apu_noise_t *n)
+{
+    return n->length > 0 && envelope_volume(&n->env) > 0;
+}
+
+static int noise_output(const apu_noise_t *n)
+{
+    return noise_active(n) && !(n->shift & 1) ? envelope_volume(&n->env) : 0;
+}
+
+static bool dmc_active(const apu_dmc_t *d)
+{
+    return !d->silence || d->buffer_full || d->remaining > 0;
+}
+
+static int mix(const apu_t *apu)
+{
+    int pulse = pulse_output(&apu->pulse[0], 0) + pulse_output(&apu->pulse[1], 1);
+    int tnd = 3 * triangle_table[apu->triangle.step] + 2 * noise_output(&apu->noise)
+            + apu->dmc.level;
+
+    /* The 2A03's non-linear mixer, in its usual rational approximation */
+    int out = 0;
+    if (pulse)
+        out += (int)((int64_t)pulse * 9552 * MIX_SCALE / ((8128 + 100 * pulse) * 100));
+    if (tnd)
+        out += (int)((int64_t)tnd * 16367 * MIX_SCALE / ((24329 + 100 * tnd) * 100));
+    return out;
+}
+
+/* ---------------------------------------------------------------------------
+ * Synthesis
+ * ------------------------------------------------------------------------- */
+static void add_delta(apu_t *apu, uint64_t time, int delta)
+{
+    uint64_t pos = apu->offset + (time - apu->frame_start) * apu->factor;
+    uint64_t index = pos >> 32;
+    if (index >= APU_MAX_SAMPLES)
+        return;
+    const int16_t *k = blip_kernel[(pos >> (32 - 5)) & (BLIP_PHASES - 1)];
+    int32_t *out = &apu->blip[index];
+    for (int i = 0; i < APU_BLIP_TAPS; i++)
+        out[i] += k[i] * delta;
+}
+
+static void update_output(apu_t *apu)
+{
+    int amp = mix(apu);
+    if (amp != apu->amp) {
+        if (apu->sample_rate)
+            add_delta(apu, apu->time, amp - apu->amp);
+        apu->amp = amp;
+    }
+}
+
+bool apu_set_rate(apu_t *apu, uint32_t sample_rate, double ratio)
+{
+    if (sample_rate && !apu->blip) {
+        apu->blip = calloc(APU_MAX_SAMPLES + APU_BLIP_TAPS, sizeof(apu->blip[0]));
+        apu->samples = calloc(APU_MAX_SAMPLES, sizeof(apu->samples[0]));
+        if (!apu->blip || !apu->samples) {
+            apu_free(apu);
+            return false;
+        }
+    }
+    apu->sample_rate = sample_rate;
+    apu->factor = (uint64_t)((double)sample_rate * ratio / APU_CPU_HZ * 4294967296.0);
+    return true;
+}
+
+void apu_end_frame(apu_t *apu)
+{
+    if (!apu->sample_rate) {
+        apu->sample_count = 0;
+        apu->frame_start = apu->time;
+        return;
+    }
+
+    uint64_t end = apu->offset + (apu->time - apu->frame_start) * apu->factor;
+    uint64_t count = end >> 32;
+    if (count > APU_MAX_SAMPLES) {
+        count = APU_MAX_SAMPLES;   /* overlong frame: drop the rest */
+        end = count << 32;
+    }
+
+    int32_t sum = apu->integrator;
+    for (uint64_t i = 0; i < count; i++) {
+        sum += apu->blip[i];
+        int32_t s = sum >> BLIP_UNIT_BITS;
+        sum -= s << (BLIP_UNIT_BITS - BLIP_BASS_SHIFT);
+        apu->samples[i] = (int16_t)(s > 32767 ? 32767 : s < -32768 ? -32768 : s);
+    }
+    apu->integrator = sum;
+    apu->sample_count = (int)count;
+
+    /* Kernel tails that reach past the frame move to the front */
+    memmove(apu->blip, apu->blip + count, APU_BLIP_TAPS * sizeof(apu->blip[0]));
+    memset(apu->blip + APU_BLIP_TAPS, 0, count * sizeof(apu->blip[0]));
+    apu->offset = end & 0xFFFFFFFFu;
+    apu->frame_start = apu->time;
+}
+
+/* ---------------------------------------------------------------------------
+ * Frame counter clocks
+ * ------------------------------------------------------------------------- */
+static void clock_envelope(apu_envelope_t *env)
+{
+    if (env->start) {
+        env->start = false;
+        env->decay = 15;
+        env->divider = env->volume;
+    } else if (env->divider == 0) {
+        env->divider = env->volume;
+        if (env->decay > 0)
+            env->decay--;
+        else if (env->loop)
+            env->decay = 15;
+    } else {
+        env->divider--;
+    }
+}
+
+static void clock_quarter(apu_t *apu)
+{
+    clock_envelope(&apu->pulse[0].env);
+    clock_envelope(&apu->pulse[1].env);
+    clock_envelope(&apu->noise.env);
+
+    apu_triangle_t *t = &apu->triangle;
+    if (t->linear_reload)
+        t->linear = t->linear_load;
+    else if (t->linear > 0)
+        t->linear--;
+    if (!t->control)
+        t->linear_reload = false;
+}
+
+static void clock_half(apu_t *apu)
+{
+    for (int i = 0; i < 2; i++) {
+        apu_pulse_t *p = &apu->pulse[i];
+        if (!p->env.loop && p->length > 0)
+            p->length--;
+
+        if (p->sweep_divider == 0 && p->sweep_enabled && p->sweep_shift > 0 &&
+            !pulse_muted(p, i))
+            p->period = (uint16_t)sweep_target(p, i);
+        if (p->sweep_divider == 0 || p->sweep_reload) {
+            p->sweep_divider = p->sweep_period;
+            p->sweep_reload = false;
+        } else {
+            p->sweep_divider--;
+        }
+    }
+    if (!apu->triangle.control && apu->triangle.length > 0)
+        apu->triangle.length--;
+    if (!apu->noise.env.loop && apu->noise.length > 0)
+        apu->noise.length--;
+}
+
+static void frame_step(apu_t *apu)
+{
+    const uint32_t *steps = frame_steps[apu->five_step];
+    int step = apu->frame_step;
+
+    switch (step) {
+    case 0:
+    case 2:
+        clock_quarter(apu);
+        break;
+    case 1:
+        clock_quarter(apu);
+        clock_half(apu);
+        break;
+    case FRAME_IRQ_STEP:
+        clock_quarter(apu);
+        clock_half(apu);
+        if (!apu->five_step && !apu->irq_inhibit)
+            apu->frame_irq = true;
+        break;
+    default:
+        break;   /* sequence restart */
+    }
+
+    if (step == FRAME_STEPS - 1) {
+        apu->frame_step = 0;
+        apu->frame_timer = steps[0];
+    } else {
+        apu->frame_step = (uint8_t)(step + 1);
+        apu->frame_timer = steps[step + 1] - steps[step];
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * DMC
+ * ------------------------------------------------------------------------- */
+static void dmc_restart(apu_dmc_t *d)
+{
+    d->addr = d->sample_addr;
+    d->remaining = d->sample_length;
+}
+
+static void dmc_fetch(apu_t *apu)
+{
+    apu_dmc_t *d = &apu->dmc;
+    if (d->buffer_full || d->remaining == 0)
+        return;
+
+    d->buffer = apu->read ? apu->read(apu->read_ctx, d->addr) : 0;
+    d->buffer_full = true;
+    d->addr = d->addr == 0xFFFF ? 0x8000 : (uint16_t)(d->addr + 1);
+    if (--d->remaining == 0) {
+        if (d->loop)
+            dmc_restart(d);
+        else if (d->irq_enabled)
+            apu->dmc_irq = true;
+    }
+}
+
+static void dmc_clock(apu_t *apu)
+{
+    apu_dmc_t *d = &apu->dmc;
+    if (!d->silence) {
+        if (d->shift & 1) {
+            if (d->level <= 125)
+                d->level += 2;
+        } else if (d->level >= 2) {
+            d->level -= 2;
+        }
+    }
+    d->shift >>= 1;
+
+    if (--d->bits == 0) {
+        d->bits = 8;
+        d->silence = !d->buffer_full;
+        if (d->buffer_full) {
+            d->shift = d->buffer;
+            d->buffer_full = false;
+            dmc_fetch(apu);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * Timekeeping
+ * ------------------------------------------------------------------------- */
+
+/* Advance a channel timer by dt cycles; returns how many times it
+ * expired. An active channel never gets a dt past its next expiry. */
+static uint32_t advance_timer(uint32_t *timer, uint32_t reload, uint32_t dt)
+{
+    if (dt < *timer) {
+        *timer -= dt;
+        return 0;
+    }
+    dt -= *timer;
+    *timer = reload - dt % reload;
+    return 1 + dt / reload;
+}
+
+static uint32_t pulse_reload(const apu_pulse_t *p)
+{
+    return (p->period + 1u) * 2;   /* clocked every other CPU cycle */
+}
+
+void apu_run(apu_t *apu, uint64_t until)
+{
+    while (apu->time < until) {
+        bool active[5] = {
+            pulse_active(&apu->pulse[0], 0),
+            pulse_active(&apu->pulse[1], 1),
+            triangle_active(&apu->triangle),
+            noise_active(&apu->noise),
+            dmc_active(&apu->dmc),
+        };
+        uint32_t timers[5] = {
+            apu->pulse[0].timer, apu->pulse[1].timer, apu->triangle.timer,
+            apu->noise.timer, apu->dmc.timer,
+        };
+
+        /* Up to the next event that can change anything audible */
+        uint64_t span = until - apu->time;
+        uint32_t dt = span < apu->frame_timer ? (uint32_t)span : apu->frame_timer;
+        for (int c = 0; c < 5; c++) {
+            if (active[c] && timers[c] < dt)
+                dt = timers[c];
+        }
+
+        for (int i = 0; i < 2; i++) {
+            apu_pulse_t *p = &apu->pulse[i];
+            uint32_t n = advance_timer(&p->timer, pulse_reload(p), dt);
+            p->step = (uint8_t)((p->step + n) & 7);
+        }
+
+        apu_triangle_t *t = &apu->triangle;
+        uint32_t n = advance_timer(&t->timer, t->period + 1u, dt);
+        if (active[2])
+            t->step = (uint8_t)((t->step + n) & 31);
+
+        apu_noise_t *ns = &apu->noise;
+        for (n = advance_timer(&ns->timer, ns->period, dt); n > 0; n--) {
+            uint16_t bit = (ns->shift ^ (ns->shift >> (ns->mode ? 6 : 1))) & 1;
+            ns->shift = (uint16_t)((ns->shift >> 1) | (bit << 14));
+        }
+
+        apu_dmc_t *d = &apu->dmc;
+        n = advance_timer(&d->timer, d->rate, dt);
+        if (active[4]) {
+            if (n)
+                dmc_clock(apu);
+        } else {
+            /* Silent and idle: only the bit counter turns over */
+            d->bits = (uint8_t)((d->bits - 1u + 8u - n % 8u) % 8u + 1u);
+        }
+
+        apu->time += dt;
+        apu->frame_timer -= dt;
+        if (apu->frame_timer == 0)
+            frame_step(apu);
+
+        update_output(apu);
+    }
+}
+
+uint32_t apu_cycles_until_irq(const apu_t *apu)
+{
+    uint32_t best = 0;
+
+    if (!apu->five_step && !apu->irq_inhibit && !apu->frame_irq) {
+        const uint32_t *steps = frame_steps[0];
+        uint32_t pos = steps[apu->frame_step] - apu->frame_timer;
+        uint32_t irq = steps[FRAME_IRQ_STEP];
+        best = pos < irq ? irq - pos : irq + (steps[FRAME_STEPS - 1] - pos);
+    }
+
+    const apu_dmc_t *d = &apu->dmc;
+    if (d->irq_enabled && !d->loop && d->remaining > 0 && !apu->dmc_irq) {
+        /* The last byte is fetched when the shift register next
+         * empties, remaining - 1 output cycles from then */
+        uint32_t t = d->timer + (d->bits - 1u) * d->rate + (d->remaining - 1u) * 8u * d->rate;
+        if (!d->buffer_full)
+            t = d->timer;
+        if (best == 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* ---------------------------------------------------------------------------
+ * Registers
+ * ------------------------------------------------------------------------- */
+uint8_t apu_read_status(apu_t *apu)
+{
+    uint8_t status = (uint8_t)((apu->pulse[0].length > 0) |
+                               (apu->pulse[1].length > 0) << 1 |
+                               (apu->triangle.length > 0) << 2 |
+                               (apu->noise.length > 0) << 3 |
+                               (apu->dmc.remaining > 0) << 4 |
+                               apu->frame_irq << 6 |
+                               apu->dmc_irq << 7);
+    apu->frame_irq = false;
+    return status;
+}
+
+static void write_envelope(apu_envelope_t *env, uint8_t val)
+{
+    env->loop = (val & 0x20) != 0;
+    env->constant = (val & 0x10) != 0;
+    env->volume = val & 0x0F;
+}
+
+void apu_write(apu_t *apu, uint16_t addr, uint8_t val)
+{
+    if (addr < 0x4008) {
+        int i = (addr >> 2) & 1;
+        apu_pulse_t *p = &apu->pulse[i];
+        switch (addr & 3) {
+        case 0:
+            p->duty = val >> 6;
+            write_envelope(&p->env, val);
+            break;
+        case 1:
+            p->sweep_enabled = (val & 0x80) != 0;
+            p->sweep_period = (val >> 4) & 0x07;
+            p->sweep_negate = (val & 0x08) != 0;
+            p->sweep_shift = val & 0x07;
+            p->sweep_reload = true;
+            break;
+        case 2:
+            p->period = (uint16_t)((p->period & 0x700) | val);
+            break;
+        default:
+            p->period = (uint16_t)((p->period & 0x0FF) | (val & 0x07) << 8);
+            if (apu->enabled & (1u << i))
+                p->length = length_table[val >> 3];
+            p->step = 0;
+            p->env.start = true;
+            break;
+        }
+    } else if (addr < 0x400C) {
+        apu_triangle_t *t = &apu->triangle;
+        switch (addr & 3) {
+        case 0:
+            t->control = (val & 0x80) != 0;
+            t->linear_load = val & 0x7F;
+            break;
+        case 2:
+            t->period = (uint16_t)((t->period & 0x700) | val);
+            break;
+        case 3:
+            t->period = (uint16_t)((t->period & 0x0FF) | (val & 0x07) << 8);
+            if (apu->enabled & 0x04)
+                t->length = length_table[val >> 3];
+            t->linear_reload = true;
+            break;
+        default:
+            break;
+        }
+    } else if (addr < 0x4010) {
+        apu_noise_t *n = &apu->noise;
+        switch (addr & 3) {
+        case 0:
+            write_envelope(&n->env, val);
+            break;
+        case 2:
+            n->mode = (val & 0x80) != 0;
+            n->period = noise_periods[val & 0x0F];
+            break;
+        case 3:
+            if (apu->enabled & 0x08)
+                n->length = length_table[val >> 3];
+            n->env.start = true;
+            break;
+        default:
+            break;
+        }
+    } else if (addr < 0x4014) {
+        apu_dmc_t *d = &apu->dmc;
+        switch (addr & 3) {
+        case 0:
+            d->irq_enabled = (val & 0x80) != 0;
+            d->loop = (val & 0x40) != 0;
+            d->rate = dmc_rates[val & 0x0F];
+            if (!d->irq_enabled)
+                apu->dmc_irq = false;
+            break;
+        case 1:
+            d->level = val & 0x7F;
+            break;
+        case 2:
+            d->sample_addr = (uint16_t)(0xC000 + val * 64);
+            break;
+        default:
+            d->sample_length = (uint16_t)(val * 16 + 1);
+            break;
+        }
+    } else if (addr == 0x4015) {
+        apu->enabled = val & 0x1F;
+        if (!(val & 0x01)) apu->pulse[0].length = 0;
+        if (!(val & 0x02)) apu->pulse[1].length = 0;
+        if (!(val & 0x04)) apu->triangle.length = 0;
+        if (!(val & 0x08)) apu->noise.length = 0;
+        apu->dmc_irq = false;
+        if (!(val & 0x10)) {
+            apu->dmc.remaining = 0;
+        } else if (apu->dmc.remaining == 0) {
+            dmc_restart(&apu->dmc);
+            dmc_fetch(apu);
+        }
+    } else if (addr == 0x4017) {
+        apu->five_step = (val & 0x80) != 0;
+        apu->irq_inhibit = (val & 0x40) != 0;
+        if (apu->irq_inhibit)
+            apu->frame_irq = false;
+        apu->frame_step = 0;
+        apu->frame_timer = frame_steps[apu->five_step][0];
+        if (apu->five_step) {
+            clock_quarter(apu);
+            clock_half(apu);
+        }
+    }
+
+    update_output(apu);
+}
+
+/* ---------------------------------------------------------------------------
+ * Power-on
+ * ------------------------------------------------------------------------- */
+void apu_init(apu_t *apu, uint8_t (*read)(void *ctx, uint16_t addr), void *ctx)
+{
+    memset(apu, 0, sizeof(*apu));
+    apu->read = read;
+    apu->read_ctx = ctx;
+
+    apu->pulse[0].timer = apu->pulse[1].timer = 2;
+    apu->triangle.timer = 1;
+    apu->noise.shift = 1;
+    apu->noise.period = apu->noise.timer = noise_periods[0];
+    apu->dmc.rate = apu->dmc.timer = dmc_rates[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+    apu->frame_timer = frame_steps[0][0];
+    apu->amp = mix(apu);
+}
+
+void apu_free(apu_t *apu)
+{
+    free(apu->blip);
+    free(apu->samples);
+    apu->blip = NULL;
+    apu->samples = NULL;
+    apu->sample_rate = 0;
+}
+
+/* ---------------------------------------------------------------------------
+ * Save states. The synthesis buffer is not saved; a loaded state starts
+ * a new audio frame at the saved cycle.
+ * ------------------------------------------------------------------------- */
+static void save_envelope(const apu_envelope_t *env, state_writer_t *w)
+{
+    state_put_u8(w, (uint8_t)(env->start | env->loop << 1 | env->constant << 2));
+    state_put_u8(w, env->volume);
+    state_put_u8(w, env->divider);
+    state_put_u8(w, env->decay);
+}
+
+static void load_envelope(apu_envelope_t *env, state_reader_t *r)
+{
+    uint8_t flags = state_get_u8(r);
+    env->start = flags & 1;
+    env->loop = (flags >> 1) & 1;
+    env->constant = (flags >> 2) & 1;
+    env->volume = state_get_u8(r) & 0x0F;
+    env->divider = state_get_u8(r);
+    env->decay = state_get_u8(r);
+}
+
+void apu_save_state(const apu_t *apu, state_writer_t *w)
+{
+    for (int i = 0; i < 2; i++) {
+        const apu_pulse_t *p = &apu->pulse[i];
+        save_envelope(&p->env, w);
+        state_put_u8(w, p->duty);
+        state_put_u8(w, p->step);
+        state_put_u16(w, p->period);
+        state_put_u32(w, p->timer);
+        state_put_u8(w, p->length);
+        state_put_u8(w, (uint8_t)(p->sweep_enabled | p->sweep_negate << 1 | p->sweep_reload << 2));
+        state_put_u8(w, p->sweep_period);
+        state_put_u8(w, p->sweep_shift);
+        state_put_u8(w, p->sweep_divider);
+    }
+
+    const apu_triangle_t *t = &apu->triangle;
+    state_put_u8(w, (uint8_t)(t->control | t->linear_reload << 1));
+    state_put_u8(w, t->linear_load);
+    state_put_u8(w, t->linear);
+    state_put_u8(w, t->length);
+    state_put_u8(w, t->step);
+    state_put_u16(w, t->period);
+    state_put_u32(w, t->timer);
+
+    const apu_noise_t *n = &apu->noise;
+    save_envelope(&n->env, w);
+    state_put_u8(w, n->mode);
+    state_put_u8(w, n->length);
+    state_put_u16(w, n->shift);
+    state_put_u16(w, n->period);
+    state_put_u32(w, n->timer);
+
+    const apu_dmc_t *d = &apu->dmc;
+    state_put_u8(w, (uint8_t)(d->irq_enabled | d->loop << 1 | d->buffer_full << 2 |
+                              d->silence << 3));
+    state_put_u16(w, d->rate);
+    state_put_u8(w, d->level);
+    state_put_u16(w, d->sample_addr);
+    state_put_u16(w, d->sample_length);
+    state_put_u16(w, d->addr);
+    state_put_u16(w, d->remaining);
+    state_put_u8(w, d->buffer);
+    state_put_u8(w, d->shift);
+    state_put_u8(w, d->bits);
+    state_put_u32(w, d->timer);
+
+    state_put_u8(w, apu->enabled);
+    state_put_u8(w, (uint8_t)(apu->five_step | apu->irq_inhibit << 1 | apu->frame_irq << 2 |
+                              apu->dmc_irq << 3));
+    state_put_u8(w, apu->frame_step);
+    state_put_u32(w, apu->frame_timer);
+    state_put_u64(w, apu->time);
+}
+
+/* Lookup tables reject out-of-range values, so a corrupt state cannot
+ * index past them or stall apu_run with a zero timer */
+static uint32_t valid_timer(uint32_t timer)
+{
+    return timer ? timer : 1;
+}
+
+void apu_load_state(apu_t *apu, state_reader_t *r)
+{
+    for (int i = 0; i < 2; i++) {
+        apu_pulse_t *p = &apu->pulse[i];
+        load_envelope(&p->env, r);
+        p->duty = state_get_u8(r) & 3;
+        p->step = state_get_u8(r) & 7;
+        p->period = state_get_u16(r) & 0x7FF;
+        p->timer = valid_timer(state_get_u32(r));
+        p->length = state_get_u8(r);
+        uint8_t flags = state_get_u8(r);
+        p->sweep_enabled = flags & 1;
+        p->sweep_negate = (flags >> 1) & 1;
+        p->sweep_reload = (flags >> 2) & 1;
+        p->sweep_period = state_get_u8(r) & 7;
+        p->sweep_shift = state_get_u8(r) & 7;
+        p->sweep_divider = state_get_u8(r);
+    }
+
+    apu_triangle_t *t = &apu->triangle;
+    uint8_t flags = state_get_u8(r);
+    t->control = flags & 1;
+    t->linear_reload = (flags >> 1) & 1;
+    t->linear_load = state_get_u8(r) & 0x7F;
+    t->linear = state_get_u8(r);
+    t->length = state_get_u8(r);
+    t->step = state_get_u8(r) & 31;
+    t->period = state_get_u16(r) & 0x7FF;
+    t->timer = valid_timer(state_get_u32(r));
+
+    apu_noise_t *n = &apu->noise;
+    load_envelope(&n->env, r);
+    n->mode = state_get_u8(r) & 1;
+    n->length = state_get_u8(r);
+    n->shift = state_get_u16(r) & 0x7FFF;
+    n->period = (uint16_t)valid_timer(state_get_u16(r));
+    n->timer = valid_timer(state_get_u32(r));
+
+    apu_dmc_t *d = &apu->dmc;
+    flags = state_get_u8(r);
+    d->irq_enabled = flags & 1;
+    d->loop = (flags >> 1) & 1;
+    d->buffer_full = (flags >> 2) & 1;
+    d->silence = (flags >> 3) & 1;
+    d->rate = (uint16_t)valid_timer(state_get_u16(r));
+    d->level = state_get_u8(r) & 0x7F;
+    d->sample_addr = state_get_u16(r);
+    d->sample_length = state_get_u16(r);
+    d->addr = state_get_u16(r);
+    d->remaining = state_get_u16(r);
+    d->buffer = state_get_u8(r);
+    d->shift = state_get_u8(r);
+    d->bits = (uint8_t)((state_get_u8(r) - 1u) % 8u + 1u);
+    d->timer = valid_timer(state_get_u32(r));
+
+    apu->enabled = state_get_u8(r) & 0x1F;
+    flags = state_get_u8(r);
+    apu->five_step = flags & 1;
+    apu->irq_inhibit = (flags >> 1) & 1;
+    apu->frame_irq = (flags >> 2) & 1;
+    apu->dmc_irq = (flags >> 3) & 1;
+    apu->frame_step = state_get_u8(r) % FRAME_STEPS;
+    apu->frame_timer = valid_timer(state_get_u32(r));
+    apu->time = state_get_u64(r);
+
+    if (apu->blip)
+        memset(apu->blip, 0, (APU_MAX_SAMPLES + APU_BLIP_TAPS) * sizeof(apu->blip[0]));
+    apu->frame_start = apu->time;
+    apu->offset = 0;
+    apu->amp = mix(apu);
+    apu->sample_count = 0;
+}
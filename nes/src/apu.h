@@ -0,0 +1,152 @@
+#ifndef APU_H
+#define APU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "state.h"
+
+/* 2A03 APU: two pulse channels, triangle, noise and DMC, the frame
+ * counter and its IRQ.
+ *
+ * The APU is not clocked per CPU cycle. apu_run advances it to a CPU
+ * cycle from one channel or frame-counter event to the next, and every
+ * change of the mixed output is recorded as a band-limited step at its
+ * exact cycle. apu_end_frame then turns the frame's steps into samples
+ * in one pass. nes.c runs it to the current cycle before every register
+ * access and at the end of each frame. */
+
+#define APU_CPU_HZ        1789773   /* NTSC CPU clock */
+#define APU_MAX_SAMPLES   4096      /* per frame, enough for 192 kHz */
+#define APU_BLIP_TAPS     16        /* band-limited step width, in samples */
+
+typedef struct {
+    bool     start;
+    bool     loop;           /* also halts the length counter */
+    bool     constant;
+    uint8_t  volume;         /* constant volume, or envelope period */
+    uint8_t  divider;
+    uint8_t  decay;
+} apu_envelope_t;
+
+typedef struct {
+    apu_envelope_t env;
+    uint8_t  duty;
+    uint8_t  step;           /* sequencer position, 0-7 */
+    uint16_t period;         /* 11-bit timer reload */
+    uint32_t timer;          /* CPU cycles until the next sequencer step */
+    uint8_t length;
+    bool    sweep_enabled;
+    bool    sweep_negate;
+    bool    sweep_reload;
+    uint8_t sweep_period;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+} apu_pulse_t;
+
+typedef struct {
+    bool     control;        /* halts length, holds the linear counter */
+    bool     linear_reload;
+    uint8_t  linear_load;
+    uint8_t  linear;
+    uint8_t  length;
+    uint8_t  step;           /* 0-31 */
+    uint16_t period;
+    uint32_t timer;
+} apu_triangle_t;
+
+typedef struct {
+    apu_envelope_t env;
+    bool     mode;           /* short (93-step) sequence */
+    uint8_t  length;
+    uint16_t shift;          /* 15-bit LFSR */
+    uint16_t period;         /* in CPU cycles */
+    uint32_t timer;
+} apu_noise_t;
+
+typedef struct {
+    bool     irq_enabled;
+    bool     loop;
+    uint16_t rate;           /* CPU cycles per output bit */
+    uint8_t  level;          /* 7-bit output */
+    uint16_t sample_addr;    /* $4012 */
+    uint16_t sample_length;  /* $4013 */
+    uint16_t addr;           /* next byte to fetch */
+    uint16_t remaining;      /* bytes left to fetch */
+    uint8_t  buffer;
+    bool     buffer_full;
+    uint8_t  shift;
+    uint8_t  bits;           /* left in the shift register */
+    bool     silence;
+    uint32_t timer;
+} apu_dmc_t;
+
+typedef struct {
+    apu_pulse_t    pulse[2];
+    apu_triangle_t triangle;
+    apu_noise_t    noise;
+    apu_dmc_t      dmc;
+
+    uint8_t  enabled;        /* $4015 channel enables */
+    bool     five_step;      /* $4017 bit 7 */
+    bool     irq_inhibit;    /* $4017 bit 6 */
+    bool     frame_irq;
+    bool     dmc_irq;
+    uint8_t  frame_step;     /* next frame-counter step */
+    uint32_t frame_timer;    /* CPU cycles until it */
+
+    uint64_t time;           /* CPU cycle the APU has been run to */
+
+    /* DMC sample fetches; set by the owner */
+    uint8_t (*read)(void *ctx, uint16_t addr);
+    void    *read_ctx;
+
+    /* Synthesis. sample_rate 0 turns it off (channels still run); the
+     * buffers are allocated by the first apu_set_rate, so machines that
+     * never make sound do not carry them. */
+    uint32_t sample_rate;
+    uint64_t factor;         /* samples per CPU cycle, 32.32 fixed point */
+    uint64_t frame_start;    /* CPU cycle of sample 0 of this frame */
+    uint64_t offset;         /* fractional sample position of frame_start */
+    int      amp;            /* current mixed output */
+    int32_t  integrator;
+    int32_t *blip;           /* APU_MAX_SAMPLES + APU_BLIP_TAPS */
+
+    /* Output of the last apu_end_frame */
+    int16_t *samples;        /* APU_MAX_SAMPLES */
+    int      sample_count;
+} apu_t;
+
+void apu_init(apu_t *apu, uint8_t (*read)(void *ctx, uint16_t addr), void *ctx);
+void apu_free(apu_t *apu);
+
+/* Output sample rate, scaled by `ratio` for dynamic rate control: a
+ * ratio slightly below 1 makes each frame a little shorter in samples.
+ * False, with synthesis left off, if the buffers cannot be allocated. */
+bool apu_set_rate(apu_t *apu, uint32_t sample_rate, double ratio);
+
+/* Advance to CPU cycle `until` */
+void apu_run(apu_t *apu, uint64_t until);
+
+/* Close the audio frame at apu->time: fills samples/sample_count */
+void apu_end_frame(apu_t *apu);
+
+/* $4000-$4017 register access; the caller runs the APU to the access
+ * cycle first */
+uint8_t apu_read_status(apu_t *apu);
+void    apu_write(apu_t *apu, uint16_t addr, uint8_t val);
+
+static inline bool apu_irq(const apu_t *apu)
+{
+    return apu->frame_irq || apu->dmc_irq;
+}
+
+/* CPU cycles from apu->time until the frame counter or DMC raises an
+ * IRQ, or 0 if none is scheduled. May be early, never late. */
+uint32_t apu_cycles_until_irq(const apu_t *apu);
+
+/* apu->time is only meaningful next to the CPU's cycle count, so
+ * nes_load_state checks the two against each other */
+void apu_save_state(const apu_t *apu, state_writer_t *w);
+void apu_load_state(apu_t *apu, state_reader_t *r);
+
+#endif
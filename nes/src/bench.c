@@ -0,0 +1,492 @@
+/*
+ * bench.c — headless NES frame-rate benchmark (no SDL)
+ *
+ *   nes_bench [-w warmup] [-r reps] [-f frames] [-s skip] [-a frames]
+ *             [-k every] [-m movie] [-i index]
+ *             [-e envs [-t threads] [-o argb|gray|half|none]] rom.nes...
+ *
+ * Every ROM is run under two input scripts: "idle" (no buttons, usually
+ * the title screen or attract mode) and "play" (Start, then a fixed
+ * cycle of directions and A/B so gameplay code runs). Each repetition
+ * starts from a freshly loaded machine; loading happens outside the
+ * timed region. The hash of the last frame is reported along with
+ * whether every repetition produced the same one, so a timing change can
+ * be told apart from a behaviour change.
+ *
+ * -s N runs N of every N+1 frames with PPU output suppressed, as headless
+ * runs that never look at the pixels would. The last frame is always
+ * drawn, so its hash still matches a run without skipping.
+ *
+ * -a N runs N frames ahead of every frame from a snapshot and restores
+ * it, as the frontend's -runahead does, drawing only the frame shown; fps
+ * still counts real frames, so the drop is the run-ahead overhead. The
+ * real last frame is drawn as well, so the hash matches a run without
+ * -a exactly when every restore put the machine back.
+ *
+ * -m FILE replaces the scripts with an input movie recorded by the
+ * frontend (nes -record), so real play sessions can be benchmarked and
+ * bisected. It runs for the movie's length and only on the game it was
+ * recorded on, and every frame hash the movie holds is checked: the
+ * first frame that differs is named and the run fails, exit status 1.
+ * -k N adds the hash of every Nth frame to the results; checkpoint
+ * frames are always drawn.
+ *
+ * -e N runs N libnes instances (libnes.h) of each ROM instead of one
+ * machine, all given the same inputs and stepped together by
+ * libnes_step_many on a pool of -t threads, drawing the observation -o
+ * (argb by default). A step is -s + 1 frames holding the buttons of its
+ * first frame, so with -s 0 and argb the hash matches the single-machine
+ * run. fps counts frames summed over all instances, and "envs_agree"
+ * reports whether every instance ended on the same observation (or RAM,
+ * for -o none).
+ *
+ * -i FILE loads ROMs through a ROM index (romdb.h), adding any not yet in
+ * it and saving it on exit, as batch runners over many ROMs would.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+#include "movie.h"
+#include "libnes.h"
+#include "bench.h"
+
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPS   5
+#define DEFAULT_FRAMES 600
+
+typedef uint8_t (*script_fn)(int frame);
+
+static uint8_t script_idle(int frame)
+{
+    (void)frame;
+    return 0;
+}
+
+static uint8_t script_play(int frame)
+{
+    static const uint8_t pattern[8] = {
+        BTN_RIGHT, BTN_RIGHT | BTN_A, BTN_RIGHT | BTN_B, BTN_LEFT,
+        BTN_UP, BTN_DOWN | BTN_B, BTN_A, 0,
+    };
+    if (frame < 60)
+        return 0;
+    if (frame < 65)
+        return BTN_START;
+    if (frame < 120)
+        return 0;
+    return pattern[(frame / 15) % 8];
+}
+
+/* -m: the loaded movie */
+static movie_t movie;
+
+static uint8_t script_movie(int frame)
+{
+    return movie_buttons(&movie, (size_t)frame);
+}
+
+typedef struct {
+    const char *name;
+    script_fn   buttons;
+} script_t;
+
+static const script_t scripts[] = {
+    { "idle", script_idle },
+    { "play", script_play },
+};
+
+static const script_t movie_script = { "movie", script_movie };
+
+/* -k: checkpoint hashes reported per result */
+#define MAX_CHECKPOINTS 256
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] rom.nes...\n"
+        "  -w N   warm-up runs per benchmark (default: %d)\n"
+        "  -r N   measured repetitions (default: %d, max %d)\n"
+        "  -f N   frames per run (default: %d)\n"
+        "  -s N   skip drawing N of every N+1 frames (default: 0)\n"
+        "  -a N   run ahead N frames from a snapshot each frame (default: 0)\n"
+        "  -k N   report the frame hash every N frames (at most %d)\n"
+        "  -m F   replay input movie F instead of the built-in scripts\n"
+        "  -i F   look ROMs up in the ROM index F, creating it if needed\n"
+        "  -e N   run N libnes instances per ROM through a thread pool\n"
+        "  -t N   threads for -e, counting the main one (default: 1)\n"
+        "  -o O   observation for -e: argb, gray, half or none (default: argb)\n",
+        prog, DEFAULT_WARMUP, DEFAULT_REPS, BENCH_MAX_REPS, DEFAULT_FRAMES, MAX_CHECKPOINTS);
+}
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* FNV-1a over the framebuffer, as movies record it */
+static uint32_t frame_hash(const nes_t *nes)
+{
+    return movie_frame_hash(nes->ppu.framebuffer);
+}
+
+/* FNV-1a over an instance's observation, or its RAM if it has none */
+static uint32_t env_hash(const libnes_t *env)
+{
+    int width, height;
+    size_t pitch;
+    const uint8_t *p = libnes_observation(env, &width, &height, &pitch);
+    if (!p)
+        return fnv1a(2166136261u, libnes_ram(env), 2048);
+    (void)width;
+    return fnv1a(2166136261u, p, (size_t)height * pitch);
+}
+
+typedef struct {
+    int frames;
+    int skip;
+    int ahead;
+    int every;    /* checkpoint interval; 0 = last frame only */
+} run_opts_t;
+
+/* One timed run; returns elapsed seconds, or a negative value if the ROM
+ * cannot be loaded. hashes[] receives the checkpoint hashes, the last
+ * frame's last; *count how many. */
+static double run_once(nes_t *nes, nes_t *snap, const char *rom, romdb_t *db,
+                       script_fn buttons, const run_opts_t *o,
+                       uint32_t *hashes, int *count)
+{
+    if (!nes_init_indexed(nes, rom, db))
+        return -1.0;
+    if (buttons == script_movie && nes->cart.checksum != movie.checksum) {
+        fprintf(stderr, "%s: the movie was recorded on a different game\n", rom);
+        nes_free(nes);
+        return -1.0;
+    }
+
+    *count = 0;
+    double hashing = 0.0;   /* kept out of the result */
+    double t0 = bench_now();
+    for (int f = 0; f < o->frames; f++) {
+        bool last = f == o->frames - 1;
+        bool check = last || (o->every > 0 && (f + 1) % o->every == 0 &&
+                              *count < MAX_CHECKPOINTS - 1);
+        uint32_t expect = 0;
+        bool verify = buttons == script_movie && movie_hash_at(&movie, (size_t)f + 1, &expect);
+        bool shown = f % (o->skip + 1) == 0 || last;
+        nes->ppu.skip_output = !check && !verify && (!shown || o->ahead > 0);
+        nes_set_controller(nes, 0, buttons(f));
+        nes_step_frame(nes);
+        if (check || verify) {
+            double h0 = bench_now();
+            uint32_t hash = frame_hash(nes);
+            if (check)
+                hashes[(*count)++] = hash;
+            if (verify && hash != expect) {
+                fprintf(stderr, "%s: frame %d hash %08x, the movie has %08x\n",
+                        rom, f + 1, hash, expect);
+                nes_free(nes);
+                return -1.0;
+            }
+            hashing += bench_now() - h0;
+        }
+        if (o->ahead > 0 && shown) {
+            nes_snapshot(nes, snap);
+            for (int i = 1; i <= o->ahead; i++) {
+                nes->ppu.skip_output = i < o->ahead;
+                nes_step_frame(nes);
+            }
+            nes_restore(nes, snap);
+        }
+    }
+    double elapsed = bench_now() - t0 - hashing;
+
+    nes_free(nes);
+    return elapsed;
+}
+
+/* -e: the instances of one run and what they step with */
+typedef struct {
+    libnes_pool_t *pool;
+    libnes_t     **envs;
+    uint8_t       *actions;
+    int            count;
+    libnes_obs_t   obs;
+} env_set_t;
+
+/* One timed run of every instance; returns elapsed seconds, or a
+ * negative value if they cannot be created or instance 0 misses a movie
+ * hash. *hash is instance 0's last observation and *agree whether all
+ * others ended on the same. Movie hashes are checked with -s 0 and an
+ * argb observation only: longer steps hold one frame's buttons, so they
+ * leave the movie anyway, and other observations hash other pixels. */
+static double run_envs(env_set_t *set, const libnes_rom_t *rom, script_fn buttons,
+                       const run_opts_t *o, uint32_t *hash, bool *agree)
+{
+    int created = 0;
+    while (created < set->count) {
+        set->envs[created] = libnes_create(rom, set->obs);
+        if (!set->envs[created])
+            break;
+        created++;
+    }
+    double elapsed = -1.0;
+    if (created == set->count) {
+        int step = o->skip + 1;
+        bool verify = buttons == script_movie && step == 1 && set->obs == LIBNES_OBS_ARGB;
+        double hashing = 0.0;
+        double t0 = bench_now();
+        for (int f = 0; f < o->frames; f += step) {
+            int n = o->frames - f < step ? o->frames - f : step;
+            memset(set->actions, buttons(f), (size_t)set->count);
+            libnes_step_many(set->pool, set->envs, set->actions, set->count, n);
+            uint32_t expect;
+            if (verify && movie_hash_at(&movie, (size_t)(f + n), &expect)) {
+                double h0 = bench_now();
+                uint32_t got = env_hash(set->envs[0]);
+                hashing += bench_now() - h0;
+                if (got != expect) {
+                    fprintf(stderr, "frame %d hash %08x, the movie has %08x\n",
+                            f + n, got, expect);
+                    break;
+                }
+            }
+            if (f + n == o->frames)
+                elapsed = bench_now() - t0 - hashing;
+        }
+
+        *hash = env_hash(set->envs[0]);
+        *agree = true;
+        for (int i = 1; i < set->count && *agree; i++)
+            *agree = env_hash(set->envs[i]) == *hash;
+    }
+    for (int i = 0; i < created; i++)
+        libnes_destroy(set->envs[i]);
+    return elapsed;
+}
+
+static bool parse_obs(const char *name, libnes_obs_t *obs)
+{
+    static const struct { const char *name; libnes_obs_t obs; } names[] = {
+        { "argb", LIBNES_OBS_ARGB }, { "gray", LIBNES_OBS_GRAY },
+        { "half", LIBNES_OBS_GRAY_HALF }, { "none", LIBNES_OBS_NONE },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i].name) == 0) {
+            *obs = names[i].obs;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    long warmup = DEFAULT_WARMUP, reps = DEFAULT_REPS, frames = DEFAULT_FRAMES, skip = 0;
+    long ahead = 0, every = 0, env_count = 0, threads = 1;
+    const char *index_path = NULL, *movie_path = NULL, *obs_name = "argb";
+    libnes_obs_t obs = LIBNES_OBS_ARGB;
+    int first_rom = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            first_rom = i;
+            break;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-w") == 0) {
+            warmup = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            reps = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            frames = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            skip = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            ahead = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            every = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            movie_path = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            index_path = argv[++i];
+        } else if (strcmp(argv[i], "-e") == 0) {
+            env_count = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            threads = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            obs_name = argv[++i];
+            if (!parse_obs(obs_name, &obs)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (first_rom == argc || warmup < 0 || reps < 1 || reps > BENCH_MAX_REPS ||
+        frames < 1 || skip < 0 || skip >= frames || ahead < 0 || ahead > 60 || every < 0 ||
+        env_count < 0 || env_count > 65536 || threads < 1 || threads > 256) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const script_t *run_scripts = scripts;
+    size_t script_count = sizeof(scripts) / sizeof(scripts[0]);
+    movie_init(&movie, 0, 0);
+    if (movie_path) {
+        if (!movie_load(&movie, movie_path))
+            return 1;
+        if (movie.frames == 0) {
+            fprintf(stderr, "%s: the movie is empty\n", movie_path);
+            movie_free(&movie);
+            return 1;
+        }
+        frames = (long)movie.frames;
+        skip = skip < frames ? skip : frames - 1;
+        run_scripts = &movie_script;
+        script_count = 1;
+    }
+    run_opts_t opts = { (int)frames, (int)skip, (int)ahead, (int)every };
+    if (env_count > 0 && (ahead > 0 || every > 0 || index_path)) {
+        fprintf(stderr, "-e cannot be combined with -a, -k or -i\n");
+        movie_free(&movie);
+        return 1;
+    }
+
+    romdb_t index;
+    romdb_init(&index);
+    if (index_path && !romdb_load(&index, index_path)) {
+        movie_free(&movie);
+        return 1;
+    }
+
+    /* nes_t is large; keep it off the stack */
+    nes_t *nes = malloc(sizeof(nes_t));
+    nes_t *snap = ahead ? malloc(sizeof(nes_t)) : NULL;
+    env_set_t set = { NULL, NULL, NULL, (int)env_count, obs };
+    if (env_count > 0) {
+        set.envs = calloc((size_t)env_count, sizeof(*set.envs));
+        set.actions = malloc((size_t)env_count);
+        set.pool = libnes_pool_create((int)threads);
+    }
+    if (!nes || (ahead && !snap) ||
+        (env_count > 0 && (!set.envs || !set.actions || !set.pool))) {
+        fprintf(stderr, "Out of memory\n");
+        libnes_pool_destroy(set.pool);
+        free(set.envs);
+        free(set.actions);
+        free(snap);
+        free(nes);
+        romdb_free(&index);
+        movie_free(&movie);
+        return 1;
+    }
+
+    printf("{\n  \"suite\": \"nes\",\n  \"warmup\": %ld,\n  \"reps\": %ld,\n"
+           "  \"frames\": %ld,\n  \"skip\": %ld,\n  \"runahead\": %ld,\n",
+           warmup, reps, frames, skip, ahead);
+    if (env_count > 0)
+        printf("  \"envs\": %ld,\n  \"threads\": %ld,\n  \"obs\": \"%s\",\n",
+               env_count, threads, obs_name);
+    printf("  \"results\": [");
+
+    int status = 0;
+    bool first = true;
+    for (int r = first_rom; r < argc; r++) {
+        libnes_rom_t *rom = NULL;
+        if (env_count > 0) {
+            rom = libnes_rom_load(argv[r]);
+            if (!rom || (movie_path && libnes_rom_checksum(rom) != movie.checksum)) {
+                if (rom)
+                    fprintf(stderr, "%s: the movie was recorded on a different game\n", argv[r]);
+                fprintf(stderr, "%s: skipped\n", argv[r]);
+                libnes_rom_free(rom);
+                status = 1;
+                continue;
+            }
+        }
+        for (size_t s = 0; s < script_count; s++) {
+            double fps[BENCH_MAX_REPS];
+            uint32_t hashes[MAX_CHECKPOINTS], rep_hashes[MAX_CHECKPOINTS];
+            int count = 0, rep_count = 0;
+            bool deterministic = true, agree = true;
+            bool ok = true;
+
+            fprintf(stderr, "%s/%s: ", argv[r], run_scripts[s].name);
+            for (long k = 0; k < warmup + reps && ok; k++) {
+                double t;
+                bool rep_agree = true;
+                if (rom) {
+                    t = run_envs(&set, rom, run_scripts[s].buttons, &opts,
+                                 &rep_hashes[0], &rep_agree);
+                    rep_count = 1;
+                } else {
+                    t = run_once(nes, snap, argv[r], index_path ? &index : NULL,
+                                 run_scripts[s].buttons, &opts, rep_hashes, &rep_count);
+                }
+                agree = agree && rep_agree;
+                if (t < 0.0) {
+                    ok = false;
+                    break;
+                }
+                if (k == 0) {
+                    memcpy(hashes, rep_hashes, sizeof(hashes));
+                    count = rep_count;
+                } else if (memcmp(rep_hashes, hashes, (size_t)count * sizeof(hashes[0])) != 0) {
+                    deterministic = false;
+                }
+                if (k >= warmup)
+                    fps[k - warmup] = (double)frames * (double)(env_count ? env_count : 1) / t;
+            }
+            if (!ok) {
+                fprintf(stderr, "skipped\n");
+                status = 1;
+                break;
+            }
+            fprintf(stderr, "%.1f fps\n", bench_summarize(fps, (int)reps).mean);
+
+            printf("%s\n    {\"rom\": ", first ? "" : ",");
+            bench_json_string(stdout, argv[r]);
+            printf(", \"script\": \"%s\", \"frame_hash\": \"%08x\", "
+                   "\"deterministic\": %s,\n     ",
+                   run_scripts[s].name, hashes[count - 1], deterministic ? "true" : "false");
+            if (env_count > 0)
+                printf("\"envs_agree\": %s,\n     ", agree ? "true" : "false");
+            if (every > 0) {
+                printf("\"checkpoints\": [");
+                for (int c = 0; c < count - 1; c++)
+                    printf("%s\"%08x\"", c ? ", " : "", hashes[c]);
+                printf("],\n     ");
+            }
+            bench_json_stats(stdout, "fps", fps, (int)reps);
+            printf("}");
+            first = false;
+        }
+        libnes_rom_free(rom);
+    }
+    printf("\n  ]\n}\n");
+
+    if (index_path && !romdb_save(&index, index_path))
+        status = 1;
+    romdb_free(&index);
+    movie_free(&movie);
+    libnes_pool_destroy(set.pool);
+    free(set.envs);
+    free(set.actions);
+    free(snap);
+    free(nes);
+    return status;
+}
@@ -1,6 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "cartridge.h"
 
@@ -11,11 +16,100 @@
 
 static const uint8_t ines_magic[4] = {0x4E, 0x45, 0x53, 0x1A};
 
-bool cartridge_load(cartridge_t *cart, const char *path)
+static uint32_t fnv1a32(uint32_t h, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Map the whole file read-only. Where that fails (a pipe, or a system
+ * without mmap for this file) it is read onto the heap instead. */
+static bool load_image(cartridge_t *cart, int fd, size_t size)
+{
+    if (size > 0) {
+        void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            cart->image = p;
+            cart->image_size = size;
+            cart->image_mapped = true;
+            return true;
+        }
+    }
+
+    /* Read to end of file; a pipe reports no size up front */
+    size_t cap = size ? size : 65536, got = 0;
+    cart->image = malloc(cap);
+    for (;;) {
+        if (!cart->image) {
+            fprintf(stderr, "cartridge_load: failed to allocate ROM image (%zu bytes)\n", cap);
+            return false;
+        }
+        ssize_t n = read(fd, cart->image + got, cap - got);
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+        if (got == cap) {
+            if (size)
+                break;
+            uint8_t *grown = realloc(cart->image, cap *= 2);
+            if (!grown)
+                free(cart->image);
+            cart->image = grown;
+        }
+    }
+    cart->image_size = got;
+    return true;
+}
+
+/* One 16-byte CHR tile to CHR_TILE_BYTES of pixel indices */
+static void decode_tile(const uint8_t *src, uint8_t *out)
 {
-    uint8_t header[INES_HEADER_SIZE];
-    FILE *fp = NULL;
+    for (int row = 0; row < 8; row++) {
+        uint8_t plane0 = src[row];
+        uint8_t plane1 = src[row + 8];
+        uint8_t *plain = &out[row * 8];
+        uint8_t *flipped = &out[64 + row * 8];
 
+        for (int x = 0; x < 8; x++) {
+            int bit = 7 - x;
+            uint8_t pixel = (uint8_t)(((plane1 >> bit) & 1) << 1 | ((plane0 >> bit) & 1));
+            plain[x] = pixel;
+            flipped[7 - x] = pixel;
+        }
+    }
+}
+
+/* CHR RAM boards get an empty per-cartridge decode table */
+static bool alloc_chr_ram_cache(cartridge_t *cart)
+{
+    cart->chr_decoded = malloc((size_t)CHR_RAM_TILES * CHR_TILE_BYTES);
+    cart->chr_valid = calloc(CHR_RAM_TILES, sizeof(bool));
+    if (!cart->chr_decoded || !cart->chr_valid) {
+        free(cart->chr_decoded);
+        free(cart->chr_valid);
+        cart->chr_decoded = NULL;
+        cart->chr_valid = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Power-on banking */
+static void power_on(cartridge_t *cart)
+{
+    memset(&cart->regs, 0, sizeof(cart->regs));
+    cart->irq_line = false;
+    cartridge_set_mirror(cart, cart->mirror);
+    cart->mapper->reset(cart);
+    cart->mapper->update(cart);
+    cart->dirty = 0;
+}
+
+bool cartridge_load(cartridge_t *cart, const char *path, romdb_t *db)
+{
     if (!cart || !path) {
         fprintf(stderr, "cartridge_load: NULL argument\n");
         return false;
@@ -24,21 +118,34 @@ bool cartridge_load(cartridge_t *cart, const char *path)
     /* Zero out the struct so cleanup is safe on any error path */
     memset(cart, 0, sizeof(*cart));
 
-    fp = fopen(path, "rb");
-    if (!fp) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "cartridge_load: cannot open '%s'\n", path);
         return false;
     }
 
-    /* --- Read and validate the 16-byte iNES header --- */
-    if (fread(header, 1, INES_HEADER_SIZE, fp) != INES_HEADER_SIZE) {
-        fprintf(stderr, "cartridge_load: failed to read iNES header\n");
+    romdb_key_t key;
+    bool ok = romdb_key_fd(fd, &key);
+    if (!ok)
+        fprintf(stderr, "cartridge_load: cannot stat '%s'\n", path);
+    else
+        ok = load_image(cart, fd, (size_t)key.size);
+    close(fd);
+    if (!ok)
         goto fail;
-    }
 
-    if (memcmp(header, ines_magic, 4) != 0) {
-        fprintf(stderr, "cartridge_load: invalid iNES magic bytes\n");
-        goto fail;
+    /* --- Validate the 16-byte iNES header, unless the index has it --- */
+    const romdb_entry_t *entry = db ? romdb_find(db, &key) : NULL;
+    const uint8_t *header = entry ? entry->header : cart->image;
+    if (!entry) {
+        if (cart->image_size < INES_HEADER_SIZE) {
+            fprintf(stderr, "cartridge_load: failed to read iNES header\n");
+            goto fail;
+        }
+        if (memcmp(header, ines_magic, 4) != 0) {
+            fprintf(stderr, "cartridge_load: invalid iNES magic bytes\n");
+            goto fail;
+        }
     }
 
     /* --- Extract fields from the header --- */
@@ -47,7 +154,8 @@ bool cartridge_load(cartridge_t *cart, const char *path)
     cart->mapper_id = (header[7] & 0xF0) | (header[6] >> 4);
     cart->mirror    = (header[6] & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
 
-    if (cart->mapper_id != 0) {
+    cart->mapper = mapper_find(cart->mapper_id);
+    if (!cart->mapper) {
         fprintf(stderr, "Unsupported mapper: %d\n", cart->mapper_id);
         goto fail;
     }
@@ -57,121 +165,238 @@ bool cartridge_load(cartridge_t *cart, const char *path)
         goto fail;
     }
 
-    /* --- Skip trainer if present (512 bytes) --- */
-    if (header[6] & 0x04) {
-        if (fseek(fp, TRAINER_SIZE, SEEK_CUR) != 0) {
-            fprintf(stderr, "cartridge_load: failed to skip trainer\n");
-            goto fail;
-        }
-    }
-
-    /* --- Load PRG ROM --- */
+    /* --- Locate PRG and CHR ROM, past the trainer if present --- */
+    size_t offset = INES_HEADER_SIZE + ((header[6] & 0x04) ? TRAINER_SIZE : 0);
     size_t prg_size = (size_t)cart->prg_banks * PRG_BANK_SIZE;
-    cart->prg_rom = malloc(prg_size);
-    if (!cart->prg_rom) {
-        fprintf(stderr, "cartridge_load: failed to allocate PRG ROM (%zu bytes)\n",
-                prg_size);
-        goto fail;
-    }
-
-    if (fread(cart->prg_rom, 1, prg_size, fp) != prg_size) {
+    size_t chr_size = (size_t)cart->chr_banks * CHR_BANK_SIZE;
+    if (cart->image_size < offset + prg_size) {
         fprintf(stderr, "cartridge_load: failed to read PRG ROM\n");
         goto fail;
     }
+    cart->prg_rom = cart->image + offset;
 
-    /* --- Load CHR ROM or initialize CHR RAM --- */
+    /* CHR banks == 0 means the board has CHR RAM instead */
     if (cart->chr_banks > 0) {
-        size_t chr_size = (size_t)cart->chr_banks * CHR_BANK_SIZE;
-        cart->chr_rom = malloc(chr_size);
-        if (!cart->chr_rom) {
-            fprintf(stderr, "cartridge_load: failed to allocate CHR ROM (%zu bytes)\n",
-                    chr_size);
+        if (cart->image_size < offset + prg_size + chr_size) {
+            fprintf(stderr, "cartridge_load: failed to read CHR ROM\n");
             goto fail;
         }
+        cart->chr_rom = cart->image + offset + prg_size;
+    }
 
-        if (fread(cart->chr_rom, 1, chr_size, fp) != chr_size) {
-            fprintf(stderr, "cartridge_load: failed to read CHR ROM\n");
+    /* CHR ROM is decoded once, up front; CHR RAM as it is drawn */
+    if (cart->chr_banks > 0) {
+        size_t tiles = chr_size / 16;
+        cart->chr_decoded = malloc(tiles * CHR_TILE_BYTES);
+        if (!cart->chr_decoded) {
+            fprintf(stderr, "cartridge_load: out of memory decoding CHR ROM\n");
             goto fail;
         }
+        for (size_t t = 0; t < tiles; t++)
+            decode_tile(cart->chr_rom + t * 16, cart->chr_decoded + t * CHR_TILE_BYTES);
+    } else if (!alloc_chr_ram_cache(cart)) {
+        fprintf(stderr, "cartridge_load: out of memory for the CHR RAM cache\n");
+        goto fail;
+    }
+
+    /* PRG and CHR are contiguous in the file, so one pass covers both */
+    if (entry) {
+        cart->checksum = entry->checksum;
     } else {
-        /* CHR banks == 0 means the board has CHR RAM instead */
-        cart->chr_rom = NULL;
-        memset(cart->chr_ram, 0, sizeof(cart->chr_ram));
+        cart->checksum = fnv1a32(2166136261u, cart->prg_rom, prg_size + chr_size);
+        if (db)
+            romdb_insert(db, &key, header, cart->checksum);
     }
 
-    fclose(fp);
+    cart->has_prg_ram = cart->mapper->has_prg_ram;
+    cart->scanline_counter = cart->mapper->scanline != NULL;
+    power_on(cart);
     return true;
 
 fail:
-    if (fp)
-        fclose(fp);
     cartridge_free(cart);
     return false;
 }
 
+bool cartridge_clone(cartridge_t *cart, const cartridge_t *rom)
+{
+    memcpy(cart, rom, sizeof(*cart));
+    cart->image_borrowed = true;
+    memset(cart->chr_ram, 0, sizeof(cart->chr_ram));
+    memset(cart->prg_ram, 0, sizeof(cart->prg_ram));
+    /* Decoded CHR ROM is shared; CHR RAM tiles follow this cartridge's RAM */
+    if (cart->chr_banks == 0 && !alloc_chr_ram_cache(cart))
+        return false;
+    /* The copied slots point into rom's RAM; rebuild them */
+    power_on(cart);
+    return true;
+}
+
 void cartridge_free(cartridge_t *cart)
 {
     if (!cart)
         return;
 
-    free(cart->prg_rom);
-    cart->prg_rom = NULL;
+    /* Decoded CHR ROM is borrowed along with the image; CHR RAM's is not */
+    if (cart->chr_valid || !cart->image_borrowed)
+        free(cart->chr_decoded);
+    free(cart->chr_valid);
+    cart->chr_decoded = NULL;
+    cart->chr_valid = NULL;
 
-    free(cart->chr_rom);
+    if (cart->image_borrowed)
+        ;   /* the cartridge it was cloned from frees it */
+    else if (cart->image_mapped)
+        munmap(cart->image, cart->image_size);
+    else
+        free(cart->image);
+    cart->image = NULL;
+    cart->image_size = 0;
+    cart->image_mapped = false;
+    cart->image_borrowed = false;
+    cart->prg_rom = NULL;
     cart->chr_rom = NULL;
 }
 
+/* ---------------------------------------------------------------------------
+ * Bank slots
+ * ------------------------------------------------------------------------- */
+void cartridge_set_prg_8k(cartridge_t *cart, int slot, int bank)
+{
+    int count = cart->prg_banks * 2;
+    bank %= count;
+    if (bank < 0)
+        bank += count;
+    uint8_t *mem = cart->prg_rom + (size_t)bank * 0x2000;
+    if (cart->prg_slot[slot] != mem) {
+        cart->prg_slot[slot] = mem;
+        cart->dirty |= CART_DIRTY_PRG;
+    }
+}
+
+void cartridge_set_chr_1k(cartridge_t *cart, int slot, int bank)
+{
+    int count = cart->chr_banks > 0 ? cart->chr_banks * 8 : (int)sizeof(cart->chr_ram) / 0x400;
+    uint8_t *base = cart->chr_banks > 0 ? cart->chr_rom : cart->chr_ram;
+    bank %= count;
+    if (bank < 0)
+        bank += count;
+    cart->chr_slot[slot] = base + (size_t)bank * 0x400;
+    cart->chr_tile[slot] = (uint32_t)bank * 64;
+}
+
+void cartridge_set_mirror(cartridge_t *cart, mirror_mode_t mirror)
+{
+    /* Physical table (0 or 1) for each of the four logical ones */
+    static const uint8_t layout[4][4] = {
+        [MIRROR_HORIZONTAL]  = { 0, 0, 1, 1 },
+        [MIRROR_VERTICAL]    = { 0, 1, 0, 1 },
+        [MIRROR_SINGLE_LOW]  = { 0, 0, 0, 0 },
+        [MIRROR_SINGLE_HIGH] = { 1, 1, 1, 1 },
+    };
+    cart->mirror = mirror;
+    for (int i = 0; i < 4; i++)
+        cart->nt_offset[i] = (uint16_t)(layout[mirror][i] * 0x0400);
+}
+
 /* ---------------------------------------------------------------------------
  * CPU bus read  ($4020-$FFFF mapped through the cartridge)
- * Mapper 0 (NROM) layout:
- *   $6000-$7FFF  PRG RAM  — not present on NROM, return 0
- *   $8000-$BFFF  first 16KB PRG bank
- *   $C000-$FFFF  last 16KB PRG bank (mirrors first if only 1 bank)
+ *   $6000-$7FFF  PRG RAM, on boards that have it
+ *   $8000-$FFFF  four 8KB PRG slots set up by the mapper
  * ------------------------------------------------------------------------- */
 uint8_t cartridge_cpu_read(cartridge_t *cart, uint16_t addr)
 {
-    if (addr >= 0x8000) {
-        if (addr < 0xC000) {
-            /* $8000-$BFFF: first PRG bank */
-            return cart->prg_rom[addr & 0x3FFF];
-        }
-        /* $C000-$FFFF: last PRG bank, mirror if only 1 bank */
-        if (cart->prg_banks == 1)
-            return cart->prg_rom[addr & 0x3FFF];
-        return cart->prg_rom[0x4000 + (addr & 0x3FFF)];
-    }
+    if (addr >= 0x8000)
+        return cart->prg_slot[(addr >> 13) & 3][addr & 0x1FFF];
+    if (addr >= 0x6000 && cart->has_prg_ram)
+        return cart->prg_ram[addr & 0x1FFF];
 
-    /* $6000-$7FFF: PRG RAM — NROM has none */
     /* $4020-$5FFF: expansion area — nothing mapped */
     return 0;
 }
 
 /* ---------------------------------------------------------------------------
- * CPU bus write — Mapper 0 has no writable registers, so this is a no-op.
+ * CPU bus write — PRG RAM, or the mapper's registers at $8000-$FFFF
  * ------------------------------------------------------------------------- */
 void cartridge_cpu_write(cartridge_t *cart, uint16_t addr, uint8_t val)
 {
-    (void)cart;
-    (void)addr;
-    (void)val;
+    if (addr >= 0x8000) {
+        if (cart->mapper->write)
+            cart->mapper->write(cart, addr, val);
+    } else if (addr >= 0x6000 && cart->has_prg_ram) {
+        cart->prg_ram[addr & 0x1FFF] = val;
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * PPU / CHR bus write — only effective when using CHR RAM (chr_banks == 0).
+ * Writes to CHR ROM are silently ignored.
+ *
+ * Decoded tiles are keyed by RAM offset, so a bank mapped into more than
+ * one slot (MMC1 with both 4KB registers equal, MMC3 banks wrapping on 8KB
+ * of RAM) has its tile dropped for every slot that shows it.
+ * ------------------------------------------------------------------------- */
+void cartridge_chr_write(cartridge_t *cart, uint16_t addr, uint8_t val)
+{
+    if (cart->chr_banks == 0) {
+        int slot = (addr >> 10) & 7;
+        cart->chr_slot[slot][addr & 0x03FF] = val;
+        cart->chr_valid[cart->chr_tile[slot] + ((addr >> 4) & 0x3F)] = false;
+    }
 }
 
 /* ---------------------------------------------------------------------------
- * PPU / CHR bus read  ($0000-$1FFF)
+ * Mapper scanline counter and IRQ
  * ------------------------------------------------------------------------- */
-uint8_t cartridge_chr_read(cartridge_t *cart, uint16_t addr)
+void cartridge_scanline(cartridge_t *cart)
 {
-    if (cart->chr_banks > 0)
-        return cart->chr_rom[addr & 0x1FFF];
-    return cart->chr_ram[addr & 0x1FFF];
+    if (cart->mapper->scanline)
+        cart->mapper->scanline(cart);
+}
+
+int cartridge_irq_clocks(const cartridge_t *cart)
+{
+    return cart->mapper->irq_clocks ? cart->mapper->irq_clocks(cart) : 0;
 }
 
 /* ---------------------------------------------------------------------------
- * PPU / CHR bus write — only effective when using CHR RAM (chr_banks == 0).
- * Writes to CHR ROM are silently ignored.
+ * Decoded CHR cache
  * ------------------------------------------------------------------------- */
-void cartridge_chr_write(cartridge_t *cart, uint16_t addr, uint8_t val)
+void cartridge_chr_decode_tile(cartridge_t *cart, unsigned tile)
 {
+    decode_tile(cart->chr_ram + tile * 16, cart->chr_decoded + tile * CHR_TILE_BYTES);
+    cart->chr_valid[tile] = true;
+}
+
+void cartridge_chr_invalidate(cartridge_t *cart)
+{
+    if (cart->chr_valid)
+        memset(cart->chr_valid, 0, CHR_RAM_TILES * sizeof(bool));
+}
+
+/* ---------------------------------------------------------------------------
+ * Save states
+ * ------------------------------------------------------------------------- */
+void cartridge_save_state(const cartridge_t *cart, state_writer_t *w)
+{
+    state_put(w, cart->regs.raw, sizeof(cart->regs.raw));
+    state_put_u8(w, cart->irq_line);
+    if (cart->chr_banks == 0)
+        state_put(w, cart->chr_ram, sizeof(cart->chr_ram));
+    if (cart->has_prg_ram)
+        state_put(w, cart->prg_ram, sizeof(cart->prg_ram));
+}
+
+void cartridge_load_state(cartridge_t *cart, state_reader_t *r)
+{
+    state_get(r, cart->regs.raw, sizeof(cart->regs.raw));
+    cart->irq_line = state_get_u8(r) != 0;
     if (cart->chr_banks == 0)
-        cart->chr_ram[addr & 0x1FFF] = val;
+        state_get(r, cart->chr_ram, sizeof(cart->chr_ram));
+    if (cart->has_prg_ram)
+        state_get(r, cart->prg_ram, sizeof(cart->prg_ram));
+
+    cart->mapper->update(cart);
+    cartridge_chr_invalidate(cart);
+    cart->dirty |= CART_DIRTY_PRG;
 }
@@ -3,29 +3,172 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "state.h"
+#include "romdb.h"
 
 typedef enum {
     MIRROR_HORIZONTAL,
-    MIRROR_VERTICAL
+    MIRROR_VERTICAL,
+    MIRROR_SINGLE_LOW,    /* all four tables on physical NT 0 */
+    MIRROR_SINGLE_HIGH    /* all four tables on physical NT 1 */
 } mirror_mode_t;
 
+/* CHR patterns decoded to one 2-bit pixel index per byte (leftmost pixel
+ * first), plus the horizontally mirrored rows for sprites: CHR_TILE_BYTES
+ * per 16-byte tile, indexed by the tile's place in CHR ROM or RAM rather
+ * than by PPU address, so bank switches cost nothing and a bank seen
+ * through two slots is one set of tiles.
+ *
+ * CHR ROM is decoded whole at load time and never changes, so clones
+ * share the table read-only. CHR RAM has a table per cartridge, decoded
+ * on first use; writes clear the tile's valid flag, and state loads and
+ * snapshot restores drop them all (cartridge_chr_invalidate). */
+#define CHR_TILE_BYTES 128   /* 8 rows of 8 pixels, then the same mirrored */
+#define CHR_RAM_TILES  512
+/* Mapper registers. Every member is a byte so the union can be saved
+ * as raw bytes in save states. */
+typedef union {
+    uint8_t bank;            /* UxROM PRG bank, CNROM CHR bank */
+    struct {
+        uint8_t shift;       /* serial load register */
+        uint8_t count;       /* bits shifted in so far */
+        uint8_t control;
+        uint8_t chr0;
+        uint8_t chr1;
+        uint8_t prg;
+    } mmc1;
+    struct {
+        uint8_t select;      /* $8000: target register and bank modes */
+        uint8_t r[8];        /* $8001: R0-R7 */
+        uint8_t mirror;      /* $A000 */
+        uint8_t irq_latch;   /* $C000 */
+        uint8_t irq_counter;
+        uint8_t irq_reload;  /* $C001 written; reload on the next clock */
+        uint8_t irq_enabled; /* $E001 / $E000 */
+    } mmc3;
+    uint8_t raw[16];
+} mapper_regs_t;
+
+/* cartridge_t.dirty bits, set by mapper writes for nes.c to act on */
+#define CART_DIRTY_PRG 0x01   /* prg_slot changed: refresh the CPU page table */
+#define CART_DIRTY_IRQ 0x02   /* IRQ timing changed: end the CPU batch */
+
+typedef struct mapper_t mapper_t;
+
 typedef struct {
+    /* The ROM file is mapped read-only, so PRG/CHR ROM are shared between
+     * every process running the same game; prg_rom and chr_rom point into
+     * the image. Where mmap is unavailable the file is read onto the heap
+     * instead. */
+    uint8_t *image;
+    size_t   image_size;
+    bool     image_mapped;
+    bool     image_borrowed;   /* cartridge_clone: another cartridge_t owns it */
     uint8_t *prg_rom;
     uint8_t *chr_rom;
     uint8_t  chr_ram[8192];
+    uint8_t  prg_ram[8192];  /* $6000-$7FFF, if has_prg_ram */
     uint8_t  prg_banks;      /* number of 16KB PRG banks */
     uint8_t  chr_banks;      /* number of 8KB CHR banks (0 = use chr_ram) */
     uint8_t  mapper_id;
     mirror_mode_t mirror;
+    uint32_t checksum;       /* FNV-1a over PRG + CHR ROM, identifies the game */
+
+    /* Banking as the buses currently see it. The mapper rebuilds these
+     * when one of its registers changes, so reads are a table lookup
+     * whatever the mapper. */
+    const mapper_t *mapper;
+    mapper_regs_t regs;
+    uint8_t *prg_slot[4];    /* 8KB CPU windows at $8000/$A000/$C000/$E000 */
+    uint8_t *chr_slot[8];    /* 1KB PPU windows at $0000-$1FFF */
+    uint32_t chr_tile[8];    /* first chr_decoded tile of each slot */
+    uint16_t nt_offset[4];   /* nametable RAM offset of $2000/$2400/$2800/$2C00 */
+    bool     has_prg_ram;
+    bool     scanline_counter;   /* mapper is clocked by cartridge_scanline */
+    bool     irq_line;       /* mapper IRQ output, level-triggered */
+    uint8_t  dirty;          /* CART_DIRTY_* */
+
+    uint8_t *chr_decoded;    /* CHR_TILE_BYTES per tile; shared by clones for CHR ROM */
+    bool    *chr_valid;      /* CHR RAM: tiles decoded since their last write; NULL for ROM */
 } cartridge_t;
 
-bool cartridge_load(cartridge_t *cart, const char *path);
+/* One mapper implementation (mapper.c). `update` rebuilds the slots and
+ * mirroring from `regs`; it runs after reset, after register writes and
+ * after a state load. */
+struct mapper_t {
+    uint8_t     id;
+    const char *name;
+    bool        has_prg_ram;
+    void (*reset)(cartridge_t *cart);
+    void (*update)(cartridge_t *cart);
+    void (*write)(cartridge_t *cart, uint16_t addr, uint8_t val);   /* $8000-$FFFF, or NULL */
+    void (*scanline)(cartridge_t *cart);                            /* or NULL */
+    int  (*irq_clocks)(const cartridge_t *cart);                    /* or NULL */
+};
+
+/* Mapper for an iNES mapper number, or NULL if unsupported */
+const mapper_t *mapper_find(uint8_t id);
+
+/* Bank helpers for mapper implementations. Bank numbers wrap at the
+ * ROM size. */
+void    cartridge_set_prg_8k(cartridge_t *cart, int slot, int bank);
+void    cartridge_set_chr_1k(cartridge_t *cart, int slot, int bank);
+void    cartridge_set_mirror(cartridge_t *cart, mirror_mode_t mirror);
+
+/* Load an iNES file. With an index, a file seen before skips the header
+ * parse and the checksum pass, and a new one is added to the index. */
+bool cartridge_load(cartridge_t *cart, const char *path, romdb_t *db);
 void cartridge_free(cartridge_t *cart);
 
+/* A freshly powered-on cartridge sharing rom's image and decoded CHR ROM,
+ * e.g. for many machines running one game. rom must outlive it and is
+ * not modified; it is best left unused itself, as a template. False if
+ * a CHR RAM board's decode table cannot be allocated. */
+bool cartridge_clone(cartridge_t *cart, const cartridge_t *rom);
+
 uint8_t cartridge_cpu_read(cartridge_t *cart, uint16_t addr);
 void    cartridge_cpu_write(cartridge_t *cart, uint16_t addr, uint8_t val);
 
-uint8_t cartridge_chr_read(cartridge_t *cart, uint16_t addr);
+static inline uint8_t cartridge_chr_read(const cartridge_t *cart, uint16_t addr)
+{
+    return cart->chr_slot[(addr >> 10) & 7][addr & 0x03FF];
+}
 void    cartridge_chr_write(cartridge_t *cart, uint16_t addr, uint8_t val);
 
+/* Nametable RAM index for PPU address $2000-$2FFF under the current
+ * mirroring */
+static inline uint16_t cartridge_nt_index(const cartridge_t *cart, uint16_t addr)
+{
+    return cart->nt_offset[(addr >> 10) & 3] + (addr & 0x03FF);
+}
+
+/* Scanline clock from the PPU (dot 260 of each rendered line) */
+void    cartridge_scanline(cartridge_t *cart);
+
+/* Scanline clocks until the mapper raises its IRQ, or 0 if it will not
+ * without a register write */
+int     cartridge_irq_clocks(const cartridge_t *cart);
+
+/* Decode one CHR RAM tile (miss path of cartridge_chr_row) */
+void    cartridge_chr_decode_tile(cartridge_t *cart, unsigned tile);
+
+/* Decoded pattern row containing `addr` ($0000-$1FFF, plane 0 address):
+ * 8 pixel indices, mirrored if `flip` */
+static inline const uint8_t *cartridge_chr_row(cartridge_t *cart, uint16_t addr, bool flip)
+{
+    unsigned tile = cart->chr_tile[(addr >> 10) & 7] + ((addr >> 4) & 0x3F);
+    if (cart->chr_valid && !cart->chr_valid[tile])
+        cartridge_chr_decode_tile(cart, tile);
+    return cart->chr_decoded + tile * CHR_TILE_BYTES + flip * 64 + (addr & 0x07) * 8;
+}
+
+/* Drop every decoded CHR RAM tile, after chr_ram changed behind
+ * cartridge_chr_write's back */
+void    cartridge_chr_invalidate(cartridge_t *cart);
+
+/* Save states: mapper registers and writable cartridge memory (CHR and
+ * PRG RAM). Loading rebuilds the banking and sets CART_DIRTY_PRG. */
+void    cartridge_save_state(const cartridge_t *cart, state_writer_t *w);
+void    cartridge_load_state(cartridge_t *cart, state_reader_t *r);
+
 #endif
@@ -0,0 +1,380 @@
+/*
+ * libnes.c — instances sharing one cartridge, and a work-stealing pool
+ *
+ * Each thread of the pool owns a range of instance indices, packed as
+ * next (low 32 bits) and end (high 32 bits) in one word. The owner takes
+ * from the front by bumping next; a thief whose own range is empty takes
+ * the back half of another's by lowering end, and installs it as its own.
+ * Both are compare-and-swap on the whole word, so an index is handed out
+ * exactly once. Every index belongs to one range at a time, so a stale
+ * value can never match again within a batch.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libnes.h"
+#include "nes.h"
+
+#define CACHE_LINE 64
+
+struct libnes_rom {
+    cartridge_t cart;   /* never run: the template instances are cloned from,
+                           sharing its image and decoded CHR ROM */
+};
+
+struct libnes {
+    nes_t        nes;
+    const libnes_rom_t *rom;
+    libnes_obs_t obs;
+    int          width, height;
+    size_t       pitch;
+    uint8_t     *pixels;   /* follows the struct in the same allocation */
+};
+
+libnes_rom_t *libnes_rom_load(const char *path)
+{
+    libnes_rom_t *rom = malloc(sizeof(*rom));
+    if (!rom) {
+        fprintf(stderr, "libnes_rom_load: out of memory\n");
+        return NULL;
+    }
+    if (!cartridge_load(&rom->cart, path, NULL)) {
+        free(rom);
+        return NULL;
+    }
+    return rom;
+}
+
+void libnes_rom_free(libnes_rom_t *rom)
+{
+    if (!rom)
+        return;
+    cartridge_free(&rom->cart);
+    free(rom);
+}
+
+uint32_t libnes_rom_checksum(const libnes_rom_t *rom)
+{
+    return rom->cart.checksum;
+}
+
+/* Point the PPU at the observation; nes_init_shared clears it */
+static void attach_output(libnes_t *env)
+{
+    ppu_t *ppu = &env->nes.ppu;
+    switch (env->obs) {
+    case LIBNES_OBS_NONE:
+        break;
+    case LIBNES_OBS_ARGB:
+        ppu_set_output(ppu, (uint32_t *)env->pixels, NES_WIDTH);
+        break;
+    case LIBNES_OBS_GRAY:
+    case LIBNES_OBS_GRAY_HALF:
+        ppu_set_gray_output(ppu, env->pixels, (int)env->pitch,
+                            env->obs == LIBNES_OBS_GRAY_HALF);
+        break;
+    }
+}
+
+libnes_t *libnes_create(const libnes_rom_t *rom, libnes_obs_t obs)
+{
+    int width = NES_WIDTH, height = NES_HEIGHT;
+    size_t bpp = 1;
+    if (obs == LIBNES_OBS_ARGB)
+        bpp = sizeof(uint32_t);
+    else if (obs == LIBNES_OBS_GRAY_HALF)
+        width /= 2, height /= 2;
+    else if (obs == LIBNES_OBS_NONE)
+        width = height = 0;
+
+    /* sizeof(libnes_t) is a multiple of nes_t's alignment, which covers
+     * the pixels' */
+    size_t pixel_bytes = (size_t)width * (size_t)height * bpp;
+    libnes_t *env = calloc(1, sizeof(*env) + pixel_bytes);
+    if (!env) {
+        fprintf(stderr, "libnes_create: out of memory\n");
+        return NULL;
+    }
+    env->obs = obs;
+    env->width = width;
+    env->height = height;
+    env->pitch = (size_t)width * bpp;
+    env->pixels = pixel_bytes ? (uint8_t *)(env + 1) : NULL;
+    env->rom = rom;
+
+    if (!nes_init_shared(&env->nes, &rom->cart)) {
+        free(env);
+        return NULL;
+    }
+    attach_output(env);
+    return env;
+}
+
+void libnes_destroy(libnes_t *env)
+{
+    if (!env)
+        return;
+    nes_free(&env->nes);
+    free(env);
+}
+
+bool libnes_reset(libnes_t *env)
+{
+    nes_free(&env->nes);
+    if (!nes_init_shared(&env->nes, &env->rom->cart))
+        return false;
+    attach_output(env);
+    return true;
+}
+
+void libnes_step(libnes_t *env, uint8_t buttons, int frames)
+{
+    nes_t *nes = &env->nes;
+    nes_set_controller(nes, 0, buttons);
+    for (int f = 1; f <= frames; f++) {
+        nes->ppu.skip_output = f < frames;
+        nes_step_frame(nes);
+    }
+}
+
+const void *libnes_observation(const libnes_t *env, int *width, int *height,
+                               size_t *pitch)
+{
+    if (width)
+        *width = env->width;
+    if (height)
+        *height = env->height;
+    if (pitch)
+        *pitch = env->pitch;
+    return env->pixels;
+}
+
+const uint8_t *libnes_ram(const libnes_t *env)
+{
+    return env->nes.ram;
+}
+
+size_t libnes_state_size(const libnes_t *env)
+{
+    return nes_state_size(&env->nes);
+}
+
+size_t libnes_save_state(const libnes_t *env, uint8_t *buf, size_t cap)
+{
+    return nes_save_state(&env->nes, buf, cap);
+}
+
+bool libnes_load_state(libnes_t *env, const uint8_t *buf, size_t len)
+{
+    return nes_load_state(&env->nes, buf, len);
+}
+
+/* ---------------------------------------------------------------------------
+ * Thread pool
+ * ------------------------------------------------------------------------- */
+typedef struct {
+    uint64_t range;   /* next | end << 32; accessed atomically */
+    char     pad[CACHE_LINE - sizeof(uint64_t)];
+} share_t;
+
+typedef struct {
+    libnes_pool_t *pool;
+    int            self;
+} worker_t;
+
+struct libnes_pool {
+    int        threads;
+    share_t   *shares;      /* one per thread; the caller is 0 */
+    pthread_t *workers;     /* threads - 1 */
+    worker_t  *worker_args;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  start;  /* a batch was posted, or quit */
+    pthread_cond_t  done;   /* the last worker finished its part */
+    uint64_t        batch;  /* batches posted so far */
+    int             busy;   /* workers still in the current batch */
+    bool            quit;
+
+    /* The current batch */
+    libnes_t *const *envs;
+    const uint8_t   *actions;
+    int              frames;
+};
+
+static inline uint64_t pack_range(uint32_t next, uint32_t end)
+{
+    return (uint64_t)end << 32 | next;
+}
+
+/* Take the next index of one's own share */
+static bool take(share_t *s, uint32_t *index)
+{
+    uint64_t old = __atomic_load_n(&s->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)old, end = (uint32_t)(old >> 32);
+        if (next >= end)
+            return false;
+        if (__atomic_compare_exchange_n(&s->range, &old, pack_range(next + 1, end), true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *index = next;
+            return true;
+        }
+    }
+}
+
+/* Move the back half of victim's share (all of it if one is left) into
+ * one's own, which is empty */
+static bool steal(share_t *victim, share_t *mine)
+{
+    uint64_t old = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)old, end = (uint32_t)(old >> 32);
+        if (next >= end)
+            return false;
+        uint32_t mid = next + (end - next) / 2;
+        if (__atomic_compare_exchange_n(&victim->range, &old, pack_range(next, mid), true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&mine->range, pack_range(mid, end), __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+static void run_share(libnes_pool_t *pool, int self)
+{
+    share_t *mine = &pool->shares[self];
+    for (;;) {
+        uint32_t i;
+        while (take(mine, &i))
+            libnes_step(pool->envs[i], pool->actions[i], pool->frames);
+
+        bool stole = false;
+        for (int k = 1; k < pool->threads && !stole; k++)
+            stole = steal(&pool->shares[(self + k) % pool->threads], mine);
+        if (!stole)
+            return;
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    libnes_pool_t *pool = w->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->batch == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_share(pool, w->self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+libnes_pool_t *libnes_pool_create(int threads)
+{
+    if (threads < 1) {
+        fprintf(stderr, "libnes_pool_create: need at least one thread\n");
+        return NULL;
+    }
+    libnes_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        fprintf(stderr, "libnes_pool_create: out of memory\n");
+        return NULL;
+    }
+    pool->threads = threads;
+    pool->shares = calloc((size_t)threads, sizeof(share_t));
+    pool->workers = calloc((size_t)threads, sizeof(pthread_t));
+    pool->worker_args = calloc((size_t)threads, sizeof(worker_t));
+    if (!pool->shares || !pool->workers || !pool->worker_args) {
+        fprintf(stderr, "libnes_pool_create: out of memory\n");
+        free(pool->shares);
+        free(pool->workers);
+        free(pool->worker_args);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int t = 1; t < threads; t++) {
+        pool->worker_args[t].pool = pool;
+        pool->worker_args[t].self = t;
+        if (pthread_create(&pool->workers[t], NULL, worker_main, &pool->worker_args[t]) != 0) {
+            fprintf(stderr, "libnes_pool_create: cannot start thread %d\n", t);
+            pool->threads = t;   /* the ones running so far */
+            libnes_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void libnes_pool_destroy(libnes_pool_t *pool)
+{
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 1; t < pool->threads; t++)
+        pthread_join(pool->workers[t], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->shares);
+    free(pool->workers);
+    free(pool->worker_args);
+    free(pool);
+}
+
+void libnes_step_many(libnes_pool_t *pool, libnes_t *const envs[],
+                      const uint8_t actions[], int n, int frames)
+{
+    if (!pool || pool->threads == 1 || n < 2) {
+        for (int i = 0; i < n; i++)
+            libnes_step(envs[i], actions[i], frames);
+        return;
+    }
+
+    int threads = pool->threads;
+    for (int t = 0; t < threads; t++) {
+        uint32_t begin = (uint32_t)((int64_t)n * t / threads);
+        uint32_t end = (uint32_t)((int64_t)n * (t + 1) / threads);
+        __atomic_store_n(&pool->shares[t].range, pack_range(begin, end), __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->envs = envs;
+    pool->actions = actions;
+    pool->frames = frames;
+    pool->busy = threads - 1;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_share(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,78 @@
+#ifndef LIBNES_H
+#define LIBNES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* libnes: the NES core as a library for running many machines at once,
+ * e.g. as reinforcement-learning environments.
+ *
+ * A libnes_rom_t is a game loaded once; any number of libnes_t instances
+ * run it, sharing its read-only ROM image. Instances are opaque and
+ * heap-allocated, carry no framebuffer and no audio, and draw only the
+ * observation they were created with, at the end of each step.
+ * libnes_step_many runs one step on each of many instances across a
+ * thread pool.
+ *
+ * Everything is deterministic: the same actions from the same state give
+ * the same observations whatever the thread count. Different instances
+ * may be used from different threads; one instance from one at a time. */
+
+typedef struct libnes_rom  libnes_rom_t;
+typedef struct libnes      libnes_t;
+typedef struct libnes_pool libnes_pool_t;
+
+typedef enum {
+    LIBNES_OBS_NONE,        /* no pixels; agents that only read RAM */
+    LIBNES_OBS_ARGB,        /* 256x240, 4 bytes per pixel (ARGB8888) */
+    LIBNES_OBS_GRAY,        /* 256x240, 1 byte of luminance per pixel */
+    LIBNES_OBS_GRAY_HALF    /* 128x120 luminance, each the mean of 2x2 */
+} libnes_obs_t;
+
+/* Load an iNES file; NULL (reason on stderr) if it cannot be run. Free
+ * it only after every instance created from it. */
+libnes_rom_t *libnes_rom_load(const char *path);
+void          libnes_rom_free(libnes_rom_t *rom);
+/* The game checksum save states and input movies are matched against */
+uint32_t      libnes_rom_checksum(const libnes_rom_t *rom);
+
+/* A powered-on machine, or NULL if out of memory */
+libnes_t *libnes_create(const libnes_rom_t *rom, libnes_obs_t obs);
+void      libnes_destroy(libnes_t *env);
+
+/* Back to power-on, as a new episode. False if out of memory, after
+ * which the instance may only be destroyed. */
+bool libnes_reset(libnes_t *env);
+
+/* Run `frames` (>= 1) frames with controller 1 holding `buttons` (the
+ * BTN_* bits of nes.h); only the last one is drawn */
+void libnes_step(libnes_t *env, uint8_t buttons, int frames);
+
+/* The last drawn observation: its size in pixels and bytes per row.
+ * NULL for LIBNES_OBS_NONE. */
+const void *libnes_observation(const libnes_t *env, int *width, int *height,
+                               size_t *pitch);
+
+/* The 2 KB of work RAM, where games keep score, lives and positions */
+const uint8_t *libnes_ram(const libnes_t *env);
+
+/* Save states, in the format of nes_save_state */
+size_t libnes_state_size(const libnes_t *env);
+size_t libnes_save_state(const libnes_t *env, uint8_t *buf, size_t cap);
+bool   libnes_load_state(libnes_t *env, const uint8_t *buf, size_t len);
+
+/* A pool of `threads` (>= 1) threads, counting the caller's: step_many
+ * runs on the calling thread plus threads - 1 workers. NULL on error. */
+libnes_pool_t *libnes_pool_create(int threads);
+void           libnes_pool_destroy(libnes_pool_t *pool);
+
+/* libnes_step(envs[i], actions[i], frames) for every i < n, spread over
+ * the pool; returns when all are done. Each thread starts on its own
+ * contiguous share and steals from the others once it runs out, so
+ * instances that take longer (busier scenes, lag frames) do not leave
+ * threads idle. A NULL pool runs them on the caller. */
+void libnes_step_many(libnes_pool_t *pool, libnes_t *const envs[],
+                      const uint8_t actions[], int n, int frames);
+
+#endif
@@ -1,21 +1,412 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 
 #include "nes.h"
 #include "platform_nes.h"
+#include "rewind.h"
+#include "framebuf.h"
+#include "audio.h"
+#include "movie.h"
+#include "telemetry.h"
 
 #define TARGET_FPS     60
-#define FRAME_TIME_MS  (1000 / TARGET_FPS)   /* ~16 ms */
+#define FRAME_TIME_MS  (1000 / TARGET_FPS)   /* ~16 ms, without audio */
+
+/* With audio the sound card is the clock: emulation keeps about three
+ * frames (50 ms) queued and sleeps while more than that is waiting */
+#define AUDIO_RATE    48000
+#define AUDIO_RING    8192                      /* samples */
+#define AUDIO_TARGET  (AUDIO_RATE * 3 / TARGET_FPS)
+
+/* Rewind history: keyframe once a second, 4 MB holds well over a minute
+ * for typical NROM games */
+#define REWIND_RING_BYTES  (4u << 20)
+#define REWIND_KEYFRAME    60
+
+/* -trace: records buffered between the emulator and the trace writer */
+#define TRACE_RING  (1u << 20)
+
+/* -frameskip: frames run without drawing (ppu_t.skip_output) */
+#define FRAMESKIP_AUTO     (-1)  /* skip only while behind the 60 Hz budget */
+#define MAX_AUTO_SKIP      4     /* drawn at least every 5th frame */
+#define FAST_FORWARD_SKIP  7     /* Tab held: unpaced, draw one frame in 8 */
+
+/* -runahead: frames emulated past the real one and shown instead of it */
+#define MAX_RUNAHEAD          4
+#define RUNAHEAD_REPORT       600   /* frames between overhead reports (~10 s) */
+
+/* Time spent on run-ahead, reported every RUNAHEAD_REPORT run-ahead
+ * frames. Counter ticks from SDL_GetPerformanceCounter. */
+typedef struct {
+    uint64_t frames;
+    uint64_t copy_ticks;    /* snapshot + restore */
+    uint64_t ahead_ticks;   /* the speculative frames */
+    uint64_t worst_ticks;   /* largest total for one frame */
+} runahead_stats_t;
+
+/* Save states go next to the ROM as <rom>.state */
+static void save_state_file(const nes_t *nes, uint8_t *buf, size_t size,
+                            const char *rom_path)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.state", rom_path);
+
+    size_t len = nes_save_state(nes, buf, size);
+    FILE *fp = fopen(path, "wb");
+    if (!fp || len == 0 || fwrite(buf, 1, len, fp) != len) {
+        fprintf(stderr, "Failed to write save state '%s'\n", path);
+        if (fp)
+            fclose(fp);
+        return;
+    }
+    fclose(fp);
+    printf("Saved state: %s\n", path);
+}
+
+static bool load_state_file(nes_t *nes, uint8_t *buf, size_t size,
+                            const char *rom_path)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.state", rom_path);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "No save state '%s'\n", path);
+        return false;
+    }
+    /* Read one byte more than expected so oversized files are caught */
+    uint8_t extra;
+    size_t len = fread(buf, 1, size, fp);
+    if (len == size && fread(&extra, 1, 1, fp) == 1)
+        len++;
+    fclose(fp);
+
+    if (!nes_load_state(nes, buf, len))
+        return false;
+    printf("Loaded state: %s\n", path);
+    return true;
+}
+
+/* Emulation runs on its own thread so a slow present or a compositor
+ * stall on the SDL thread never delays it. The emulation thread owns
+ * nes_t and the state buffers; the SDL thread owns the window. They share
+ * only the frame handoff and the input words below. */
+typedef struct {
+    nes_t      *nes;
+    rewind_t   *rewind;
+    uint8_t    *state;       /* state_size bytes, then the rewind tag */
+    size_t      state_size;
+    const char *rom_path;
+    int         frameskip;   /* frames skipped per drawn one, or FRAMESKIP_AUTO */
+    int         runahead;    /* 0 = off */
+    nes_t      *snapshot;    /* run-ahead restore point */
+    runahead_stats_t ra_stats;
+    movie_t    *movie;       /* -record, or NULL */
+    bool        recording;   /* false once the movie could not grow */
+    framebuf_t  frames;
+    Uint32      frame_event; /* pushed after each publish; (Uint32)-1 if none */
+    audio_t    *audio;       /* NULL: no device, paced by SDL_GetTicks */
+    telemetry_t *tel;        /* -stats or -overlay, or NULL */
+    nes_timing_t timing;     /* nes_t.timing while tel is set */
+
+    /* Written by the SDL thread, read by the emulation thread */
+    uint8_t  buttons;
+    unsigned pressed;   /* save/load presses not yet handled */
+    unsigned held;      /* rewind and fast-forward while held */
+    bool     quit;
+} emu_t;
+
+static void runahead_report(emu_t *emu)
+{
+    runahead_stats_t *st = &emu->ra_stats;
+    if (st->frames == 0)
+        return;
+    double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    fprintf(stderr, "run-ahead %d: +%.2f ms/frame (%.3f ms copying), worst %.2f ms\n",
+            emu->runahead,
+            (double)(st->copy_ticks + st->ahead_ticks) * ms / (double)st->frames,
+            (double)st->copy_ticks * ms / (double)st->frames,
+            (double)st->worst_ticks * ms);
+    memset(st, 0, sizeof(*st));
+}
+
+/* Run-ahead: run the real frame undrawn, then emu->runahead frames past
+ * it with the same input, draw only the last of those, and go back. A
+ * game shows the effect of a button a frame or more after reading it;
+ * showing a frame from the future hides that much of its lag. The
+ * speculative frames run with synthesis off, so the real frame's audio
+ * is still in apu.samples after the restore and they are never heard. A
+ * movie checkpoint draws the real frame into the core's own framebuffer
+ * as well, for its hash. */
+static void run_ahead_frame(emu_t *emu, bool checkpoint)
+{
+    nes_t *nes = emu->nes;
+    runahead_stats_t *st = &emu->ra_stats;
+
+    if (checkpoint)
+        ppu_set_output(&nes->ppu, NULL, 0);
+    nes->ppu.skip_output = !checkpoint;
+    nes_step_frame(nes);
+    if (checkpoint)
+        ppu_set_output(&nes->ppu, framebuf_back(&emu->frames), NES_WIDTH);
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    nes_snapshot(nes, emu->snapshot);
+    Uint64 t1 = SDL_GetPerformanceCounter();
+
+    nes->trace = NULL;   /* the trace follows the real timeline only */
+    nes->apu.sample_rate = 0;
+    for (int i = 1; i <= emu->runahead; i++) {
+        nes->ppu.skip_output = i < emu->runahead;
+        nes_step_frame(nes);
+    }
+    Uint64 t2 = SDL_GetPerformanceCounter();
+    nes_restore(nes, emu->snapshot);
+    Uint64 t3 = SDL_GetPerformanceCounter();
+
+    st->copy_ticks += (t1 - t0) + (t3 - t2);
+    st->ahead_ticks += t2 - t1;
+    if (t3 - t0 > st->worst_ticks)
+        st->worst_ticks = t3 - t0;
+    if (++st->frames == RUNAHEAD_REPORT)
+        runahead_report(emu);
+}
+
+/* Telemetry for nes_step_frame (or a run-ahead frame) taking `ticks` */
+static void record_step(emu_t *emu, Uint64 ticks)
+{
+    telemetry_t *tel = emu->tel;
+    uint64_t ppu = emu->timing.ppu, dma = emu->timing.dma;
+    telemetry_add(tel, TEL_CPU, ticks > ppu + dma ? ticks - ppu - dma : 0);
+    telemetry_add(tel, TEL_PPU, ppu);
+    telemetry_add(tel, TEL_DMA, dma);
+    emu->timing.ppu = emu->timing.dma = 0;
+}
+
+/* Telemetry for a loop iteration that began at `start` and went to
+ * sleep at `sleep_start`; the sleep has just ended */
+static void record_iteration(emu_t *emu, Uint64 start, Uint64 sleep_start)
+{
+    if (!emu->tel)
+        return;
+    telemetry_add(emu->tel, TEL_WORK, sleep_start - start);
+    telemetry_add(emu->tel, TEL_SLEEP, SDL_GetPerformanceCounter() - sleep_start);
+}
+
+/* Wake the SDL thread, which sleeps in SDL_WaitEventTimeout */
+static void notify_frame(const emu_t *emu)
+{
+    if (emu->frame_event == (Uint32)-1)
+        return;
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = emu->frame_event;
+    SDL_PushEvent(&event);
+}
+
+static int emu_thread(void *arg)
+{
+    emu_t *emu = (emu_t *)arg;
+    nes_t *nes = emu->nes;
+    int skipped = 0;      /* frames skipped in a row */
+    bool behind = false;  /* the last frame overran its budget */
+    Uint64 last_start = 0;
+
+    while (!__atomic_load_n(&emu->quit, __ATOMIC_ACQUIRE)) {
+        Uint32 frame_start = SDL_GetTicks();
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (emu->tel && last_start)
+            telemetry_add(emu->tel, TEL_PERIOD, start - last_start);
+        last_start = start;
+
+        nes_set_controller(nes, 0, __atomic_load_n(&emu->buttons, __ATOMIC_RELAXED));
+        unsigned hotkeys = __atomic_exchange_n(&emu->pressed, 0, __ATOMIC_ACQ_REL)
+                         | __atomic_load_n(&emu->held, __ATOMIC_RELAXED);
+
+        if (hotkeys & NES_HOTKEY_SAVE)
+            save_state_file(nes, emu->state, emu->state_size, emu->rom_path);
+        if (hotkeys & NES_HOTKEY_LOAD) {
+            /* A movie replays from power-on, so it cannot jump to a state */
+            if (emu->recording)
+                fprintf(stderr, "Loading a state is disabled while recording\n");
+            /* History from before the load no longer leads here */
+            else if (load_state_file(nes, emu->state, emu->state_size, emu->rom_path))
+                rewind_clear(emu->rewind);
+        }
+
+        /* Each history entry is the state at the start of a frame, tagged
+         * with the movie length at that point. The newest is the frame
+         * just run, so stepping back one frame restores the entry before
+         * it and replays that frame to redraw the picture; the entry goes
+         * back on as the start of the replayed frame. The movie is cut to
+         * the tag, so it forgets the rewound frames too. */
+        bool rewound = (hotkeys & NES_HOTKEY_REWIND)
+                    && rewind_pop(emu->rewind, emu->state);
+        if (rewound) {
+            rewind_pop(emu->rewind, emu->state);   /* none left: replay the oldest */
+            nes_load_state(nes, emu->state, emu->state_size);
+            uint64_t tag;
+            memcpy(&tag, emu->state + emu->state_size, sizeof(tag));
+            if (emu->recording)
+                movie_truncate(emu->movie, (size_t)tag);
+            rewind_push(emu->rewind, emu->state);
+        } else if (nes_save_state(nes, emu->state, emu->state_size)) {
+            uint64_t tag = emu->movie ? emu->movie->frames : 0;
+            memcpy(emu->state + emu->state_size, &tag, sizeof(tag));
+            rewind_push(emu->rewind, emu->state);
+        }
+
+        /* Decide whether this frame is drawn. Skipped frames still run
+         * everything the game can observe, just no pixel work. */
+        bool fast = (hotkeys & NES_HOTKEY_FAST) != 0;
+        bool skip;
+        if (fast)
+            skip = skipped < FAST_FORWARD_SKIP;
+        else if (emu->frameskip == FRAMESKIP_AUTO)
+            skip = behind && skipped < MAX_AUTO_SKIP;
+        else
+            skip = skipped < emu->frameskip;
+        skipped = skip ? skipped + 1 : 0;
+        nes->ppu.skip_output = skip;
+
+        /* Drawn frames go straight into the handoff slot */
+        ppu_set_output(&nes->ppu, framebuf_back(&emu->frames), NES_WIDTH);
+
+        /* Steer the queue toward its target by emitting slightly more
+         * or fewer samples per frame than the nominal rate */
+        if (emu->audio)
+            apu_set_rate(&nes->apu, AUDIO_RATE,
+                         audio_rate_ratio(emu->audio, AUDIO_TARGET));
+
+        /* Record the buttons this frame actually runs with (a rewind
+         * replays the previous frame's) */
+        if (emu->recording && !movie_record(emu->movie, nes->controller[0])) {
+            fprintf(stderr, "Recording stopped after %zu frames\n", emu->movie->frames);
+            emu->recording = false;
+        }
+
+        /* Movie checkpoints are drawn into the core's framebuffer, where
+         * nes_bench -m hashes them, whatever is shown */
+        bool ahead = emu->runahead && !skip;
+        bool checkpoint = emu->recording && movie_checkpoint_due(emu->movie);
+        if (checkpoint && !ahead) {
+            ppu_set_output(&nes->ppu, NULL, 0);
+            nes->ppu.skip_output = false;
+        }
+
+        /* Run one full frame of emulation; frames that are not drawn
+         * have nothing to run ahead for */
+        Uint64 step_start = SDL_GetPerformanceCounter();
+        if (ahead)
+            run_ahead_frame(emu, checkpoint);
+        else
+            nes_step_frame(nes);
+        if (emu->tel)
+            record_step(emu, SDL_GetPerformanceCounter() - step_start);
+
+        if (checkpoint) {
+            if (!ahead && !skip)
+                memcpy(framebuf_back(&emu->frames), nes->ppu.framebuffer,
+                       NES_WIDTH * NES_HEIGHT * sizeof(uint32_t));
+            if (!movie_checkpoint(emu->movie, movie_frame_hash(nes->ppu.framebuffer))) {
+                fprintf(stderr, "Recording stopped after %zu frames\n", emu->movie->frames);
+                emu->recording = false;
+            }
+        }
+
+#ifdef NES_PROFILE
+        if (cpu6502_profile_signalled())
+            nes_profile_dump(stderr);
+#endif
+
+        /* Hand the finished frame to the SDL thread */
+        if (!skip) {
+            framebuf_publish(&emu->frames);
+            notify_frame(emu);
+        }
+
+        /* Frame timing. With audio, wait for the queue to drain to its
+         * target; fast-forward queues what fits and drops the rest. */
+        if (emu->audio) {
+            audio_write(emu->audio, nes->apu.samples, (uint32_t)nes->apu.sample_count);
+            behind = !fast && audio_queued(emu->audio) < AUDIO_TARGET / 2;
+            Uint64 sleep_start = SDL_GetPerformanceCounter();
+            if (!fast)
+                audio_wait(emu->audio, AUDIO_TARGET);
+            record_iteration(emu, start, sleep_start);
+            continue;
+        }
+
+        /* Without: delay to maintain ~60 FPS unless fast-forwarding */
+        Uint32 frame_elapsed = SDL_GetTicks() - frame_start;
+        behind = !fast && frame_elapsed > FRAME_TIME_MS;
+        Uint64 sleep_start = SDL_GetPerformanceCounter();
+        if (!fast && frame_elapsed < FRAME_TIME_MS) {
+            SDL_Delay(FRAME_TIME_MS - frame_elapsed);
+        }
+        record_iteration(emu, start, sleep_start);
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <rom.nes>\n", argv[0]);
+    const char *trace_path = NULL;
+    const char *record_path = NULL;
+    const char *stats_path = NULL;
+    bool overlay = false;
+    int frameskip = 0;
+    int runahead = 0;
+    int arg = 1;
+    bool usage_ok = true;
+    while (usage_ok && arg + 1 < argc && argv[arg][0] == '-') {
+        const char *val = argv[arg + 1];
+        int used = 2;
+        if (strcmp(argv[arg], "-overlay") == 0) {
+            overlay = true;
+            used = 1;
+        } else if (strcmp(argv[arg], "-stats") == 0) {
+            stats_path = val;
+        } else if (strcmp(argv[arg], "-trace") == 0) {
+            trace_path = val;
+        } else if (strcmp(argv[arg], "-record") == 0) {
+            record_path = val;
+        } else if (strcmp(argv[arg], "-frameskip") == 0) {
+            char *end;
+            if (strcmp(val, "auto") == 0) {
+                frameskip = FRAMESKIP_AUTO;
+            } else {
+                long n = strtol(val, &end, 10);
+                usage_ok = *val != '\0' && *end == '\0' && n >= 0 && n <= 59;
+                frameskip = (int)n;
+            }
+        } else if (strcmp(argv[arg], "-runahead") == 0) {
+            char *end;
+            long n = strtol(val, &end, 10);
+            usage_ok = *val != '\0' && *end == '\0' && n >= 1 && n <= MAX_RUNAHEAD;
+            runahead = (int)n;
+        } else {
+            usage_ok = false;
+        }
+        arg += used;
+    }
+    if (!usage_ok || argc != arg + 1) {
+        fprintf(stderr,
+            "Usage: %s [-trace trace.bin] [-record movie.nesm] [-frameskip N|auto]\n"
+            "          [-runahead N] [-stats FILE] [-overlay] <rom.nes>\n"
+            "  -record FILE     save this session's input as a movie (nes_bench -m)\n"
+            "  -frameskip N     draw one frame in N+1 (0-59, default 0)\n"
+            "  -frameskip auto  skip drawing only while running behind\n"
+            "  -runahead N      show the frame N frames ahead (1-%d) to cut input lag\n"
+            "  -stats FILE      write frame-time percentiles on exit (.json or CSV)\n"
+            "  -overlay         show frame times (ms) over the picture\n",
+            argv[0], MAX_RUNAHEAD);
         exit(1);
     }
 
-    const char *rom_path = argv[1];
+    const char *rom_path = argv[arg];
 
     nes_t nes;
     if (!nes_init(&nes, rom_path)) {
@@ -23,39 +414,142 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    if (trace_path) {
+        nes.trace = trace_open(trace_path, TRACE_RING);
+        if (!nes.trace) {
+            nes_free(&nes);
+            exit(1);
+        }
+    }
+
     nes_platform_t plat;
     if (!nes_platform_init(&plat, "NES", 3)) {
         fprintf(stderr, "Failed to initialize SDL2 platform\n");
+        trace_close(nes.trace);
         nes_free(&nes);
         exit(1);
     }
 
-    bool running = true;
-    while (running) {
-        Uint32 frame_start = SDL_GetTicks();
+    /* Sound is optional: without a device, run silent on the timer */
+    audio_t audio;
+    bool have_audio = audio_open(&audio, AUDIO_RATE, AUDIO_RING);
+    if (have_audio && !apu_set_rate(&nes.apu, AUDIO_RATE, 1.0)) {
+        fprintf(stderr, "Out of memory for sound; running silent\n");
+        audio_close(&audio);
+        have_audio = false;
+    }
+
+    /* Frame-time telemetry; the core's PPU and DMA time only while on */
+    telemetry_t telemetry;
+    telemetry_init(&telemetry, nes_platform_metrics, TEL_COUNT,
+                   SDL_GetPerformanceFrequency(), overlay);
+    bool have_telemetry = stats_path || overlay;
+
+    emu_t emu;
+    memset(&emu, 0, sizeof(emu));
+    emu.audio = have_audio ? &audio : NULL;
+    emu.frame_event = SDL_RegisterEvents(1);
+    emu.nes = &nes;
+    if (have_telemetry) {
+        emu.tel = &telemetry;
+        emu.timing.now = SDL_GetPerformanceCounter;
+        nes.timing = &emu.timing;
+    }
+    emu.rom_path = rom_path;
+    emu.frameskip = frameskip;
+    emu.runahead = runahead;
+    movie_t movie;
+    movie_init(&movie, nes.cart.checksum, MOVIE_INTERVAL);
+    emu.movie = record_path ? &movie : NULL;
+    emu.recording = record_path != NULL;
+    emu.state_size = nes_state_size(&nes);
+    /* Rewind entries carry a 64-bit movie frame tag after the state */
+    emu.state = malloc(emu.state_size + sizeof(uint64_t));
+    emu.rewind = rewind_create(emu.state_size + sizeof(uint64_t), REWIND_RING_BYTES,
+                               REWIND_KEYFRAME);
+    emu.snapshot = runahead ? malloc(sizeof(nes_t)) : NULL;
+    bool have_frames = framebuf_init(&emu.frames,
+                                      NES_WIDTH * NES_HEIGHT * sizeof(uint32_t));
+    if (!emu.state || !emu.rewind || !have_frames || (runahead && !emu.snapshot)) {
+        fprintf(stderr, "Failed to allocate save state and frame buffers\n");
+        free(emu.snapshot);
+        free(emu.state);
+        rewind_destroy(emu.rewind);
+        if (have_frames)
+            framebuf_destroy(&emu.frames);
+        if (have_audio)
+            audio_close(&audio);
+        nes_platform_destroy(&plat);
+        trace_close(nes.trace);
+        nes_free(&nes);
+        exit(1);
+    }
 
-        /* Poll input and check for quit */
+#ifdef NES_PROFILE
+    /* kill -USR1 <pid> prints the profile so far */
+    cpu6502_profile_install_signal();
+#endif
+
+    SDL_Thread *thread = SDL_CreateThread(emu_thread, "emulation", &emu);
+    if (!thread) {
+        fprintf(stderr, "SDL_CreateThread failed: %s\n", SDL_GetError());
+        framebuf_destroy(&emu.frames);
+        rewind_destroy(emu.rewind);
+        free(emu.snapshot);
+        free(emu.state);
+        if (have_audio)
+            audio_close(&audio);
+        nes_platform_destroy(&plat);
+        trace_close(nes.trace);
+        nes_free(&nes);
+        exit(1);
+    }
+
+    /* Input and presentation run at their own pace; a frame is shown as
+     * soon as the emulation thread publishes it. In between, the thread
+     * sleeps until the next input or frame event (or polls every
+     * millisecond if no event type could be registered). */
+    for (;;) {
         uint8_t buttons = 0;
-        if (!nes_platform_poll_input(&buttons)) {
-            running = false;
+        unsigned hotkeys = 0;
+        if (!nes_platform_poll_input(&buttons, &hotkeys))
             break;
-        }
-        nes_set_controller(&nes, 0, buttons);
+        __atomic_store_n(&emu.buttons, buttons, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&emu.pressed, hotkeys & (NES_HOTKEY_SAVE | NES_HOTKEY_LOAD),
+                          __ATOMIC_RELEASE);
+        __atomic_store_n(&emu.held, hotkeys & (NES_HOTKEY_REWIND | NES_HOTKEY_FAST),
+                         __ATOMIC_RELAXED);
 
-        /* Run one full frame of emulation */
-        nes_step_frame(&nes);
+        const uint32_t *frame = framebuf_acquire(&emu.frames);
+        if (frame)
+            nes_platform_render(&plat, frame, emu.tel);
+        else
+            SDL_WaitEventTimeout(NULL, emu.frame_event == (Uint32)-1 ? 1 : -1);
+    }
 
-        /* Render the PPU framebuffer */
-        nes_platform_render(&plat, nes.ppu.framebuffer);
+    __atomic_store_n(&emu.quit, true, __ATOMIC_RELEASE);
+    SDL_WaitThread(thread, NULL);
 
-        /* Frame timing: delay to maintain ~60 FPS */
-        Uint32 frame_elapsed = SDL_GetTicks() - frame_start;
-        if (frame_elapsed < FRAME_TIME_MS) {
-            SDL_Delay(FRAME_TIME_MS - frame_elapsed);
-        }
-    }
+#ifdef NES_PROFILE
+    nes_profile_dump(stderr);
+#endif
 
+    if (runahead)
+        runahead_report(&emu);
+    if (stats_path && telemetry_write(&telemetry, stats_path))
+        printf("Saved frame times: %s\n", stats_path);
+    if (record_path && movie_save(&movie, record_path))
+        printf("Saved movie: %s (%zu frames)\n", record_path, movie.frames);
+    movie_free(&movie);
+    framebuf_destroy(&emu.frames);
+    rewind_destroy(emu.rewind);
+    free(emu.snapshot);
+    free(emu.state);
+    if (have_audio)
+        audio_close(&audio);
     nes_platform_destroy(&plat);
+    if (!trace_close(nes.trace))
+        fprintf(stderr, "Trace '%s' is incomplete\n", trace_path);
     nes_free(&nes);
     return 0;
 }
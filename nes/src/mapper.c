@@ -0,0 +1,259 @@
+/*
+ * mapper.c — cartridge mappers: NROM (0), MMC1 (1), UxROM (2), CNROM (3)
+ * and MMC3 (4)
+ *
+ * A mapper only decodes register writes and translates its register file
+ * into the cartridge's bank slots (8KB PRG, 1KB CHR) and mirroring. The
+ * buses read through the slots and never look at mapper state, so a
+ * bank-switching board costs the same per access as NROM.
+ */
+
+#include <stddef.h>
+
+#include "cartridge.h"
+
+/* Map 2 consecutive 8KB PRG banks (one 16KB bank) into slots slot, slot+1 */
+static void set_prg_16k(cartridge_t *cart, int slot, int bank)
+{
+    cartridge_set_prg_8k(cart, slot, bank * 2);
+    cartridge_set_prg_8k(cart, slot + 1, bank * 2 + 1);
+}
+
+static void set_chr_4k(cartridge_t *cart, int slot, int bank)
+{
+    for (int i = 0; i < 4; i++)
+        cartridge_set_chr_1k(cart, slot + i, bank * 4 + i);
+}
+
+static void set_chr_8k(cartridge_t *cart, int bank)
+{
+    set_chr_4k(cart, 0, bank * 2);
+    set_chr_4k(cart, 4, bank * 2 + 1);
+}
+
+static void reset_none(cartridge_t *cart)
+{
+    (void)cart;
+}
+
+/* ---------------------------------------------------------------------------
+ * NROM (0): 16 or 32KB PRG, 8KB CHR, no registers
+ * ------------------------------------------------------------------------- */
+static void nrom_update(cartridge_t *cart)
+{
+    /* A 16KB board mirrors its bank at $C000 */
+    set_prg_16k(cart, 0, 0);
+    set_prg_16k(cart, 2, -1);
+    set_chr_8k(cart, 0);
+}
+
+/* ---------------------------------------------------------------------------
+ * UxROM (2): switchable 16KB at $8000, last bank fixed at $C000
+ * ------------------------------------------------------------------------- */
+static void uxrom_update(cartridge_t *cart)
+{
+    set_prg_16k(cart, 0, cart->regs.bank);
+    set_prg_16k(cart, 2, -1);
+    set_chr_8k(cart, 0);
+}
+
+static void bank_write(cartridge_t *cart, uint16_t addr, uint8_t val)
+{
+    (void)addr;
+    cart->regs.bank = val;
+    cart->mapper->update(cart);
+}
+
+/* ---------------------------------------------------------------------------
+ * CNROM (3): fixed PRG, switchable 8KB CHR
+ * ------------------------------------------------------------------------- */
+static void cnrom_update(cartridge_t *cart)
+{
+    set_prg_16k(cart, 0, 0);
+    set_prg_16k(cart, 2, -1);
+    set_chr_8k(cart, cart->regs.bank);
+}
+
+/* ---------------------------------------------------------------------------
+ * MMC1 (1): five-write serial port; 16/32KB PRG and 4/8KB CHR modes,
+ * software mirroring. On 512KB boards (SUROM) CHR bank bit 4 picks the
+ * 256KB PRG half.
+ * ------------------------------------------------------------------------- */
+static void mmc1_reset(cartridge_t *cart)
+{
+    cart->regs.mmc1.control = 0x0C;   /* 16KB PRG, last bank fixed */
+}
+
+static void mmc1_update(cartridge_t *cart)
+{
+    static const mirror_mode_t mirror[4] = {
+        MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL,
+    };
+    uint8_t control = cart->regs.mmc1.control;
+    int outer = cart->prg_banks > 16 ? (cart->regs.mmc1.chr0 & 0x10) : 0;
+    int prg = cart->regs.mmc1.prg & 0x0F;
+
+    cartridge_set_mirror(cart, mirror[control & 0x03]);
+
+    switch ((control >> 2) & 0x03) {
+    case 0:
+    case 1:   /* 32KB at $8000, low bit ignored */
+        set_prg_16k(cart, 0, outer | (prg & 0x0E));
+        set_prg_16k(cart, 2, outer | (prg | 0x01));
+        break;
+    case 2:   /* first bank fixed at $8000, switch $C000 */
+        set_prg_16k(cart, 0, outer);
+        set_prg_16k(cart, 2, outer | prg);
+        break;
+    default:  /* switch $8000, last bank fixed at $C000 */
+        set_prg_16k(cart, 0, outer | prg);
+        set_prg_16k(cart, 2, outer | 0x0F);
+        break;
+    }
+
+    if (control & 0x10) {
+        set_chr_4k(cart, 0, cart->regs.mmc1.chr0);
+        set_chr_4k(cart, 4, cart->regs.mmc1.chr1);
+    } else {
+        set_chr_8k(cart, cart->regs.mmc1.chr0 >> 1);
+    }
+}
+
+static void mmc1_write(cartridge_t *cart, uint16_t addr, uint8_t val)
+{
+    if (val & 0x80) {
+        /* Reset the shift register and lock the last PRG bank */
+        cart->regs.mmc1.shift = 0;
+        cart->regs.mmc1.count = 0;
+        cart->regs.mmc1.control |= 0x0C;
+        mmc1_update(cart);
+        return;
+    }
+
+    cart->regs.mmc1.shift |= (uint8_t)((val & 0x01) << cart->regs.mmc1.count);
+    if (++cart->regs.mmc1.count < 5)
+        return;
+
+    /* Fifth write: the address picks the register */
+    uint8_t data = cart->regs.mmc1.shift;
+    switch ((addr >> 13) & 0x03) {
+    case 0: cart->regs.mmc1.control = data; break;
+    case 1: cart->regs.mmc1.chr0 = data;    break;
+    case 2: cart->regs.mmc1.chr1 = data;    break;
+    default: cart->regs.mmc1.prg = data;    break;
+    }
+    cart->regs.mmc1.shift = 0;
+    cart->regs.mmc1.count = 0;
+    mmc1_update(cart);
+}
+
+/* ---------------------------------------------------------------------------
+ * MMC3 (4): 8KB PRG and 1/2KB CHR banks through R0-R7, and a scanline
+ * counter clocked by PPU A12 (cartridge_scanline) that raises an IRQ
+ * when it reaches zero.
+ * ------------------------------------------------------------------------- */
+static void mmc3_update(cartridge_t *cart)
+{
+    const uint8_t *r = cart->regs.mmc3.r;
+    uint8_t select = cart->regs.mmc3.select;
+
+    /* PRG mode (bit 6) swaps $8000 and $C000; $E000 is always the last */
+    int swap = (select & 0x40) ? 2 : 0;
+    cartridge_set_prg_8k(cart, 0 ^ swap, r[6]);
+    cartridge_set_prg_8k(cart, 1, r[7]);
+    cartridge_set_prg_8k(cart, 2 ^ swap, -2);
+    cartridge_set_prg_8k(cart, 3, -1);
+
+    /* CHR mode (bit 7) swaps the 2KB and 1KB halves */
+    int invert = (select & 0x80) ? 4 : 0;
+    cartridge_set_chr_1k(cart, 0 ^ invert, r[0] & 0xFE);
+    cartridge_set_chr_1k(cart, 1 ^ invert, r[0] | 0x01);
+    cartridge_set_chr_1k(cart, 2 ^ invert, r[1] & 0xFE);
+    cartridge_set_chr_1k(cart, 3 ^ invert, r[1] | 0x01);
+    cartridge_set_chr_1k(cart, 4 ^ invert, r[2]);
+    cartridge_set_chr_1k(cart, 5 ^ invert, r[3]);
+    cartridge_set_chr_1k(cart, 6 ^ invert, r[4]);
+    cartridge_set_chr_1k(cart, 7 ^ invert, r[5]);
+
+    cartridge_set_mirror(cart, (cart->regs.mmc3.mirror & 0x01) ? MIRROR_HORIZONTAL
+                                                               : MIRROR_VERTICAL);
+}
+
+static void mmc3_write(cartridge_t *cart, uint16_t addr, uint8_t val)
+{
+    bool odd = addr & 0x01;
+
+    switch (addr & 0xE000) {
+    case 0x8000:
+        if (odd)
+            cart->regs.mmc3.r[cart->regs.mmc3.select & 0x07] = val;
+        else
+            cart->regs.mmc3.select = val;
+        mmc3_update(cart);
+        break;
+    case 0xA000:
+        /* Odd: PRG RAM protect, not emulated */
+        if (!odd) {
+            cart->regs.mmc3.mirror = val;
+            mmc3_update(cart);
+        }
+        break;
+    case 0xC000:
+        if (odd) {
+            cart->regs.mmc3.irq_counter = 0;
+            cart->regs.mmc3.irq_reload = 1;
+        } else {
+            cart->regs.mmc3.irq_latch = val;
+        }
+        cart->dirty |= CART_DIRTY_IRQ;
+        break;
+    default:   /* $E000 */
+        cart->regs.mmc3.irq_enabled = odd;
+        if (!odd)
+            cart->irq_line = false;   /* disabling also acknowledges */
+        cart->dirty |= CART_DIRTY_IRQ;
+        break;
+    }
+}
+
+static void mmc3_scanline(cartridge_t *cart)
+{
+    if (cart->regs.mmc3.irq_counter == 0 || cart->regs.mmc3.irq_reload) {
+        cart->regs.mmc3.irq_counter = cart->regs.mmc3.irq_latch;
+        cart->regs.mmc3.irq_reload = 0;
+    } else {
+        cart->regs.mmc3.irq_counter--;
+    }
+    if (cart->regs.mmc3.irq_counter == 0 && cart->regs.mmc3.irq_enabled)
+        cart->irq_line = true;
+}
+
+static int mmc3_irq_clocks(const cartridge_t *cart)
+{
+    if (!cart->regs.mmc3.irq_enabled)
+        return 0;
+    /* A reload lands on the first clock; from there it counts down */
+    if (cart->regs.mmc3.irq_counter == 0 || cart->regs.mmc3.irq_reload)
+        return 1 + cart->regs.mmc3.irq_latch;
+    return cart->regs.mmc3.irq_counter;
+}
+
+/* ---------------------------------------------------------------------------
+ * Registry
+ * ------------------------------------------------------------------------- */
+static const mapper_t mappers[] = {
+    { 0, "NROM",  false, reset_none, nrom_update,  NULL,       NULL,          NULL },
+    { 1, "MMC1",  true,  mmc1_reset, mmc1_update,  mmc1_write, NULL,          NULL },
+    { 2, "UxROM", false, reset_none, uxrom_update, bank_write, NULL,          NULL },
+    { 3, "CNROM", false, reset_none, cnrom_update, bank_write, NULL,          NULL },
+    { 4, "MMC3",  true,  reset_none, mmc3_update,  mmc3_write, mmc3_scanline, mmc3_irq_clocks },
+};
+
+const mapper_t *mapper_find(uint8_t id)
+{
+    for (size_t i = 0; i < sizeof(mappers) / sizeof(mappers[0]); i++) {
+        if (mappers[i].id == id)
+            return &mappers[i];
+    }
+    return NULL;
+}
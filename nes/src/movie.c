@@ -0,0 +1,203 @@
+/*
+ * movie.c — recording, saving and loading input movies
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "ppu.h"
+#include "state.h"
+
+static const uint8_t movie_magic[4] = { 'N', 'E', 'S', 'M' };
+
+#define HEADER_V1_BYTES (4 + 2 + 4 + 4 + 4)
+#define HEADER_BYTES    (HEADER_V1_BYTES + 4 + 4)
+#define RUN_BYTES       3
+#define HASH_BYTES      4
+#define MAX_RUN         0xFFFF
+
+void movie_init(movie_t *m, uint32_t checksum, uint32_t interval)
+{
+    memset(m, 0, sizeof(*m));
+    m->checksum = checksum;
+    m->interval = interval;
+}
+
+void movie_free(movie_t *m)
+{
+    free(m->buttons);
+    free(m->hashes);
+    movie_init(m, 0, 0);
+}
+
+bool movie_record(movie_t *m, uint8_t buttons)
+{
+    if (m->frames == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 3600;   /* a minute, then doubling */
+        uint8_t *p = realloc(m->buttons, cap);
+        if (!p) {
+            fprintf(stderr, "movie_record: out of memory\n");
+            return false;
+        }
+        m->buttons = p;
+        m->cap = cap;
+    }
+    m->buttons[m->frames++] = buttons;
+    return true;
+}
+
+bool movie_checkpoint(movie_t *m, uint32_t hash)
+{
+    if (m->hash_count == m->hash_cap) {
+        size_t cap = m->hash_cap ? m->hash_cap * 2 : 64;
+        uint32_t *p = realloc(m->hashes, cap * sizeof(*p));
+        if (!p) {
+            fprintf(stderr, "movie_checkpoint: out of memory\n");
+            return false;
+        }
+        m->hashes = p;
+        m->hash_cap = cap;
+    }
+    m->hashes[m->hash_count++] = hash;
+    return true;
+}
+
+uint32_t movie_frame_hash(const uint32_t *pixels)
+{
+    const uint8_t *p = (const uint8_t *)pixels;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < NES_WIDTH * NES_HEIGHT * sizeof(uint32_t); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void movie_truncate(movie_t *m, size_t frames)
+{
+    if (frames < m->frames)
+        m->frames = frames;
+    size_t hashes = m->interval ? frames / m->interval : 0;
+    if (hashes < m->hash_count)
+        m->hash_count = hashes;
+}
+
+/* End of the run of equal frames starting at f, at most MAX_RUN long */
+static size_t run_end(const movie_t *m, size_t f)
+{
+    size_t end = f + 1;
+    while (end < m->frames && end - f < MAX_RUN && m->buttons[end] == m->buttons[f])
+        end++;
+    return end;
+}
+
+bool movie_save(const movie_t *m, const char *path)
+{
+    size_t runs = 0;
+    for (size_t f = 0; f < m->frames; f = run_end(m, f))
+        runs++;
+    size_t len = HEADER_BYTES + runs * RUN_BYTES + m->hash_count * HASH_BYTES;
+    uint8_t *buf = malloc(len);
+    if (!buf) {
+        fprintf(stderr, "movie_save: out of memory\n");
+        return false;
+    }
+
+    state_writer_t w;
+    state_writer_init(&w, buf, len);
+    state_put(&w, movie_magic, sizeof(movie_magic));
+    state_put_u16(&w, MOVIE_VERSION);
+    state_put_u32(&w, m->checksum);
+    state_put_u32(&w, (uint32_t)m->frames);
+    state_put_u32(&w, (uint32_t)runs);
+    state_put_u32(&w, m->interval);
+    state_put_u32(&w, (uint32_t)m->hash_count);
+    for (size_t f = 0, end; f < m->frames; f = end) {
+        end = run_end(m, f);
+        state_put_u8(&w, m->buttons[f]);
+        state_put_u16(&w, (uint16_t)(end - f));
+    }
+    for (size_t i = 0; i < m->hash_count; i++)
+        state_put_u32(&w, m->hashes[i]);
+
+    FILE *fp = fopen(path, "wb");
+    bool ok = fp && fwrite(buf, 1, w.len, fp) == w.len;
+    if (fp && fclose(fp) != 0)
+        ok = false;
+    free(buf);
+    if (!ok)
+        fprintf(stderr, "movie_save: failed to write '%s'\n", path);
+    return ok;
+}
+
+bool movie_load(movie_t *m, const char *path)
+{
+    movie_init(m, 0, 0);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "movie_load: cannot open '%s'\n", path);
+        return false;
+    }
+
+    /* Version 1 stops after the run count */
+    uint8_t head[HEADER_BYTES];
+    bool ok = fread(head, 1, HEADER_V1_BYTES, fp) == HEADER_V1_BYTES &&
+              memcmp(head, movie_magic, sizeof(movie_magic)) == 0;
+    state_reader_t r;
+    uint32_t frames = 0, runs = 0, hashes = 0;
+    if (ok) {
+        state_reader_init(&r, head + sizeof(movie_magic), HEADER_V1_BYTES - sizeof(movie_magic));
+        uint16_t version = state_get_u16(&r);
+        m->checksum = state_get_u32(&r);
+        frames = state_get_u32(&r);
+        runs = state_get_u32(&r);
+        if (version == MOVIE_VERSION) {
+            ok = fread(head, 1, HEADER_BYTES - HEADER_V1_BYTES, fp) == HEADER_BYTES - HEADER_V1_BYTES;
+            state_reader_init(&r, head, HEADER_BYTES - HEADER_V1_BYTES);
+            m->interval = state_get_u32(&r);
+            hashes = state_get_u32(&r);
+            ok = ok && (m->interval ? hashes <= frames / m->interval : hashes == 0);
+        } else {
+            ok = version == 1;
+        }
+    }
+
+    uint8_t *body = NULL;
+    if (ok) {
+        size_t len = (size_t)runs * RUN_BYTES + (size_t)hashes * HASH_BYTES;
+        body = malloc(len + 1);
+        m->buttons = malloc((size_t)frames + 1);
+        m->cap = (size_t)frames + 1;
+        m->hashes = malloc(((size_t)hashes + 1) * sizeof(*m->hashes));
+        m->hash_cap = (size_t)hashes + 1;
+        ok = body && m->buttons && m->hashes && fread(body, 1, len, fp) == len;
+    }
+    fclose(fp);
+
+    if (ok) {
+        state_reader_init(&r, body, (size_t)runs * RUN_BYTES + (size_t)hashes * HASH_BYTES);
+        for (uint32_t i = 0; i < runs && ok; i++) {
+            uint8_t buttons = state_get_u8(&r);
+            uint16_t n = state_get_u16(&r);
+            ok = n > 0 && n <= frames - m->frames;
+            if (ok) {
+                memset(m->buttons + m->frames, buttons, n);
+                m->frames += n;
+            }
+        }
+        ok = ok && m->frames == frames;
+        while (ok && m->hash_count < hashes)
+            m->hashes[m->hash_count++] = state_get_u32(&r);
+    }
+    free(body);
+
+    if (!ok) {
+        fprintf(stderr, "movie_load: '%s' is not a valid movie\n", path);
+        movie_free(m);
+        return false;
+    }
+    return true;
+}
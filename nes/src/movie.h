@@ -0,0 +1,83 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Input movies: controller 1's buttons for every frame since power-on.
+ *
+ * The core is deterministic, so a ROM plus its movie reproduces a play
+ * session exactly: the frontend records one (-record), and nes_bench
+ * replays it headless as a gameplay workload (-m). Every `interval`
+ * frames the recorder also stores a hash of the frame just drawn, which
+ * the player checks, so a session that stops reproducing is caught at
+ * the first frame that differs. On disk the frames are run-length
+ * encoded, since buttons usually stay put for many frames:
+ *
+ *   "NESM", u16 version, u32 cartridge checksum, u32 frames, u32 runs,
+ *   u32 interval, u32 hashes, runs x { u8 buttons, u16 frames },
+ *   hashes x u32                            (little-endian)
+ *
+ * Version 1 movies have no interval, hashes or hash list.
+ */
+
+#define MOVIE_VERSION      2
+#define MOVIE_INTERVAL     60   /* frames between recorded hashes */
+
+typedef struct {
+    uint32_t  checksum;  /* cartridge_t.checksum of the recorded game */
+    uint8_t  *buttons;   /* one byte per frame, BTN_* bits */
+    size_t    frames;
+    size_t    cap;
+    uint32_t  interval;  /* frames per hash; 0 = no hashes */
+    uint32_t *hashes;    /* movie_frame_hash after frame (i + 1) * interval */
+    size_t    hash_count;
+    size_t    hash_cap;
+} movie_t;
+
+/* An empty movie hashing every `interval` frames (0: never) */
+void movie_init(movie_t *m, uint32_t checksum, uint32_t interval);
+void movie_free(movie_t *m);
+
+/* Append the next frame's buttons; false if out of memory */
+bool movie_record(movie_t *m, uint8_t buttons);
+
+/* True if the frame just recorded ends on a hash: it has to be drawn
+ * into the core's framebuffer and passed to movie_checkpoint */
+static inline bool movie_checkpoint_due(const movie_t *m)
+{
+    return m->interval && m->frames % m->interval == 0;
+}
+
+/* Append the hash for the frame just run; false if out of memory */
+bool movie_checkpoint(movie_t *m, uint32_t hash);
+
+/* FNV-1a over a 256x240 ARGB frame, as stored by movie_checkpoint */
+uint32_t movie_frame_hash(const uint32_t *pixels);
+
+/* Hash recorded after `frames` frames, or false if there is none */
+static inline bool movie_hash_at(const movie_t *m, size_t frames, uint32_t *hash)
+{
+    if (!m->interval || frames == 0 || frames % m->interval)
+        return false;
+    size_t i = frames / m->interval - 1;
+    if (i >= m->hash_count)
+        return false;
+    *hash = m->hashes[i];
+    return true;
+}
+
+/* Drop frames from `frames` on, and their hashes, e.g. after rewinding */
+void movie_truncate(movie_t *m, size_t frames);
+
+bool movie_save(const movie_t *m, const char *path);
+bool movie_load(movie_t *m, const char *path);
+
+/* Buttons for `frame`; none once the movie has ended */
+static inline uint8_t movie_buttons(const movie_t *m, size_t frame)
+{
+    return frame < m->frames ? m->buttons[frame] : 0;
+}
+
+#endif
@@ -1,7 +1,96 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/* The 2A03 core is compiled into this file (at the end): no decimal
+ * mode, and accesses outside the CPU page table call nes_bus_read and
+ * nes_bus_write directly. Must come before cpu6502.h is included. */
+#define CPU6502_NO_DECIMAL
+#define CPU6502_BUS_READ  nes_bus_read
+#define CPU6502_BUS_WRITE nes_bus_write
+
 #include "nes.h"
+#include "opcodes.h"
+
+/* ---------------------------------------------------------------------------
+ * Bus profiling (NES_PROFILE builds only)
+ * ------------------------------------------------------------------------- */
+#ifdef NES_PROFILE
+nes_profile_t nes_profile;
+
+static nes_region_t bus_region(uint16_t addr)
+{
+    if (addr < 0x2000) return NES_REGION_RAM;
+    if (addr < 0x4000) return NES_REGION_PPU;
+    if (addr < 0x4020) return NES_REGION_APU_IO;
+    return NES_REGION_CART;
+}
+
+#define PROFILE_READ(addr)  (nes_profile.reads[bus_region(addr)]++)
+#define PROFILE_WRITE(addr) (nes_profile.writes[bus_region(addr)]++)
+
+void nes_profile_dump(FILE *fp)
+{
+    static const char *const names[NES_REGION_COUNT] = {
+        "RAM", "PPU", "APU/IO", "cartridge",
+    };
+
+    fprintf(fp, "Bus profile:\n  region           reads        writes\n");
+    for (int r = 0; r < NES_REGION_COUNT; r++) {
+        fprintf(fp, "  %-10s %12llu  %12llu\n", names[r],
+                (unsigned long long)nes_profile.reads[r],
+                (unsigned long long)nes_profile.writes[r]);
+    }
+#ifdef CPU6502_PROFILE
+    cpu6502_profile_dump(fp);
+#endif
+}
+#else
+#define PROFILE_READ(addr)  ((void)0)
+#define PROFILE_WRITE(addr) ((void)0)
+#endif
+
+/* ---------------------------------------------------------------------------
+ * PPU catch-up
+ *
+ * Run the PPU up to CPU cycle `target`. An NMI raised on the way is
+ * latched and taken by nes_step_frame at the next instruction boundary,
+ * which is where the per-instruction stepping used to deliver it.
+ * ------------------------------------------------------------------------- */
+static void nes_ppu_catch_up(nes_t *nes, uint64_t target)
+{
+    if (target <= nes->ppu_sync)
+        return;
+    long dots = (long)(target - nes->ppu_sync) * 3;
+    nes->ppu_sync = target;
+    nes_timing_t *timing = nes->timing;
+    uint64_t start = timing ? timing->now() : 0;
+    if (ppu_run(&nes->ppu, dots))
+        nes->nmi_pending = true;
+    if (timing)
+        timing->ppu += timing->now() - start;
+}
+
+/* Sync for a bus access from inside an instruction. The opcode's cycles
+ * are already counted by then; the access itself falls in the last one. */
+static void nes_ppu_sync_access(nes_t *nes)
+{
+    nes_ppu_catch_up(nes, nes->cpu.cycles - 1);
+}
+
+static void nes_cart_changed(nes_t *nes);
+
+/* Bring the APU up to a register access, timed like nes_ppu_sync_access */
+static void nes_apu_sync_access(nes_t *nes)
+{
+    apu_run(&nes->apu, nes->cpu.cycles - 1);
+}
+
+/* DMC sample fetches read cartridge space directly */
+static uint8_t nes_dmc_read(void *ctx, uint16_t addr)
+{
+    return cartridge_cpu_read(&((nes_t *)ctx)->cart, addr);
+}
 
 /* ---------------------------------------------------------------------------
  * NES CPU bus read ($0000-$FFFF)
@@ -11,6 +100,8 @@ uint8_t nes_bus_read(void *ctx, uint16_t addr)
 {
     nes_t *nes = (nes_t *)ctx;
 
+    PROFILE_READ(addr);
+
     if (addr < 0x2000) {
         /* $0000-$1FFF: 2KB internal RAM, mirrored every 0x0800 */
         return nes->ram[addr & 0x07FF];
@@ -18,6 +109,7 @@ uint8_t nes_bus_read(void *ctx, uint16_t addr)
 
     if (addr < 0x4000) {
         /* $2000-$3FFF: PPU registers, mirrored every 8 bytes */
+        nes_ppu_sync_access(nes);
         return ppu_cpu_read(&nes->ppu, addr & 0x0007);
     }
 
@@ -35,8 +127,13 @@ uint8_t nes_bus_read(void *ctx, uint16_t addr)
         return bit;
     }
 
+    if (addr == 0x4015) {
+        nes_apu_sync_access(nes);
+        return apu_read_status(&nes->apu);
+    }
+
     if (addr < 0x4020) {
-        /* $4000-$4015, $4018-$401F: APU/IO registers — stub */
+        /* $4000-$4014, $4018-$401F: write-only or unused */
         return 0;
     }
 
@@ -52,6 +149,8 @@ void nes_bus_write(void *ctx, uint16_t addr, uint8_t val)
 {
     nes_t *nes = (nes_t *)ctx;
 
+    PROFILE_WRITE(addr);
+
     if (addr < 0x2000) {
         /* $0000-$1FFF: 2KB internal RAM, mirrored */
         nes->ram[addr & 0x07FF] = val;
@@ -60,6 +159,7 @@ void nes_bus_write(void *ctx, uint16_t addr, uint8_t val)
 
     if (addr < 0x4000) {
         /* $2000-$3FFF: PPU registers, mirrored every 8 bytes */
+        nes_ppu_sync_access(nes);
         ppu_cpu_write(&nes->ppu, addr & 0x0007, val);
         return;
     }
@@ -68,6 +168,7 @@ void nes_bus_write(void *ctx, uint16_t addr, uint8_t val)
         /* OAM DMA: writing $XX here copies 256 bytes from page $XX00 */
         nes->dma_pending = true;
         nes->dma_page = val;
+        cpu6502_break(&nes->cpu);   /* nes_step_frame performs it */
         return;
     }
 
@@ -84,19 +185,104 @@ void nes_bus_write(void *ctx, uint16_t addr, uint8_t val)
         return;
     }
 
+    if (addr < 0x4018) {
+        /* $4000-$4013, $4015, $4017: APU. The DMC and frame counter
+         * registers can move an IRQ, so they end the CPU batch for
+         * nes_step_frame to recompute its deadline. */
+        nes_apu_sync_access(nes);
+        apu_write(&nes->apu, addr, val);
+        if (addr >= 0x4010 && addr != 0x4011 && addr != 0x4012)
+            cpu6502_break(&nes->cpu);
+        return;
+    }
+
     if (addr < 0x4020) {
-        /* $4000-$4013, $4015, $4017-$401F: APU/IO registers — stub, no-op */
+        /* $4018-$401F: unused */
         return;
     }
 
-    /* $4020-$FFFF: cartridge space */
+    /* $4020-$FFFF: cartridge space. Mapper writes can change what the
+     * PPU fetches, so it is brought up to date first. */
+    nes_ppu_sync_access(nes);
     cartridge_cpu_write(&nes->cart, addr, val);
+    if (nes->cart.dirty)
+        nes_cart_changed(nes);
+}
+
+/* ---------------------------------------------------------------------------
+ * CPU page table
+ *
+ * Internal RAM (all four mirrors), PRG RAM and the PRG ROM slots are read
+ * directly by the CPU. PPU/APU/IO pages and anything the mapper decodes
+ * stay NULL and go through nes_bus_read / nes_bus_write. ROM pages have
+ * no write entry, so writes still reach cartridge_cpu_write. The
+ * cartridge pages are remapped whenever the mapper switches PRG banks.
+ * ------------------------------------------------------------------------- */
+static void nes_map_cart_pages(nes_t *nes)
+{
+#ifdef NES_PROFILE
+    (void)nes;
+#else
+    cartridge_t *cart = &nes->cart;
+
+    if (cart->has_prg_ram)
+        cpu6502_map_pages(&nes->cpu, 0x60, 32, cart->prg_ram, cart->prg_ram);
+    for (int slot = 0; slot < 4; slot++)
+        cpu6502_map_pages(&nes->cpu, (uint8_t)(0x80 + slot * 32), 32, cart->prg_slot[slot], NULL);
+#endif
+}
+
+static void nes_map_cpu_pages(nes_t *nes)
+{
+#ifdef NES_PROFILE
+    /* Leave every page on the callbacks so every access is counted */
+    (void)nes;
+#else
+    for (int mirror = 0; mirror < 4; mirror++)
+        cpu6502_map_pages(&nes->cpu, (uint8_t)(mirror * 8), 8, nes->ram, nes->ram);
+    nes_map_cart_pages(nes);
+#endif
+}
+
+/* A mapper write changed the PRG banks or the IRQ timing. The CPU batch
+ * is ended on an IRQ change so nes_step_frame recomputes its deadline. */
+static void nes_cart_changed(nes_t *nes)
+{
+    if (nes->cart.dirty & CART_DIRTY_PRG)
+        nes_map_cart_pages(nes);
+    if (nes->cart.dirty & CART_DIRTY_IRQ)
+        cpu6502_break(&nes->cpu);
+    nes->cart.dirty = 0;
 }
 
 /* ---------------------------------------------------------------------------
  * Initialization and teardown
  * ------------------------------------------------------------------------- */
 bool nes_init(nes_t *nes, const char *rom_path)
+{
+    return nes_init_indexed(nes, rom_path, NULL);
+}
+
+/* Power-on state of everything but the cartridge, which is loaded */
+static void nes_power_on(nes_t *nes, uint32_t *framebuffer)
+{
+    ppu_init(&nes->ppu, nes);
+    nes->ppu.framebuffer = framebuffer;
+    ppu_set_output(&nes->ppu, NULL, 0);
+    apu_init(&nes->apu, nes_dmc_read, nes);
+    cpu6502_init(&nes->cpu, nes_bus_read, nes_bus_write, nes);
+#if !defined(NES_PROFILE) && !defined(CPU6502_PROFILE)
+    /* Profiles should show where the game spends its time, idle loops
+     * included */
+    nes->cpu.spin_detect = true;
+#endif
+    nes_map_cpu_pages(nes);
+    cpu6502_reset(&nes->cpu);
+    nes->ppu_sync = nes->cpu.cycles;
+    nes->apu.time = nes->apu.frame_start = nes->cpu.cycles;
+}
+
+bool nes_init_indexed(nes_t *nes, const char *rom_path, romdb_t *db)
 {
     if (!nes || !rom_path) {
         fprintf(stderr, "nes_init: NULL argument\n");
@@ -105,15 +291,30 @@ bool nes_init(nes_t *nes, const char *rom_path)
 
     memset(nes, 0, sizeof(*nes));
 
-    if (!cartridge_load(&nes->cart, rom_path)) {
+    if (!cartridge_load(&nes->cart, rom_path, db)) {
         fprintf(stderr, "nes_init: failed to load ROM '%s'\n", rom_path);
         return false;
     }
 
-    ppu_init(&nes->ppu, nes);
-    cpu6502_init(&nes->cpu, nes_bus_read, nes_bus_write, nes);
-    cpu6502_reset(&nes->cpu);
+    uint32_t *framebuffer = calloc(NES_WIDTH * NES_HEIGHT, sizeof(uint32_t));
+    if (!framebuffer) {
+        fprintf(stderr, "nes_init: out of memory\n");
+        cartridge_free(&nes->cart);
+        return false;
+    }
 
+    nes_power_on(nes, framebuffer);
+    return true;
+}
+
+bool nes_init_shared(nes_t *nes, const cartridge_t *rom)
+{
+    memset(nes, 0, sizeof(*nes));
+    if (!cartridge_clone(&nes->cart, rom)) {
+        fprintf(stderr, "nes_init_shared: out of memory\n");
+        return false;
+    }
+    nes_power_on(nes, NULL);
     return true;
 }
 
@@ -122,47 +323,272 @@ void nes_free(nes_t *nes)
     if (!nes)
         return;
     cartridge_free(&nes->cart);
+    apu_free(&nes->apu);
+    free(nes->ppu.framebuffer);
+    nes->ppu.framebuffer = NULL;
+}
+
+/* ---------------------------------------------------------------------------
+ * Idle loops
+ *
+ * Games wait for the NMI by spinning on a RAM flag (LDA flag / BEQ) or on
+ * PPUSTATUS (BIT $2002 / BPL). When cpu6502_run stops on a short loop,
+ * nes_skip_idle checks that it only reads memory that cannot change
+ * before the current batch ends: RAM and cartridge space, which only an
+ * interrupt handler could write, and PPUSTATUS up to the next time one
+ * of its bits could change. It also checks that the loop writes nothing.
+ * It then runs one iteration to measure it and to confirm that every
+ * register comes back unchanged. After that it adds whole iterations to
+ * the cycle count, stopping one iteration short of the batch end or the
+ * PPUSTATUS horizon. The machine ends up exactly where running the loop
+ * would have left it; the PPU and APU catch up as usual. A loop that
+ * cannot be skipped goes into cpu->spin_ignore for the rest of the
+ * frame, so the CPU does not keep stopping on it.
+ * ------------------------------------------------------------------------- */
+#define IDLE_MAX_INSNS 6
+
+/* Reads and compares (which leave the same registers behind on every
+ * pass), branches, JMP and NOP */
+static bool idle_opcode(uint8_t op)
+{
+    switch (op) {
+    case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9:   /* LDA */
+    case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:              /* LDX */
+    case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:              /* LDY */
+    case 0x24: case 0x2C:                                               /* BIT */
+    case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9:   /* CMP */
+    case 0xE0: case 0xE4: case 0xEC: case 0xC0: case 0xC4: case 0xCC:   /* CPX, CPY */
+    case 0x29: case 0x25: case 0x35: case 0x2D: case 0x3D: case 0x39:   /* AND */
+    case 0x09: case 0x05: case 0x15: case 0x0D: case 0x1D: case 0x19:   /* ORA */
+    case 0x10: case 0x30: case 0x50: case 0x70:
+    case 0x90: case 0xB0: case 0xD0: case 0xF0:                         /* Bxx */
+    case 0x4C: case 0xEA:                                               /* JMP, NOP */
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Code bytes come from mapped pages only; anything else is not a loop
+ * worth skipping */
+static bool idle_fetch(const cpu6502_t *cpu, uint16_t addr, uint8_t *byte)
+{
+    const uint8_t *page = cpu->read_page[addr >> 8];
+    if (!page)
+        return false;
+    *byte = page[addr & 0xFF];
+    return true;
+}
+
+/* Decode the loop at `start`: true if it is built from idle_opcode
+ * instructions ending in a jump back to start, and every operand it
+ * reads is side-effect free. *end is set past the jump back, and
+ * *status if an operand is PPUSTATUS. */
+static bool idle_loop_safe(const cpu6502_t *cpu, uint16_t start, uint16_t *end,
+                           bool *status)
+{
+    uint8_t modes[IDLE_MAX_INSNS];
+    uint16_t operands[IDLE_MAX_INSNS];
+    bool loads_x = false, loads_y = false;
+    int count = 0;
+    uint16_t pc = start;
+
+    for (;;) {
+        if (count == IDLE_MAX_INSNS)
+            return false;
+        uint8_t op, lo = 0, hi = 0;
+        if (!idle_fetch(cpu, pc, &op) || !idle_opcode(op))
+            return false;
+        int len = opcode_length(op);
+        if ((len > 1 && !idle_fetch(cpu, (uint16_t)(pc + 1), &lo)) ||
+            (len > 2 && !idle_fetch(cpu, (uint16_t)(pc + 2), &hi)))
+            return false;
+        pc = (uint16_t)(pc + len);
+
+        uint16_t operand = (uint16_t)(hi << 8 | lo);
+        if (op == 0x4C && operand != start)
+            return false;
+        if (op == 0x4C)
+            break;
+        if (opcode_modes[op] == AM_REL) {
+            uint16_t target = (uint16_t)(pc + (int8_t)lo);
+            if (target == start)
+                break;
+            if (target < pc)
+                return false;   /* only forward exits */
+            continue;
+        }
+        loads_x |= op == 0xA2 || op == 0xA6 || op == 0xB6 || op == 0xAE || op == 0xBE;
+        loads_y |= op == 0xA0 || op == 0xA4 || op == 0xB4 || op == 0xAC || op == 0xBC;
+        modes[count] = opcode_modes[op];
+        operands[count] = operand;
+        count++;
+    }
+
+    *end = pc;
+
+    /* Indexed operands use X and Y as they are between passes, which is
+     * only right if the loop does not load them itself */
+    for (int i = 0; i < count; i++) {
+        uint16_t addr;
+        switch (modes[i]) {
+        case AM_IMM: case AM_IMP:
+            continue;
+        case AM_ZPG: addr = operands[i] & 0xFF; break;
+        case AM_ABS: addr = operands[i]; break;
+        case AM_ZPX: if (loads_x) return false; addr = (operands[i] + cpu->x) & 0xFF; break;
+        case AM_ZPY: if (loads_y) return false; addr = (operands[i] + cpu->y) & 0xFF; break;
+        case AM_ABX: if (loads_x) return false; addr = (uint16_t)(operands[i] + cpu->x); break;
+        case AM_ABY: if (loads_y) return false; addr = (uint16_t)(operands[i] + cpu->y); break;
+        default:
+            return false;
+        }
+        if (addr < 0x2000 || addr >= 0x4020)
+            continue;   /* RAM, cartridge */
+        if (addr < 0x4000 && (addr & 7) == 2) {
+            *status = true;   /* PPUSTATUS: reading it again changes nothing */
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+/* The CPU stopped at the start of a loop in a batch ending at `end` */
+static void nes_skip_idle(nes_t *nes, uint64_t end)
+{
+    cpu6502_t *cpu = &nes->cpu;
+    uint16_t start = cpu->pc, last;
+    bool status = false;
+    if (!idle_loop_safe(cpu, start, &last, &status)) {
+        cpu->spin_ignore = start;
+        return;
+    }
+    uint64_t limit = end;
+    if (status) {
+        nes_ppu_catch_up(nes, cpu->cycles);
+        long dots = ppu_dots_until_status_change(&nes->ppu);
+        if ((uint64_t)dots / 3 < end - cpu->cycles)
+            limit = cpu->cycles + (uint64_t)dots / 3;
+    }
+
+    /* One pass for real, stopping where cpu6502_run would, and before
+     * anything outside the checked code */
+    uint8_t a = cpu->a, x = cpu->x, y = cpu->y, sp = cpu->sp, p = cpu->status;
+    uint64_t before = cpu->cycles;
+    cpu->spin_detect = false;
+    cpu->run_break = false;
+    for (int i = 0; i < IDLE_MAX_INSNS && cpu->cycles < end && !cpu->run_break; i++) {
+        cpu6502_step(cpu);
+        if (cpu->pc == start || cpu->pc < start || cpu->pc >= last)
+            break;
+    }
+    cpu->spin_detect = true;
+    if (cpu->pc != start || cpu->cycles >= end)
+        return;   /* the wait is over, or the batch is */
+    if (cpu->a != a || cpu->x != x || cpu->y != y || cpu->sp != sp || cpu->status != p) {
+        cpu->spin_ignore = start;
+        return;
+    }
+
+    uint64_t pass = cpu->cycles - before;
+    uint64_t passes = limit > cpu->cycles ? (limit - cpu->cycles) / pass : 0;
+    if (passes < 2) {
+        cpu->spin_ignore = start;
+        return;
+    }
+    cpu->cycles += (passes - 1) * pass;
+    nes->idle_cycles += (passes - 1) * pass;
 }
 
 /* ---------------------------------------------------------------------------
  * Run one complete frame (~29780.5 CPU cycles, 89341.5 PPU cycles)
  *
- * Keeps stepping the CPU and PPU (at 3:1 ratio) until the PPU's frame
- * counter advances. OAM DMA is handled inline when dma_pending is set.
+ * The CPU runs in batches (cpu6502_run) and the PPU is caught up lazily:
+ * on PPU register and cartridge accesses, and at the end of each batch.
+ * A batch is sized to end on the instruction during which VBlank starts,
+ * the frame ends, or the mapper's scanline counter or the APU would raise
+ * an IRQ, so interrupts are taken after the same instruction as with
+ * dot-by-dot stepping. OAM DMA writes break the batch and are performed
+ * here. While the IRQ line is held but masked, the CPU ends its batch on
+ * any instruction that clears I (cpu6502_t.irq_line). The APU is run to
+ * the CPU between batches and closes its audio frame with the video one.
  * ------------------------------------------------------------------------- */
 void nes_step_frame(nes_t *nes)
 {
+    cpu6502_t *cpu = &nes->cpu;
     uint64_t start_frame = nes->ppu.frame;
+    cpu->spin_ignore = 0;   /* a new frame: give every loop another chance */
+
+    for (;;) {
+        nes_ppu_catch_up(nes, cpu->cycles);
+        apu_run(&nes->apu, cpu->cycles);
+
+        if (nes->nmi_pending) {
+            nes->nmi_pending = false;
+            uint64_t before = cpu->cycles;
+            cpu6502_nmi(cpu);
+            /* The interrupt sequence has never been clocked into the
+             * PPU; frame timing depends on that */
+            nes->ppu_sync += cpu->cycles - before;
+        }
+        if (nes->ppu.frame != start_frame)
+            break;
+
+        cpu->irq_line = nes->cart.irq_line || apu_irq(&nes->apu);
+        if (cpu->irq_line && !cpu_get_flag(cpu, CPU_FLAG_I))
+            cpu6502_irq(cpu);
 
-    while (nes->ppu.frame == start_frame) {
         if (nes->dma_pending) {
-            /* OAM DMA: copy 256 bytes from CPU page $XX00 into OAM */
-            for (int i = 0; i < 256; i++) {
-                uint16_t src = ((uint16_t)nes->dma_page << 8) | (uint16_t)i;
-                nes->ppu.oam[i] = nes_bus_read(nes, src);
+            /* OAM DMA: copy 256 bytes from CPU page $XX00 into OAM, in
+             * one go from RAM or ROM; I/O pages go through the bus */
+            nes_timing_t *timing = nes->timing;
+            uint64_t start = timing ? timing->now() : 0;
+            const uint8_t *page = cpu->read_page[nes->dma_page];
+            if (page) {
+                memcpy(nes->ppu.oam, page, sizeof(nes->ppu.oam));
+            } else {
+                for (int i = 0; i < 256; i++) {
+                    uint16_t src = ((uint16_t)nes->dma_page << 8) | (uint16_t)i;
+                    nes->ppu.oam[i] = cpu_read(cpu, src);
+                }
             }
+            ppu_oam_changed(&nes->ppu);
             nes->dma_pending = false;
+            if (timing)
+                timing->dma += timing->now() - start;
 
             /* DMA takes ~514 CPU cycles = ~1542 PPU cycles */
-            for (int i = 0; i < 1542; i++) {
-                if (ppu_step(&nes->ppu)) {
-                    cpu6502_nmi(&nes->cpu);
-                }
-            }
-            nes->cpu.cycles += 514;
+            cpu->cycles += 514;
+            continue;
+        }
+
+        long dots = ppu_dots_until_event(&nes->ppu);
+        int clocks = cartridge_irq_clocks(&nes->cart);
+        if (clocks > 0) {
+            long irq_dots = ppu_dots_until_scanline_clock(&nes->ppu, clocks);
+            if (irq_dots < dots)
+                dots = irq_dots;
+        }
+        uint32_t apu_cycles = apu_cycles_until_irq(&nes->apu);
+        if (apu_cycles > 0 && (long)apu_cycles * 3 < dots)
+            dots = (long)apu_cycles * 3;
+        uint64_t budget = ((uint64_t)dots + 2) / 3;
+        if (cpu->halted) {
+            /* A jammed CPU does nothing, but the PPU keeps going */
+            cpu->cycles += budget;
+        } else if (nes->trace) {
+            trace_capture(nes->trace, cpu);
+            cpu6502_step(cpu);
         } else {
-            uint64_t prev = nes->cpu.cycles;
-            cpu6502_step(&nes->cpu);
-            uint64_t elapsed = nes->cpu.cycles - prev;
-
-            /* PPU runs at 3x the CPU clock */
-            for (uint64_t i = 0; i < elapsed * 3; i++) {
-                if (ppu_step(&nes->ppu)) {
-                    cpu6502_nmi(&nes->cpu);
-                }
-            }
+            uint64_t end = cpu->cycles + budget;
+            cpu6502_run(cpu, budget);
+            if (cpu->spin_detect && (cpu->spinning || cpu->trapped))
+                nes_skip_idle(nes, end);
         }
     }
+
+    apu_end_frame(&nes->apu);
 }
 
 /* ---------------------------------------------------------------------------
@@ -178,3 +604,173 @@ void nes_set_controller(nes_t *nes, int port, uint8_t buttons)
         return;
     nes->controller[port] = buttons;
 }
+
+/* ---------------------------------------------------------------------------
+ * Save states
+ *
+ * Layout: "NESS", u16 version, u32 cartridge checksum, then CPU, PPU,
+ * APU, RAM, cartridge and I/O state, all little-endian.
+ * ------------------------------------------------------------------------- */
+static const uint8_t state_magic[4] = {'N', 'E', 'S', 'S'};
+
+#define FRAME_CPU_CYCLES 29781   /* rounded up from 29780.5 */
+
+static void nes_write_state(const nes_t *nes, state_writer_t *w)
+{
+    state_put(w, state_magic, sizeof(state_magic));
+    state_put_u16(w, NES_STATE_VERSION);
+    state_put_u32(w, nes->cart.checksum);
+
+    cpu6502_save_state(&nes->cpu, w);
+    ppu_save_state(&nes->ppu, w);
+    apu_save_state(&nes->apu, w);
+    state_put(w, nes->ram, sizeof(nes->ram));
+    cartridge_save_state(&nes->cart, w);
+
+    state_put(w, nes->controller, sizeof(nes->controller));
+    state_put(w, nes->controller_shift, sizeof(nes->controller_shift));
+    state_put_u8(w, nes->controller_strobe);
+    state_put_u8(w, nes->dma_pending);
+    state_put_u8(w, nes->dma_page);
+    state_put_u16(w, nes->dma_addr);
+    state_put_u8(w, nes->dma_dummy);
+    state_put_u64(w, nes->system_cycles);
+}
+
+size_t nes_state_size(const nes_t *nes)
+{
+    state_writer_t w;
+    state_writer_init(&w, NULL, 0);
+    nes_write_state(nes, &w);
+    return w.len;
+}
+
+size_t nes_save_state(const nes_t *nes, uint8_t *buf, size_t cap)
+{
+    state_writer_t w;
+    state_writer_init(&w, buf, cap);
+    nes_write_state(nes, &w);
+    return w.error ? 0 : w.len;
+}
+
+/* Everything after the header, into `nes`; false if the data is corrupt */
+static bool decode_state(nes_t *nes, state_reader_t *r)
+{
+    cpu6502_load_state(&nes->cpu, r);
+    ppu_load_state(&nes->ppu, r);
+    apu_load_state(&nes->apu, r);
+
+    /* The APU is run up to the CPU between batches, so it is never ahead
+     * of it and never more than a frame behind. Anything else would have
+     * the next apu_run catch up for as long as it takes. */
+    if (nes->apu.time > nes->cpu.cycles ||
+        nes->cpu.cycles - nes->apu.time > FRAME_CPU_CYCLES)
+        return false;
+
+    state_get(r, nes->ram, sizeof(nes->ram));
+    cartridge_load_state(&nes->cart, r);
+    nes_map_cart_pages(nes);
+    nes->cart.dirty = 0;
+
+    state_get(r, nes->controller, sizeof(nes->controller));
+    state_get(r, nes->controller_shift, sizeof(nes->controller_shift));
+    nes->controller_strobe = state_get_u8(r) != 0;
+    nes->dma_pending = state_get_u8(r) != 0;
+    nes->dma_page = state_get_u8(r);
+    nes->dma_addr = state_get_u16(r);
+    nes->dma_dummy = state_get_u8(r) != 0;
+    nes->system_cycles = state_get_u64(r);
+    nes->ppu_sync = nes->cpu.cycles;
+    nes->nmi_pending = false;
+    return !r->error;
+}
+
+bool nes_load_state(nes_t *nes, const uint8_t *buf, size_t len)
+{
+    state_reader_t r;
+    state_reader_init(&r, buf, len);
+
+    uint8_t magic[4];
+    state_get(&r, magic, sizeof(magic));
+    uint16_t version = state_get_u16(&r);
+    uint32_t checksum = state_get_u32(&r);
+
+    if (r.error || memcmp(magic, state_magic, sizeof(magic)) != 0) {
+        fprintf(stderr, "nes_load_state: not a save state\n");
+        return false;
+    }
+    if (version != NES_STATE_VERSION) {
+        fprintf(stderr, "nes_load_state: unsupported version %u\n", version);
+        return false;
+    }
+    if (checksum != nes->cart.checksum) {
+        fprintf(stderr, "nes_load_state: state belongs to a different game\n");
+        return false;
+    }
+    if (len != nes_state_size(nes)) {
+        fprintf(stderr, "nes_load_state: truncated or oversized state\n");
+        return false;
+    }
+
+    /* Decode into a scratch copy of the machine first: a state that
+     * turns out to be corrupt must leave the running one untouched. The
+     * copy's page pointers lead into itself, so it cannot simply be
+     * copied back; a valid state is decoded a second time instead. The
+     * copy is kept off the caches and audio buffers it shares with the
+     * machine. */
+    nes_t *scratch = malloc(sizeof(*scratch));
+    if (!scratch) {
+        fprintf(stderr, "nes_load_state: out of memory\n");
+        return false;
+    }
+    nes_snapshot(nes, scratch);
+    scratch->cart.chr_valid = NULL;
+    scratch->apu.blip = NULL;
+    scratch->apu.samples = NULL;
+    scratch->apu.sample_rate = 0;
+    state_reader_t body = r;
+    bool ok = decode_state(scratch, &r);
+    free(scratch);
+    if (!ok) {
+        fprintf(stderr, "nes_load_state: corrupt state\n");
+        return false;
+    }
+    decode_state(nes, &body);
+    return true;
+}
+
+/* ---------------------------------------------------------------------------
+ * Snapshots
+ *
+ * Every pointer in nes_t points into nes_t itself (page tables, bank
+ * slots) or at things that do not change while running (the ROM image,
+ * the framebuffer and output surfaces, the trace ring, the timing), so
+ * copying the struct back into the same instance restores it exactly:
+ * no serialization, no validation, no remapping. Pixels are output, not
+ * state, and are not copied. Two heap buffers are shared rather than
+ * copied: decoded CHR RAM tiles, dropped on restore since the RAM may
+ * have been written since, and the APU synthesis buffers, which the
+ * caller keeps still by turning the sample rate off between the two
+ * (the restore turns it back on).
+ * ------------------------------------------------------------------------- */
+void nes_snapshot(const nes_t *nes, nes_t *snap)
+{
+    memcpy(snap, nes, sizeof(*snap));
+}
+
+void nes_restore(nes_t *nes, const nes_t *snap)
+{
+    memcpy(nes, snap, sizeof(*nes));
+    cartridge_chr_invalidate(&nes->cart);
+}
+
+/* ---------------------------------------------------------------------------
+ * The 2A03 core
+ *
+ * The 6502 project's CPU and opcode handlers, specialized by the macros
+ * at the top of this file. Built here, in the same translation unit as
+ * the bus, every handler's I/O and cartridge access is a direct call the
+ * compiler may inline. The 6502 targets build the same files generic.
+ * ------------------------------------------------------------------------- */
+#include "cpu6502.c"
+#include "opcodes.c"
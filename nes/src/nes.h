@@ -3,13 +3,28 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "cpu6502.h"
 #include "ppu.h"
+#include "apu.h"
 #include "cartridge.h"
+#include "trace.h"
+#include "profile.h"
+
+/* Time spent in the PPU and in OAM DMA, for frontend telemetry. `now`
+ * is any monotonic clock (SDL_GetPerformanceCounter, say); ppu and dma
+ * accumulate its ticks until the owner resets them. Costs two clock
+ * reads per PPU catch-up and per DMA while attached. */
+typedef struct {
+    uint64_t (*now)(void);
+    uint64_t ppu;
+    uint64_t dma;
+} nes_timing_t;
 
 struct nes_t {
     cpu6502_t   cpu;
     ppu_t       ppu;
+    apu_t       apu;
     cartridge_t cart;
 
     /* 2KB internal RAM */
@@ -28,13 +43,82 @@ struct nes_t {
 
     /* Timing */
     uint64_t system_cycles;
+
+    /* PPU catch-up: the PPU has been run up to this CPU cycle and owes
+     * three dots per cycle since. Brought up to date on PPU register and
+     * cartridge accesses and at VBlank/frame-end deadlines; always
+     * current between frames, so it is not part of save states. */
+    uint64_t ppu_sync;
+    bool     nmi_pending;   /* raised during a catch-up, taken at the next instruction */
+
+    /* CPU cycles fast-forwarded through idle loops (nes_skip_idle); a
+     * statistic, not part of save states */
+    uint64_t idle_cycles;
+
+    /* Optional instruction trace (not part of save states) */
+    trace_ring_t *trace;
+
+    /* Optional wall-clock breakdown of nes_step_frame (not part of save
+     * states) */
+    nes_timing_t *timing;
 };
 
 bool nes_init(nes_t *nes, const char *rom_path);
+/* nes_init looking the ROM up in (and adding it to) a ROM index */
+bool nes_init_indexed(nes_t *nes, const char *rom_path, romdb_t *db);
+/* Power on a machine running an already loaded cartridge, sharing its
+ * ROM image and decoded CHR ROM; see cartridge_clone. Fails only if a
+ * CHR RAM board's decode table cannot be allocated. The machine has no
+ * framebuffer of its own and draws only into surfaces given to
+ * ppu_set_output or ppu_set_gray_output. */
+bool nes_init_shared(nes_t *nes, const cartridge_t *rom);
 void nes_free(nes_t *nes);
 void nes_step_frame(nes_t *nes);
 void nes_set_controller(nes_t *nes, int port, uint8_t buttons);
 
+/* Versioned binary save states. The size is fixed for a given cartridge.
+ * nes_save_state returns the number of bytes written (0 if cap is too
+ * small). nes_load_state checks magic, version, game and size before
+ * touching the machine and returns false if any of them differ. */
+#define NES_STATE_VERSION 3
+size_t nes_state_size(const nes_t *nes);
+size_t nes_save_state(const nes_t *nes, uint8_t *buf, size_t cap);
+bool   nes_load_state(nes_t *nes, const uint8_t *buf, size_t len);
+
+/* In-memory snapshots for run-ahead: a plain copy of the machine, far
+ * cheaper than a save state. The framebuffer is output, not state, and
+ * is not copied. A snapshot may only be restored into the nes_t it was
+ * taken from, and is never passed to nes_free (it shares the cartridge
+ * image, CHR cache, audio buffers and framebuffer with the original).
+ * Frames run between the two must have the APU's sample rate at 0, or
+ * they overwrite the last real frame's samples. */
+void nes_snapshot(const nes_t *nes, nes_t *snap);
+void nes_restore(nes_t *nes, const nes_t *snap);
+
+#ifdef NES_PROFILE
+/* Bus accesses by region, counted in nes_bus_read / nes_bus_write. With
+ * NES_PROFILE the CPU page table is left empty so RAM and ROM accesses
+ * reach the callbacks and are counted too (cpu_peek, and so the operand
+ * bytes in traces, then read as zero). */
+typedef enum {
+    NES_REGION_RAM,     /* $0000-$1FFF */
+    NES_REGION_PPU,     /* $2000-$3FFF */
+    NES_REGION_APU_IO,  /* $4000-$401F */
+    NES_REGION_CART,    /* $4020-$FFFF */
+    NES_REGION_COUNT
+} nes_region_t;
+
+typedef struct {
+    uint64_t reads[NES_REGION_COUNT];
+    uint64_t writes[NES_REGION_COUNT];
+} nes_profile_t;
+
+extern nes_profile_t nes_profile;
+
+/* Bus region table followed by the CPU opcode/PC report */
+void nes_profile_dump(FILE *fp);
+#endif
+
 /* NES CPU bus (match bus_read_fn / bus_write_fn signatures) */
 uint8_t nes_bus_read(void *ctx, uint16_t addr);
 void    nes_bus_write(void *ctx, uint16_t addr, uint8_t val);
@@ -1,8 +1,20 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "platform_nes.h"
 #include "nes.h"
 
+const tel_metric_desc_t nes_platform_metrics[TEL_COUNT] = {
+    { "period",  "PER" },
+    { "work",    "WRK" },
+    { "cpu",     "CPU" },
+    { "ppu",     "PPU" },
+    { "dma",     "DMA" },
+    { "sleep",   "SLP" },
+    { "upload",  "UPL" },
+    { "present", "PRS" },
+};
+
 /* ---------------------------------------------------------------------------
  * Initialize the SDL2 platform: window, renderer, and streaming texture.
  * Returns false on failure with a diagnostic message to stderr.
@@ -69,14 +81,40 @@ void nes_platform_destroy(nes_platform_t *plat)
 /* ---------------------------------------------------------------------------
  * Upload the PPU framebuffer to the GPU texture and present it.
  * framebuffer is 256x240 pixels in ARGB8888 format.
+ *
+ * With telemetry, the upload and the present are timed separately, and
+ * with its overlay on the frame is copied into the locked texture and
+ * the table drawn over it there.
  * ------------------------------------------------------------------------- */
-void nes_platform_render(nes_platform_t *plat, const uint32_t *framebuffer)
+void nes_platform_render(nes_platform_t *plat, const uint32_t *framebuffer,
+                         telemetry_t *tel)
 {
-    SDL_UpdateTexture(plat->texture, NULL, framebuffer,
-                      NES_WIDTH * (int)sizeof(uint32_t));
+    Uint64 t0 = tel ? SDL_GetPerformanceCounter() : 0;
+
+    void *pixels;
+    int pitch;
+    if (tel && tel->overlay &&
+        SDL_LockTexture(plat->texture, NULL, &pixels, &pitch) == 0) {
+        for (int y = 0; y < NES_HEIGHT; y++)
+            memcpy((uint8_t *)pixels + y * pitch, framebuffer + y * NES_WIDTH,
+                   NES_WIDTH * sizeof(uint32_t));
+        telemetry_draw(tel, pixels, pitch / (int)sizeof(uint32_t), NES_WIDTH, NES_HEIGHT,
+                       0xFFFFFF00, 0xFF000000);
+        SDL_UnlockTexture(plat->texture);
+    } else {
+        SDL_UpdateTexture(plat->texture, NULL, framebuffer,
+                          NES_WIDTH * (int)sizeof(uint32_t));
+    }
+
+    Uint64 t1 = tel ? SDL_GetPerformanceCounter() : 0;
     SDL_RenderClear(plat->renderer);
     SDL_RenderCopy(plat->renderer, plat->texture, NULL, NULL);
     SDL_RenderPresent(plat->renderer);
+
+    if (tel) {
+        telemetry_add(tel, TEL_UPLOAD, t1 - t0);
+        telemetry_add(tel, TEL_PRESENT, SDL_GetPerformanceCounter() - t1);
+    }
 }
 
 /* ---------------------------------------------------------------------------
@@ -92,12 +130,16 @@ void nes_platform_render(nes_platform_t *plat, const uint32_t *framebuffer)
  *   Left arrow-> Left   (bit 6)
  *   Right arrow-> Right (bit 7)
  *
+ * Hotkeys: F5 save state, F7 load state (on press), Backspace rewind
+ * and Tab fast-forward (while held).
+ *
  * Returns false if the user requested quit (SDL_QUIT or Escape).
  * ------------------------------------------------------------------------- */
-bool nes_platform_poll_input(uint8_t *controller)
+bool nes_platform_poll_input(uint8_t *controller, unsigned *hotkeys)
 {
     SDL_Event event;
 
+    *hotkeys = 0;
     while (SDL_PollEvent(&event)) {
         if (event.type == SDL_QUIT) {
             return false;
@@ -105,6 +147,10 @@ bool nes_platform_poll_input(uint8_t *controller)
         if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) {
             return false;
         }
+        if (event.type == SDL_KEYDOWN && !event.key.repeat) {
+            if (event.key.keysym.sym == SDLK_F5) *hotkeys |= NES_HOTKEY_SAVE;
+            if (event.key.keysym.sym == SDLK_F7) *hotkeys |= NES_HOTKEY_LOAD;
+        }
     }
 
     /* Use SDL_GetKeyboardState for held-key support rather than event-based
@@ -121,6 +167,9 @@ bool nes_platform_poll_input(uint8_t *controller)
     if (keys[SDL_SCANCODE_LEFT])   buttons |= BTN_LEFT;
     if (keys[SDL_SCANCODE_RIGHT])  buttons |= BTN_RIGHT;
 
+    if (keys[SDL_SCANCODE_BACKSPACE]) *hotkeys |= NES_HOTKEY_REWIND;
+    if (keys[SDL_SCANCODE_TAB])       *hotkeys |= NES_HOTKEY_FAST;
+
     *controller = buttons;
     return true;
 }
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL.h>
+#include "telemetry.h"
 
 typedef struct {
     SDL_Window   *window;
@@ -11,9 +12,36 @@ typedef struct {
     SDL_Texture  *texture;
 } nes_platform_t;
 
+/* Frame-time metrics, numbered for telemetry_add and described in
+ * nes_platform_metrics for telemetry_init */
+typedef enum {
+    /* Emulation thread, once per loop iteration */
+    TEL_PERIOD,     /* start of one iteration to the next */
+    TEL_WORK,       /* the iteration without its sleep */
+    TEL_CPU,        /* the rest of nes_step_frame: CPU, APU, run-ahead copies */
+    TEL_PPU,        /* PPU catch-up */
+    TEL_DMA,        /* OAM DMA copies */
+    TEL_SLEEP,      /* audio_wait or SDL_Delay */
+    /* SDL thread, once per presented frame */
+    TEL_UPLOAD,     /* frame (and overlay) into the texture */
+    TEL_PRESENT,    /* RenderCopy and RenderPresent */
+    TEL_COUNT
+} tel_metric_t;
+
+extern const tel_metric_desc_t nes_platform_metrics[TEL_COUNT];
+
 bool nes_platform_init(nes_platform_t *plat, const char *title, int scale);
 void nes_platform_destroy(nes_platform_t *plat);
-void nes_platform_render(nes_platform_t *plat, const uint32_t *framebuffer);
-bool nes_platform_poll_input(uint8_t *controller);
+/* Show a frame. With telemetry (tel non-NULL) the upload and present
+ * are recorded, and the overlay is drawn over the frame if it is on. */
+void nes_platform_render(nes_platform_t *plat, const uint32_t *framebuffer,
+                         telemetry_t *tel);
+/* Frontend hotkeys reported by nes_platform_poll_input */
+#define NES_HOTKEY_SAVE   0x01   /* F5 pressed: save state */
+#define NES_HOTKEY_LOAD   0x02   /* F7 pressed: load state */
+#define NES_HOTKEY_REWIND 0x04   /* Backspace held: rewind */
+#define NES_HOTKEY_FAST   0x08   /* Tab held: fast-forward */
+
+bool nes_platform_poll_input(uint8_t *controller, unsigned *hotkeys);
 
 #endif
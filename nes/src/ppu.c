@@ -8,6 +8,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "nes.h"
 
@@ -39,6 +44,20 @@ static const uint32_t nes_palette[64] = {
 /* Forward declaration for the scanline renderer */
 static void render_scanline(ppu_t *ppu);
 
+/* Dot at which a scanline-counting mapper is clocked on lines -1..239 */
+#define SCANLINE_CLOCK_DOT 260
+
+/* Move to cycle 0 of the next scanline, wrapping into the next frame */
+static void next_scanline(ppu_t *ppu)
+{
+    ppu->cycle = 0;
+    ppu->scanline++;
+    if (ppu->scanline > 260) {
+        ppu->scanline = -1;
+        ppu->frame++;
+    }
+}
+
 /* -----------------------------------------------------------------------
  * PPU internal bus: read
  * Maps $0000-$1FFF to cartridge CHR, $2000-$3EFF to nametables,
@@ -54,21 +73,9 @@ uint8_t ppu_bus_read(ppu_t *ppu, uint16_t addr)
     }
 
     if (addr < 0x3F00) {
-        /* Nametables with mirroring */
-        addr &= 0x2FFF;  /* Handle $3000-$3EFF mirror of $2000-$2EFF */
-        uint16_t offset = addr - 0x2000;
-        uint16_t table  = offset / 0x0400;
-        uint16_t index  = offset % 0x0400;
-        uint16_t nt_index;
-
-        if (ppu->nes->cart.mirror == MIRROR_VERTICAL) {
-            /* Tables 0,2 share physical NT 0; tables 1,3 share physical NT 1 */
-            nt_index = (table & 1) * 0x0400 + index;
-        } else {
-            /* Horizontal: tables 0,1 share NT 0; tables 2,3 share NT 1 */
-            nt_index = (table / 2) * 0x0400 + index;
-        }
-        return ppu->nametable[nt_index];
+        /* Nametables, mirrored as the cartridge currently wires them
+         * ($3000-$3EFF mirrors $2000-$2EFF) */
+        return ppu->nametable[cartridge_nt_index(&ppu->nes->cart, addr)];
     }
 
     /* Palette RAM ($3F00-$3FFF) */
@@ -97,18 +104,7 @@ void ppu_bus_write(ppu_t *ppu, uint16_t addr, uint8_t val)
 
     if (addr < 0x3F00) {
         /* Nametables with mirroring */
-        addr &= 0x2FFF;
-        uint16_t offset = addr - 0x2000;
-        uint16_t table  = offset / 0x0400;
-        uint16_t index  = offset % 0x0400;
-        uint16_t nt_index;
-
-        if (ppu->nes->cart.mirror == MIRROR_VERTICAL) {
-            nt_index = (table & 1) * 0x0400 + index;
-        } else {
-            nt_index = (table / 2) * 0x0400 + index;
-        }
-        ppu->nametable[nt_index] = val;
+        ppu->nametable[cartridge_nt_index(&ppu->nes->cart, addr)] = val;
         return;
     }
 
@@ -129,6 +125,8 @@ void ppu_cpu_write(ppu_t *ppu, uint16_t addr, uint8_t val)
 {
     switch (addr & 0x07) {
     case 0: { /* $2000 PPUCTRL */
+        if ((ppu->ctrl ^ val) & 0x20)
+            ppu->sprites_dirty = true;   /* sprite size */
         ppu->ctrl = val;
         bool prev_nmi = ppu->nmi_output;
         ppu->nmi_output = (val & 0x80) != 0;
@@ -150,7 +148,10 @@ void ppu_cpu_write(ppu_t *ppu, uint16_t addr, uint8_t val)
         break;
 
     case 4: /* $2004 OAMDATA */
-        ppu->oam[ppu->oam_addr] = val;
+        if (ppu->oam[ppu->oam_addr] != val) {
+            ppu->oam[ppu->oam_addr] = val;
+            ppu->sprites_dirty = true;
+        }
         ppu->oam_addr++;
         break;
 
@@ -232,6 +233,199 @@ uint8_t ppu_cpu_read(ppu_t *ppu, uint16_t addr)
     return 0;
 }
 
+/* -----------------------------------------------------------------------
+ * Scanline helpers shared by the drawing and no-output paths
+ * ----------------------------------------------------------------------- */
+
+/* Rebuild the per-line sprite lists from OAM: the up to 8 sprites that
+ * overlap each visible line, in OAM order, and whether a ninth does
+ * (without the hardware's false positives and negatives from its buggy
+ * OAM scan). One pass over OAM instead of one per line. */
+static void build_sprite_lists(ppu_t *ppu)
+{
+    int sprite_height = (ppu->ctrl & 0x20) ? 16 : 8;
+    memset(ppu->line_count, 0, sizeof(ppu->line_count));
+    memset(ppu->line_overflow, 0, sizeof(ppu->line_overflow));
+    for (int i = 0; i < 64; i++) {
+        int top = ppu->oam[i * 4] + 1;
+        int bottom = top + sprite_height < NES_HEIGHT ? top + sprite_height : NES_HEIGHT;
+        for (int y = top; y < bottom; y++) {
+            if (ppu->line_count[y] == 8)
+                ppu->line_overflow[y] = true;
+            else
+                ppu->line_sprites[y][ppu->line_count[y]++] = (uint8_t)i;
+        }
+    }
+    ppu->sprites_dirty = false;
+}
+
+/* The sprites on scanline y, in OAM order; sets the overflow flag if
+ * there are more than 8 */
+static const uint8_t *evaluate_sprites(ppu_t *ppu, int y, int *count)
+{
+    if (ppu->sprites_dirty)
+        build_sprite_lists(ppu);
+    if (ppu->line_overflow[y])
+        ppu->status |= 0x20;
+    *count = ppu->line_count[y];
+    return ppu->line_sprites[y];
+}
+
+/* CHR address of OAM sprite i's row on scanline y */
+static uint16_t sprite_pattern_addr(const ppu_t *ppu, int i, int y, int sprite_height)
+{
+    uint8_t sy   = ppu->oam[i * 4 + 0];
+    uint8_t tile = ppu->oam[i * 4 + 1];
+    uint8_t attr = ppu->oam[i * 4 + 2];
+
+    int row = y - ((int)sy + 1);
+
+    /* Vertical flip */
+    if (attr & 0x80) row = sprite_height - 1 - row;
+
+    if (sprite_height == 8) {
+        uint16_t table = (ppu->ctrl & 0x08) ? 0x1000 : 0x0000;
+        return table + tile * 16 + row;
+    }
+    /* 8x16 sprites: bank selected by bit 0 of tile index */
+    uint16_t table    = (tile & 1) ? 0x1000 : 0x0000;
+    uint8_t  tile_num = tile & 0xFE;
+    if (row >= 8) { tile_num++; row -= 8; }
+    return table + tile_num * 16 + row;
+}
+
+/* Background pixel value (0-3) at screen column x of the current line */
+static uint8_t bg_pixel_at(ppu_t *ppu, int x)
+{
+    uint16_t v = ppu->v;
+    int px = x + ppu->fine_x;
+    int coarse_x = (v & 0x001F) + px / 8;
+    if (coarse_x >= 32) {
+        coarse_x -= 32;
+        v ^= 0x0400;   /* Crossed into the horizontal nametable */
+    }
+    v = (v & ~0x001F) | coarse_x;
+
+    uint8_t tile_id = ppu_bus_read(ppu, 0x2000 | (v & 0x0FFF));
+    uint16_t pattern_base = (ppu->ctrl & 0x10) ? 0x1000 : 0x0000;
+    const uint8_t *row = cartridge_chr_row(&ppu->nes->cart,
+                                           pattern_base + tile_id * 16 + ((v >> 12) & 0x07), false);
+    return row[px & 7];
+}
+
+/* Increment fine Y with carry into coarse Y, then reload the horizontal
+ * scroll from t for the next line */
+static void advance_v(ppu_t *ppu)
+{
+    if ((ppu->v & 0x7000) != 0x7000) {
+        ppu->v += 0x1000;
+    } else {
+        ppu->v &= ~0x7000;
+        int cy = (ppu->v & 0x03E0) >> 5;
+        if (cy == 29) {
+            cy = 0;
+            ppu->v ^= 0x0800;   /* Switch vertical nametable */
+        } else if (cy == 31) {
+            cy = 0;              /* Wrap without toggling nametable */
+        } else {
+            cy++;
+        }
+        ppu->v = (ppu->v & ~0x03E0) | (cy << 5);
+    }
+
+    ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+}
+
+/* -----------------------------------------------------------------------
+ * emit_line -- write one line of palette RAM indices to the output
+ *
+ * ARGB goes straight to the output surface. Gray is ITU-R BT.601 luma of
+ * the same colours; at half size, even lines store the mean of each pixel
+ * pair and odd lines average theirs in, so every byte ends up as the mean
+ * of a 2x2 block.
+ * ----------------------------------------------------------------------- */
+static void emit_line(ppu_t *ppu, int y, const uint8_t index[NES_WIDTH])
+{
+    uint32_t argb[32];
+    for (int i = 0; i < 32; i++)
+        argb[i] = nes_palette[ppu->palette[i] & 0x3F];
+
+    if (!ppu->gray) {
+        uint32_t *line = ppu->output + (size_t)y * ppu->output_pitch;
+        for (int x = 0; x < NES_WIDTH; x++)
+            line[x] = argb[index[x]];
+        return;
+    }
+
+    uint8_t luma[32];
+    for (int i = 0; i < 32; i++) {
+        uint32_t c = argb[i];
+        luma[i] = (uint8_t)((77 * ((c >> 16) & 0xFF) + 150 * ((c >> 8) & 0xFF) +
+                             29 * (c & 0xFF) + 128) >> 8);
+    }
+
+    if (!ppu->gray_half) {
+        uint8_t *line = ppu->gray + (size_t)y * ppu->gray_pitch;
+        for (int x = 0; x < NES_WIDTH; x++)
+            line[x] = luma[index[x]];
+        return;
+    }
+
+    uint8_t *line = ppu->gray + (size_t)(y >> 1) * ppu->gray_pitch;
+    if (!(y & 1)) {
+        for (int x = 0; x < NES_WIDTH / 2; x++)
+            line[x] = (uint8_t)((luma[index[2 * x]] + luma[index[2 * x + 1]] + 1) >> 1);
+    } else {
+        for (int x = 0; x < NES_WIDTH / 2; x++) {
+            int pair = (luma[index[2 * x]] + luma[index[2 * x + 1]] + 1) >> 1;
+            line[x] = (uint8_t)((line[x] + pair + 1) >> 1);
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * skip_scanline -- a visible line with output suppressed
+ *
+ * Produces only what the CPU can observe: the sprite overflow flag, the
+ * sprite 0 hit (by testing sprite 0's opaque pixels against the
+ * background under them) and the v register updates. No pixels are
+ * decoded and the framebuffer is left as it was.
+ * ----------------------------------------------------------------------- */
+static void skip_scanline(ppu_t *ppu)
+{
+    int y = ppu->scanline;
+
+    if (ppu->mask & 0x10) {
+        int sprite_height = (ppu->ctrl & 0x20) ? 16 : 8;
+        int count;
+        const uint8_t *indices = evaluate_sprites(ppu, y, &count);
+
+        /* Sprite 0 is first in OAM order if it is on this line at all */
+        if (count > 0 && indices[0] == 0 && (ppu->mask & 0x08) && !(ppu->status & 0x40)) {
+            uint8_t attr = ppu->oam[2];
+            int sx = ppu->oam[3];
+            const uint8_t *pixels = cartridge_chr_row(&ppu->nes->cart,
+                sprite_pattern_addr(ppu, 0, y, sprite_height), (attr & 0x40) != 0);
+            /* Left 8 pixels are clipped unless both layers show there */
+            int min_x = (ppu->mask & 0x06) == 0x06 ? 0 : 8;
+
+            for (int px = 0; px < 8; px++) {
+                int x = sx + px;
+                if (x >= 255)
+                    break;   /* no hit at x = 255 */
+                if (x < min_x || pixels[px] == 0)
+                    continue;
+                if (bg_pixel_at(ppu, x) != 0) {
+                    ppu->status |= 0x40;
+                    break;
+                }
+            }
+        }
+    }
+
+    advance_v(ppu);
+}
+
 /* -----------------------------------------------------------------------
  * render_scanline -- renders a full 256-pixel row (background + sprites)
  *
@@ -243,15 +437,22 @@ static void render_scanline(ppu_t *ppu)
 {
     int y = ppu->scanline;
 
-    /* Background pixel/palette buffers for compositing */
-    uint8_t bg_pixel[256];
-    uint8_t bg_palette[256];
-    memset(bg_pixel, 0, sizeof(bg_pixel));
-    memset(bg_palette, 0, sizeof(bg_palette));
+    /* Background pixel/palette buffers for compositing. Whole tiles are
+     * stored at tile * 8 - fine_x; the 8-byte margins take the parts
+     * scrolled off either edge. */
+    uint8_t bg_pixel_buf[8 + 33 * 8];
+    uint8_t bg_palette_buf[8 + 33 * 8];
+    uint8_t *bg_pixel = bg_pixel_buf + 8;
+    uint8_t *bg_palette = bg_palette_buf + 8;
+    memset(bg_pixel_buf, 0, sizeof(bg_pixel_buf));
+    memset(bg_palette_buf, 0, sizeof(bg_palette_buf));
+
+    cartridge_t *cart = &ppu->nes->cart;
 
     /* --- Background rendering --- */
     if (ppu->mask & 0x08) {
         uint16_t v = ppu->v;
+        uint16_t pattern_base = (ppu->ctrl & 0x10) ? 0x1000 : 0x0000;
 
         /* Render 33 tiles (one extra for fine-X scrolling overshoot) */
         for (int tile = 0; tile < 33; tile++) {
@@ -268,23 +469,12 @@ static void render_scanline(ppu_t *ppu)
             uint8_t shift = ((v >> 4) & 0x04) | (v & 0x02);
             uint8_t pal = (attr_byte >> shift) & 0x03;
 
-            /* Pattern table address */
-            uint16_t pattern_base = (ppu->ctrl & 0x10) ? 0x1000 : 0x0000;
+            /* Pre-decoded tile row from the CHR cache */
             uint8_t fine_y = (v >> 12) & 0x07;
-            uint8_t plane0 = ppu_bus_read(ppu, pattern_base + tile_id * 16 + fine_y);
-            uint8_t plane1 = ppu_bus_read(ppu, pattern_base + tile_id * 16 + fine_y + 8);
-
-            /* Decode 8 pixels from the tile row */
-            for (int px = 0; px < 8; px++) {
-                int screen_x = tile * 8 + px - ppu->fine_x;
-                if (screen_x < 0 || screen_x >= 256) continue;
-
-                int bit = 7 - px;
-                uint8_t pixel = (uint8_t)(((plane1 >> bit) & 1) << 1
-                              | ((plane0 >> bit) & 1));
-                bg_pixel[screen_x]   = pixel;
-                bg_palette[screen_x] = pal;
-            }
+            const uint8_t *row = cartridge_chr_row(cart, pattern_base + tile_id * 16 + fine_y, false);
+            int screen_x = tile * 8 - ppu->fine_x;
+            memcpy(bg_pixel + screen_x, row, 8);
+            memset(bg_palette + screen_x, pal, 8);
 
             /* Increment coarse X in the local v copy */
             if ((v & 0x001F) == 31) {
@@ -297,134 +487,114 @@ static void render_scanline(ppu_t *ppu)
     }
 
     /* --- Sprite evaluation and rendering --- */
-    uint8_t spr_color[256];
-    uint8_t spr_priority[256];   /* 0 = in front of BG, 1 = behind BG */
-    uint8_t spr_opaque[256];
+    uint8_t spr_index[256];      /* palette RAM index, 0 = transparent */
+    uint8_t spr_behind[256];     /* 0 = in front of BG, 1 = behind BG */
     uint8_t spr_zero[256];
-    memset(spr_opaque, 0, sizeof(spr_opaque));
+    memset(spr_index, 0, sizeof(spr_index));
+    memset(spr_behind, 0, sizeof(spr_behind));
     memset(spr_zero, 0, sizeof(spr_zero));
 
     if (ppu->mask & 0x10) {
         int sprite_height = (ppu->ctrl & 0x20) ? 16 : 8;
-        int count = 0;
-
-        /* Find up to 8 sprites that overlap this scanline */
-        int sprite_indices[8];
-        for (int i = 0; i < 64 && count < 8; i++) {
-            uint8_t sy = ppu->oam[i * 4];
-            int row = y - ((int)sy + 1);
-            if (row >= 0 && row < sprite_height) {
-                sprite_indices[count++] = i;
-            }
-        }
+        int count;
+        const uint8_t *sprite_indices = evaluate_sprites(ppu, y, &count);
 
         /* Render in reverse order so lower-index sprites overwrite higher
          * (lower OAM index = higher priority, painted last) */
         for (int s = count - 1; s >= 0; s--) {
             int i        = sprite_indices[s];
-            uint8_t sy   = ppu->oam[i * 4 + 0];
-            uint8_t tile = ppu->oam[i * 4 + 1];
             uint8_t attr = ppu->oam[i * 4 + 2];
             uint8_t sx   = ppu->oam[i * 4 + 3];
 
-            int row = y - ((int)sy + 1);
-
-            /* Vertical flip */
-            if (attr & 0x80) row = sprite_height - 1 - row;
-
-            /* Compute pattern address */
-            uint16_t pattern_addr;
-            if (sprite_height == 8) {
-                uint16_t table = (ppu->ctrl & 0x08) ? 0x1000 : 0x0000;
-                pattern_addr = table + tile * 16 + row;
-            } else {
-                /* 8x16 sprites: bank selected by bit 0 of tile index */
-                uint16_t table    = (tile & 1) ? 0x1000 : 0x0000;
-                uint8_t  tile_num = tile & 0xFE;
-                if (row >= 8) { tile_num++; row -= 8; }
-                pattern_addr = table + tile_num * 16 + row;
-            }
-
-            uint8_t plane0 = ppu_bus_read(ppu, pattern_addr);
-            uint8_t plane1 = ppu_bus_read(ppu, pattern_addr + 8);
+            /* Horizontal flip comes from the mirrored copy in the cache */
+            uint16_t pattern_addr = sprite_pattern_addr(ppu, i, y, sprite_height);
+            const uint8_t *pixels = cartridge_chr_row(cart, pattern_addr, (attr & 0x40) != 0);
 
             for (int px = 0; px < 8; px++) {
-                int bit = (attr & 0x40) ? px : (7 - px);  /* Horizontal flip */
-                uint8_t pixel = (uint8_t)(((plane1 >> bit) & 1) << 1
-                              | ((plane0 >> bit) & 1));
+                uint8_t pixel = pixels[px];
                 if (pixel == 0) continue;  /* Transparent */
 
                 int screen_x = sx + px;
                 if (screen_x >= 256) continue;
 
-                uint8_t spr_pal = attr & 0x03;
-                uint16_t pal_addr = 0x10 + spr_pal * 4 + pixel;
-                /* Mirror sprite background ($10) to universal BG ($00) */
-                if (pal_addr == 0x10) pal_addr = 0x00;
-
-                spr_color[screen_x]    = ppu->palette[pal_addr];
-                spr_priority[screen_x] = (attr >> 5) & 1;
-                spr_opaque[screen_x]   = 1;
+                /* pixel != 0, so this never lands on a $3F1x mirror */
+                spr_index[screen_x]  = (uint8_t)(0x10 + (attr & 0x03) * 4 + pixel);
+                spr_behind[screen_x] = (attr >> 5) & 1;
                 if (i == 0) spr_zero[screen_x] = 1;
             }
         }
     }
 
     /* --- Composite background and sprites into the framebuffer --- */
-    for (int x = 0; x < 256; x++) {
-        bool show_bg  = (bg_pixel[x] != 0)
-                      && (ppu->mask & 0x08)
-                      && (x >= 8 || (ppu->mask & 0x02));
-        bool show_spr = spr_opaque[x]
-                      && (ppu->mask & 0x10)
-                      && (x >= 8 || (ppu->mask & 0x04));
 
-        /* Sprite 0 hit detection */
-        if (show_bg && show_spr && spr_zero[x] && x != 255) {
-            ppu->status |= 0x40;
-        }
+    /* Left-column clipping: hide the layer in pixels 0-7. Disabled layers
+     * were never drawn, so these buffers already hold transparent pixels. */
+    if (!(ppu->mask & 0x02))
+        memset(bg_pixel, 0, 8);
+    if (!(ppu->mask & 0x04))
+        memset(spr_index, 0, 8);
+
+    /* Resolve every pixel to a palette RAM index first, then to ARGB
+     * through a per-scanline table, so the colour lookup is branch-free */
+    uint8_t index[256];
+    int hit = 0;
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= 256; x += 16) {
+        __m128i bp  = _mm_loadu_si128((const __m128i *)(bg_pixel + x));
+        __m128i pal = _mm_loadu_si128((const __m128i *)(bg_palette + x));
+        __m128i si  = _mm_loadu_si128((const __m128i *)(spr_index + x));
+        __m128i sb  = _mm_loadu_si128((const __m128i *)(spr_behind + x));
+        __m128i sz  = _mm_loadu_si128((const __m128i *)(spr_zero + x));
+
+        __m128i bg_clear  = _mm_cmpeq_epi8(bp, zero);
+        __m128i spr_clear = _mm_cmpeq_epi8(si, zero);
+        /* palette * 4 + pixel; values are below 4, so no bits cross lanes */
+        __m128i bg_idx  = _mm_andnot_si128(bg_clear, _mm_or_si128(_mm_slli_epi16(pal, 2), bp));
+        /* Sprite wins when opaque and either in front or over clear BG */
+        __m128i use_spr = _mm_andnot_si128(spr_clear,
+                              _mm_or_si128(bg_clear, _mm_cmpeq_epi8(sb, zero)));
+        __m128i out = _mm_or_si128(_mm_and_si128(use_spr, si), _mm_andnot_si128(use_spr, bg_idx));
+        _mm_storeu_si128((__m128i *)(index + x), out);
+
+        __m128i both = _mm_andnot_si128(_mm_or_si128(bg_clear, spr_clear),
+                                        _mm_cmpgt_epi8(sz, zero));
+        int bits = _mm_movemask_epi8(both);
+        if (x == 240)
+            bits &= 0x7FFF;        /* no hit at x = 255 */
+        hit |= bits;
+    }
+#endif
+    for (; x < 256; x++) {
+        bool bg_on  = bg_pixel[x] != 0;
+        bool spr_on = spr_index[x] != 0;
 
-        uint8_t color;
-        if (!show_bg && !show_spr) {
-            /* Neither BG nor sprite: use universal background color */
-            color = ppu->palette[0];
-        } else if (show_spr && !show_bg) {
-            color = spr_color[x];
-        } else if (!show_spr && show_bg) {
-            color = ppu->palette[bg_palette[x] * 4 + bg_pixel[x]];
-        } else {
-            /* Both opaque: sprite priority decides */
-            if (spr_priority[x] == 0) {
-                color = spr_color[x];       /* Sprite in front */
-            } else {
-                color = ppu->palette[bg_palette[x] * 4 + bg_pixel[x]];
-            }
-        }
+        /* Sprite 0 hit detection */
+        if (bg_on && spr_on && spr_zero[x] && x != 255)
+            hit = 1;
 
-        ppu->framebuffer[y * NES_WIDTH + x] = nes_palette[color & 0x3F];
+        if (spr_on && (!bg_on || !spr_behind[x]))
+            index[x] = spr_index[x];
+        else
+            index[x] = bg_on ? (uint8_t)(bg_palette[x] * 4 + bg_pixel[x]) : 0;
     }
+    if (hit)
+        ppu->status |= 0x40;
 
-    /* --- Post-scanline v register updates --- */
+    emit_line(ppu, y, index);
 
-    /* Increment fine Y, with carry into coarse Y */
-    if ((ppu->v & 0x7000) != 0x7000) {
-        ppu->v += 0x1000;
-    } else {
-        ppu->v &= ~0x7000;
-        int cy = (ppu->v & 0x03E0) >> 5;
-        if (cy == 29) {
-            cy = 0;
-            ppu->v ^= 0x0800;   /* Switch vertical nametable */
-        } else if (cy == 31) {
-            cy = 0;              /* Wrap without toggling nametable */
-        } else {
-            cy++;
-        }
-        ppu->v = (ppu->v & ~0x03E0) | (cy << 5);
-    }
+    /* --- Post-scanline v register updates --- */
+    advance_v(ppu);
+}
 
-    /* Copy horizontal bits from t into v (reset X scroll for next line) */
-    ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+/* A visible line with rendering disabled shows the backdrop colour.
+ * Every line is written each drawn frame, so an output surface never
+ * keeps pixels from whatever frame it held last. */
+static void draw_backdrop(ppu_t *ppu)
+{
+    static const uint8_t backdrop[NES_WIDTH];   /* all palette entry 0 */
+    emit_line(ppu, ppu->scanline, backdrop);
 }
 
 /* -----------------------------------------------------------------------
@@ -451,8 +621,14 @@ bool ppu_step(ppu_t *ppu)
         }
     } else if (ppu->scanline >= 0 && ppu->scanline < 240) {
         /* Visible scanlines */
+        bool draw = !ppu->skip_output && (ppu->output || ppu->gray);
         if (ppu->cycle == 0 && rendering_enabled) {
-            render_scanline(ppu);
+            if (draw)
+                render_scanline(ppu);
+            else
+                skip_scanline(ppu);
+        } else if (ppu->cycle == 0 && draw) {
+            draw_backdrop(ppu);
         }
     } else if (ppu->scanline == 241 && ppu->cycle == 1) {
         /* VBlank start */
@@ -463,20 +639,136 @@ bool ppu_step(ppu_t *ppu)
         }
     }
 
+    /* Mapper scanline counter (MMC3): PPU A12 rises once per rendered
+     * line, at the sprite pattern fetches */
+    if (ppu->cycle == SCANLINE_CLOCK_DOT && ppu->scanline < 240 && rendering_enabled)
+        cartridge_scanline(&ppu->nes->cart);
+
     /* Advance to the next cycle/scanline */
     ppu->cycle++;
-    if (ppu->cycle > 340) {
-        ppu->cycle = 0;
-        ppu->scanline++;
-        if (ppu->scanline > 260) {
-            ppu->scanline = -1;
-            ppu->frame++;
-        }
+    if (ppu->cycle > 340)
+        next_scanline(ppu);
+
+    return nmi_triggered;
+}
+
+/* -----------------------------------------------------------------------
+ * Catch-up execution
+ *
+ * Between CPU accesses nothing can change what the PPU will do, so only
+ * the dots where ppu_step does work need to be stepped: the flag clear
+ * and vertical copy on the pre-render line, cycle 0 of each visible line,
+ * the mapper scanline clock (if the cartridge has a counter) and VBlank
+ * start. Everything else is skipped in one jump per line.
+ * ----------------------------------------------------------------------- */
+#define DOTS_PER_LINE  341
+#define DOTS_PER_FRAME (262 * DOTS_PER_LINE)
+
+/* First cycle >= the current one at which ppu_step has an effect, or
+ * DOTS_PER_LINE if the rest of the line is idle */
+static int next_event_cycle(const ppu_t *ppu)
+{
+    int c = ppu->cycle;
+    bool counter = ppu->nes->cart.scanline_counter;
+
+    if (ppu->scanline == -1) {
+        if (c <= 1)
+            return 1;
+        if (counter && c <= SCANLINE_CLOCK_DOT)
+            return SCANLINE_CLOCK_DOT;
+        if (c <= 304)
+            return c < 280 ? 280 : c;
+    } else if (ppu->scanline < 240) {
+        if (c == 0)
+            return 0;
+        if (counter && c <= SCANLINE_CLOCK_DOT)
+            return SCANLINE_CLOCK_DOT;
+    } else if (ppu->scanline == 241) {
+        if (c <= 1)
+            return 1;
     }
+    return DOTS_PER_LINE;
+}
+
+bool ppu_run(ppu_t *ppu, long dots)
+{
+    bool nmi_triggered = false;
+
+    while (dots > 0) {
+        int next = next_event_cycle(ppu);
+        if (next == ppu->cycle) {
+            nmi_triggered |= ppu_step(ppu);
+            dots--;
+            continue;
+        }
 
+        long n = next - ppu->cycle;
+        if (n > dots)
+            n = dots;
+        ppu->cycle += (int)n;
+        dots -= n;
+        if (ppu->cycle == DOTS_PER_LINE)
+            next_scanline(ppu);
+    }
     return nmi_triggered;
 }
 
+/* Dots from the current position through position (scanline, cycle) */
+static long dots_through(const ppu_t *ppu, int scanline, int cycle)
+{
+    long here = (long)(ppu->scanline + 1) * DOTS_PER_LINE + ppu->cycle;
+    long there = (long)(scanline + 1) * DOTS_PER_LINE + cycle;
+    return (there - here + DOTS_PER_FRAME) % DOTS_PER_FRAME + 1;
+}
+
+long ppu_dots_until_event(const ppu_t *ppu)
+{
+    long vblank = dots_through(ppu, 241, 1);
+    long frame_end = dots_through(ppu, 260, 340);
+    return vblank < frame_end ? vblank : frame_end;
+}
+
+long ppu_dots_until_status_change(ppu_t *ppu)
+{
+    /* Dot 1 of the pre-render line clears all three flags */
+    if (ppu->scanline == -1 && ppu->cycle <= 1)
+        return 0;
+    bool hit = !(ppu->status & 0x40), overflow = !(ppu->status & 0x20);
+    if (ppu->scanline >= NES_HEIGHT || !(ppu->mask & 0x10) || (!hit && !overflow))
+        return LONG_MAX;
+
+    /* Visible lines set sprite 0 hit and overflow at dot 0; find the
+     * first line still to come that has sprite 0 on it (if the hit is
+     * still clear) or nine sprites (if overflow is) */
+    int first = ppu->cycle == 0 ? ppu->scanline : ppu->scanline + 1;
+    if (first < 0)
+        first = 0;
+    if (ppu->sprites_dirty)
+        build_sprite_lists(ppu);
+    for (int y = first; y < NES_HEIGHT; y++) {
+        if ((hit && ppu->line_count[y] > 0 && ppu->line_sprites[y][0] == 0) ||
+            (overflow && ppu->line_overflow[y]))
+            return (long)(y - ppu->scanline) * DOTS_PER_LINE - ppu->cycle;
+    }
+    return LONG_MAX;
+}
+
+long ppu_dots_until_scanline_clock(const ppu_t *ppu, int n)
+{
+    /* Clock points are dot 260 of lines -1..239: 241 per frame, point k
+     * at frame position k * DOTS_PER_LINE + 260 */
+    const long points = 241;
+    long here = (long)(ppu->scanline + 1) * DOTS_PER_LINE + ppu->cycle;
+    long k = here <= SCANLINE_CLOCK_DOT
+           ? 0 : (here - SCANLINE_CLOCK_DOT + DOTS_PER_LINE - 1) / DOTS_PER_LINE;
+    if (k > points)
+        k = points;   /* past line 239: the next frame's first point */
+    k += n - 1;
+    long there = (k / points) * DOTS_PER_FRAME
+               + (k % points) * DOTS_PER_LINE + SCANLINE_CLOCK_DOT;
+    return there - here + 1;
+}
+
 /* -----------------------------------------------------------------------
  * ppu_init / ppu_reset
  * ----------------------------------------------------------------------- */
@@ -485,6 +777,26 @@ void ppu_init(ppu_t *ppu, nes_t *nes)
     memset(ppu, 0, sizeof(*ppu));
     ppu->nes      = nes;
     ppu->scanline = -1;
+    ppu->sprites_dirty = true;
+    ppu_set_output(ppu, NULL, 0);
+}
+
+void ppu_set_output(ppu_t *ppu, uint32_t *pixels, int pitch)
+{
+    if (pixels) {
+        ppu->output       = pixels;
+        ppu->output_pitch = pitch;
+    } else {
+        ppu->output       = ppu->framebuffer;
+        ppu->output_pitch = NES_WIDTH;
+    }
+}
+
+void ppu_set_gray_output(ppu_t *ppu, uint8_t *pixels, int pitch, bool half)
+{
+    ppu->gray       = pixels;
+    ppu->gray_pitch = pitch;
+    ppu->gray_half  = half;
 }
 
 void ppu_reset(ppu_t *ppu)
@@ -509,7 +821,64 @@ void ppu_reset(ppu_t *ppu)
     memset(ppu->nametable,   0, sizeof(ppu->nametable));
     memset(ppu->palette,     0, sizeof(ppu->palette));
     memset(ppu->oam,         0, sizeof(ppu->oam));
-    memset(ppu->framebuffer, 0, sizeof(ppu->framebuffer));
+    ppu->sprites_dirty = true;
+    if (ppu->framebuffer)
+        memset(ppu->framebuffer, 0, NES_WIDTH * NES_HEIGHT * sizeof(uint32_t));
 
     ppu->nes = nes;
 }
+
+/* -----------------------------------------------------------------------
+ * Save states
+ * ----------------------------------------------------------------------- */
+void ppu_save_state(const ppu_t *ppu, state_writer_t *w)
+{
+    state_put(w, ppu->nametable, sizeof(ppu->nametable));
+    state_put(w, ppu->palette, sizeof(ppu->palette));
+    state_put(w, ppu->oam, sizeof(ppu->oam));
+    state_put_u8(w, ppu->ctrl);
+    state_put_u8(w, ppu->mask);
+    state_put_u8(w, ppu->status);
+    state_put_u8(w, ppu->oam_addr);
+    state_put_u16(w, ppu->v);
+    state_put_u16(w, ppu->t);
+    state_put_u8(w, ppu->fine_x);
+    state_put_u8(w, ppu->w);
+    state_put_u8(w, ppu->data_buf);
+    state_put_u16(w, (uint16_t)ppu->scanline);
+    state_put_u16(w, (uint16_t)ppu->cycle);
+    state_put_u64(w, ppu->frame);
+    state_put_u8(w, ppu->nmi_occurred);
+    state_put_u8(w, ppu->nmi_output);
+}
+
+void ppu_load_state(ppu_t *ppu, state_reader_t *r)
+{
+    /* Decode into a copy and keep it only if it is valid, so a rejected
+     * state leaves the PPU as it was */
+    ppu_t next = *ppu;
+    state_get(r, next.nametable, sizeof(next.nametable));
+    state_get(r, next.palette, sizeof(next.palette));
+    state_get(r, next.oam, sizeof(next.oam));
+    next.ctrl     = state_get_u8(r);
+    next.mask     = state_get_u8(r);
+    next.status   = state_get_u8(r);
+    next.oam_addr = state_get_u8(r);
+    next.v        = state_get_u16(r) & 0x7FFF;
+    next.t        = state_get_u16(r) & 0x7FFF;
+    next.fine_x   = state_get_u8(r) & 0x07;
+    next.w        = state_get_u8(r) != 0;
+    next.data_buf = state_get_u8(r);
+    next.scanline = (int16_t)state_get_u16(r);
+    next.cycle    = (int16_t)state_get_u16(r);
+    next.frame    = state_get_u64(r);
+    next.nmi_occurred = state_get_u8(r) != 0;
+    next.nmi_output   = state_get_u8(r) != 0;
+    next.sprites_dirty = true;
+
+    /* Keep a corrupt state from walking the renderer off its tables */
+    if (next.scanline < -1 || next.scanline > 260 || next.cycle < 0 || next.cycle > 340)
+        r->error = true;
+    if (!r->error)
+        *ppu = next;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "state.h"
 
 #define NES_WIDTH  256
 #define NES_HEIGHT 240
@@ -39,17 +40,90 @@ typedef struct {
     bool nmi_occurred;
     bool nmi_output;
 
-    /* Output framebuffer: 256x240 pixels as ARGB8888 */
-    uint32_t framebuffer[NES_WIDTH * NES_HEIGHT];
+    /* Sprites on each visible line, first 8 in OAM order, and whether a
+     * ninth sets the overflow flag there. Built from OAM on first use
+     * after sprites_dirty is set: by $2004 writes, sprite size changes,
+     * OAM DMA (ppu_oam_changed) and state loads. */
+    uint8_t line_sprites[NES_HEIGHT][8];
+    uint8_t line_count[NES_HEIGHT];
+    bool    line_overflow[NES_HEIGHT];
+    bool    sprites_dirty;
+
+    /* Output framebuffer: 256x240 pixels as ARGB8888, owned by nes_t.
+     * NULL for machines that only ever draw into a caller's surface. */
+    uint32_t *framebuffer;
+
+    /* Where visible lines are drawn: framebuffer unless ppu_set_output
+     * pointed it at a caller's surface. Nothing is drawn while NULL. */
+    uint32_t *output;
+    int       output_pitch;   /* in pixels */
+
+    /* ppu_set_gray_output: 8-bit luminance instead of ARGB, optionally
+     * averaged down to 128x120. Takes precedence over output. */
+    uint8_t  *gray;
+    int       gray_pitch;     /* in bytes */
+    bool      gray_half;
+
+    /* No-output mode for frame skipping: visible lines update only what
+     * the CPU can observe (sprite 0 hit, sprite overflow, scrolling) and
+     * the output keeps its previous contents. Set by the frontend
+     * before each frame; not part of save states. */
+    bool skip_output;
 
     /* Back-pointer to NES for CHR access */
     nes_t *nes;
 } ppu_t;
 
 void    ppu_init(ppu_t *ppu, nes_t *nes);
+
+/* Draw visible lines into `pixels` (256x240 ARGB8888, `pitch` pixels per
+ * row) instead of framebuffer, e.g. a texture or a frame queue slot, so
+ * no copy is needed to display them. May be changed between frames;
+ * NULL goes back to framebuffer. The pointer is not carried by save
+ * states, and a copied ppu_t still points at the original's buffer. */
+void    ppu_set_output(ppu_t *ppu, uint32_t *pixels, int pitch);
+
+/* Draw luminance (0-255) into `pixels` instead, one byte per pixel:
+ * 256x240, or with `half` 128x120 with each byte the mean of a 2x2
+ * block. Observations for agents that do not need colour, at a quarter
+ * or a sixteenth of the ARGB size. NULL goes back to ppu_set_output's
+ * surface. Like the ARGB output, not part of save states. */
+void    ppu_set_gray_output(ppu_t *ppu, uint8_t *pixels, int pitch, bool half);
 void    ppu_reset(ppu_t *ppu);
 bool    ppu_step(ppu_t *ppu);  /* returns true if NMI should fire */
 
+/* Advance by `dots` PPU cycles with the same result as that many
+ * ppu_step calls, skipping idle stretches of each scanline. Returns true
+ * if VBlank raised an NMI on the way. */
+bool    ppu_run(ppu_t *ppu, long dots);
+
+/* Dots until VBlank start or the end of the frame has been processed,
+ * whichever is sooner (always >= 1). The CPU may run this long without
+ * the PPU before an NMI or a frame boundary could be missed. */
+long    ppu_dots_until_event(const ppu_t *ppu);
+
+/* Dots before a PPUSTATUS bit could change other than at the
+ * ppu_dots_until_event events (sprite 0 hit, overflow, the pre-render
+ * clear); LONG_MAX if none can this frame. May be early, never late. */
+long    ppu_dots_until_status_change(ppu_t *ppu);
+
+/* OAM was written other than through $2004 (OAM DMA) */
+static inline void ppu_oam_changed(ppu_t *ppu)
+{
+    ppu->sprites_dirty = true;
+}
+
+/* Dots through the n-th (n >= 1) next mapper scanline clock, if
+ * rendering stays enabled until then. With rendering off the counter
+ * does not run, so the real clock can only come later. */
+long    ppu_dots_until_scanline_clock(const ppu_t *ppu, int n);
+
+/* Save states cover VRAM, OAM and all registers. The framebuffer is not
+ * saved; it is fully redrawn by the next frame. A load that fails sets
+ * r->error and leaves the PPU unchanged. */
+void    ppu_save_state(const ppu_t *ppu, state_writer_t *w);
+void    ppu_load_state(ppu_t *ppu, state_reader_t *r);
+
 /* CPU-facing register interface (addr is 0-7) */
 uint8_t ppu_cpu_read(ppu_t *ppu, uint16_t addr);
 void    ppu_cpu_write(ppu_t *ppu, uint16_t addr, uint8_t val);
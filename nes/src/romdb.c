@@ -0,0 +1,224 @@
+/*
+ * romdb.c — on-disk index of iNES headers and checksums
+ *
+ * File layout (little-endian):
+ *   "NESRDB" 0x00 0x01          magic and version
+ *   u32 count
+ *   count x { u64 dev, u64 ino, u64 size, u64 mtime_ns,
+ *             u8 header[16], u32 checksum }
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "romdb.h"
+#include "state.h"
+
+static const uint8_t romdb_magic[8] = { 'N', 'E', 'S', 'R', 'D', 'B', 0x00, 0x01 };
+
+#define ENTRY_BYTES (4 * 8 + ROMDB_HEADER_SIZE + 4)
+
+bool romdb_key_fd(int fd, romdb_key_t *key)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return false;
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = (uint64_t)st.st_ino;
+    key->size = (uint64_t)st.st_size;
+    key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+static uint64_t key_hash(const romdb_key_t *key)
+{
+    /* splitmix64 finalizer over the fields that vary most */
+    uint64_t h = key->ino * 0x9E3779B97F4A7C15ull ^ key->dev ^ (uint64_t)key->mtime_ns;
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+static bool key_equal(const romdb_key_t *a, const romdb_key_t *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime_ns == b->mtime_ns;
+}
+
+void romdb_init(romdb_t *db)
+{
+    memset(db, 0, sizeof(*db));
+}
+
+void romdb_free(romdb_t *db)
+{
+    free(db->slots);
+    romdb_init(db);
+}
+
+/* Linear probing; the table is kept at most half full */
+static romdb_entry_t *probe(const romdb_t *db, const romdb_key_t *key)
+{
+    size_t mask = db->cap - 1;
+    for (size_t i = (size_t)key_hash(key) & mask;; i = (i + 1) & mask) {
+        romdb_entry_t *e = &db->slots[i];
+        if (!e->used || key_equal(&e->key, key))
+            return e;
+    }
+}
+
+static bool grow(romdb_t *db)
+{
+    size_t cap = db->cap ? db->cap * 2 : 64;
+    romdb_entry_t *slots = calloc(cap, sizeof(*slots));
+    if (!slots) {
+        fprintf(stderr, "romdb: out of memory\n");
+        return false;
+    }
+
+    romdb_t bigger = { slots, cap, 0, db->dirty };
+    for (size_t i = 0; i < db->cap; i++) {
+        if (db->slots[i].used) {
+            *probe(&bigger, &db->slots[i].key) = db->slots[i];
+            bigger.count++;
+        }
+    }
+    free(db->slots);
+    *db = bigger;
+    return true;
+}
+
+const romdb_entry_t *romdb_find(const romdb_t *db, const romdb_key_t *key)
+{
+    if (db->count == 0)
+        return NULL;
+    const romdb_entry_t *e = probe(db, key);
+    return e->used ? e : NULL;
+}
+
+bool romdb_insert(romdb_t *db, const romdb_key_t *key,
+                  const uint8_t header[ROMDB_HEADER_SIZE], uint32_t checksum)
+{
+    if ((db->count + 1) * 2 > db->cap && !grow(db))
+        return false;
+
+    romdb_entry_t *e = probe(db, key);
+    if (!e->used)
+        db->count++;
+    e->key = *key;
+    memcpy(e->header, header, ROMDB_HEADER_SIZE);
+    e->checksum = checksum;
+    e->used = true;
+    db->dirty = true;
+    return true;
+}
+
+bool romdb_load(romdb_t *db, const char *path)
+{
+    romdb_free(db);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return errno == ENOENT;   /* no index yet */
+
+    uint8_t head[12];
+    state_reader_t r;
+    bool ok = fread(head, 1, sizeof(head), fp) == sizeof(head) &&
+              memcmp(head, romdb_magic, sizeof(romdb_magic)) == 0;
+    uint32_t count = 0;
+    uint8_t *buf = NULL;
+    if (ok) {
+        state_reader_init(&r, head + 8, 4);
+        count = state_get_u32(&r);
+        buf = malloc((size_t)count * ENTRY_BYTES + 1);
+        ok = buf && fread(buf, ENTRY_BYTES, count, fp) == count;
+    }
+    fclose(fp);
+
+    if (ok) {
+        state_reader_init(&r, buf, (size_t)count * ENTRY_BYTES);
+        for (uint32_t i = 0; i < count && ok; i++) {
+            romdb_key_t key;
+            uint8_t header[ROMDB_HEADER_SIZE];
+            key.dev = state_get_u64(&r);
+            key.ino = state_get_u64(&r);
+            key.size = state_get_u64(&r);
+            key.mtime_ns = (int64_t)state_get_u64(&r);
+            state_get(&r, header, sizeof(header));
+            ok = romdb_insert(db, &key, header, state_get_u32(&r));
+        }
+    }
+    free(buf);
+
+    if (!ok) {
+        fprintf(stderr, "romdb_load: '%s' is not a valid ROM index\n", path);
+        romdb_free(db);
+        return false;
+    }
+    db->dirty = false;
+    return true;
+}
+
+bool romdb_save(romdb_t *db, const char *path)
+{
+    if (!db->dirty)
+        return true;
+
+    size_t len = 12 + db->count * ENTRY_BYTES;
+    uint8_t *buf = malloc(len);
+    if (!buf) {
+        fprintf(stderr, "romdb_save: out of memory\n");
+        return false;
+    }
+
+    state_writer_t w;
+    state_writer_init(&w, buf, len);
+    state_put(&w, romdb_magic, sizeof(romdb_magic));
+    state_put_u32(&w, (uint32_t)db->count);
+    for (size_t i = 0; i < db->cap; i++) {
+        const romdb_entry_t *e = &db->slots[i];
+        if (!e->used)
+            continue;
+        state_put_u64(&w, e->key.dev);
+        state_put_u64(&w, e->key.ino);
+        state_put_u64(&w, e->key.size);
+        state_put_u64(&w, (uint64_t)e->key.mtime_ns);
+        state_put(&w, e->header, sizeof(e->header));
+        state_put_u32(&w, e->checksum);
+    }
+
+    /* Write a sibling file and rename it over the index, so concurrent
+     * readers see either the old index or the new one. The name is unique
+     * to this process and call, and O_EXCL refuses to reuse a leftover,
+     * so concurrent writers never share a temp file; the last rename
+     * wins. */
+    static unsigned serial;
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.%u.tmp", path, (long)getpid(),
+             __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED));
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (fd >= 0 && !fp)
+        close(fd);
+    bool ok = fp && fwrite(buf, 1, w.len, fp) == w.len;
+    if (fp && fclose(fp) != 0)
+        ok = false;
+    free(buf);
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "romdb_save: failed to write '%s'\n", path);
+        if (fd >= 0)
+            remove(tmp);
+        return false;
+    }
+    db->dirty = false;
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* On-disk ROM index.
+ *
+ * Maps a file's identity (device, inode, size, modification time) to its
+ * iNES header and game checksum, so loading a ROM that has been seen
+ * before needs neither the header parse nor a pass over all of PRG/CHR.
+ * Any change to the file changes its identity, and a stale entry is
+ * simply never found again.
+ *
+ * The index is an in-memory hash table; romdb_load reads it from disk
+ * (a missing file is an empty index) and romdb_save writes it back
+ * atomically if anything was added. A romdb_t is not thread-safe: share
+ * one read-only, or give each thread its own. */
+
+#define ROMDB_HEADER_SIZE 16
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime_ns;
+} romdb_key_t;
+
+typedef struct {
+    romdb_key_t key;
+    uint8_t     header[ROMDB_HEADER_SIZE];   /* iNES header as on disk */
+    uint32_t    checksum;                    /* cartridge_t.checksum */
+    bool        used;
+} romdb_entry_t;
+
+typedef struct {
+    romdb_entry_t *slots;
+    size_t         cap;     /* power of two, 0 when empty */
+    size_t         count;
+    bool           dirty;   /* entries added since romdb_load */
+} romdb_t;
+
+/* Identity of an open file; false if it cannot be stat'ed */
+bool romdb_key_fd(int fd, romdb_key_t *key);
+
+void romdb_init(romdb_t *db);
+void romdb_free(romdb_t *db);
+
+/* Replace the contents of db with the index stored at path. A missing
+ * file leaves db empty and succeeds; a corrupt one is reported. */
+bool romdb_load(romdb_t *db, const char *path);
+bool romdb_save(romdb_t *db, const char *path);
+
+const romdb_entry_t *romdb_find(const romdb_t *db, const romdb_key_t *key);
+bool romdb_insert(romdb_t *db, const romdb_key_t *key,
+                  const uint8_t header[ROMDB_HEADER_SIZE], uint32_t checksum);
+
+#endif
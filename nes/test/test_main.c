@@ -0,0 +1,57 @@
+#include <stdio.h>
+
+/* ------------------------------------------------------------------ */
+/*  Extern declarations for the test functions in test_*.c            */
+/* ------------------------------------------------------------------ */
+
+/* Save states */
+extern int test_state_roundtrip(void);
+extern int test_state_cycles_corrupt(void);
+
+/* Mappers */
+extern int test_mapper_mmc1_chr_alias(void);
+extern int test_mapper_mmc3_chr_alias(void);
+
+/* ------------------------------------------------------------------ */
+/*  Test runner                                                       */
+/* ------------------------------------------------------------------ */
+
+typedef int (*test_fn)(void);
+
+typedef struct {
+    const char *name;
+    test_fn fn;
+} test_entry;
+
+int main(void)
+{
+    test_entry tests[] = {
+        /* Save states */
+        {"state_roundtrip",       test_state_roundtrip},
+        {"state_cycles_corrupt",  test_state_cycles_corrupt},
+
+        /* Mappers */
+        {"mapper_mmc1_chr_alias", test_mapper_mmc1_chr_alias},
+        {"mapper_mmc3_chr_alias", test_mapper_mmc3_chr_alias},
+    };
+
+    int total = (int)(sizeof(tests) / sizeof(tests[0]));
+    int passed = 0;
+    int failed = 0;
+
+    for (int i = 0; i < total; i++) {
+        if (tests[i].fn() == 0) {
+            passed++;
+        } else {
+            fprintf(stderr, "  FAILED: %s\n", tests[i].name);
+            failed++;
+        }
+    }
+
+    printf("\n%d/%d tests passed", passed, total);
+    if (failed > 0)
+        printf(", %d FAILED", failed);
+    printf("\n");
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/cartridge.h"
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+#define ASSERT(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); return 1; } } while (0)
+
+/* Load a 32 KB PRG, CHR RAM cartridge on the given mapper */
+static bool load_chr_ram_cart(cartridge_t *cart, uint8_t mapper)
+{
+    static uint8_t image[16 + 32768];
+    memset(image, 0, sizeof(image));
+    memcpy(image, "NES\x1A", 4);
+    image[4] = 2;                   /* PRG banks */
+    image[5] = 0;                   /* CHR RAM */
+    image[6] = (uint8_t)(mapper << 4);
+    image[7] = (uint8_t)(mapper & 0xF0);
+
+    char path[] = "/tmp/nes_test_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, image, sizeof(image)) == (ssize_t)sizeof(image);
+    close(fd);
+    memset(cart, 0, sizeof(*cart));
+    ok = ok && cartridge_load(cart, path, NULL);
+    unlink(path);
+    return ok;
+}
+
+/* Shift a 5-bit value into an MMC1 register, low bit first */
+static void mmc1_write_reg(cartridge_t *cart, uint16_t addr, uint8_t val)
+{
+    for (int i = 0; i < 5; i++)
+        cartridge_cpu_write(cart, addr, (uint8_t)((val >> i) & 1));
+}
+
+/* Decode tile row `read` through the cache, write a pattern byte through
+ * `write` and decode `read` again: both slots show the same bank, so the
+ * second decode has to see the write */
+static int check_alias(cartridge_t *cart, uint16_t write, uint16_t read, const char *name)
+{
+    ASSERT(cartridge_chr_read(cart, read) == 0, "%s: CHR RAM not clear\n", name);
+    const uint8_t *row = cartridge_chr_row(cart, read, false);
+    ASSERT(row[0] == 0, "%s: pixel %u before the write\n", name, row[0]);
+
+    cartridge_chr_write(cart, write, 0x80);
+    ASSERT(cartridge_chr_read(cart, read) == 0x80, "%s: slots not aliased\n", name);
+    row = cartridge_chr_row(cart, read, false);
+    ASSERT(row[0] == 1, "%s: stale tile, pixel %u expected 1\n", name, row[0]);
+    return 0;
+}
+
+/* ================================================================== */
+/*  CHR RAM aliasing                                                  */
+/* ================================================================== */
+
+/* MMC1 4KB CHR mode with both registers on bank 0: $0000 and $1000
+ * show the same 4KB of CHR RAM */
+int test_mapper_mmc1_chr_alias(void)
+{
+    static cartridge_t cart;
+    ASSERT(load_chr_ram_cart(&cart, 1), "test_mapper_mmc1_chr_alias: load failed\n");
+
+    mmc1_write_reg(&cart, 0x8000, 0x1C);    /* 4KB CHR, 16KB PRG */
+    mmc1_write_reg(&cart, 0xA000, 0);
+    mmc1_write_reg(&cart, 0xC000, 0);
+    int result = check_alias(&cart, 0x0010, 0x1010, "test_mapper_mmc1_chr_alias");
+
+    cartridge_free(&cart);
+    return result;
+}
+
+/* MMC3 on 8KB of CHR RAM: R3 = 11 wraps to the bank R2 = 3 selects, so
+ * $1000 and $1400 show the same 1KB */
+int test_mapper_mmc3_chr_alias(void)
+{
+    static cartridge_t cart;
+    ASSERT(load_chr_ram_cart(&cart, 4), "test_mapper_mmc3_chr_alias: load failed\n");
+
+    cartridge_cpu_write(&cart, 0x8000, 2);
+    cartridge_cpu_write(&cart, 0x8001, 3);
+    cartridge_cpu_write(&cart, 0x8000, 3);
+    cartridge_cpu_write(&cart, 0x8001, 11);
+    int result = check_alias(&cart, 0x1020, 0x1420, "test_mapper_mmc3_chr_alias");
+
+    cartridge_free(&cart);
+    return result;
+}
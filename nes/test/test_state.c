@@ -0,0 +1,121 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/nes.h"
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+#define ASSERT(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); return 1; } } while (0)
+
+/* Offset of cpu.cycles in a state: "NESS", u16 version, u32 checksum,
+ * then A, X, Y, SP, u16 PC and P ahead of it */
+#define STATE_CPU_CYCLES 17
+
+/* Write a 16 KB NROM image whose reset handler spins on JMP $8000 */
+static int write_rom(char *path)
+{
+    static uint8_t image[16 + 16384 + 8192];
+    memset(image, 0, sizeof(image));
+    memcpy(image, "NES\x1A", 4);
+    image[4] = 1;                   /* PRG banks */
+    image[5] = 1;                   /* CHR banks */
+
+    uint8_t *prg = image + 16;
+    prg[0x0000] = 0x4C;             /* JMP $8000 */
+    prg[0x0001] = 0x00;
+    prg[0x0002] = 0x80;
+    prg[0x3FFA] = 0x00;             /* NMI   -> $8000 */
+    prg[0x3FFB] = 0x80;
+    prg[0x3FFC] = 0x00;             /* RESET -> $8000 */
+    prg[0x3FFD] = 0x80;
+    prg[0x3FFE] = 0x00;             /* IRQ   -> $8000 */
+    prg[0x3FFF] = 0x80;
+
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    FILE *f = fdopen(fd, "wb");
+    if (!f || fwrite(image, sizeof(image), 1, f) != 1) {
+        if (f)
+            fclose(f);
+        return -1;
+    }
+    return fclose(f);
+}
+
+/* Power on, run a few frames and save; returns the state size or 0 */
+static size_t setup(nes_t *nes, char *path, uint8_t **state)
+{
+    if (write_rom(path) != 0 || !nes_init(nes, path))
+        return 0;
+    for (int i = 0; i < 3; i++)
+        nes_step_frame(nes);
+
+    size_t len = nes_state_size(nes);
+    *state = malloc(len);
+    if (!*state || nes_save_state(nes, *state, len) != len)
+        return 0;
+    return len;
+}
+
+static void teardown(nes_t *nes, char *path, uint8_t *state)
+{
+    free(state);
+    nes_free(nes);
+    unlink(path);
+}
+
+/* ================================================================== */
+/*  Save states                                                       */
+/* ================================================================== */
+
+int test_state_roundtrip(void)
+{
+    static nes_t nes;
+    char path[] = "/tmp/nes_test_XXXXXX";
+    uint8_t *state = NULL;
+    size_t len = setup(&nes, path, &state);
+    ASSERT(len > 0, "test_state_roundtrip: setup failed\n");
+
+    uint64_t cycles = nes.cpu.cycles;
+    nes_step_frame(&nes);
+    int ok = nes_load_state(&nes, state, len);
+    uint64_t loaded = nes.cpu.cycles;
+    teardown(&nes, path, state);
+
+    ASSERT(ok, "test_state_roundtrip: valid state rejected\n");
+    ASSERT(loaded == cycles, "test_state_roundtrip: cycles=%llu expected %llu\n",
+           (unsigned long long)loaded, (unsigned long long)cycles);
+    return 0;
+}
+
+/* cpu.cycles far past apu.time would have apu_run catch up forever */
+int test_state_cycles_corrupt(void)
+{
+    static nes_t nes;
+    char path[] = "/tmp/nes_test_XXXXXX";
+    uint8_t *state = NULL;
+    size_t len = setup(&nes, path, &state);
+    ASSERT(len > 0, "test_state_cycles_corrupt: setup failed\n");
+
+    uint64_t cycles = nes.cpu.cycles;
+    int accepted = 0;
+    for (int byte = 2; byte < 8; byte++) {
+        state[STATE_CPU_CYCLES + byte] ^= 0x01;
+        accepted += nes_load_state(&nes, state, len);
+        state[STATE_CPU_CYCLES + byte] ^= 0x01;
+    }
+    uint64_t after = nes.cpu.cycles;
+    teardown(&nes, path, state);
+
+    ASSERT(accepted == 0, "test_state_cycles_corrupt: %d corrupt states accepted\n", accepted);
+    ASSERT(after == cycles, "test_state_cycles_corrupt: machine changed by a rejected load\n");
+    return 0;
+}
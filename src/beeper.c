@@ -0,0 +1,61 @@
+#include "beeper.h"
+#include <string.h>
+
+#define FRAME_HZ        60
+#define FRAME_MAX       1024    /* samples: 48 kHz / 60 Hz plus the drift */
+#define BEEP_HZ         440.0
+#define BEEP_AMPLITUDE  6000.0
+#define BEEP_RAMP_MS    5.0     /* gain fade at start and stop */
+
+void beeper_init(beeper_t *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+/* polyBLEP residual: smooths the square's edges so it carries no
+ * harmonics above Nyquist to alias back down as a buzz */
+static double poly_blep(double t, double dt) {
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0;
+    }
+    if (t > 1.0 - dt) {
+        t = (t - 1.0) / dt;
+        return t * t + t + t + 1.0;
+    }
+    return 0.0;
+}
+
+void beeper_frame(beeper_t *b, audio_t *a, bool on, uint32_t target) {
+    /* Rate control: a short queue gets a slightly longer frame */
+    double len = (double)a->rate / FRAME_HZ * audio_rate_ratio(a, target) + b->carry;
+    uint32_t n = (uint32_t)len;
+    b->carry = len - n;
+
+    const double dt = BEEP_HZ / a->rate;
+    const double ramp = 1000.0 / (BEEP_RAMP_MS * a->rate);
+    int16_t samples[FRAME_MAX];
+    while (n > 0) {
+        uint32_t chunk = n < FRAME_MAX ? n : FRAME_MAX;
+        for (uint32_t i = 0; i < chunk; i++) {
+            if (on && b->gain < 1.0)
+                b->gain = b->gain + ramp < 1.0 ? b->gain + ramp : 1.0;
+            else if (!on && b->gain > 0.0)
+                b->gain = b->gain - ramp > 0.0 ? b->gain - ramp : 0.0;
+
+            double v = 0.0;
+            if (b->gain > 0.0) {
+                double half = b->phase + 0.5;
+                if (half >= 1.0) half -= 1.0;
+                v = (b->phase < 0.5 ? 1.0 : -1.0)
+                  + poly_blep(b->phase, dt) - poly_blep(half, dt);
+                b->phase += dt;
+                if (b->phase >= 1.0) b->phase -= 1.0;
+            } else {
+                b->phase = 0.0;
+            }
+            samples[i] = (int16_t)(v * b->gain * BEEP_AMPLITUDE);
+        }
+        audio_write(a, samples, chunk);
+        n -= chunk;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include "audio.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The CHIP-8 beeper: a band-limited 440 Hz square while the sound timer
+ * runs, queued into the shared audio ring one 60 Hz frame at a time.
+ * Frame lengths follow audio_rate_ratio, so the emulated 60 Hz tracks the
+ * sound card's clock. */
+
+typedef struct {
+    double phase;       /* 0..1 through the current square cycle */
+    double gain;        /* 0..1, ramped to avoid clicks at start and stop */
+    double carry;       /* fractional samples owed to the next frame */
+} beeper_t;
+
+void beeper_init(beeper_t *b);
+
+/* Queue one frame of output, lengthened or shortened to steer the queue
+ * toward `target` samples. Samples that do not fit are dropped. */
+void beeper_frame(beeper_t *b, audio_t *a, bool on, uint32_t target);
+
+#endif
@@ -0,0 +1,287 @@
+/* bench.c -- CHIP-8 throughput benchmark with JSON output
+ *
+ * Runs each workload for a fixed number of instructions through every
+ * engine: the interpreter (chip8_cycle), the block JIT when the host has
+ * a backend, and the SoA batch engine. Timers tick every TICK_CYCLES
+ * instructions, as a 500 Hz ROM would see at 60 Hz. Each engine gets
+ * warm-up runs, then timed repetitions reported as mean/stddev/min/max.
+ *
+ * Two built-in ROMs always run, so the suite needs no files; ROMs given
+ * on the command line are added after them.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "chip8_batch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPS   5
+#define DEFAULT_CYCLES 20000000LL
+#define DEFAULT_BATCH  64
+#define MAX_REPS       100
+#define TICK_CYCLES    8       /* ~500 Hz / 60 Hz */
+#define ROM_MAX        (CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START)
+
+typedef struct {
+    const char *name;
+    uint8_t data[ROM_MAX];
+    size_t size;
+} workload_t;
+
+/* Full-screen sprite sweep: DXYN-bound, with a wrapping draw every row */
+static const uint8_t rom_sprites[] = {
+    0x60, 0x00, 0x61, 0x00, 0xA3, 0x00, 0xD0, 0x1F,   /* 200 */
+    0x70, 0x08, 0x30, 0x40, 0x12, 0x06, 0x60, 0x00,   /* 208 */
+    0x71, 0x0F, 0x31, 0x1E, 0x12, 0x06, 0x61, 0x00,   /* 210 */
+    0x72, 0x01, 0x12, 0x06,                           /* 218 */
+};
+static const uint8_t rom_sprites_data[15] = {        /* at 0x300 */
+    0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF,
+    0x3C, 0x42, 0x99, 0xA5, 0x99, 0x42, 0x3C,
+};
+
+/* Register ALU loop: 8XYN, 7XNN, skips and FX1E, no drawing */
+static const uint8_t rom_alu[] = {
+    0x60, 0x01, 0x61, 0x03, 0x80, 0x14, 0x81, 0x05,   /* 200 */
+    0x82, 0x06, 0x83, 0x0E, 0x84, 0x12, 0x85, 0x11,   /* 208 */
+    0x86, 0x13, 0x77, 0x05, 0x47, 0x00, 0x78, 0x01,   /* 210 */
+    0xF8, 0x1E, 0x90, 0x10, 0x6A, 0x00, 0x12, 0x04,   /* 218 */
+};
+
+typedef enum { ENGINE_INTERP, ENGINE_JIT, ENGINE_BATCH, ENGINE_COUNT } engine_t;
+
+static const char *const engine_names[ENGINE_COUNT] = { "interp", "jit", "batch" };
+
+typedef struct {
+    long warmup;
+    long reps;
+    long long cycles;   /* instructions per run (per instance for batch) */
+    long batch;         /* instances for the batch engine */
+} options_t;
+
+static void print_usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] [rom...]\n"
+        "  -w N      warm-up runs per benchmark (default: %d)\n"
+        "  -r N      measured repetitions (default: %d, max %d)\n"
+        "  -c N      instructions per run (default: %lld)\n"
+        "  -batch N  instances for the batch engine (default: %d)\n",
+        prog, DEFAULT_WARMUP, DEFAULT_REPS, MAX_REPS, DEFAULT_CYCLES, DEFAULT_BATCH);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Mean, sample stddev, min and max as a JSON object member */
+static void print_stats(const char *key, const double *v, long n) {
+    double mean = 0.0, ss = 0.0, lo = v[0], hi = v[0];
+    for (long i = 0; i < n; i++) {
+        mean += v[i];
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+    mean /= n;
+    for (long i = 0; i < n; i++)
+        ss += (v[i] - mean) * (v[i] - mean);
+    double stddev = n > 1 ? sqrt(ss / (n - 1)) : 0.0;
+
+    printf("\"%s\": {\"mean\": %.1f, \"stddev\": %.1f, \"min\": %.1f, \"max\": %.1f}",
+           key, mean, stddev, lo, hi);
+}
+
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            printf("\\%c", *p);
+        else if (*p < 0x20)
+            printf("\\u%04x", *p);
+        else
+            putchar(*p);
+    }
+    putchar('"');
+}
+
+static bool load_workload(workload_t *w, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open ROM: %s\n", path);
+        return false;
+    }
+    w->name = path;
+    w->size = fread(w->data, 1, sizeof(w->data), f);
+    bool too_large = fgetc(f) != EOF;
+    fclose(f);
+
+    if (w->size == 0 || too_large) {
+        fprintf(stderr, "%s: ROM is empty or larger than %d bytes\n", path, ROM_MAX);
+        return false;
+    }
+    return true;
+}
+
+/* Fresh machine with the workload loaded (chip8_load_rom would re-read
+ * the file and print a banner for every repetition) */
+static void start_workload(chip8_t *chip, const workload_t *w) {
+    chip8_init(chip, 0);
+    memcpy(&chip->memory[CHIP8_PROGRAM_START], w->data, w->size);
+    chip8_invalidate(chip, 0, CHIP8_MEMORY_SIZE);
+}
+
+/* One timed run; returns elapsed seconds, or a negative value if the
+ * engine is unavailable */
+static double run_once(const options_t *opt, const workload_t *w, engine_t engine,
+                       chip8_t *chip) {
+    chip8_jit_t *jit = NULL;
+    chip8_batch_t *batch = NULL;
+
+    start_workload(chip, w);
+    if (engine == ENGINE_JIT) {
+        jit = chip8_jit_create(chip);
+        if (!jit)
+            return -1.0;
+    } else if (engine == ENGINE_BATCH) {
+        batch = chip8_batch_create((int)opt->batch, 1);
+        if (!batch)
+            return -1.0;
+        for (int i = 0; i < opt->batch; i++)
+            chip8_batch_import(batch, i, chip);
+    }
+
+    double start = now_seconds();
+    for (long long done = 0; done < opt->cycles; done += TICK_CYCLES) {
+        long n = opt->cycles - done < TICK_CYCLES ? (long)(opt->cycles - done) : TICK_CYCLES;
+        switch (engine) {
+        case ENGINE_INTERP:
+            for (long i = 0; i < n; i++)
+                chip8_cycle(chip);
+            chip8_tick_timers(chip);
+            break;
+        case ENGINE_JIT:
+            chip8_jit_run(jit, n);
+            chip8_tick_timers(chip);
+            break;
+        default:
+            chip8_batch_run(batch, n);
+            chip8_batch_tick_timers(batch);
+            break;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    chip8_jit_destroy(jit);
+    chip8_batch_destroy(batch);
+    return elapsed;
+}
+
+static bool parse_long(const char *s, long long min, long long *out) {
+    char *end;
+    long long v = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < min)
+        return false;
+    *out = v;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opt = { DEFAULT_WARMUP, DEFAULT_REPS, DEFAULT_CYCLES, DEFAULT_BATCH };
+    int argi = 1;
+
+    while (argi < argc && argv[argi][0] == '-') {
+        long long v;
+        if (argi + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        const char *flag = argv[argi], *val = argv[argi + 1];
+
+        if (strcmp(flag, "-w") == 0 && parse_long(val, 0, &v)) {
+            opt.warmup = (long)v;
+        } else if (strcmp(flag, "-r") == 0 && parse_long(val, 1, &v) && v <= MAX_REPS) {
+            opt.reps = (long)v;
+        } else if (strcmp(flag, "-c") == 0 && parse_long(val, 1, &v)) {
+            opt.cycles = v;
+        } else if (strcmp(flag, "-batch") == 0 && parse_long(val, 1, &v)) {
+            opt.batch = (long)v;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+        argi += 2;
+    }
+
+    int count = 2 + (argc - argi);
+    workload_t *workloads = calloc((size_t)count, sizeof(workload_t));
+    chip8_t *chip = malloc(sizeof(chip8_t));
+    if (!workloads || !chip) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    workloads[0].name = "sprites";
+    memcpy(workloads[0].data, rom_sprites, sizeof(rom_sprites));
+    memcpy(workloads[0].data + 0x100, rom_sprites_data, sizeof(rom_sprites_data));
+    workloads[0].size = 0x100 + sizeof(rom_sprites_data);
+    workloads[1].name = "alu";
+    memcpy(workloads[1].data, rom_alu, sizeof(rom_alu));
+    workloads[1].size = sizeof(rom_alu);
+    for (int i = argi; i < argc; i++) {
+        if (!load_workload(&workloads[2 + i - argi], argv[i]))
+            return 1;
+    }
+
+    printf("{\n  \"suite\": \"chip8\",\n  \"warmup\": %ld,\n  \"reps\": %ld,\n"
+           "  \"cycles\": %lld,\n  \"batch\": %ld,\n  \"results\": [",
+           opt.warmup, opt.reps, opt.cycles, opt.batch);
+
+    bool first = true;
+    for (int wi = 0; wi < count; wi++) {
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            double rate[MAX_REPS];
+            double instances = e == ENGINE_BATCH ? (double)opt.batch : 1.0;
+            bool available = true;
+
+            fprintf(stderr, "%s/%s: ", workloads[wi].name, engine_names[e]);
+            for (long k = 0; k < opt.warmup + opt.reps; k++) {
+                double t = run_once(&opt, &workloads[wi], (engine_t)e, chip);
+                if (t < 0.0) {
+                    available = false;
+                    break;
+                }
+                if (k >= opt.warmup)
+                    rate[k - opt.warmup] = (double)opt.cycles * instances / t;
+            }
+            if (!available) {
+                fprintf(stderr, "not available on this host\n");
+                continue;
+            }
+            double mean = 0.0;
+            for (long k = 0; k < opt.reps; k++)
+                mean += rate[k] / (double)opt.reps;
+            fprintf(stderr, "%.1f Mcycles/s\n", mean / 1e6);
+
+            printf("%s\n    {\"rom\": ", first ? "" : ",");
+            print_json_string(workloads[wi].name);
+            printf(", \"engine\": \"%s\", \"instances\": %.0f,\n     ",
+                   engine_names[e], instances);
+            print_stats("cycles_per_sec", rate, opt.reps);
+            printf("}");
+            first = false;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    free(workloads);
+    free(chip);
+    return 0;
+}
@@ -2,7 +2,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 
 static const uint8_t fontset[80] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -23,11 +22,11 @@ static const uint8_t fontset[80] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80, // F
 };
 
-void chip8_init(chip8_t *chip) {
+void chip8_init(chip8_t *chip, uint64_t seed) {
     memset(chip, 0, sizeof(chip8_t));
     chip->pc = CHIP8_PROGRAM_START;
     memcpy(chip->memory, fontset, sizeof(fontset));
-    srand(time(NULL));
+    chip->rng_state = seed;
 }
 
 bool chip8_load_rom(chip8_t *chip, const char *path) {
@@ -50,6 +49,9 @@ bool chip8_load_rom(chip8_t *chip, const char *path) {
     size_t bytes_read = fread(&chip->memory[CHIP8_PROGRAM_START], 1, size, f);
     fclose(f);
 
+    /* Everything previously decoded is stale now */
+    chip8_invalidate(chip, 0, CHIP8_MEMORY_SIZE);
+
     if ((long)bytes_read != size) {
         fprintf(stderr, "ROM read incomplete: got %zu of %ld bytes\n", bytes_read, size);
         return false;
@@ -59,284 +61,552 @@ bool chip8_load_rom(chip8_t *chip, const char *path) {
     return true;
 }
 
-void chip8_cycle(chip8_t *chip) {
-    /* Bounds check: PC must have room for a 2-byte opcode */
-    if (chip->pc > CHIP8_MEMORY_SIZE - 2) {
-        fprintf(stderr, "PC out of bounds: 0x%04X\n", chip->pc);
+void chip8_invalidate(chip8_t *chip, uint16_t addr, uint16_t len) {
+    chip->code_gen++;
+    if (len >= CHIP8_MEMORY_SIZE) {
+        memset(chip->decoded, 0, sizeof(chip->decoded));
         return;
     }
+    /* An entry at even address A covers bytes A and A+1, so a write to
+     * any byte only ever touches the entry at (byte & ~1). */
+    for (uint16_t i = 0; i < len; i++)
+        chip->decoded[((addr + i) & 0xFFF) >> 1].fn = NULL;
+}
 
-    /* Fetch: read two bytes from memory at PC (big-endian) */
-    uint16_t opcode = (chip->memory[chip->pc] << 8) | chip->memory[chip->pc + 1];
+/* Store a byte and drop the cached decode for the instruction it lands in */
+static inline void mem_write(chip8_t *chip, uint16_t addr, uint8_t val) {
+    addr &= 0xFFF;
+    chip->memory[addr] = val;
+    if (chip->decoded[addr >> 1].fn) {
+        chip->decoded[addr >> 1].fn = NULL;
+        chip->code_gen++;
+    }
+}
 
-    /* Common bit extractions used by many instructions */
-    uint8_t x   = (opcode >> 8) & 0x0F;   /* second nibble  */
-    uint8_t y   = (opcode >> 4) & 0x0F;   /* third nibble   */
-    uint8_t n   =  opcode       & 0x0F;   /* fourth nibble  */
-    uint8_t nn  =  opcode       & 0xFF;   /* lower byte     */
-    uint16_t nnn =  opcode       & 0x0FFF; /* lower 12 bits  */
+/* ======================================================================
+ * Instruction handlers
+ *
+ * Each receives the pre-decoded operands. PC has already been advanced
+ * past the instruction; jumps, skips, calls and FX0A override it.
+ * ====================================================================== */
 
-    /* Advance PC past this instruction before executing.
-     * Instructions that modify PC (jumps, skips, calls, FX0A) will
-     * override this as needed. */
-    chip->pc += 2;
+static void op_unknown(chip8_t *chip, const chip8_op_t *op) {
+    (void)chip;
+    fprintf(stderr, "Unknown opcode: 0x%04X\n", op->opcode);
+}
 
-    /* Decode and execute */
-    switch (opcode & 0xF000) {
+/* 00E0 - Clear display */
+static void op_cls(chip8_t *chip, const chip8_op_t *op) {
+    (void)op;
+    memset(chip->display, 0, sizeof(chip->display));
+    chip->draw_flag = true;
+}
 
-    case 0x0000:
-        switch (opcode) {
-        case 0x00E0: /* 00E0 - Clear display */
-            memset(chip->display, 0, sizeof(chip->display));
-            chip->draw_flag = true;
-            break;
-
-        case 0x00EE: /* 00EE - Return from subroutine */
-            if (chip->sp == 0) {
-                fprintf(stderr, "Stack underflow!\n");
-                break;
-            }
-            chip->sp--;
-            chip->pc = chip->stack[chip->sp];
-            break;
-
-        default:
-            fprintf(stderr, "Unknown opcode: 0x%04X\n", opcode);
-            break;
-        }
-        break;
+/* 00EE - Return from subroutine */
+static void op_ret(chip8_t *chip, const chip8_op_t *op) {
+    (void)op;
+    if (chip->sp == 0) {
+        fprintf(stderr, "Stack underflow!\n");
+        return;
+    }
+    chip->sp--;
+    chip->pc = chip->stack[chip->sp];
+}
 
-    case 0x1000: /* 1NNN - Jump to NNN */
-        chip->pc = nnn;
-        break;
+/* 1NNN - Jump to NNN */
+static void op_jp(chip8_t *chip, const chip8_op_t *op) {
+    chip->pc = op->nnn;
+}
 
-    case 0x2000: /* 2NNN - Call subroutine at NNN */
-        if (chip->sp >= CHIP8_STACK_SIZE) {
-            fprintf(stderr, "Stack overflow!\n");
-            break;
-        }
-        chip->stack[chip->sp] = chip->pc;
-        chip->sp++;
-        chip->pc = nnn;
-        break;
+/* 2NNN - Call subroutine at NNN */
+static void op_call(chip8_t *chip, const chip8_op_t *op) {
+    if (chip->sp >= CHIP8_STACK_SIZE) {
+        fprintf(stderr, "Stack overflow!\n");
+        return;
+    }
+    chip->stack[chip->sp] = chip->pc;
+    chip->sp++;
+    chip->pc = op->nnn;
+}
 
-    case 0x3000: /* 3XNN - Skip next if VX == NN */
-        if (chip->V[x] == nn)
-            chip->pc += 2;
-        break;
+/* 3XNN - Skip next if VX == NN */
+static void op_se_imm(chip8_t *chip, const chip8_op_t *op) {
+    if (chip->V[op->x] == op->nn)
+        chip->pc += 2;
+}
 
-    case 0x4000: /* 4XNN - Skip next if VX != NN */
-        if (chip->V[x] != nn)
-            chip->pc += 2;
-        break;
+/* 4XNN - Skip next if VX != NN */
+static void op_sne_imm(chip8_t *chip, const chip8_op_t *op) {
+    if (chip->V[op->x] != op->nn)
+        chip->pc += 2;
+}
 
-    case 0x5000: /* 5XY0 - Skip next if VX == VY */
-        if (chip->V[x] == chip->V[y])
-            chip->pc += 2;
-        break;
+/* 5XY0 - Skip next if VX == VY */
+static void op_se_reg(chip8_t *chip, const chip8_op_t *op) {
+    if (chip->V[op->x] == chip->V[op->y])
+        chip->pc += 2;
+}
 
-    case 0x6000: /* 6XNN - Set VX = NN */
-        chip->V[x] = nn;
-        break;
+/* 6XNN - Set VX = NN */
+static void op_ld_imm(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] = op->nn;
+}
 
-    case 0x7000: /* 7XNN - Add NN to VX (no carry flag) */
-        chip->V[x] += nn;
-        break;
+/* 7XNN - Add NN to VX (no carry flag) */
+static void op_add_imm(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] += op->nn;
+}
 
-    case 0x8000:
-        switch (n) {
-        case 0x0: /* 8XY0 - Set VX = VY */
-            chip->V[x] = chip->V[y];
-            break;
-
-        case 0x1: /* 8XY1 - VX = VX | VY */
-            chip->V[x] |= chip->V[y];
-            break;
-
-        case 0x2: /* 8XY2 - VX = VX & VY */
-            chip->V[x] &= chip->V[y];
-            break;
-
-        case 0x3: /* 8XY3 - VX = VX ^ VY */
-            chip->V[x] ^= chip->V[y];
-            break;
-
-        case 0x4: { /* 8XY4 - VX += VY, VF = carry */
-            uint16_t sum = chip->V[x] + chip->V[y];
-            chip->V[x] = sum & 0xFF;
-            chip->V[0xF] = (sum > 0xFF) ? 1 : 0;
-            break;
-        }
+/* 8XY0 - Set VX = VY */
+static void op_ld_reg(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] = chip->V[op->y];
+}
 
-        case 0x5: { /* 8XY5 - VX -= VY, VF = NOT borrow */
-            uint8_t flag = (chip->V[x] >= chip->V[y]) ? 1 : 0;
-            chip->V[x] -= chip->V[y];
-            chip->V[0xF] = flag;
-            break;
-        }
+/* 8XY1 - VX = VX | VY */
+static void op_or(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] |= chip->V[op->y];
+}
 
-        case 0x6: { /* 8XY6 - VX >>= 1, VF = LSB before shift */
-            uint8_t lsb = chip->V[x] & 0x01;
-            chip->V[x] >>= 1;
-            chip->V[0xF] = lsb;
-            break;
-        }
+/* 8XY2 - VX = VX & VY */
+static void op_and(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] &= chip->V[op->y];
+}
 
-        case 0x7: { /* 8XY7 - VX = VY - VX, VF = NOT borrow */
-            uint8_t flag = (chip->V[y] >= chip->V[x]) ? 1 : 0;
-            chip->V[x] = chip->V[y] - chip->V[x];
-            chip->V[0xF] = flag;
-            break;
-        }
+/* 8XY3 - VX = VX ^ VY */
+static void op_xor(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] ^= chip->V[op->y];
+}
 
-        case 0xE: { /* 8XYE - VX <<= 1, VF = MSB before shift */
-            uint8_t msb = (chip->V[x] >> 7) & 0x01;
-            chip->V[x] <<= 1;
-            chip->V[0xF] = msb;
-            break;
-        }
+/* 8XY4 - VX += VY, VF = carry */
+static void op_add_reg(chip8_t *chip, const chip8_op_t *op) {
+    uint16_t sum = chip->V[op->x] + chip->V[op->y];
+    chip->V[op->x] = sum & 0xFF;
+    chip->V[0xF] = (sum > 0xFF) ? 1 : 0;
+}
 
-        default:
-            fprintf(stderr, "Unknown opcode: 0x%04X\n", opcode);
-            break;
-        }
-        break;
+/* 8XY5 - VX -= VY, VF = NOT borrow */
+static void op_sub(chip8_t *chip, const chip8_op_t *op) {
+    uint8_t flag = (chip->V[op->x] >= chip->V[op->y]) ? 1 : 0;
+    chip->V[op->x] -= chip->V[op->y];
+    chip->V[0xF] = flag;
+}
 
-    case 0x9000: /* 9XY0 - Skip next if VX != VY */
-        if (chip->V[x] != chip->V[y])
-            chip->pc += 2;
-        break;
+/* 8XY6 - VX >>= 1, VF = LSB before shift */
+static void op_shr(chip8_t *chip, const chip8_op_t *op) {
+    uint8_t lsb = chip->V[op->x] & 0x01;
+    chip->V[op->x] >>= 1;
+    chip->V[0xF] = lsb;
+}
 
-    case 0xA000: /* ANNN - Set I = NNN */
-        chip->I = nnn;
-        break;
+/* 8XY7 - VX = VY - VX, VF = NOT borrow */
+static void op_subn(chip8_t *chip, const chip8_op_t *op) {
+    uint8_t flag = (chip->V[op->y] >= chip->V[op->x]) ? 1 : 0;
+    chip->V[op->x] = chip->V[op->y] - chip->V[op->x];
+    chip->V[0xF] = flag;
+}
 
-    case 0xB000: /* BNNN - Jump to NNN + V0 */
-        chip->pc = nnn + chip->V[0];
-        break;
+/* 8XYE - VX <<= 1, VF = MSB before shift */
+static void op_shl(chip8_t *chip, const chip8_op_t *op) {
+    uint8_t msb = (chip->V[op->x] >> 7) & 0x01;
+    chip->V[op->x] <<= 1;
+    chip->V[0xF] = msb;
+}
 
-    case 0xC000: /* CXNN - VX = random byte & NN */
-        chip->V[x] = (rand() & 0xFF) & nn;
-        break;
+/* 9XY0 - Skip next if VX != VY */
+static void op_sne_reg(chip8_t *chip, const chip8_op_t *op) {
+    if (chip->V[op->x] != chip->V[op->y])
+        chip->pc += 2;
+}
 
-    case 0xD000: { /* DXYN - Draw sprite at (VX, VY), N bytes tall */
-        uint8_t xpos = chip->V[x] % CHIP8_DISPLAY_WIDTH;
-        uint8_t ypos = chip->V[y] % CHIP8_DISPLAY_HEIGHT;
-        chip->V[0xF] = 0;
+/* ANNN - Set I = NNN */
+static void op_ld_i(chip8_t *chip, const chip8_op_t *op) {
+    chip->I = op->nnn;
+}
 
-        for (uint8_t row = 0; row < n; row++) {
-            uint8_t py = ypos + row;
-            if (py >= CHIP8_DISPLAY_HEIGHT) break;
+/* BNNN - Jump to NNN + V0 */
+static void op_jp_v0(chip8_t *chip, const chip8_op_t *op) {
+    chip->pc = op->nnn + chip->V[0];
+}
 
-            uint8_t sprite_byte = chip->memory[(chip->I + row) & 0xFFF];
+/* CXNN - VX = random byte & NN */
+static void op_rnd(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] = (uint8_t)(chip8_rng_next(&chip->rng_state) >> 56) & op->nn;
+}
 
-            for (uint8_t col = 0; col < 8; col++) {
-                uint8_t px = xpos + col;
-                if (px >= CHIP8_DISPLAY_WIDTH) break;
+/* DXYN - Draw sprite at (VX, VY), N bytes tall */
+static void op_drw(chip8_t *chip, const chip8_op_t *op) {
+    uint8_t xpos = chip->V[op->x] % CHIP8_DISPLAY_WIDTH;
+    uint8_t ypos = chip->V[op->y] % CHIP8_DISPLAY_HEIGHT;
+    chip->V[0xF] = 0;
 
-                /* Check if this bit in the sprite row is set */
-                if ((sprite_byte & (0x80 >> col)) != 0) {
-                    uint16_t idx = py * CHIP8_DISPLAY_WIDTH + px;
+    for (uint8_t row = 0; row < op->n; row++) {
+        uint8_t py = ypos + row;
+        if (py >= CHIP8_DISPLAY_HEIGHT) break;
 
-                    /* Collision: pixel was on, now will be turned off */
-                    if (chip->display[idx] == 1)
-                        chip->V[0xF] = 1;
+        /* Place the sprite byte at xpos within the 64-bit row. Bits
+         * shifted past the right edge fall off, which clips the sprite. */
+        uint8_t sprite_byte = chip->memory[(chip->I + row) & 0xFFF];
+        uint64_t bits = ((uint64_t)sprite_byte << 56) >> xpos;
 
-                    chip->display[idx] ^= 1;
-                }
-            }
-        }
+        /* Collision: any pixel that was on and is about to turn off */
+        if (chip->display[py] & bits)
+            chip->V[0xF] = 1;
 
-        chip->draw_flag = true;
-        break;
+        chip->display[py] ^= bits;
+    }
+
+    chip->draw_flag = true;
+}
+
+/* EX9E - Skip next if key VX is pressed */
+static void op_skp(chip8_t *chip, const chip8_op_t *op) {
+    if (chip->keypad[chip->V[op->x] & 0x0F])
+        chip->pc += 2;
+}
+
+/* EXA1 - Skip next if key VX is NOT pressed */
+static void op_sknp(chip8_t *chip, const chip8_op_t *op) {
+    if (!chip->keypad[chip->V[op->x] & 0x0F])
+        chip->pc += 2;
+}
+
+/* FX07 - VX = delay timer */
+static void op_ld_vx_dt(chip8_t *chip, const chip8_op_t *op) {
+    chip->V[op->x] = chip->delay_timer;
+}
+
+/* FX0A - Wait for key press, store in VX */
+static void op_ld_key(chip8_t *chip, const chip8_op_t *op) {
+    for (uint8_t i = 0; i < CHIP8_KEYPAD_SIZE; i++) {
+        if (chip->keypad[i]) {
+            chip->V[op->x] = i;
+            return;
+        }
     }
+    /* If no key was pressed, rewind PC to re-execute this
+     * instruction on the next cycle (blocking wait). */
+    chip->pc -= 2;
+}
+
+/* FX15 - Set delay timer = VX */
+static void op_ld_dt(chip8_t *chip, const chip8_op_t *op) {
+    chip->delay_timer = chip->V[op->x];
+}
 
+/* FX18 - Set sound timer = VX */
+static void op_ld_st(chip8_t *chip, const chip8_op_t *op) {
+    chip->sound_timer = chip->V[op->x];
+}
+
+/* FX1E - I += VX */
+static void op_add_i(chip8_t *chip, const chip8_op_t *op) {
+    chip->I += chip->V[op->x];
+    chip->I &= 0xFFF;
+}
+
+/* FX29 - I = address of font character VX */
+static void op_ld_font(chip8_t *chip, const chip8_op_t *op) {
+    chip->I = (chip->V[op->x] & 0x0F) * 5;
+}
+
+/* FX33 - Store BCD of VX at I, I+1, I+2 */
+static void op_bcd(chip8_t *chip, const chip8_op_t *op) {
+    uint8_t v = chip->V[op->x];
+    mem_write(chip, chip->I,     v / 100);
+    mem_write(chip, chip->I + 1, (v / 10) % 10);
+    mem_write(chip, chip->I + 2, v % 10);
+}
+
+/* FX55 - Store V0..VX in memory starting at I */
+static void op_store(chip8_t *chip, const chip8_op_t *op) {
+    for (uint8_t i = 0; i <= op->x; i++)
+        mem_write(chip, chip->I + i, chip->V[i]);
+}
+
+/* FX65 - Load V0..VX from memory starting at I */
+static void op_load(chip8_t *chip, const chip8_op_t *op) {
+    for (uint8_t i = 0; i <= op->x; i++)
+        chip->V[i] = chip->memory[(chip->I + i) & 0xFFF];
+}
+
+/* ======================================================================
+ * Decoder: extract operands once and pick the handler
+ * ====================================================================== */
+
+void chip8_decode(uint16_t opcode, chip8_op_t *op) {
+    op->opcode = opcode;
+    op->x   = (opcode >> 8) & 0x0F;   /* second nibble  */
+    op->y   = (opcode >> 4) & 0x0F;   /* third nibble   */
+    op->n   =  opcode       & 0x0F;   /* fourth nibble  */
+    op->nn  =  opcode       & 0xFF;   /* lower byte     */
+    op->nnn =  opcode       & 0x0FFF; /* lower 12 bits  */
+
+    chip8_handler_fn fn = op_unknown;
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0) fn = op_cls;
+        else if (opcode == 0x00EE) fn = op_ret;
+        break;
+    case 0x1000: fn = op_jp;      break;
+    case 0x2000: fn = op_call;    break;
+    case 0x3000: fn = op_se_imm;  break;
+    case 0x4000: fn = op_sne_imm; break;
+    case 0x5000: fn = op_se_reg;  break;
+    case 0x6000: fn = op_ld_imm;  break;
+    case 0x7000: fn = op_add_imm; break;
+    case 0x8000:
+        switch (op->n) {
+        case 0x0: fn = op_ld_reg;  break;
+        case 0x1: fn = op_or;      break;
+        case 0x2: fn = op_and;     break;
+        case 0x3: fn = op_xor;     break;
+        case 0x4: fn = op_add_reg; break;
+        case 0x5: fn = op_sub;     break;
+        case 0x6: fn = op_shr;     break;
+        case 0x7: fn = op_subn;    break;
+        case 0xE: fn = op_shl;     break;
+        default: break;
+        }
+        break;
+    case 0x9000: fn = op_sne_reg; break;
+    case 0xA000: fn = op_ld_i;    break;
+    case 0xB000: fn = op_jp_v0;   break;
+    case 0xC000: fn = op_rnd;     break;
+    case 0xD000: fn = op_drw;     break;
     case 0xE000:
-        switch (nn) {
-        case 0x9E: /* EX9E - Skip next if key VX is pressed */
-            if (chip->keypad[chip->V[x] & 0x0F])
-                chip->pc += 2;
-            break;
-
-        case 0xA1: /* EXA1 - Skip next if key VX is NOT pressed */
-            if (!chip->keypad[chip->V[x] & 0x0F])
-                chip->pc += 2;
-            break;
-
-        default:
-            fprintf(stderr, "Unknown opcode: 0x%04X\n", opcode);
-            break;
+        if (op->nn == 0x9E) fn = op_skp;
+        else if (op->nn == 0xA1) fn = op_sknp;
+        break;
+    case 0xF000:
+        switch (op->nn) {
+        case 0x07: fn = op_ld_vx_dt; break;
+        case 0x0A: fn = op_ld_key;   break;
+        case 0x15: fn = op_ld_dt;    break;
+        case 0x18: fn = op_ld_st;    break;
+        case 0x1E: fn = op_add_i;    break;
+        case 0x29: fn = op_ld_font;  break;
+        case 0x33: fn = op_bcd;      break;
+        case 0x55: fn = op_store;    break;
+        case 0x65: fn = op_load;     break;
+        default: break;
         }
         break;
+    }
 
-    case 0xF000:
-        switch (nn) {
-        case 0x07: /* FX07 - VX = delay timer */
-            chip->V[x] = chip->delay_timer;
-            break;
-
-        case 0x0A: { /* FX0A - Wait for key press, store in VX */
-            bool key_pressed = false;
-            for (uint8_t i = 0; i < CHIP8_KEYPAD_SIZE; i++) {
-                if (chip->keypad[i]) {
-                    chip->V[x] = i;
-                    key_pressed = true;
-                    break;
-                }
-            }
-            /* If no key was pressed, rewind PC to re-execute this
-             * instruction on the next cycle (blocking wait). */
-            if (!key_pressed)
-                chip->pc -= 2;
-            break;
+    op->fn = fn;
+}
+
+void chip8_cycle(chip8_t *chip) {
+    /* Bounds check: PC must have room for a 2-byte opcode */
+    if (chip->pc > CHIP8_MEMORY_SIZE - 2) {
+        fprintf(stderr, "PC out of bounds: 0x%04X\n", chip->pc);
+        return;
+    }
+
+    /* Fetch from the decoded-op cache, decoding on first use. Odd PCs
+     * (rare, but legal) have no cache slot and are decoded each time. */
+    chip8_op_t *op;
+    chip8_op_t odd;
+    if ((chip->pc & 1) == 0) {
+        op = &chip->decoded[chip->pc >> 1];
+        if (!op->fn)
+            chip8_decode((chip->memory[chip->pc] << 8) | chip->memory[chip->pc + 1], op);
+    } else {
+        op = &odd;
+        chip8_decode((chip->memory[chip->pc] << 8) | chip->memory[chip->pc + 1], op);
+    }
+
+    /* Advance PC past this instruction before executing.
+     * Instructions that modify PC (jumps, skips, calls, FX0A) will
+     * override this as needed. */
+    chip->pc += 2;
+
+    op->fn(chip, op);
+}
+
+/* ======================================================================
+ * Idle loops
+ *
+ * Within one chip8_run call the keypad and timers cannot change. A loop
+ * that reads only them and the registers, writes nothing but V and I,
+ * and comes back to its start with both as they were will therefore go
+ * round the same way until the call ends: waiting for a key (FX0A with
+ * none down) or polling the delay timer (FX07 / 3X00 / 1NNN). chip8_run
+ * runs such a loop once more for real to measure a pass and check the
+ * registers, then skips all remaining whole passes. The outcome is
+ * exactly that of calling chip8_cycle `cycles` times.
+ * ====================================================================== */
+
+#define IDLE_MAX_OPS 8
+
+/* Reads registers, timers and keys; writes only V and I */
+static bool idle_opcode(uint16_t opcode) {
+    switch (opcode >> 12) {
+    case 0x1: case 0x3: case 0x4: case 0x6: case 0xA:
+        return true;
+    case 0x5: case 0x8: case 0x9:
+        return (opcode & 0xF) == 0;   /* 5XY0, 8XY0, 9XY0 */
+    case 0xE:
+        return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+    case 0xF:
+        return (opcode & 0xFF) == 0x07 || (opcode & 0xFF) == 0x0A;
+    default:
+        return false;
+    }
+}
+
+/* Every instruction from start to the one at `last` (the jump back) */
+static bool idle_loop(const chip8_t *chip, uint16_t start, uint16_t last) {
+    if (last > CHIP8_MEMORY_SIZE - 2)
+        return false;
+    for (uint16_t a = start; a <= last; a += 2) {
+        if (!idle_opcode((uint16_t)(chip->memory[a] << 8 | chip->memory[a + 1])))
+            return false;
+    }
+    return true;
+}
+
+long chip8_run(chip8_t *chip, long cycles) {
+    long done = 0, skipped = 0;
+    uint32_t declined = 0x10000;   /* a loop start found not to be idle */
+
+    while (done < cycles) {
+        uint16_t pc = chip->pc;
+        chip8_cycle(chip);
+        done++;
+
+        /* Only jumps back (and FX0A, which stays put) start a check */
+        uint16_t start = chip->pc;
+        if (start > pc || pc - start > 2 * (IDLE_MAX_OPS - 1) || start == declined)
+            continue;
+        if (!idle_loop(chip, start, pc)) {
+            declined = start;
+            continue;
         }
 
-        case 0x15: /* FX15 - Set delay timer = VX */
-            chip->delay_timer = chip->V[x];
-            break;
-
-        case 0x18: /* FX18 - Set sound timer = VX */
-            chip->sound_timer = chip->V[x];
-            break;
-
-        case 0x1E: /* FX1E - I += VX */
-            chip->I += chip->V[x];
-            chip->I &= 0xFFF;
-            break;
-
-        case 0x29: /* FX29 - I = address of font character VX */
-            chip->I = (chip->V[x] & 0x0F) * 5;
-            break;
-
-        case 0x33: /* FX33 - Store BCD of VX at I, I+1, I+2 */
-            chip->memory[chip->I & 0xFFF]       = chip->V[x] / 100;
-            chip->memory[(chip->I + 1) & 0xFFF] = (chip->V[x] / 10) % 10;
-            chip->memory[(chip->I + 2) & 0xFFF] = chip->V[x] % 10;
-            break;
-
-        case 0x55: /* FX55 - Store V0..VX in memory starting at I */
-            for (uint8_t i = 0; i <= x; i++)
-                chip->memory[(chip->I + i) & 0xFFF] = chip->V[i];
-            break;
-
-        case 0x65: /* FX65 - Load V0..VX from memory starting at I */
-            for (uint8_t i = 0; i <= x; i++)
-                chip->V[i] = chip->memory[(chip->I + i) & 0xFFF];
-            break;
-
-        default:
-            fprintf(stderr, "Unknown opcode: 0x%04X\n", opcode);
-            break;
+        uint8_t V[CHIP8_REGISTER_COUNT];
+        memcpy(V, chip->V, sizeof(V));
+        uint16_t I = chip->I;
+        long pass = 0;
+        while (done < cycles && pass < IDLE_MAX_OPS && chip->pc >= start && chip->pc <= pc) {
+            chip8_cycle(chip);
+            done++;
+            pass++;
+            if (chip->pc == start)
+                break;
+        }
+        if (chip->pc != start || done == cycles)
+            continue;   /* left the checked code, or out of cycles anyway */
+        if (memcmp(V, chip->V, sizeof(V)) != 0 || I != chip->I) {
+            declined = start;
+            continue;
         }
-        break;
 
-    default:
-        fprintf(stderr, "Unknown opcode: 0x%04X\n", opcode);
-        break;
+        long passes = (cycles - done) / pass;
+        done += passes * pass;
+        skipped += passes * pass;
     }
+    return skipped;
 }
 
 void chip8_tick_timers(chip8_t *chip) {
     if (chip->delay_timer > 0) chip->delay_timer--;
     if (chip->sound_timer > 0) chip->sound_timer--;
 }
+
+/* ======================================================================
+ * Save states
+ *
+ * "C8ST", u16 version, then memory, registers, display, stack, keypad,
+ * timers and RNG state, multi-byte values little-endian.
+ * ====================================================================== */
+
+static const uint8_t state_magic[4] = { 'C', '8', 'S', 'T' };
+
+#define STATE_SIZE (4 + 2 + CHIP8_MEMORY_SIZE + CHIP8_REGISTER_COUNT + 2 + 2 + \
+                    CHIP8_DISPLAY_HEIGHT * 8 + CHIP8_STACK_SIZE * 2 + 1 + \
+                    CHIP8_KEYPAD_SIZE + 1 + 1 + 1 + 8)
+
+static uint8_t *put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        *p++ = (uint8_t)(v >> (8 * i));
+    return p;
+}
+
+static uint64_t get_le(const uint8_t **p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v |= (uint64_t)(*p)[i] << (8 * i);
+    *p += bytes;
+    return v;
+}
+
+size_t chip8_state_size(void) {
+    return STATE_SIZE;
+}
+
+size_t chip8_save_state(const chip8_t *chip, uint8_t *buf, size_t cap) {
+    if (cap < STATE_SIZE)
+        return 0;
+
+    uint8_t *p = buf;
+    memcpy(p, state_magic, 4);                 p += 4;
+    p = put_le(p, CHIP8_STATE_VERSION, 2);
+    memcpy(p, chip->memory, CHIP8_MEMORY_SIZE); p += CHIP8_MEMORY_SIZE;
+    memcpy(p, chip->V, CHIP8_REGISTER_COUNT);   p += CHIP8_REGISTER_COUNT;
+    p = put_le(p, chip->I, 2);
+    p = put_le(p, chip->pc, 2);
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+        p = put_le(p, chip->display[y], 8);
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++)
+        p = put_le(p, chip->stack[i], 2);
+    *p++ = chip->sp;
+    memcpy(p, chip->keypad, CHIP8_KEYPAD_SIZE); p += CHIP8_KEYPAD_SIZE;
+    *p++ = chip->delay_timer;
+    *p++ = chip->sound_timer;
+    *p++ = chip->draw_flag;
+    p = put_le(p, chip->rng_state, 8);
+
+    return (size_t)(p - buf);
+}
+
+bool chip8_load_state(chip8_t *chip, const uint8_t *buf, size_t len) {
+    if (len != STATE_SIZE || memcmp(buf, state_magic, 4) != 0) {
+        fprintf(stderr, "Not a CHIP-8 save state\n");
+        return false;
+    }
+    const uint8_t *p = buf + 4;
+    unsigned version = (unsigned)get_le(&p, 2);
+    if (version != CHIP8_STATE_VERSION) {
+        fprintf(stderr, "Unsupported save state version %u\n", version);
+        return false;
+    }
+
+    /* Range-check the fields the interpreter indexes with first */
+    const uint8_t *regs = p + CHIP8_MEMORY_SIZE + CHIP8_REGISTER_COUNT;
+    const uint8_t *sp_at = regs + 4 + CHIP8_DISPLAY_HEIGHT * 8 + CHIP8_STACK_SIZE * 2;
+    uint16_t index = regs[0] | (regs[1] << 8);
+    if (index >= CHIP8_MEMORY_SIZE || *sp_at > CHIP8_STACK_SIZE) {
+        fprintf(stderr, "Corrupt save state\n");
+        return false;
+    }
+
+    memcpy(chip->memory, p, CHIP8_MEMORY_SIZE); p += CHIP8_MEMORY_SIZE;
+    memcpy(chip->V, p, CHIP8_REGISTER_COUNT);   p += CHIP8_REGISTER_COUNT;
+    chip->I  = (uint16_t)get_le(&p, 2);
+    chip->pc = (uint16_t)get_le(&p, 2);
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+        chip->display[y] = get_le(&p, 8);
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++)
+        chip->stack[i] = (uint16_t)get_le(&p, 2);
+    chip->sp = *p++;
+    memcpy(chip->keypad, p, CHIP8_KEYPAD_SIZE); p += CHIP8_KEYPAD_SIZE;
+    chip->delay_timer = *p++;
+    chip->sound_timer = *p++;
+    chip->draw_flag = *p++ != 0;
+    chip->rng_state = get_le(&p, 8);
+
+    chip8_invalidate(chip, 0, CHIP8_MEMORY_SIZE);
+    return true;
+}
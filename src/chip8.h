@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define CHIP8_MEMORY_SIZE 4096
 #define CHIP8_DISPLAY_WIDTH 64
@@ -12,23 +13,91 @@
 #define CHIP8_KEYPAD_SIZE 16
 #define CHIP8_PROGRAM_START 0x200
 
-typedef struct {
+typedef struct chip8_t chip8_t;
+typedef struct chip8_op_t chip8_op_t;
+
+typedef void (*chip8_handler_fn)(chip8_t *chip, const chip8_op_t *op);
+
+/* A pre-decoded instruction: handler plus operands extracted once */
+struct chip8_op_t {
+    chip8_handler_fn fn;    /* NULL = not decoded yet */
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t x, y, n, nn;
+};
+
+struct chip8_t {
     uint8_t memory[CHIP8_MEMORY_SIZE];
     uint8_t V[CHIP8_REGISTER_COUNT];       // general purpose registers V0-VF
     uint16_t I;                             // index register
     uint16_t pc;                            // program counter
-    uint8_t display[CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT];
+    uint64_t display[CHIP8_DISPLAY_HEIGHT]; /* one row per word, bit 63 = x 0 */
     uint16_t stack[CHIP8_STACK_SIZE];
     uint8_t sp;                             // stack pointer
     uint8_t keypad[CHIP8_KEYPAD_SIZE];
     uint8_t delay_timer;
     uint8_t sound_timer;
     bool draw_flag;
-} chip8_t;
 
-void chip8_init(chip8_t *chip);
+    /* Decoded-op cache, one entry per even address. Anything that writes
+     * memory must go through chip8_invalidate (FX33/FX55 and ROM loading
+     * already do). */
+    chip8_op_t decoded[CHIP8_MEMORY_SIZE / 2];
+
+    /* Bumped whenever a decoded entry is invalidated, i.e. whenever code
+     * that has run is overwritten. Lets translated code notice writes. */
+    uint32_t code_gen;
+
+    /* CXNN random source (splitmix64). Any value is a valid state, so it
+     * can be saved and restored as a plain integer. */
+    uint64_t rng_state;
+};
+
+/* `seed` fully determines CXNN results; pass e.g. time(NULL) for a
+ * different game every run. */
+void chip8_init(chip8_t *chip, uint64_t seed);
 bool chip8_load_rom(chip8_t *chip, const char *path);
 void chip8_cycle(chip8_t *chip);
+/* chip8_cycle `cycles` times, skipping the passes of idle loops (a key
+ * wait, a delay-timer poll) that cannot end before the keypad or timers
+ * change. Returns the number of cycles skipped. */
+long chip8_run(chip8_t *chip, long cycles);
 void chip8_tick_timers(chip8_t *chip);
 
+/* Versioned binary save states (machine state and RNG; the decode cache
+ * is rebuilt on load). chip8_save_state returns bytes written, 0 if cap
+ * is too small; chip8_load_state validates before changing anything. */
+#define CHIP8_STATE_VERSION 1
+size_t chip8_state_size(void);
+size_t chip8_save_state(const chip8_t *chip, uint8_t *buf, size_t cap);
+bool chip8_load_state(chip8_t *chip, const uint8_t *buf, size_t len);
+
+/* Decode an opcode into handler + operands */
+void chip8_decode(uint16_t opcode, chip8_op_t *op);
+
+/* Drop cached decodes covering memory[addr .. addr+len) */
+void chip8_invalidate(chip8_t *chip, uint16_t addr, uint16_t len);
+
+/* Advance a splitmix64 state and return the next 64 random bits */
+static inline uint64_t chip8_rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Save / restore the random stream, e.g. for replays */
+static inline uint64_t chip8_rng_save(const chip8_t *chip) {
+    return chip->rng_state;
+}
+
+static inline void chip8_rng_restore(chip8_t *chip, uint64_t state) {
+    chip->rng_state = state;
+}
+
+/* Read a single pixel from the packed display */
+static inline bool chip8_get_pixel(const chip8_t *chip, int x, int y) {
+    return (chip->display[y] >> (CHIP8_DISPLAY_WIDTH - 1 - x)) & 1;
+}
+
 #endif
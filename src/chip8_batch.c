@@ -0,0 +1,733 @@
+/* chip8_batch.c -- lockstep multi-instance CHIP-8 engine
+ *
+ * Each step walks a slice of instances and groups runs of neighbours that
+ * have the same PC and the same opcode there. Common ALU, load and skip
+ * instructions then execute as one loop over the group's SoA lanes (SSE2
+ * where available); everything else, and every instance that has drifted
+ * off on its own, goes through the per-lane interpreter below, which
+ * mirrors the handlers in chip8.c.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "chip8_batch.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Slices start on multiples of this many lanes so two threads never
+ * write the same cache line of a register array. */
+#define LANE_ALIGN 64
+
+typedef struct worker_t worker_t;
+
+struct chip8_batch_t {
+    int count;
+    int stride;                       /* count rounded up to LANE_ALIGN */
+
+    /* Per-register lane arrays: V[r][i] is register r of instance i */
+    uint8_t  *V[CHIP8_REGISTER_COUNT];
+    uint16_t *pc;
+    uint16_t *I;
+    uint8_t  *delay_timer;
+    uint8_t  *sound_timer;
+    uint8_t  *sp;
+    uint16_t *keys;                   /* bit N = key N held */
+    uint8_t  *draw_flag;
+    uint8_t  *fault;                  /* PC out of bounds already reported */
+    uint64_t *dirty;                  /* bit c = 64-byte chunk c differs from image */
+    uint64_t *rng;                    /* CXNN state, as chip8_t.rng_state */
+
+    /* Per-instance blocks */
+    uint8_t  *memory;                 /* count * CHIP8_MEMORY_SIZE */
+    uint64_t *display;                /* count * CHIP8_DISPLAY_HEIGHT */
+    uint16_t *stack;                  /* count * CHIP8_STACK_SIZE */
+
+    /* The ROM image every instance was loaded with. Instruction fetches
+     * from chunks an instance has not written go here instead, so lanes
+     * running unmodified code share one cached copy. */
+    uint8_t image[CHIP8_MEMORY_SIZE];
+
+    void *lanes;                      /* single allocation behind the lane arrays */
+
+    /* Thread pool */
+    int nworkers;                     /* helper threads (caller not counted) */
+    worker_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    int pending;
+    long job_cycles;
+    bool quit;
+};
+
+struct worker_t {
+    chip8_batch_t *batch;
+    int lo, hi;
+    pthread_t thread;
+};
+
+static inline uint8_t *lane_mem(const chip8_batch_t *b, int i) {
+    return b->memory + (size_t)i * CHIP8_MEMORY_SIZE;
+}
+
+static inline uint64_t *lane_display(const chip8_batch_t *b, int i) {
+    return b->display + (size_t)i * CHIP8_DISPLAY_HEIGHT;
+}
+
+static inline uint16_t *lane_stack(const chip8_batch_t *b, int i) {
+    return b->stack + (size_t)i * CHIP8_STACK_SIZE;
+}
+
+/* Dirty-chunk bits covering the two opcode bytes at pc */
+static inline uint64_t chunk_bits(uint16_t pc) {
+    return (1ULL << (pc >> 6)) | (1ULL << ((pc + 1) >> 6));
+}
+
+static inline uint16_t fetch(const chip8_batch_t *b, int i, uint16_t pc) {
+    const uint8_t *m = (b->dirty[i] & chunk_bits(pc)) ? lane_mem(b, i) : b->image;
+    return (uint16_t)((m[pc] << 8) | m[pc + 1]);
+}
+
+static inline void lane_write(chip8_batch_t *b, int i, uint16_t addr, uint8_t val) {
+    addr &= 0xFFF;
+    lane_mem(b, i)[addr] = val;
+    b->dirty[i] |= 1ULL << (addr >> 6);
+}
+
+/* ======================================================================
+ * Group kernels: one instruction over lanes [0, n) of the given arrays
+ * ====================================================================== */
+
+static void lanes_add_imm(uint8_t *v, uint8_t nn, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128i k = _mm_set1_epi8((char)nn);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(v + i));
+        _mm_storeu_si128((__m128i *)(v + i), _mm_add_epi8(a, k));
+    }
+#endif
+    for (; i < n; i++)
+        v[i] += nn;
+}
+
+/* 8XY1/2/3 */
+static void lanes_logic(uint8_t *vx, const uint8_t *vy, int n, uint8_t kind) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(vx + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(vy + i));
+        __m128i r = kind == 1 ? _mm_or_si128(a, c)
+                  : kind == 2 ? _mm_and_si128(a, c)
+                              : _mm_xor_si128(a, c);
+        _mm_storeu_si128((__m128i *)(vx + i), r);
+    }
+#endif
+    for (; i < n; i++) {
+        if (kind == 1)      vx[i] |= vy[i];
+        else if (kind == 2) vx[i] &= vy[i];
+        else                vx[i] ^= vy[i];
+    }
+}
+
+/* 8XY4: VX += VY, VF = carry. The flag is stored after the result, as in
+ * the interpreter, so X or Y being F behaves the same. */
+static void lanes_add_flag(uint8_t *vx, const uint8_t *vy, uint8_t *vf, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(vx + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(vy + i));
+        __m128i s = _mm_add_epi8(a, c);
+        __m128i no_carry = _mm_cmpeq_epi8(_mm_max_epu8(s, a), s);   /* s >= a */
+        _mm_storeu_si128((__m128i *)(vx + i), s);
+        _mm_storeu_si128((__m128i *)(vf + i), _mm_andnot_si128(no_carry, one));
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t sum = vx[i] + vy[i];
+        vx[i] = sum & 0xFF;
+        vf[i] = sum > 0xFF;
+    }
+}
+
+/* 8XY5 / 8XY7: VX = A - B, VF = A >= B */
+static void lanes_sub_flag(uint8_t *vx, const uint8_t *a, const uint8_t *c,
+                           uint8_t *vf, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vc = _mm_loadu_si128((const __m128i *)(c + i));
+        __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(va, vc), va);
+        _mm_storeu_si128((__m128i *)(vx + i), _mm_sub_epi8(va, vc));
+        _mm_storeu_si128((__m128i *)(vf + i), _mm_and_si128(ge, one));
+    }
+#endif
+    for (; i < n; i++) {
+        uint8_t flag = a[i] >= c[i];
+        vx[i] = (uint8_t)(a[i] - c[i]);
+        vf[i] = flag;
+    }
+}
+
+/* 8XY6 / 8XYE */
+static void lanes_shift(uint8_t *vx, uint8_t *vf, int n, bool right) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i low7 = _mm_set1_epi8(0x7F);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(vx + i));
+        __m128i r, flag;
+        if (right) {
+            flag = _mm_and_si128(a, one);
+            r = _mm_and_si128(_mm_srli_epi16(a, 1), low7);
+        } else {
+            flag = _mm_and_si128(_mm_srli_epi16(a, 7), one);
+            r = _mm_add_epi8(a, a);
+        }
+        _mm_storeu_si128((__m128i *)(vx + i), r);
+        _mm_storeu_si128((__m128i *)(vf + i), flag);
+    }
+#endif
+    for (; i < n; i++) {
+        uint8_t a = vx[i];
+        vx[i] = right ? (uint8_t)(a >> 1) : (uint8_t)(a << 1);
+        vf[i] = right ? (a & 1) : (a >> 7);
+    }
+}
+
+/* ======================================================================
+ * Per-lane interpreter
+ * ====================================================================== */
+
+static void lane_draw(chip8_batch_t *b, int i, uint8_t x, uint8_t y, uint8_t n) {
+    const uint8_t *mem = lane_mem(b, i);
+    uint64_t *display = lane_display(b, i);
+    uint8_t xpos = b->V[x][i] % CHIP8_DISPLAY_WIDTH;
+    uint8_t ypos = b->V[y][i] % CHIP8_DISPLAY_HEIGHT;
+    uint16_t index = b->I[i];
+    uint8_t collision = 0;
+
+    for (uint8_t row = 0; row < n; row++) {
+        uint8_t py = ypos + row;
+        if (py >= CHIP8_DISPLAY_HEIGHT) break;
+
+        uint8_t sprite_byte = mem[(index + row) & 0xFFF];
+        uint64_t bits = ((uint64_t)sprite_byte << 56) >> xpos;
+        if (display[py] & bits)
+            collision = 1;
+        display[py] ^= bits;
+    }
+
+    b->V[0xF][i] = collision;
+    b->draw_flag[i] = 1;
+}
+
+static void lane_step(chip8_batch_t *b, int i, uint16_t opcode) {
+    uint8_t x  = (opcode >> 8) & 0x0F;
+    uint8_t y  = (opcode >> 4) & 0x0F;
+    uint8_t n  =  opcode       & 0x0F;
+    uint8_t nn =  opcode       & 0xFF;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t *vx = &b->V[x][i];
+    uint8_t vy = b->V[y][i];
+    const uint8_t *mem = lane_mem(b, i);
+
+    b->pc[i] += 2;
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0) {
+            memset(lane_display(b, i), 0, CHIP8_DISPLAY_HEIGHT * sizeof(uint64_t));
+            b->draw_flag[i] = 1;
+            return;
+        }
+        if (opcode == 0x00EE) {
+            if (b->sp[i] == 0) {
+                fprintf(stderr, "Stack underflow!\n");
+                return;
+            }
+            b->sp[i]--;
+            b->pc[i] = lane_stack(b, i)[b->sp[i]];
+            return;
+        }
+        break;
+    case 0x1000: b->pc[i] = nnn; return;
+    case 0x2000:
+        if (b->sp[i] >= CHIP8_STACK_SIZE) {
+            fprintf(stderr, "Stack overflow!\n");
+            return;
+        }
+        lane_stack(b, i)[b->sp[i]++] = b->pc[i];
+        b->pc[i] = nnn;
+        return;
+    case 0x3000: if (*vx == nn) b->pc[i] += 2; return;
+    case 0x4000: if (*vx != nn) b->pc[i] += 2; return;
+    case 0x5000: if (*vx == vy) b->pc[i] += 2; return;
+    case 0x6000: *vx = nn; return;
+    case 0x7000: *vx += nn; return;
+    case 0x8000: {
+        uint8_t a = *vx, flag;
+        switch (n) {
+        case 0x0: *vx = vy; return;
+        case 0x1: *vx |= vy; return;
+        case 0x2: *vx &= vy; return;
+        case 0x3: *vx ^= vy; return;
+        case 0x4: *vx = (uint8_t)(a + vy); flag = (a + vy) > 0xFF; break;
+        case 0x5: *vx = (uint8_t)(a - vy); flag = a >= vy;         break;
+        case 0x6: *vx = a >> 1;            flag = a & 1;           break;
+        case 0x7: *vx = (uint8_t)(vy - a); flag = vy >= a;         break;
+        case 0xE: *vx = (uint8_t)(a << 1); flag = a >> 7;          break;
+        default: goto unknown;
+        }
+        b->V[0xF][i] = flag;
+        return;
+    }
+    case 0x9000: if (*vx != vy) b->pc[i] += 2; return;
+    case 0xA000: b->I[i] = nnn; return;
+    case 0xB000: b->pc[i] = nnn + b->V[0][i]; return;
+    case 0xC000: *vx = (uint8_t)(chip8_rng_next(&b->rng[i]) >> 56) & nn; return;
+    case 0xD000: lane_draw(b, i, x, y, n); return;
+    case 0xE000:
+        if (nn == 0x9E) {
+            if (b->keys[i] & (1u << (*vx & 0x0F))) b->pc[i] += 2;
+            return;
+        }
+        if (nn == 0xA1) {
+            if (!(b->keys[i] & (1u << (*vx & 0x0F)))) b->pc[i] += 2;
+            return;
+        }
+        break;
+    case 0xF000:
+        switch (nn) {
+        case 0x07: *vx = b->delay_timer[i]; return;
+        case 0x0A:
+            for (uint8_t k = 0; k < CHIP8_KEYPAD_SIZE; k++) {
+                if (b->keys[i] & (1u << k)) {
+                    *vx = k;
+                    return;
+                }
+            }
+            b->pc[i] -= 2;
+            return;
+        case 0x15: b->delay_timer[i] = *vx; return;
+        case 0x18: b->sound_timer[i] = *vx; return;
+        case 0x1E: b->I[i] = (b->I[i] + *vx) & 0xFFF; return;
+        case 0x29: b->I[i] = (*vx & 0x0F) * 5; return;
+        case 0x33: {
+            uint8_t v = *vx;
+            uint16_t at = b->I[i];
+            lane_write(b, i, at,     v / 100);
+            lane_write(b, i, at + 1, (v / 10) % 10);
+            lane_write(b, i, at + 2, v % 10);
+            return;
+        }
+        case 0x55:
+            for (uint8_t r = 0; r <= x; r++)
+                lane_write(b, i, b->I[i] + r, b->V[r][i]);
+            return;
+        case 0x65:
+            for (uint8_t r = 0; r <= x; r++)
+                b->V[r][i] = mem[(b->I[i] + r) & 0xFFF];
+            return;
+        default:
+            break;
+        }
+        break;
+    }
+
+unknown:
+    fprintf(stderr, "Unknown opcode: 0x%04X\n", opcode);
+}
+
+/* ======================================================================
+ * Group execution
+ * ====================================================================== */
+
+/* Execute `opcode` at `pc` on lanes [lo, hi), which all share both.
+ * Returns false if the instruction has no group kernel. */
+static bool group_step(chip8_batch_t *b, int lo, int hi, uint16_t pc, uint16_t opcode) {
+    int n = hi - lo;
+    uint8_t x  = (opcode >> 8) & 0x0F;
+    uint8_t y  = (opcode >> 4) & 0x0F;
+    uint8_t nn =  opcode       & 0xFF;
+    uint16_t next = pc + 2;
+    uint8_t *vx = b->V[x] + lo;
+    uint8_t *vy = b->V[y] + lo;
+    uint8_t *vf = b->V[0xF] + lo;
+
+    switch (opcode & 0xF000) {
+    case 0x1000:
+        next = opcode & 0x0FFF;
+        break;
+    case 0x3000:
+        for (int i = 0; i < n; i++)
+            b->pc[lo + i] = next + (vx[i] == nn ? 2 : 0);
+        return true;
+    case 0x4000:
+        for (int i = 0; i < n; i++)
+            b->pc[lo + i] = next + (vx[i] != nn ? 2 : 0);
+        return true;
+    case 0x5000:
+        for (int i = 0; i < n; i++)
+            b->pc[lo + i] = next + (vx[i] == vy[i] ? 2 : 0);
+        return true;
+    case 0x9000:
+        for (int i = 0; i < n; i++)
+            b->pc[lo + i] = next + (vx[i] != vy[i] ? 2 : 0);
+        return true;
+    case 0x6000:
+        memset(vx, nn, (size_t)n);
+        break;
+    case 0x7000:
+        lanes_add_imm(vx, nn, n);
+        break;
+    case 0x8000:
+        switch (opcode & 0x000F) {
+        case 0x0: if (x != y) memcpy(vx, vy, (size_t)n); break;
+        case 0x1:
+        case 0x2:
+        case 0x3: lanes_logic(vx, vy, n, opcode & 0x000F); break;
+        case 0x4: lanes_add_flag(vx, vy, vf, n); break;
+        case 0x5: lanes_sub_flag(vx, vx, vy, vf, n); break;
+        case 0x6: lanes_shift(vx, vf, n, true); break;
+        case 0x7: lanes_sub_flag(vx, vy, vx, vf, n); break;
+        case 0xE: lanes_shift(vx, vf, n, false); break;
+        default: return false;
+        }
+        break;
+    case 0xA000:
+        for (int i = 0; i < n; i++)
+            b->I[lo + i] = opcode & 0x0FFF;
+        break;
+    case 0xF000:
+        switch (nn) {
+        case 0x07: memcpy(vx, b->delay_timer + lo, (size_t)n); break;
+        case 0x15: memcpy(b->delay_timer + lo, vx, (size_t)n); break;
+        case 0x18: memcpy(b->sound_timer + lo, vx, (size_t)n); break;
+        case 0x1E:
+            for (int i = 0; i < n; i++)
+                b->I[lo + i] = (b->I[lo + i] + vx[i]) & 0xFFF;
+            break;
+        default: return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    for (int i = 0; i < n; i++)
+        b->pc[lo + i] = next;
+    return true;
+}
+
+static void lane_fault(chip8_batch_t *b, int i) {
+    if (!b->fault[i]) {
+        fprintf(stderr, "PC out of bounds: 0x%04X (instance %d)\n", b->pc[i], i);
+        b->fault[i] = 1;
+    }
+}
+
+static void run_slice(chip8_batch_t *b, int lo, int hi, long cycles) {
+    for (long c = 0; c < cycles; c++) {
+        int i = lo;
+        while (i < hi) {
+            uint16_t pc = b->pc[i];
+            if (pc > CHIP8_MEMORY_SIZE - 2) {
+                lane_fault(b, i++);
+                continue;
+            }
+
+            /* Extend the group while neighbours agree on PC and opcode.
+             * Memory is per instance, so the opcode check is what keeps
+             * self-modifying code correct; lanes that have not touched
+             * the chunk match without reading their own memory. */
+            uint16_t opcode = fetch(b, i, pc);
+            uint64_t bits = chunk_bits(pc);
+            bool leader_clean = !(b->dirty[i] & bits);
+            int end = i + 1;
+            while (end < hi && b->pc[end] == pc) {
+                if (!(leader_clean && !(b->dirty[end] & bits)) &&
+                    fetch(b, end, pc) != opcode)
+                    break;
+                end++;
+            }
+
+            if (!group_step(b, i, end, pc, opcode)) {
+                for (int k = i; k < end; k++)
+                    lane_step(b, k, opcode);
+            }
+            i = end;
+        }
+    }
+}
+
+/* ======================================================================
+ * Thread pool
+ * ====================================================================== */
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    chip8_batch_t *b = w->batch;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&b->lock);
+    for (;;) {
+        while (b->generation == seen && !b->quit)
+            pthread_cond_wait(&b->start, &b->lock);
+        if (b->quit)
+            break;
+        seen = b->generation;
+        long cycles = b->job_cycles;
+        pthread_mutex_unlock(&b->lock);
+
+        run_slice(b, w->lo, w->hi, cycles);
+
+        pthread_mutex_lock(&b->lock);
+        if (--b->pending == 0)
+            pthread_cond_signal(&b->done);
+    }
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+/* Slice boundary k of `parts`, rounded to LANE_ALIGN */
+static int slice_edge(const chip8_batch_t *b, int k, int parts) {
+    long edge = (long)b->count * k / parts;
+    edge = (edge + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN;
+    return edge > b->count ? b->count : (int)edge;
+}
+
+static void stop_workers(chip8_batch_t *b, int started) {
+    pthread_mutex_lock(&b->lock);
+    b->quit = true;
+    pthread_cond_broadcast(&b->start);
+    pthread_mutex_unlock(&b->lock);
+    for (int k = 0; k < started; k++)
+        pthread_join(b->workers[k].thread, NULL);
+}
+
+/* ======================================================================
+ * Public API
+ * ====================================================================== */
+
+chip8_batch_t *chip8_batch_create(int count, int threads) {
+    if (count <= 0) {
+        fprintf(stderr, "Batch size must be positive\n");
+        return NULL;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > count)
+        threads = count;
+
+    chip8_batch_t *b = calloc(1, sizeof(*b));
+    if (!b)
+        return NULL;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->start, NULL);
+    pthread_cond_init(&b->done, NULL);
+    b->count = count;
+    b->stride = (count + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN;
+
+    /* Lane arrays: dirty masks and RNG states, then pc, I and keys as
+     * words, then
+     * 16 V + fault + sp + timers + draw as bytes, all in one cache-aligned
+     * block. */
+    size_t s = (size_t)b->stride;
+    size_t lane_bytes = s * 8 * 2 + s * 2 * 3 + s * (CHIP8_REGISTER_COUNT + 5);
+    if (posix_memalign(&b->lanes, 64, lane_bytes) != 0) {
+        b->lanes = NULL;
+        chip8_batch_destroy(b);
+        return NULL;
+    }
+    memset(b->lanes, 0, lane_bytes);
+
+    uint8_t *p = b->lanes;
+    b->dirty = (uint64_t *)p; p += s * 8;
+    b->rng = (uint64_t *)p;   p += s * 8;
+    b->pc = (uint16_t *)p;    p += s * 2;
+    b->I = (uint16_t *)p;     p += s * 2;
+    b->keys = (uint16_t *)p;  p += s * 2;
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; r++, p += s)
+        b->V[r] = p;
+    b->fault = p;       p += s;
+    b->sp = p;          p += s;
+    b->delay_timer = p; p += s;
+    b->sound_timer = p; p += s;
+    b->draw_flag = p;
+
+    b->memory = calloc((size_t)count, CHIP8_MEMORY_SIZE);
+    b->display = calloc((size_t)count * CHIP8_DISPLAY_HEIGHT, sizeof(uint64_t));
+    b->stack = calloc((size_t)count * CHIP8_STACK_SIZE, sizeof(uint16_t));
+    if (!b->memory || !b->display || !b->stack) {
+        fprintf(stderr, "Out of memory for %d instances\n", count);
+        chip8_batch_destroy(b);
+        return NULL;
+    }
+
+    /* The caller runs slice 0; helpers take slices 1..threads-1 */
+    b->nworkers = threads - 1;
+    if (b->nworkers > 0) {
+        b->workers = calloc((size_t)b->nworkers, sizeof(worker_t));
+        if (!b->workers)
+            b->nworkers = 0;
+        for (int k = 0; k < b->nworkers; k++) {
+            worker_t *w = &b->workers[k];
+            w->batch = b;
+            w->lo = slice_edge(b, k + 1, threads);
+            w->hi = slice_edge(b, k + 2, threads);
+            if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+                fprintf(stderr, "Failed to start batch worker %d\n", k);
+                stop_workers(b, k);
+                b->nworkers = 0;
+                free(b->workers);
+                b->workers = NULL;
+                b->quit = false;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+        b->pc[i] = CHIP8_PROGRAM_START;
+    return b;
+}
+
+void chip8_batch_destroy(chip8_batch_t *b) {
+    if (!b)
+        return;
+    if (b->nworkers > 0) {
+        stop_workers(b, b->nworkers);
+        free(b->workers);
+    }
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->start);
+    pthread_cond_destroy(&b->done);
+    free(b->memory);
+    free(b->display);
+    free(b->stack);
+    free(b->lanes);
+    free(b);
+}
+
+int chip8_batch_count(const chip8_batch_t *b) {
+    return b->count;
+}
+
+bool chip8_batch_load_rom(chip8_batch_t *b, const char *path, uint64_t seed) {
+    /* Let the regular loader do validation, fonts and reporting once,
+     * then clone the machine into every lane. */
+    chip8_t *tmpl = malloc(sizeof(chip8_t));
+    if (!tmpl)
+        return false;
+    chip8_init(tmpl, seed);
+    if (!chip8_load_rom(tmpl, path)) {
+        free(tmpl);
+        return false;
+    }
+    memcpy(b->image, tmpl->memory, CHIP8_MEMORY_SIZE);
+    for (int i = 0; i < b->count; i++) {
+        chip8_batch_import(b, i, tmpl);
+        b->rng[i] = seed + (uint64_t)i;
+    }
+    free(tmpl);
+    return true;
+}
+
+void chip8_batch_import(chip8_batch_t *b, int i, const chip8_t *chip) {
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; r++)
+        b->V[r][i] = chip->V[r];
+    b->pc[i] = chip->pc;
+    b->I[i] = chip->I;
+    b->sp[i] = chip->sp;
+    b->delay_timer[i] = chip->delay_timer;
+    b->sound_timer[i] = chip->sound_timer;
+    b->draw_flag[i] = chip->draw_flag;
+    b->fault[i] = 0;
+    b->rng[i] = chip->rng_state;
+
+    uint16_t keys = 0;
+    for (int k = 0; k < CHIP8_KEYPAD_SIZE; k++)
+        if (chip->keypad[k]) keys |= (uint16_t)(1u << k);
+    b->keys[i] = keys;
+
+    memcpy(lane_mem(b, i), chip->memory, CHIP8_MEMORY_SIZE);
+    memcpy(lane_display(b, i), chip->display, sizeof(chip->display));
+    memcpy(lane_stack(b, i), chip->stack, sizeof(chip->stack));
+
+    uint64_t dirty = 0;
+    for (int c = 0; c < CHIP8_MEMORY_SIZE / 64; c++)
+        if (memcmp(chip->memory + c * 64, b->image + c * 64, 64) != 0)
+            dirty |= 1ULL << c;
+    b->dirty[i] = dirty;
+}
+
+void chip8_batch_export(const chip8_batch_t *b, int i, chip8_t *chip) {
+    memset(chip, 0, sizeof(*chip));
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; r++)
+        chip->V[r] = b->V[r][i];
+    chip->pc = b->pc[i];
+    chip->I = b->I[i];
+    chip->sp = b->sp[i];
+    chip->delay_timer = b->delay_timer[i];
+    chip->sound_timer = b->sound_timer[i];
+    chip->draw_flag = b->draw_flag[i];
+    chip->rng_state = b->rng[i];
+    for (int k = 0; k < CHIP8_KEYPAD_SIZE; k++)
+        chip->keypad[k] = (b->keys[i] >> k) & 1;
+
+    memcpy(chip->memory, lane_mem(b, i), CHIP8_MEMORY_SIZE);
+    memcpy(chip->display, lane_display(b, i), sizeof(chip->display));
+    memcpy(chip->stack, lane_stack(b, i), sizeof(chip->stack));
+}
+
+void chip8_batch_run(chip8_batch_t *b, long cycles) {
+    if (cycles <= 0)
+        return;
+    if (b->nworkers == 0) {
+        run_slice(b, 0, b->count, cycles);
+        return;
+    }
+
+    pthread_mutex_lock(&b->lock);
+    b->job_cycles = cycles;
+    b->pending = b->nworkers;
+    b->generation++;
+    pthread_cond_broadcast(&b->start);
+    pthread_mutex_unlock(&b->lock);
+
+    run_slice(b, 0, slice_edge(b, 1, b->nworkers + 1), cycles);
+
+    pthread_mutex_lock(&b->lock);
+    while (b->pending > 0)
+        pthread_cond_wait(&b->done, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+}
+
+void chip8_batch_tick_timers(chip8_batch_t *b) {
+    for (int i = 0; i < b->count; i++) {
+        b->delay_timer[i] -= b->delay_timer[i] > 0;
+        b->sound_timer[i] -= b->sound_timer[i] > 0;
+    }
+}
+
+void chip8_batch_set_keys(chip8_batch_t *b, int i, uint16_t keys) {
+    b->keys[i] = keys;
+}
+
+const uint64_t *chip8_batch_display(const chip8_batch_t *b, int i) {
+    return lane_display(b, i);
+}
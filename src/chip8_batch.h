@@ -0,0 +1,44 @@
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/* Many CHIP-8 machines stepped in lockstep.
+ *
+ * State is kept as structure-of-arrays: each register is an array indexed
+ * by instance, so instances that sit on the same instruction can be
+ * executed together with vector code. Memory, display and stack are per
+ * instance. There is no decoded-op cache, so one instance takes about
+ * 4.3 KB (its own 4 KB of memory plus display, stack and registers)
+ * against about 36 KB for a chip8_t, 32 KB of which is that cache.
+ *
+ * Instances are split into contiguous slices, one per worker thread. */
+typedef struct chip8_batch_t chip8_batch_t;
+
+/* `threads` is the total number of threads stepping the batch, including
+ * the caller; 1 runs everything on the calling thread. */
+chip8_batch_t *chip8_batch_create(int count, int threads);
+void chip8_batch_destroy(chip8_batch_t *batch);
+int chip8_batch_count(const chip8_batch_t *batch);
+
+/* Reset every instance and load the same ROM into all of them. Instance
+ * i gets seed + i, so instance 0 matches a chip8_t seeded with `seed`. */
+bool chip8_batch_load_rom(chip8_batch_t *batch, const char *path, uint64_t seed);
+
+/* Copy one instance in from / out to a regular chip8_t */
+void chip8_batch_import(chip8_batch_t *batch, int index, const chip8_t *chip);
+void chip8_batch_export(const chip8_batch_t *batch, int index, chip8_t *chip);
+
+/* Execute `cycles` instructions on every instance */
+void chip8_batch_run(chip8_batch_t *batch, long cycles);
+void chip8_batch_tick_timers(chip8_batch_t *batch);
+
+/* Keypad state of one instance, bit N = key N held */
+void chip8_batch_set_keys(chip8_batch_t *batch, int index, uint16_t keys);
+
+/* Packed display rows of one instance (same layout as chip8_t.display) */
+const uint64_t *chip8_batch_display(const chip8_batch_t *batch, int index);
+
+#endif
@@ -0,0 +1,1049 @@
+/* chip8_jit.c -- basic-block recompiler for CHIP-8
+ *
+ * A block starts at an even address and runs straight-line instructions
+ * until (and including) the first control-flow instruction. Blocks are
+ * cached per start address and all thrown away when the chip's code_gen
+ * changes, i.e. when an instruction that has been decoded is overwritten.
+ *
+ * Backends: x86-64 (System V) and AArch64 (AAPCS64, Linux and FreeBSD;
+ * macOS would need MAP_JIT). Inside a block V0-VF live in host
+ * registers, see "V register allocation" below. Other hosts have no
+ * backend and chip8_jit_create returns NULL.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "chip8_jit.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A backend can also be picked with -D, e.g. to build the emitter for
+ * inspection on another host */
+#if !defined(CHIP8_JIT_X86_64) && !defined(CHIP8_JIT_AARCH64)
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define CHIP8_JIT_X86_64 1
+#elif defined(__aarch64__) && (defined(__linux__) || defined(__FreeBSD__))
+#define CHIP8_JIT_AARCH64 1
+#endif
+#endif
+
+#if defined(CHIP8_JIT_X86_64)
+#define CHIP8_JIT_BACKEND 1
+#define JIT_POOL_SIZE     11   /* host registers for V0-VF */
+#elif defined(CHIP8_JIT_AARCH64)
+#define CHIP8_JIT_BACKEND 1
+#define JIT_POOL_SIZE     16
+#endif
+
+#ifdef CHIP8_JIT_BACKEND
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#define JIT_CODE_SIZE    (1 << 20)   /* 1 MB of translated code */
+#define JIT_BLOCK_MAX    64          /* instructions per block */
+#define JIT_BLOCK_BYTES  (JIT_BLOCK_MAX * 512)  /* worst-case encoding */
+#define JIT_PROLOGUE_MAX 64          /* room reserved in front of a block */
+
+typedef int (*block_fn)(chip8_t *chip);
+
+typedef struct {
+    block_fn code;    /* NULL = not compiled yet */
+    int      len;     /* instructions executed by the block; 0 = interpret */
+} block_t;
+
+struct chip8_jit_t {
+    chip8_t *chip;
+    uint32_t code_gen;      /* chip->code_gen the cache was built against */
+
+    uint8_t *code;          /* executable buffer */
+    size_t   code_used;
+
+    block_t  blocks[CHIP8_MEMORY_SIZE / 2];
+
+    /* Differential testing */
+    bool     diff;
+    chip8_t *shadow;
+    unsigned long mismatches;
+};
+
+/* ======================================================================
+ * Differential mode
+ * ====================================================================== */
+
+static void diff_sync(chip8_jit_t *jit) {
+    memcpy(jit->shadow, jit->chip, sizeof(chip8_t));
+}
+
+static bool diff_compare(chip8_jit_t *jit, uint16_t start_pc) {
+    const chip8_t *a = jit->chip;
+    const chip8_t *b = jit->shadow;
+    const char *what = NULL;
+
+    if (memcmp(a->V, b->V, sizeof(a->V)) != 0)                     what = "V";
+    else if (a->I != b->I)                                         what = "I";
+    else if (a->pc != b->pc)                                       what = "pc";
+    else if (a->sp != b->sp || memcmp(a->stack, b->stack, sizeof(a->stack)) != 0)
+                                                                   what = "stack";
+    else if (a->delay_timer != b->delay_timer ||
+             a->sound_timer != b->sound_timer)                     what = "timers";
+    else if (memcmp(a->display, b->display, sizeof(a->display)) != 0) what = "display";
+    else if (memcmp(a->memory, b->memory, sizeof(a->memory)) != 0) what = "memory";
+
+    if (!what)
+        return true;
+
+    fprintf(stderr, "JIT mismatch in block at 0x%03X: %s differs "
+            "(jit pc=0x%03X, interpreter pc=0x%03X)\n",
+            start_pc, what, a->pc, b->pc);
+    jit->mismatches++;
+    return false;
+}
+
+/* Inputs driven from outside the core, captured before a step so the
+ * shadow starts from what the real machine saw rather than from what
+ * the step left behind (FX15 and FX18 write the timers themselves). */
+typedef struct {
+    uint8_t keypad[CHIP8_KEYPAD_SIZE];
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+} diff_inputs_t;
+
+static void diff_capture(const chip8_t *chip, diff_inputs_t *in) {
+    memcpy(in->keypad, chip->keypad, sizeof(in->keypad));
+    in->delay_timer = chip->delay_timer;
+    in->sound_timer = chip->sound_timer;
+}
+
+/* Run `n` interpreter steps on the shadow from the inputs in `in` */
+static void diff_step_shadow(chip8_jit_t *jit, const diff_inputs_t *in, int n) {
+    chip8_t *s = jit->shadow;
+    memcpy(s->keypad, in->keypad, sizeof(s->keypad));
+    s->delay_timer = in->delay_timer;
+    s->sound_timer = in->sound_timer;
+    for (int i = 0; i < n; i++)
+        chip8_cycle(s);
+}
+
+#ifdef CHIP8_JIT_BACKEND
+
+/* ======================================================================
+ * V register allocation
+ *
+ * A V register gets a host register from the backend's pool the first
+ * time the block touches it, and is loaded from chip->V only if that
+ * access reads it. Writes mark it dirty; dirty registers are stored
+ * back in the epilogue and before every call into an interpreter
+ * handler, and since handlers may change V (CXNN, DXYN) and clobber
+ * caller-saved registers, every V is reloaded on its next read after a
+ * call. Blocks are straight-line, so emission order is execution order.
+ * When the pool runs dry (x86-64 only) the rest stay in chip->V.
+ * ====================================================================== */
+
+enum { V_READ = 1, V_WRITE = 2 };
+
+typedef struct {
+    uint8_t *p;
+    int8_t   host[CHIP8_REGISTER_COUNT];    /* -1 = lives in chip->V */
+    bool     loaded[CHIP8_REGISTER_COUNT];  /* host register is current */
+    bool     dirty[CHIP8_REGISTER_COUNT];   /* host register is newer */
+    int      pool_used;
+} emit_t;
+
+#define OFF_V(r)  ((int32_t)(offsetof(chip8_t, V) + (r)))
+#define OFF_I     ((int32_t)offsetof(chip8_t, I))
+#define OFF_PC    ((int32_t)offsetof(chip8_t, pc))
+#define OFF_DT    ((int32_t)offsetof(chip8_t, delay_timer))
+#define OFF_ST    ((int32_t)offsetof(chip8_t, sound_timer))
+#define OFF_MEM   ((int32_t)offsetof(chip8_t, memory))
+#define OFF_OP(a) ((int32_t)(offsetof(chip8_t, decoded) + ((a) >> 1) * sizeof(chip8_op_t)))
+
+static void e8(emit_t *e, uint8_t b)  { *e->p++ = b; }
+
+static void e32(emit_t *e, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        e8(e, (uint8_t)(v >> (8 * i)));
+}
+
+static void emit_init(emit_t *e, uint8_t *p) {
+    e->p = p;
+    memset(e->host, -1, sizeof(e->host));
+    memset(e->loaded, 0, sizeof(e->loaded));
+    memset(e->dirty, 0, sizeof(e->dirty));
+    e->pool_used = 0;
+}
+
+/* Backend pieces used by the allocator */
+static const int8_t pool[JIT_POOL_SIZE];
+static void e_v_load(emit_t *e, int reg, uint8_t v);
+static void e_v_store(emit_t *e, int reg, uint8_t v);
+
+/* Host register for an access to Vv, or -1 if it stays in memory */
+static int v_use(emit_t *e, uint8_t v, int access) {
+    if (e->host[v] < 0 && e->pool_used < JIT_POOL_SIZE)
+        e->host[v] = pool[e->pool_used++];
+
+    int reg = e->host[v];
+    if (reg < 0)
+        return -1;
+    if ((access & V_READ) && !e->loaded[v])
+        e_v_load(e, reg, v);
+    e->loaded[v] = true;
+    if (access & V_WRITE)
+        e->dirty[v] = true;
+    return reg;
+}
+
+/* Store dirty registers so chip->V is current */
+static void v_flush(emit_t *e) {
+    for (uint8_t v = 0; v < CHIP8_REGISTER_COUNT; v++) {
+        if (e->dirty[v]) {
+            e_v_store(e, e->host[v], v);
+            e->dirty[v] = false;
+        }
+    }
+}
+
+/* After a call: host registers may be stale or clobbered */
+static void v_forget(emit_t *e) {
+    memset(e->loaded, 0, sizeof(e->loaded));
+}
+
+typedef enum {
+    EMIT_CONTINUE,      /* instruction emitted, keep going */
+    EMIT_END_AFTER,     /* instruction emitted, block must end after it */
+    EMIT_END_BEFORE,    /* instruction not emitted; interpret it next */
+} emit_result_t;
+
+#endif
+
+#ifdef CHIP8_JIT_X86_64
+
+/* ======================================================================
+ * x86-64 emitter
+ *
+ * rbx holds the chip8_t pointer and V registers are byte registers;
+ * VF results come from the host carry flag. al, cl and dl are scratch.
+ * ====================================================================== */
+
+/* x86 register numbers used in ModRM */
+enum {
+    R_AX = 0, R_CX = 1, R_DX = 2, R_BX = 3, R_BP = 5, R_SI = 6, R_DI = 7,
+    R_R8 = 8, R_R9, R_R10, R_R11, R_R12, R_R13, R_R14, R_R15,
+};
+
+/* Caller-saved first, so small blocks push nothing */
+#define JIT_POOL_VOLATILE 6
+static const int8_t pool[JIT_POOL_SIZE] = {
+    R_SI, R_DI, R_R8, R_R9, R_R10, R_R11,
+    R_BP, R_R12, R_R13, R_R14, R_R15,
+};
+
+static void e16(emit_t *e, uint16_t v) {
+    e8(e, v & 0xFF);
+    e8(e, v >> 8);
+}
+
+static void e64(emit_t *e, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        e8(e, (uint8_t)(v >> (8 * i)));
+}
+
+enum { OP_0F = 1, OP_16 = 2 };
+
+/* [66] [REX] [0F] opcode ModRM, with `reg` in the reg field and r/m the
+ * host register `rm`, or [rbx + disp] when rm < 0. A bare REX is
+ * emitted for registers 4-7 so byte operands mean spl-dil, not ah-bh. */
+static void e_op(emit_t *e, int flags, uint8_t opcode, int reg, int rm, int32_t disp) {
+    uint8_t rex = (uint8_t)(0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+
+    if (flags & OP_16)
+        e8(e, 0x66);
+    if (rex != 0x40 || reg >= 4 || rm >= 4)
+        e8(e, rex);
+    if (flags & OP_0F)
+        e8(e, 0x0F);
+    e8(e, opcode);
+    if (rm >= 0) {
+        e8(e, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+    } else {
+        e8(e, (uint8_t)(0x80 | ((reg & 7) << 3) | R_BX));
+        e32(e, (uint32_t)disp);
+    }
+}
+
+/* e_op with Vv as the r/m operand */
+static void e_opv(emit_t *e, int flags, uint8_t opcode, int reg, uint8_t v, int access) {
+    e_op(e, flags, opcode, reg, v_use(e, v, access), OFF_V(v));
+}
+
+/* Register holding Vv: its host register, or `scratch` loaded from V */
+static int e_vreg(emit_t *e, uint8_t v, int scratch) {
+    int reg = v_use(e, v, V_READ);
+    if (reg >= 0)
+        return reg;
+    e_op(e, 0, 0x8A, scratch, -1, OFF_V(v));              /* mov r8, [Vv] */
+    return scratch;
+}
+
+static void e_v_load(emit_t *e, int reg, uint8_t v) {
+    e_op(e, 0, 0x8A, reg, -1, OFF_V(v));                  /* mov r8, [Vv] */
+}
+
+static void e_v_store(emit_t *e, int reg, uint8_t v) {
+    e_op(e, 0, 0x88, reg, -1, OFF_V(v));                  /* mov [Vv], r8 */
+}
+
+static void e_push(emit_t *e, int reg) {
+    if (reg >= 8)
+        e8(e, 0x41);
+    e8(e, (uint8_t)(0x50 | (reg & 7)));
+}
+
+static void e_pop(emit_t *e, int reg) {
+    if (reg >= 8)
+        e8(e, 0x41);
+    e8(e, (uint8_t)(0x58 | (reg & 7)));
+}
+
+/* Callee-saved pool registers pushed alongside rbx; an odd count
+ * needs 8 bytes of padding to keep rsp 16-byte aligned at calls */
+static int saved_count(const emit_t *e) {
+    return e->pool_used > JIT_POOL_VOLATILE ? e->pool_used - JIT_POOL_VOLATILE : 0;
+}
+
+static size_t e_prologue(const emit_t *body, uint8_t *buf) {
+    emit_t e = { buf, {0}, {0}, {0}, 0 };
+    int saved = saved_count(body);
+
+    e_push(&e, R_BX);
+    for (int i = 0; i < saved; i++)
+        e_push(&e, pool[JIT_POOL_VOLATILE + i]);
+    if (saved % 2) {
+        e8(&e, 0x48); e8(&e, 0x83); e8(&e, 0xEC); e8(&e, 8);   /* sub rsp, 8 */
+    }
+    e8(&e, 0x48); e8(&e, 0x89); e8(&e, 0xFB);                   /* mov rbx, rdi */
+    return (size_t)(e.p - buf);
+}
+
+static void e_epilogue(emit_t *e, int len) {
+    int saved = saved_count(e);
+
+    v_flush(e);
+    e8(e, 0xB8); e32(e, (uint32_t)len);                         /* mov eax, len */
+    if (saved % 2) {
+        e8(e, 0x48); e8(e, 0x83); e8(e, 0xC4); e8(e, 8);        /* add rsp, 8 */
+    }
+    for (int i = saved - 1; i >= 0; i--)
+        e_pop(e, pool[JIT_POOL_VOLATILE + i]);
+    e_pop(e, R_BX);
+    e8(e, 0xC3);                                                /* ret */
+}
+
+static void e_store_pc(emit_t *e, uint16_t pc) {
+    e_op(e, OP_16, 0xC7, 0, -1, OFF_PC); e16(e, pc);            /* mov word [pc], imm16 */
+}
+
+/* Call the interpreter handler for the decoded op at `addr` */
+static void e_call_handler(emit_t *e, chip8_t *chip, uint16_t addr) {
+    v_flush(e);
+    e8(e, 0x48); e8(e, 0x89); e8(e, 0xDF);                      /* mov rdi, rbx */
+    e8(e, 0x48); e8(e, 0x8D); e8(e, 0xB3);                      /* lea rsi, [rbx+op] */
+    e32(e, (uint32_t)OFF_OP(addr));
+    e8(e, 0x48); e8(e, 0xB8);                                   /* mov rax, imm64 */
+    e64(e, (uint64_t)(uintptr_t)chip->decoded[addr >> 1].fn);
+    e8(e, 0xFF); e8(e, 0xD0);                                   /* call rax */
+    v_forget(e);
+}
+
+/* Store AL into VX and DL into VF, in the interpreter's order */
+static void e_store_result_flag(emit_t *e, uint8_t x) {
+    e_opv(e, 0, 0x88, R_AX, x, V_WRITE);                        /* mov Vx, al */
+    e_opv(e, 0, 0x88, R_DX, 0xF, V_WRITE);                      /* mov VF, dl */
+}
+
+static void e_setc_dl(emit_t *e, bool inverted) {
+    e8(e, 0x0F); e8(e, inverted ? 0x93 : 0x92); e8(e, 0xC2);   /* setc/setnc dl */
+}
+
+/* Conditional skip: ZF from the preceding compare selects pc+4 (cond) */
+static void e_skip(emit_t *e, uint16_t addr, bool skip_if_equal) {
+    e8(e, 0xB9); e32(e, (uint16_t)(addr + 2));                  /* mov ecx, next */
+    e8(e, 0xBA); e32(e, (uint16_t)(addr + 4));                  /* mov edx, next+2 */
+    e8(e, 0x0F); e8(e, skip_if_equal ? 0x44 : 0x45); e8(e, 0xCA); /* cmove/cmovne ecx, edx */
+    e_op(e, OP_16, 0x89, R_CX, -1, OFF_PC);                     /* mov [pc], cx */
+}
+
+static emit_result_t emit_op(emit_t *e, chip8_t *chip, uint16_t addr, const chip8_op_t *op) {
+    uint8_t x = op->x, y = op->y;
+
+    switch (op->opcode & 0xF000) {
+    case 0x1000: /* 1NNN */
+        e_store_pc(e, op->nnn);
+        return EMIT_END_AFTER;
+
+    case 0x3000: /* 3XNN */
+    case 0x4000: /* 4XNN */
+        e_opv(e, 0, 0x80, 7, x, V_READ); e8(e, op->nn);           /* cmp Vx, nn */
+        e_skip(e, addr, (op->opcode & 0xF000) == 0x3000);
+        return EMIT_END_AFTER;
+
+    case 0x5000: /* 5XY0 */
+    case 0x9000: /* 9XY0 */
+        e_opv(e, 0, 0x3A, e_vreg(e, x, R_AX), y, V_READ);         /* cmp Vx, Vy */
+        e_skip(e, addr, (op->opcode & 0xF000) == 0x5000);
+        return EMIT_END_AFTER;
+
+    case 0x6000: /* 6XNN */
+        e_opv(e, 0, 0xC6, 0, x, V_WRITE); e8(e, op->nn);          /* mov Vx, nn */
+        return EMIT_CONTINUE;
+
+    case 0x7000: /* 7XNN */
+        e_opv(e, 0, 0x80, 0, x, V_READ | V_WRITE); e8(e, op->nn); /* add Vx, nn */
+        return EMIT_CONTINUE;
+
+    case 0x8000:
+        switch (op->n) {
+        case 0x0:
+            e_opv(e, 0, 0x88, e_vreg(e, y, R_AX), x, V_WRITE);    /* mov Vx, Vy */
+            return EMIT_CONTINUE;
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+            static const uint8_t alu[4] = { 0, 0x08, 0x20, 0x30 };  /* or/and/xor r/m8, r8 */
+            e_opv(e, 0, alu[op->n], e_vreg(e, y, R_AX), x, V_READ | V_WRITE);
+            return EMIT_CONTINUE;
+        }
+        case 0x4:
+            e_opv(e, 0, 0x8A, R_AX, x, V_READ);                   /* mov al, Vx */
+            e_opv(e, 0, 0x02, R_AX, y, V_READ);                   /* add al, Vy */
+            e_setc_dl(e, false);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0x5:
+            e_opv(e, 0, 0x8A, R_AX, x, V_READ);                   /* mov al, Vx */
+            e_opv(e, 0, 0x2A, R_AX, y, V_READ);                   /* sub al, Vy */
+            e_setc_dl(e, true);                                   /* VF = !borrow */
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0x6:
+            e_opv(e, 0, 0x8A, R_AX, x, V_READ);                   /* mov al, Vx */
+            e8(e, 0xD0); e8(e, 0xE8);                             /* shr al, 1 */
+            e_setc_dl(e, false);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0x7:
+            e_opv(e, 0, 0x8A, R_AX, y, V_READ);                   /* mov al, Vy */
+            e_opv(e, 0, 0x2A, R_AX, x, V_READ);                   /* sub al, Vx */
+            e_setc_dl(e, true);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0xE:
+            e_opv(e, 0, 0x8A, R_AX, x, V_READ);                   /* mov al, Vx */
+            e8(e, 0xD0); e8(e, 0xE0);                             /* shl al, 1 */
+            e_setc_dl(e, false);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        default:
+            break;
+        }
+        break;
+
+    case 0xA000: /* ANNN */
+        e_op(e, OP_16, 0xC7, 0, -1, OFF_I); e16(e, op->nnn);      /* mov word [I], nnn */
+        return EMIT_CONTINUE;
+
+    case 0xF000:
+        switch (op->nn) {
+        case 0x07:
+            e_op(e, 0, 0x8A, R_AX, -1, OFF_DT);                   /* mov al, [delay] */
+            e_opv(e, 0, 0x88, R_AX, x, V_WRITE);                  /* mov Vx, al */
+            return EMIT_CONTINUE;
+        case 0x15:
+        case 0x18:
+            e_op(e, 0, 0x88, e_vreg(e, x, R_AX), -1,              /* mov [timer], Vx */
+                 op->nn == 0x15 ? OFF_DT : OFF_ST);
+            return EMIT_CONTINUE;
+        case 0x1E:
+            e_opv(e, OP_0F, 0xB6, R_AX, x, V_READ);               /* movzx eax, Vx */
+            e_op(e, OP_0F, 0xB7, R_CX, -1, OFF_I);                /* movzx ecx, word [I] */
+            e8(e, 0x01); e8(e, 0xC8);                             /* add eax, ecx */
+            e8(e, 0x25); e32(e, 0xFFF);                           /* and eax, 0xFFF */
+            e_op(e, OP_16, 0x89, R_AX, -1, OFF_I);                /* mov [I], ax */
+            return EMIT_CONTINUE;
+        case 0x29:
+            e_opv(e, OP_0F, 0xB6, R_AX, x, V_READ);               /* movzx eax, Vx */
+            e8(e, 0x83); e8(e, 0xE0); e8(e, 0x0F);                /* and eax, 0x0F */
+            e8(e, 0x8D); e8(e, 0x04); e8(e, 0x80);                /* lea eax, [rax+rax*4] */
+            e_op(e, OP_16, 0x89, R_AX, -1, OFF_I);                /* mov [I], ax */
+            return EMIT_CONTINUE;
+        case 0x65:
+            e_op(e, OP_0F, 0xB7, R_DX, -1, OFF_I);                /* movzx edx, word [I] */
+            for (uint8_t i = 0; i <= x; i++) {
+                e8(e, 0x8D); e8(e, 0x42); e8(e, i);               /* lea eax, [rdx+i] */
+                e8(e, 0x25); e32(e, 0xFFF);                       /* and eax, 0xFFF */
+                e8(e, 0x8A); e8(e, 0x8C); e8(e, 0x03);            /* mov cl, [rbx+rax+mem] */
+                e32(e, (uint32_t)OFF_MEM);
+                e_opv(e, 0, 0x88, R_CX, i, V_WRITE);              /* mov Vi, cl */
+            }
+            return EMIT_CONTINUE;
+        case 0x33:
+        case 0x55:
+            /* Memory writes may hit code in this very block; run them
+             * through the interpreter and end the block afterwards. */
+            e_call_handler(e, chip, addr);
+            e_store_pc(e, (uint16_t)(addr + 2));
+            return EMIT_END_AFTER;
+        case 0x0A:
+            return EMIT_END_BEFORE;
+        default:
+            break;
+        }
+        break;
+
+    case 0x0000:
+        if (op->opcode == 0x00E0) {
+            e_call_handler(e, chip, addr);
+            return EMIT_CONTINUE;
+        }
+        if (op->opcode == 0x00EE)
+            return EMIT_END_BEFORE;
+        break;
+
+    case 0x2000: /* 2NNN */
+    case 0xB000: /* BNNN */
+    case 0xE000: /* EX9E / EXA1 */
+        return EMIT_END_BEFORE;
+
+    case 0xC000: /* CXNN */
+    case 0xD000: /* DXYN */
+        e_call_handler(e, chip, addr);
+        return EMIT_CONTINUE;
+    }
+
+    /* Unknown opcode: let the interpreter report it */
+    e_call_handler(e, chip, addr);
+    return EMIT_CONTINUE;
+}
+
+#endif /* CHIP8_JIT_X86_64 */
+
+#ifdef CHIP8_JIT_AARCH64
+
+/* ======================================================================
+ * AArch64 emitter
+ *
+ * x19 holds the chip8_t pointer and every V register gets a w register,
+ * kept zero-extended to 8 bits; VF results are computed explicitly.
+ * w1, w2, x16 and x17 are scratch.
+ * ====================================================================== */
+
+enum { A_CHIP = 19, A_ZR = 31, A_SP = 31 };
+
+/* x9-x15 are caller-saved, x20-x28 callee-saved */
+#define JIT_POOL_VOLATILE 7
+static const int8_t pool[JIT_POOL_SIZE] = {
+    9, 10, 11, 12, 13, 14, 15,
+    20, 21, 22, 23, 24, 25, 26, 27, 28,
+};
+
+enum { COND_EQ = 0, COND_NE = 1, COND_HS = 2 };
+
+enum {
+    A_STRB = 0x39000000, A_LDRB = 0x39400000,
+    A_STRH = 0x79000000, A_LDRH = 0x79400000,
+};
+
+static void ins(emit_t *e, uint32_t insn) { e32(e, insn); }
+
+/* movz/movk sequence for a 64-bit constant */
+static void a_mov_imm(emit_t *e, int rd, uint64_t imm) {
+    ins(e, 0xD2800000 | (uint32_t)(imm & 0xFFFF) << 5 | (uint32_t)rd);   /* movz xd, #lo */
+    for (int hw = 1; hw < 4; hw++) {
+        uint32_t part = (uint32_t)(imm >> (16 * hw)) & 0xFFFF;
+        if (part)
+            ins(e, 0xF2800000 | (uint32_t)hw << 21 | part << 5 | (uint32_t)rd); /* movk */
+    }
+}
+
+static void a_movz_w(emit_t *e, int rd, uint16_t imm) {
+    ins(e, 0x52800000 | (uint32_t)imm << 5 | (uint32_t)rd);             /* movz wd, #imm */
+}
+
+/* 32-bit register-register ops: add, sub, orr, and, eor, subs */
+enum {
+    A_ADD = 0x0B000000, A_SUB = 0x4B000000, A_ORR = 0x2A000000,
+    A_AND = 0x0A000000, A_EOR = 0x4A000000, A_SUBS = 0x6B000000,
+};
+
+static void a_rrr(emit_t *e, uint32_t op, int rd, int rn, int rm) {
+    ins(e, op | (uint32_t)rm << 16 | (uint32_t)rn << 5 | (uint32_t)rd);
+}
+
+/* ubfm wd, wn, #immr, #imms: lsr, uxtb and ubfx are all aliases */
+static void a_ubfm(emit_t *e, int rd, int rn, int immr, int imms) {
+    ins(e, 0x53000000 | (uint32_t)immr << 16 | (uint32_t)imms << 10 |
+           (uint32_t)rn << 5 | (uint32_t)rd);
+}
+
+static void a_uxtb(emit_t *e, int rd, int rn)       { a_ubfm(e, rd, rn, 0, 7); }
+static void a_lsr(emit_t *e, int rd, int rn, int s) { a_ubfm(e, rd, rn, s, 31); }
+
+/* and wd, wn, #(2^bits - 1) */
+static void a_mask(emit_t *e, int rd, int rn, int bits) { a_ubfm(e, rd, rn, 0, bits - 1); }
+
+/* ldrb/strb/ldrh/strh rt, [base + off]; offsets past the scaled 12-bit
+ * immediate (V and everything after it) go through x17 */
+static void a_ldst(emit_t *e, uint32_t op, int size, int rt, int base, uint32_t off) {
+    if (off / (uint32_t)size > 0xFFF) {
+        ins(e, 0x91400000 | (off >> 12) << 10 | (uint32_t)base << 5 | 17); /* add x17, base, #hi, lsl 12 */
+        base = 17;
+        off &= 0xFFF;
+    }
+    ins(e, op | (off / (uint32_t)size) << 10 | (uint32_t)base << 5 | (uint32_t)rt);
+}
+
+static void e_v_load(emit_t *e, int reg, uint8_t v) {
+    a_ldst(e, A_LDRB, 1, reg, A_CHIP, (uint32_t)OFF_V(v));
+}
+
+static void e_v_store(emit_t *e, int reg, uint8_t v) {
+    a_ldst(e, A_STRB, 1, reg, A_CHIP, (uint32_t)OFF_V(v));
+}
+
+/* Registers saved in pairs: x19 and the callee-saved pool registers
+ * in use, padded with xzr to keep sp 16-byte aligned */
+static int saved_regs(const emit_t *e, int *regs) {
+    int n = 0;
+    regs[n++] = A_CHIP;
+    for (int i = JIT_POOL_VOLATILE; i < e->pool_used; i++)
+        regs[n++] = pool[i];
+    if (n % 2)
+        regs[n++] = A_ZR;
+    return n;
+}
+
+static size_t e_prologue(const emit_t *body, uint8_t *buf) {
+    emit_t e = { buf, {0}, {0}, {0}, 0 };
+    int regs[JIT_POOL_SIZE + 2];
+    int n = saved_regs(body, regs);
+
+    ins(&e, 0xA9BF7BFD);                                        /* stp x29, x30, [sp, #-16]! */
+    for (int i = 0; i < n; i += 2)                              /* stp xa, xb, [sp, #-16]! */
+        ins(&e, 0xA9BF0000 | (uint32_t)regs[i + 1] << 10 | A_SP << 5 | (uint32_t)regs[i]);
+    ins(&e, 0xAA0003E0 | A_CHIP);                               /* mov x19, x0 */
+    return (size_t)(e.p - buf);
+}
+
+static void e_epilogue(emit_t *e, int len) {
+    int regs[JIT_POOL_SIZE + 2];
+    int n = saved_regs(e, regs);
+
+    v_flush(e);
+    a_movz_w(e, 0, (uint16_t)len);                              /* mov w0, len */
+    for (int i = n - 2; i >= 0; i -= 2)                         /* ldp xa, xb, [sp], #16 */
+        ins(e, 0xA8C10000 | (uint32_t)regs[i + 1] << 10 | A_SP << 5 | (uint32_t)regs[i]);
+    ins(e, 0xA8C17BFD);                                         /* ldp x29, x30, [sp], #16 */
+    ins(e, 0xD65F03C0);                                         /* ret */
+}
+
+static void e_store_pc(emit_t *e, uint16_t pc) {
+    a_movz_w(e, 1, pc);
+    a_ldst(e, A_STRH, 2, 1, A_CHIP, (uint32_t)OFF_PC);
+}
+
+/* Call the interpreter handler for the decoded op at `addr` */
+static void e_call_handler(emit_t *e, chip8_t *chip, uint16_t addr) {
+    v_flush(e);
+    ins(e, 0xAA0003E0 | A_CHIP << 16);                          /* mov x0, x19 */
+    a_mov_imm(e, 1, (uint64_t)OFF_OP(addr));
+    ins(e, 0x8B000000 | 1 << 16 | A_CHIP << 5 | 1);             /* add x1, x19, x1 */
+    a_mov_imm(e, 16, (uint64_t)(uintptr_t)chip->decoded[addr >> 1].fn);
+    ins(e, 0xD63F0200);                                         /* blr x16 */
+    v_forget(e);
+}
+
+/* Store w1 into VX and w2 into VF, in the interpreter's order */
+static void e_store_result_flag(emit_t *e, uint8_t x) {
+    a_uxtb(e, v_use(e, x, V_WRITE), 1);
+    a_rrr(e, A_ORR, v_use(e, 0xF, V_WRITE), A_ZR, 2);           /* mov VF, w2 */
+}
+
+/* w2 = 1 if cond holds after the preceding compare */
+static void e_cset_w2(emit_t *e, int cond) {
+    ins(e, 0x1A9F07E0 | (uint32_t)(cond ^ 1) << 12 | 2);        /* cset w2, cond */
+}
+
+/* Conditional skip: Z from the preceding compare selects pc+4 (cond) */
+static void e_skip(emit_t *e, uint16_t addr, bool skip_if_equal) {
+    a_movz_w(e, 1, (uint16_t)(addr + 2));
+    a_movz_w(e, 2, (uint16_t)(addr + 4));
+    ins(e, 0x1A800000 | 1 << 16 | (uint32_t)(skip_if_equal ? COND_EQ : COND_NE) << 12 |
+           2 << 5 | 1);                                         /* csel w1, w2, w1, cond */
+    a_ldst(e, A_STRH, 2, 1, A_CHIP, (uint32_t)OFF_PC);
+}
+
+static emit_result_t emit_op(emit_t *e, chip8_t *chip, uint16_t addr, const chip8_op_t *op) {
+    uint8_t x = op->x, y = op->y;
+    int rx, ry;
+
+    switch (op->opcode & 0xF000) {
+    case 0x1000: /* 1NNN */
+        e_store_pc(e, op->nnn);
+        return EMIT_END_AFTER;
+
+    case 0x3000: /* 3XNN */
+    case 0x4000: /* 4XNN */
+        rx = v_use(e, x, V_READ);
+        ins(e, 0x7100001F | (uint32_t)op->nn << 10 | (uint32_t)rx << 5);  /* cmp Vx, #nn */
+        e_skip(e, addr, (op->opcode & 0xF000) == 0x3000);
+        return EMIT_END_AFTER;
+
+    case 0x5000: /* 5XY0 */
+    case 0x9000: /* 9XY0 */
+        rx = v_use(e, x, V_READ);
+        ry = v_use(e, y, V_READ);
+        a_rrr(e, A_SUBS, A_ZR, rx, ry);                           /* cmp Vx, Vy */
+        e_skip(e, addr, (op->opcode & 0xF000) == 0x5000);
+        return EMIT_END_AFTER;
+
+    case 0x6000: /* 6XNN */
+        a_movz_w(e, v_use(e, x, V_WRITE), op->nn);
+        return EMIT_CONTINUE;
+
+    case 0x7000: /* 7XNN */
+        rx = v_use(e, x, V_READ | V_WRITE);
+        ins(e, 0x11000000 | (uint32_t)op->nn << 10 | (uint32_t)rx << 5 | (uint32_t)rx);
+        a_uxtb(e, rx, rx);                                        /* Vx = (Vx + nn) & 0xFF */
+        return EMIT_CONTINUE;
+
+    case 0x8000:
+        switch (op->n) {
+        case 0x0:
+            ry = v_use(e, y, V_READ);
+            a_rrr(e, A_ORR, v_use(e, x, V_WRITE), A_ZR, ry);      /* mov Vx, Vy */
+            return EMIT_CONTINUE;
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+            static const uint32_t alu[4] = { 0, A_ORR, A_AND, A_EOR };
+            ry = v_use(e, y, V_READ);
+            rx = v_use(e, x, V_READ | V_WRITE);
+            a_rrr(e, alu[op->n], rx, rx, ry);
+            return EMIT_CONTINUE;
+        }
+        case 0x4:
+            rx = v_use(e, x, V_READ);
+            ry = v_use(e, y, V_READ);
+            a_rrr(e, A_ADD, 1, rx, ry);                           /* w1 = Vx + Vy */
+            a_lsr(e, 2, 1, 8);                                    /* w2 = carry */
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0x5:
+        case 0x7:
+            rx = v_use(e, x, V_READ);
+            ry = v_use(e, y, V_READ);
+            if (op->n == 0x7) {
+                int t = rx;
+                rx = ry;
+                ry = t;
+            }
+            a_rrr(e, A_SUBS, A_ZR, rx, ry);
+            e_cset_w2(e, COND_HS);                                /* w2 = !borrow */
+            a_rrr(e, A_SUB, 1, rx, ry);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0x6:
+            rx = v_use(e, x, V_READ);
+            a_mask(e, 2, rx, 1);                                  /* w2 = Vx & 1 */
+            a_lsr(e, 1, rx, 1);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        case 0xE:
+            rx = v_use(e, x, V_READ);
+            a_lsr(e, 2, rx, 7);                                   /* w2 = Vx >> 7 */
+            a_rrr(e, A_ADD, 1, rx, rx);
+            e_store_result_flag(e, x);
+            return EMIT_CONTINUE;
+        default:
+            break;
+        }
+        break;
+
+    case 0xA000: /* ANNN */
+        a_movz_w(e, 1, op->nnn);
+        a_ldst(e, A_STRH, 2, 1, A_CHIP, (uint32_t)OFF_I);
+        return EMIT_CONTINUE;
+
+    case 0xF000:
+        switch (op->nn) {
+        case 0x07:
+            a_ldst(e, A_LDRB, 1, v_use(e, x, V_WRITE), A_CHIP, (uint32_t)OFF_DT);
+            return EMIT_CONTINUE;
+        case 0x15:
+        case 0x18:
+            a_ldst(e, A_STRB, 1, v_use(e, x, V_READ), A_CHIP,
+                   (uint32_t)(op->nn == 0x15 ? OFF_DT : OFF_ST));
+            return EMIT_CONTINUE;
+        case 0x1E:
+            rx = v_use(e, x, V_READ);
+            a_ldst(e, A_LDRH, 2, 1, A_CHIP, (uint32_t)OFF_I);
+            a_rrr(e, A_ADD, 1, 1, rx);
+            a_mask(e, 1, 1, 12);
+            a_ldst(e, A_STRH, 2, 1, A_CHIP, (uint32_t)OFF_I);
+            return EMIT_CONTINUE;
+        case 0x29:
+            rx = v_use(e, x, V_READ);
+            a_mask(e, 1, rx, 4);
+            ins(e, 0x0B000000 | 1 << 16 | 2 << 10 | 1 << 5 | 1);  /* add w1, w1, w1, lsl #2 */
+            a_ldst(e, A_STRH, 2, 1, A_CHIP, (uint32_t)OFF_I);
+            return EMIT_CONTINUE;
+        case 0x65:
+            a_ldst(e, A_LDRH, 2, 1, A_CHIP, (uint32_t)OFF_I);
+            for (uint8_t i = 0; i <= x; i++) {
+                ins(e, 0x11000000 | (uint32_t)i << 10 | 1 << 5 | 2);  /* add w2, w1, #i */
+                a_mask(e, 2, 2, 12);
+                ins(e, 0x8B000000 | 2 << 16 | A_CHIP << 5 | 2);       /* add x2, x19, x2 */
+                a_ldst(e, A_LDRB, 1, v_use(e, i, V_WRITE), 2, (uint32_t)OFF_MEM);
+            }
+            return EMIT_CONTINUE;
+        case 0x33:
+        case 0x55:
+            /* Memory writes may hit code in this very block; run them
+             * through the interpreter and end the block afterwards. */
+            e_call_handler(e, chip, addr);
+            e_store_pc(e, (uint16_t)(addr + 2));
+            return EMIT_END_AFTER;
+        case 0x0A:
+            return EMIT_END_BEFORE;
+        default:
+            break;
+        }
+        break;
+
+    case 0x0000:
+        if (op->opcode == 0x00E0) {
+            e_call_handler(e, chip, addr);
+            return EMIT_CONTINUE;
+        }
+        if (op->opcode == 0x00EE)
+            return EMIT_END_BEFORE;
+        break;
+
+    case 0x2000: /* 2NNN */
+    case 0xB000: /* BNNN */
+    case 0xE000: /* EX9E / EXA1 */
+        return EMIT_END_BEFORE;
+
+    case 0xC000: /* CXNN */
+    case 0xD000: /* DXYN */
+        e_call_handler(e, chip, addr);
+        return EMIT_CONTINUE;
+    }
+
+    /* Unknown opcode: let the interpreter report it */
+    e_call_handler(e, chip, addr);
+    return EMIT_CONTINUE;
+}
+
+#endif /* CHIP8_JIT_AARCH64 */
+
+#ifdef CHIP8_JIT_BACKEND
+
+/* ======================================================================
+ * Block cache
+ * ====================================================================== */
+
+static void *code_alloc(void) {
+    void *p = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void code_free(void *p) {
+    munmap(p, JIT_CODE_SIZE);
+}
+
+static void code_writable(chip8_jit_t *jit, bool writable) {
+    mprotect(jit->code, JIT_CODE_SIZE,
+             writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+}
+
+static void flush(chip8_jit_t *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    jit->code_used = 0;
+    jit->code_gen = jit->chip->code_gen;
+}
+
+/* The body is emitted first, JIT_PROLOGUE_MAX bytes in, because the
+ * prologue depends on which host registers it ended up using; the
+ * prologue is then placed directly in front of it. */
+static void compile(chip8_jit_t *jit, uint16_t start) {
+    chip8_t *chip = jit->chip;
+    block_t *block = &jit->blocks[start >> 1];
+
+    if (JIT_CODE_SIZE - jit->code_used < JIT_PROLOGUE_MAX + JIT_BLOCK_BYTES)
+        flush(jit);
+
+    code_writable(jit, true);
+
+    uint8_t *body = jit->code + jit->code_used + JIT_PROLOGUE_MAX;
+    emit_t e;
+    emit_init(&e, body);
+
+    int len = 0;
+    uint16_t addr = start;
+    bool ended = false;
+
+    while (len < JIT_BLOCK_MAX && addr <= CHIP8_MEMORY_SIZE - 2) {
+        /* Decode through the chip's cache so writes to this code are
+         * seen by chip8_invalidate and bump code_gen. */
+        chip8_op_t *op = &chip->decoded[addr >> 1];
+        if (!op->fn)
+            chip8_decode((chip->memory[addr] << 8) | chip->memory[addr + 1], op);
+
+        emit_result_t r = emit_op(&e, chip, addr, op);
+        if (r == EMIT_END_BEFORE)
+            break;
+        len++;
+        addr += 2;
+        if (r == EMIT_END_AFTER) {
+            ended = true;
+            break;
+        }
+    }
+
+    if (len == 0) {
+        /* First instruction needs the interpreter; remember that */
+        code_writable(jit, false);
+        block->code = (block_fn)(void (*)(void))jit->code;
+        block->len = 0;
+        return;
+    }
+
+    if (!ended)
+        e_store_pc(&e, addr);
+    e_epilogue(&e, len);
+
+    uint8_t prologue[JIT_PROLOGUE_MAX];
+    size_t prologue_len = e_prologue(&e, prologue);
+    uint8_t *entry = body - prologue_len;
+    memcpy(entry, prologue, prologue_len);
+
+    jit->code_used = (size_t)(e.p - jit->code);
+    jit->code_used = (jit->code_used + 15) & ~(size_t)15;
+    __builtin___clear_cache((char *)entry, (char *)e.p);
+    code_writable(jit, false);
+
+    block->code = (block_fn)(void (*)(void))entry;
+    block->len = len;
+}
+
+chip8_jit_t *chip8_jit_create(chip8_t *chip) {
+    chip8_jit_t *jit = calloc(1, sizeof(*jit));
+    if (!jit)
+        return NULL;
+
+    jit->code = code_alloc();
+    if (!jit->code) {
+        free(jit);
+        return NULL;
+    }
+
+    jit->chip = chip;
+    flush(jit);
+    return jit;
+}
+
+void chip8_jit_destroy(chip8_jit_t *jit) {
+    if (!jit)
+        return;
+    code_free(jit->code);
+    free(jit->shadow);
+    free(jit);
+}
+
+void chip8_jit_run(chip8_jit_t *jit, long cycles) {
+    chip8_t *chip = jit->chip;
+    bool diff = jit->diff;
+    diff_inputs_t inputs = {{0}, 0, 0};
+    long done = 0;
+
+    while (done < cycles) {
+        if (chip->code_gen != jit->code_gen)
+            flush(jit);
+
+        uint16_t pc = chip->pc;
+        block_t *block = NULL;
+
+        if ((pc & 1) == 0 && pc <= CHIP8_MEMORY_SIZE - 2) {
+            block = &jit->blocks[pc >> 1];
+            if (!block->code)
+                compile(jit, pc);
+        }
+
+        if (diff)
+            diff_capture(chip, &inputs);
+
+        /* Interpreter fallback: odd/out-of-range PCs, blocks that start
+         * with an instruction the backend leaves to the interpreter, and
+         * blocks that would run past the cycle budget. */
+        if (!block || block->len == 0 || block->len > cycles - done) {
+            chip8_cycle(chip);
+            done++;
+            if (diff) {
+                diff_step_shadow(jit, &inputs, 1);
+                if (!diff_compare(jit, pc))
+                    diff_sync(jit);
+            }
+            continue;
+        }
+
+        done += block->code(chip);
+
+        if (diff) {
+            diff_step_shadow(jit, &inputs, block->len);
+            if (!diff_compare(jit, pc))
+                diff_sync(jit);
+        }
+    }
+}
+
+#else /* no backend */
+
+chip8_jit_t *chip8_jit_create(chip8_t *chip) {
+    (void)chip;
+    return NULL;
+}
+
+void chip8_jit_destroy(chip8_jit_t *jit) {
+    (void)jit;
+}
+
+void chip8_jit_run(chip8_jit_t *jit, long cycles) {
+    (void)jit;
+    (void)cycles;
+}
+
+#endif
+
+void chip8_jit_set_diff(chip8_jit_t *jit, bool enabled) {
+    if (enabled && !jit->shadow) {
+        jit->shadow = malloc(sizeof(chip8_t));
+        if (!jit->shadow) {
+            fprintf(stderr, "JIT: cannot allocate shadow machine\n");
+            return;
+        }
+    }
+    jit->diff = enabled;
+    if (enabled)
+        diff_sync(jit);
+}
+
+unsigned long chip8_jit_mismatches(const chip8_jit_t *jit) {
+    return jit->mismatches;
+}
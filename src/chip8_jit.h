@@ -0,0 +1,30 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Basic-block recompiler for one chip8_t.
+ *
+ * Straight-line runs of instructions, up to the next jump, skip, call or
+ * FX0A, are translated to native code once and then executed as a unit.
+ * Anything the backend does not handle natively falls back to the
+ * interpreter handlers, and hosts without a backend get no JIT at all
+ * (chip8_jit_create returns NULL). */
+typedef struct chip8_jit_t chip8_jit_t;
+
+chip8_jit_t *chip8_jit_create(chip8_t *chip);
+void chip8_jit_destroy(chip8_jit_t *jit);
+
+/* Execute exactly `cycles` instructions. Blocks that would overshoot the
+ * budget are interpreted instead, so timer ticks between calls land on
+ * the same instruction boundaries as with chip8_cycle. */
+void chip8_jit_run(chip8_jit_t *jit, long cycles);
+
+/* Differential mode: mirror every block on a shadow machine driven by
+ * chip8_cycle and compare full state afterwards. Mismatches are reported
+ * on stderr and the shadow is resynchronised. */
+void chip8_jit_set_diff(chip8_jit_t *jit, bool enabled);
+unsigned long chip8_jit_mismatches(const chip8_jit_t *jit);
+
+#endif
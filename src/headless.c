@@ -0,0 +1,416 @@
+/* headless.c -- SDL-free CHIP-8 runner for regression and throughput work
+ *
+ * Runs one or more ROMs as fast as the host allows. Timers are ticked on a
+ * virtual 60 Hz clock derived from the emulated cycle count, so results are
+ * identical regardless of host speed. At each checkpoint the display is
+ * hashed (FNV-1a over the packed 64x32 bitmap) and optionally dumped as PNG.
+ *
+ * With -m, the keypad is driven by an input movie recorded in the frontend
+ * (chip8 -record), which also fixes the CPU speed, the seed and the run
+ * length, so a real play session becomes a repeatable workload. The
+ * display hashes stored in the movie are checked as it plays; the first
+ * frame that differs is reported and the ROM counts as failed.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "chip8_batch.h"
+#include "movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_HZ     500
+#define DEFAULT_FRAMES 600
+#define TIMER_HZ       60
+
+typedef struct {
+    long hz;               /* emulated CPU cycles per second */
+    long frames;           /* frames (timer ticks) to run, if no cycle limit */
+    long long cycles;      /* cycle limit; 0 = run `frames` frames */
+    long checkpoint;       /* hash every N frames; 0 = final frame only */
+    const char *dump_dir;  /* write PNGs here at checkpoints, if set */
+    bool jit;              /* run through the block recompiler */
+    bool jit_diff;         /* ...and check every block against the interpreter */
+    long batch;            /* run this many instances in lockstep; 0 = single */
+    long threads;          /* threads for the batch engine */
+    unsigned long long seed; /* CXNN seed (instance i of a batch gets seed + i) */
+    const movie_t *movie;  /* -m: keypad input, speed, seed and length */
+} options_t;
+
+static void print_usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] <rom> [rom...]\n"
+        "  -hz N   CPU cycles per emulated second (default: %d)\n"
+        "  -f N    frames of emulated time to run (default: %d)\n"
+        "  -c N    run exactly N CPU cycles instead of a frame count\n"
+        "  -k N    print a display hash every N frames (default: final only)\n"
+        "  -d DIR  dump the display as PNG at each checkpoint\n"
+        "  -jit       run through the JIT (interpreter if no backend)\n"
+        "  -jit-diff  JIT plus lockstep comparison against the interpreter\n"
+        "  -batch N   run N instances of each ROM in lockstep (SoA engine)\n"
+        "  -threads N worker threads for -batch (default: 1)\n"
+        "  -seed N    random seed for CXNN (default: 0)\n"
+        "  -m FILE    replay an input movie (sets -hz, -seed and -f)\n",
+        prog, DEFAULT_HZ, DEFAULT_FRAMES);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Pack the display into 32 rows of 8 bytes, MSB = leftmost pixel.
+ * Hashes and PNG dumps are defined over this layout. */
+static void pack_display(const chip8_t *chip, uint8_t out[CHIP8_DISPLAY_HEIGHT * 8]) {
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+        for (int i = 0; i < 8; i++)
+            out[y * 8 + i] = (uint8_t)(chip->display[y] >> (56 - 8 * i));
+    }
+}
+
+static uint64_t display_hash(const chip8_t *chip) {
+    return movie_display_hash(chip);
+}
+
+/* -----------------------------------------------------------------------
+ * Minimal PNG writer: 1-bit grayscale, one stored (uncompressed) deflate
+ * block. The image is only 288 bytes of scanline data, so compression
+ * would not buy anything.
+ * ----------------------------------------------------------------------- */
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void write_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+    uint8_t hdr[8];
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    fwrite(hdr, 1, 8, f);
+    if (len) fwrite(data, 1, len, f);
+
+    uint32_t crc = crc32_update(0, (const uint8_t *)type, 4);
+    crc = crc32_update(crc, data, len);
+    uint8_t tail[4];
+    put_be32(tail, crc);
+    fwrite(tail, 1, 4, f);
+}
+
+static bool write_png(const char *path, const chip8_t *chip) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    enum { ROW_BYTES = 1 + CHIP8_DISPLAY_WIDTH / 8,
+           RAW_SIZE  = ROW_BYTES * CHIP8_DISPLAY_HEIGHT };
+
+    uint8_t packed[CHIP8_DISPLAY_HEIGHT * 8];
+    pack_display(chip, packed);
+
+    /* zlib stream: header, one stored block, Adler-32 */
+    uint8_t idat[2 + 5 + RAW_SIZE + 4];
+    uint8_t *p = idat;
+    *p++ = 0x78;
+    *p++ = 0x01;
+    *p++ = 0x01;  /* BFINAL=1, BTYPE=00 (stored) */
+    *p++ = RAW_SIZE & 0xFF;
+    *p++ = RAW_SIZE >> 8;
+    *p++ = (uint8_t)~(RAW_SIZE & 0xFF);
+    *p++ = (uint8_t)~(RAW_SIZE >> 8);
+
+    uint32_t a = 1, b = 0;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+        uint8_t row[ROW_BYTES];
+        row[0] = 0;  /* filter: none */
+        memcpy(row + 1, packed + y * 8, 8);
+        for (int i = 0; i < ROW_BYTES; i++) {
+            a = (a + row[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        memcpy(p, row, ROW_BYTES);
+        p += ROW_BYTES;
+    }
+    put_be32(p, (b << 16) | a);
+
+    uint8_t ihdr[13];
+    put_be32(ihdr, CHIP8_DISPLAY_WIDTH);
+    put_be32(ihdr + 4, CHIP8_DISPLAY_HEIGHT);
+    ihdr[8]  = 1;  /* bit depth */
+    ihdr[9]  = 0;  /* color type: grayscale */
+    ihdr[10] = 0;  /* compression */
+    ihdr[11] = 0;  /* filter */
+    ihdr[12] = 0;  /* interlace */
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to write PNG: %s\n", path);
+        return false;
+    }
+    fwrite(signature, 1, sizeof(signature), f);
+    write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    write_chunk(f, "IDAT", idat, sizeof(idat));
+    write_chunk(f, "IEND", NULL, 0);
+    fclose(f);
+    return true;
+}
+
+static void checkpoint(const options_t *opt, const char *rom, int rom_index,
+                       const chip8_t *chip, long frame) {
+    printf("%s frame=%ld hash=%016llx\n", rom, frame,
+           (unsigned long long)display_hash(chip));
+
+    if (opt->dump_dir) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/rom%04d_frame%06ld.png",
+                 opt->dump_dir, rom_index, frame);
+        write_png(path, chip);
+    }
+}
+
+/* Run one ROM; returns cycles executed, or -1 if the ROM failed to load. */
+static long long run_rom(const options_t *opt, const char *rom, int rom_index) {
+    const movie_t *movie = opt->movie;
+    chip8_t chip;
+    chip8_init(&chip, movie ? movie->seed : opt->seed);
+    if (!chip8_load_rom(&chip, rom))
+        return -1;
+    if (movie && movie_rom_hash(&chip) != movie->rom_hash) {
+        fprintf(stderr, "%s: the movie was recorded on a different ROM\n", rom);
+        return -1;
+    }
+
+    chip8_jit_t *jit = NULL;
+    if (opt->jit) {
+        jit = chip8_jit_create(&chip);
+        if (!jit)
+            fprintf(stderr, "%s: no JIT backend for this host, interpreting\n", rom);
+        else if (opt->jit_diff)
+            chip8_jit_set_diff(jit, true);
+    }
+
+    long long total = 0;
+    long frame = 0;
+    long acc = 0;  /* fractional cycles carried between frames (in 1/60ths) */
+
+    for (;;) {
+        if (opt->cycles ? total >= opt->cycles : frame >= opt->frames)
+            break;
+
+        if (movie)
+            movie_apply(movie, (size_t)frame, &chip);
+
+        /* Distribute hz cycles evenly over 60 frames without drift */
+        acc += opt->hz;
+        long n = acc / TIMER_HZ;
+        acc %= TIMER_HZ;
+        if (opt->cycles && total + n > opt->cycles)
+            n = (long)(opt->cycles - total);
+
+        if (jit) {
+            chip8_jit_run(jit, n);
+        } else {
+            chip8_run(&chip, n);
+        }
+        total += n;
+
+        chip8_tick_timers(&chip);
+        frame++;
+
+        uint64_t expect;
+        if (movie && movie_hash_at(movie, (size_t)frame, &expect) &&
+            display_hash(&chip) != expect) {
+            fprintf(stderr, "%s: frame %ld hash %016llx, the movie has %016llx\n", rom, frame,
+                    (unsigned long long)display_hash(&chip), (unsigned long long)expect);
+            total = -1;
+            break;
+        }
+
+        if (opt->checkpoint > 0 && frame % opt->checkpoint == 0)
+            checkpoint(opt, rom, rom_index, &chip, frame);
+    }
+    if (total < 0) {
+        if (jit)
+            chip8_jit_destroy(jit);
+        return -1;
+    }
+
+    if (opt->checkpoint <= 0 || frame % opt->checkpoint != 0)
+        checkpoint(opt, rom, rom_index, &chip, frame);
+
+    if (jit) {
+        if (opt->jit_diff)
+            printf("%s jit_mismatches=%lu\n", rom, chip8_jit_mismatches(jit));
+        chip8_jit_destroy(jit);
+    }
+
+    return total;
+}
+
+/* Batch variant of run_rom. Instance 0 is checkpointed like a single
+ * run; at the end the other instances are compared against it, which for
+ * a deterministic ROM should report no divergence. Returns the total
+ * number of instructions executed over all instances. */
+static long long run_rom_batch(const options_t *opt, const char *rom, int rom_index) {
+    chip8_batch_t *batch = chip8_batch_create((int)opt->batch, (int)opt->threads);
+    chip8_t *view = malloc(sizeof(chip8_t));
+    if (!batch || !view || !chip8_batch_load_rom(batch, rom, opt->seed)) {
+        chip8_batch_destroy(batch);
+        free(view);
+        return -1;
+    }
+
+    long long total = 0;
+    long frame = 0;
+    long acc = 0;
+
+    for (;;) {
+        if (opt->cycles ? total >= opt->cycles : frame >= opt->frames)
+            break;
+
+        acc += opt->hz;
+        long n = acc / TIMER_HZ;
+        acc %= TIMER_HZ;
+        if (opt->cycles && total + n > opt->cycles)
+            n = (long)(opt->cycles - total);
+
+        chip8_batch_run(batch, n);
+        total += n;
+
+        chip8_batch_tick_timers(batch);
+        frame++;
+
+        if (opt->checkpoint > 0 && frame % opt->checkpoint == 0) {
+            chip8_batch_export(batch, 0, view);
+            checkpoint(opt, rom, rom_index, view, frame);
+        }
+    }
+
+    if (opt->checkpoint <= 0 || frame % opt->checkpoint != 0) {
+        chip8_batch_export(batch, 0, view);
+        checkpoint(opt, rom, rom_index, view, frame);
+    }
+
+    int diverged = 0;
+    for (int i = 1; i < opt->batch; i++) {
+        if (memcmp(chip8_batch_display(batch, i), chip8_batch_display(batch, 0),
+                   sizeof(view->display)) != 0)
+            diverged++;
+    }
+    printf("%s instances=%ld diverged=%d\n", rom, opt->batch, diverged);
+
+    chip8_batch_destroy(batch);
+    free(view);
+    return total * opt->batch;
+}
+
+static bool parse_long(const char *s, long long min, long long *out) {
+    char *end;
+    long long v = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < min)
+        return false;
+    *out = v;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opt = { DEFAULT_HZ, DEFAULT_FRAMES, 0, 0, NULL, false, false, 0, 1, 0, NULL };
+    const char *movie_path = NULL;
+    int argi = 1;
+
+    while (argi < argc && argv[argi][0] == '-') {
+        const char *flag = argv[argi];
+        long long v;
+
+        if (strcmp(flag, "-jit") == 0 || strcmp(flag, "-jit-diff") == 0) {
+            opt.jit = true;
+            opt.jit_diff = strcmp(flag, "-jit-diff") == 0;
+            argi++;
+            continue;
+        }
+        if (argi + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        const char *val = argv[argi + 1];
+
+        if (strcmp(flag, "-d") == 0) {
+            opt.dump_dir = val;
+        } else if (strcmp(flag, "-hz") == 0 && parse_long(val, 1, &v)) {
+            opt.hz = (long)v;
+        } else if (strcmp(flag, "-f") == 0 && parse_long(val, 1, &v)) {
+            opt.frames = (long)v;
+        } else if (strcmp(flag, "-c") == 0 && parse_long(val, 1, &v)) {
+            opt.cycles = v;
+        } else if (strcmp(flag, "-k") == 0 && parse_long(val, 0, &v)) {
+            opt.checkpoint = (long)v;
+        } else if (strcmp(flag, "-batch") == 0 && parse_long(val, 1, &v)) {
+            opt.batch = (long)v;
+        } else if (strcmp(flag, "-threads") == 0 && parse_long(val, 1, &v)) {
+            opt.threads = (long)v;
+        } else if (strcmp(flag, "-seed") == 0 && parse_long(val, 0, &v)) {
+            opt.seed = (unsigned long long)v;
+        } else if (strcmp(flag, "-m") == 0) {
+            movie_path = val;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+        argi += 2;
+    }
+
+    if (argi >= argc || (movie_path && opt.batch > 0)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    movie_t movie;
+    if (movie_path) {
+        if (!movie_load(&movie, movie_path))
+            return 1;
+        opt.movie = &movie;
+        opt.hz = movie.cpu_hz;
+        opt.frames = (long)movie.frames;
+    }
+
+    int failed = 0;
+    long long total_cycles = 0;
+    double start = now_seconds();
+
+    for (int i = argi; i < argc; i++) {
+        double rom_start = now_seconds();
+        long long cycles = opt.batch > 0 ? run_rom_batch(&opt, argv[i], i - argi)
+                                         : run_rom(&opt, argv[i], i - argi);
+        double elapsed = now_seconds() - rom_start;
+
+        if (cycles < 0) {
+            failed++;
+            continue;
+        }
+        total_cycles += cycles;
+        printf("%s cycles=%lld time=%.3fs rate=%.0f cycles/s\n", argv[i],
+               cycles, elapsed, elapsed > 0 ? (double)cycles / elapsed : 0.0);
+    }
+
+    double elapsed = now_seconds() - start;
+    printf("total roms=%d failed=%d cycles=%lld time=%.3fs rate=%.0f cycles/s\n",
+           argc - argi, failed, total_cycles, elapsed,
+           elapsed > 0 ? (double)total_cycles / elapsed : 0.0);
+
+    if (opt.movie)
+        movie_free(&movie);
+    return failed > 0 ? 1 : 0;
+}
@@ -1,80 +1,389 @@
+#include "audio.h"
+#include "beeper.h"
 #include "chip8.h"
+#include "framebuf.h"
+#include "movie.h"
 #include "platform.h"
+#include "rewind.h"
+#include "sched.h"
+#include "telemetry.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-/* Target CPU frequency: 500 Hz (500 cycles per second).
- * Timers tick at 60 Hz.
- * We run the loop as fast as possible and use SDL_GetTicks()
- * to schedule cycles and timer ticks at the correct rates.
+/* CPU speed is configurable; timers always tick at 60 Hz. The scheduler
+ * (sched.c) runs both in per-frame batches off a high-resolution counter
+ * on an emulation thread; the main thread polls input and presents the
+ * latest display, so a slow present never holds up the CPU.
  */
-#define CPU_HZ       500
-#define TIMER_HZ     60
-#define MS_PER_CYCLE (1000.0 / CPU_HZ)
-#define MS_PER_TICK  (1000.0 / TIMER_HZ)
+#define DEFAULT_CPU_HZ 500
+
+/* With a sound device the emulation thread is paced by the beeper's
+ * queue instead: about three frames (50 ms) are kept waiting */
+#define AUDIO_RATE   48000
+#define AUDIO_RING   8192
+#define AUDIO_TARGET (AUDIO_RATE * 3 / 60)
+
+/* Rewind history: a state is about 4.4 KB, a frame's delta a few dozen
+ * bytes, so a megabyte holds minutes of play */
+#define REWIND_RING_BYTES (1u << 20)
+#define REWIND_KEYFRAME   60
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-hz N | -profile NAME] [-record FILE] [-stats FILE] [-overlay] <rom>\n",
+            prog);
+    fprintf(stderr, "  -hz N          CPU cycles per second (default: %d)\n", DEFAULT_CPU_HZ);
+    fprintf(stderr, "  -profile NAME  preset speed:");
+    for (const sched_profile_t *p = sched_profiles; p->name; p++)
+        fprintf(stderr, " %s (%ld Hz)", p->name, p->cpu_hz);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -record FILE   save this session's input as a movie (chip8_headless -m)\n");
+    fprintf(stderr, "  -stats FILE    write frame-time percentiles on exit (.json or CSV)\n");
+    fprintf(stderr, "  -overlay       show frame times (ms) over the display\n");
+}
+
+/* Save states go next to the ROM as <rom>.state */
+static void state_path(char *out, size_t cap, const char *rom) {
+    snprintf(out, cap, "%s.state", rom);
+}
+
+static void save_state_file(const chip8_t *chip, const char *rom) {
+    uint8_t buf[8192];
+    char path[4096];
+    size_t len = chip8_save_state(chip, buf, sizeof(buf));
+    state_path(path, sizeof(path), rom);
+
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(buf, 1, len, f) != len) {
+        fprintf(stderr, "Failed to write save state: %s\n", path);
+        if (f) fclose(f);
+        return;
+    }
+    fclose(f);
+    printf("Saved state: %s\n", path);
+}
+
+static bool load_state_file(chip8_t *chip, const char *rom) {
+    uint8_t buf[8192];
+    char path[4096];
+    state_path(path, sizeof(path), rom);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "No save state: %s\n", path);
+        return false;
+    }
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    if (!chip8_load_state(chip, buf, len))
+        return false;
+    printf("Loaded state: %s\n", path);
+    return true;
+}
+
+/* Shared between the main (SDL) thread and the emulation thread, which
+ * owns chip8_t and the scheduler */
+typedef struct {
+    chip8_t *chip;
+    const char *rom;
+    long cpu_hz;
+    int refresh_hz;
+    framebuf_t frames;
+    Uint32 frame_event;  /* pushed after each publish; (Uint32)-1 if none */
+    audio_t *audio;      /* NULL: no device, paced by the scheduler */
+    beeper_t beeper;
+    rewind_t *rewind;
+    uint8_t *state;      /* state_size bytes, then the rewind tag */
+    size_t state_size;
+    movie_t *movie;      /* -record, or NULL */
+    telemetry_t *tel;    /* -stats or -overlay, or NULL */
+    bool recording;      /* false once the movie could not grow */
+
+    /* Written by the main thread */
+    uint16_t keys;       /* one bit per keypad key */
+    unsigned hotkeys;    /* save/load presses not yet handled */
+    bool rewinding;      /* rewind held */
+    bool quit;
+} emu_t;
+
+static void set_keypad(chip8_t *chip, uint16_t keys) {
+    for (int k = 0; k < 16; k++)
+        chip->keypad[k] = (keys >> k) & 1;
+}
+
+/* Each history entry is the state at the start of a frame, tagged with
+ * the movie length at that point. The newest is the frame just run, so
+ * stepping back one frame restores the entry before it and replays that
+ * frame with the keys now held; the entry goes back on as the start of
+ * the replayed frame. The movie is cut to the tag, so it forgets the
+ * rewound frames too. */
+static void rewind_frame(emu_t *emu, uint16_t keys, bool rewinding) {
+    chip8_t *chip = emu->chip;
+
+    if (rewinding && rewind_pop(emu->rewind, emu->state)) {
+        rewind_pop(emu->rewind, emu->state);   /* none left: replay the oldest */
+        chip8_load_state(chip, emu->state, emu->state_size);
+        set_keypad(chip, keys);
+        chip->draw_flag = true;
+        uint64_t tag;
+        memcpy(&tag, emu->state + emu->state_size, sizeof(tag));
+        if (emu->recording)
+            movie_truncate(emu->movie, (size_t)tag);
+        rewind_push(emu->rewind, emu->state);
+    } else if (chip8_save_state(chip, emu->state, emu->state_size)) {
+        uint64_t tag = emu->movie ? emu->movie->frames : 0;
+        memcpy(emu->state + emu->state_size, &tag, sizeof(tag));
+        rewind_push(emu->rewind, emu->state);
+    }
+}
+
+/* Wake the main thread, which sleeps in SDL_WaitEventTimeout */
+static void notify_frame(const emu_t *emu) {
+    if (emu->frame_event == (Uint32)-1)
+        return;
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = emu->frame_event;
+    SDL_PushEvent(&event);
+}
+
+static int emu_thread(void *arg) {
+    emu_t *emu = (emu_t *)arg;
+    chip8_t *chip = emu->chip;
+
+    sched_t sched;
+    sched_init(&sched, emu->cpu_hz, emu->refresh_hz);
+    uint64_t last_start = 0;
+
+    while (!__atomic_load_n(&emu->quit, __ATOMIC_ACQUIRE)) {
+        uint64_t start = SDL_GetPerformanceCounter();
+        if (emu->tel && last_start)
+            telemetry_add(emu->tel, TEL_PERIOD, start - last_start);
+        last_start = start;
+
+        /* Input is read right before the frames it affects */
+        uint16_t keys = __atomic_load_n(&emu->keys, __ATOMIC_RELAXED);
+        set_keypad(chip, keys);
+        bool rewinding = __atomic_load_n(&emu->rewinding, __ATOMIC_RELAXED);
+        unsigned hotkeys = __atomic_exchange_n(&emu->hotkeys, 0, __ATOMIC_ACQ_REL);
+        if (hotkeys & PLATFORM_HOTKEY_SAVE)
+            save_state_file(chip, emu->rom);
+        if (hotkeys & PLATFORM_HOTKEY_LOAD) {
+            /* A movie replays from power-on, so it cannot jump to a state */
+            if (emu->recording)
+                fprintf(stderr, "Loading a state is disabled while recording\n");
+            /* History from before the load no longer leads here */
+            else if (load_state_file(chip, emu->rom))
+                rewind_clear(emu->rewind);
+        }
+
+        /* The audio queue only ever asks for the next frame */
+        int frames = emu->audio ? 1 : sched_frames_due(&sched);
+        for (int f = 0; f < frames; f++) {
+            rewind_frame(emu, keys, rewinding);
+            if (emu->recording && !movie_record(emu->movie, keys)) {
+                fprintf(stderr, "Recording stopped after %zu frames\n", emu->movie->frames);
+                emu->recording = false;
+            }
+            long cycles = sched_frame_cycles(&sched);
+            chip8_run(chip, cycles);
+            if (emu->audio)
+                beeper_frame(&emu->beeper, emu->audio, chip->sound_timer > 0, AUDIO_TARGET);
+            chip8_tick_timers(chip);
+            if (emu->recording && !movie_checkpoint(emu->movie, chip)) {
+                fprintf(stderr, "Recording stopped after %zu frames\n", emu->movie->frames);
+                emu->recording = false;
+            }
+        }
+
+        if (chip->draw_flag) {
+            memcpy(framebuf_back(&emu->frames), chip->display, sizeof(chip->display));
+            framebuf_publish(&emu->frames);
+            chip->draw_flag = false;
+            notify_frame(emu);
+        }
+
+        uint64_t sleep_start = SDL_GetPerformanceCounter();
+        if (emu->audio)
+            audio_wait(emu->audio, AUDIO_TARGET);
+        else
+            sched_wait(&sched);
+        if (emu->tel) {
+            telemetry_add(emu->tel, TEL_EMULATE, sleep_start - start);
+            telemetry_add(emu->tel, TEL_SLEEP, SDL_GetPerformanceCounter() - sleep_start);
+        }
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: chip8 <rom>\n");
+    long cpu_hz = DEFAULT_CPU_HZ;
+    const char *record_path = NULL;
+    const char *stats_path = NULL;
+    bool overlay = false;
+    int argi = 1;
+
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        const char *flag = argv[argi];
+        const char *val = argv[argi + 1];
+        if (strcmp(flag, "-overlay") == 0) {
+            overlay = true;
+            argi++;
+            continue;
+        }
+        if (strcmp(flag, "-hz") == 0) {
+            char *end;
+            cpu_hz = strtol(val, &end, 10);
+            if (*val == '\0' || *end != '\0' || cpu_hz <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(flag, "-profile") == 0) {
+            cpu_hz = sched_profile_hz(val);
+            if (cpu_hz == 0) {
+                fprintf(stderr, "Unknown profile: %s\n", val);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(flag, "-record") == 0) {
+            record_path = val;
+        } else if (strcmp(flag, "-stats") == 0) {
+            stats_path = val;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+        argi += 2;
+    }
+
+    if (argi >= argc) {
+        print_usage(argv[0]);
         return 1;
     }
 
     chip8_t chip;
-    chip8_init(&chip);
+    uint64_t seed = (uint64_t)time(NULL);
+    chip8_init(&chip, seed);
 
-    if (!chip8_load_rom(&chip, argv[1])) {
+    if (!chip8_load_rom(&chip, argv[argi])) {
         return 1;
     }
 
+    /* The seed goes into the movie so CXNN replays identically */
+    movie_t movie;
+    movie_init(&movie, &chip, cpu_hz, seed);
+
     platform_t plat;
     if (!platform_init(&plat, "CHIP-8 Emulator", 10)) {
         fprintf(stderr, "Failed to initialize platform\n");
         return 1;
     }
 
-    bool running = true;
-    Uint32 last_cycle_time = SDL_GetTicks();
-    Uint32 last_timer_time = SDL_GetTicks();
-
-    while (running) {
-        /* Handle input every iteration */
-        running = platform_handle_input(chip.keypad);
+    /* Without a sound device the beeper is silent and the scheduler's
+     * timer keeps time */
+    audio_t audio;
+    bool have_audio = audio_open(&audio, AUDIO_RATE, AUDIO_RING);
 
-        Uint32 now = SDL_GetTicks();
+    telemetry_t telemetry;
+    telemetry_init(&telemetry, platform_metrics, TEL_COUNT,
+                   SDL_GetPerformanceFrequency(), overlay);
 
-        /* Execute CPU cycles at ~500 Hz */
-        double cycle_elapsed = (double)(now - last_cycle_time);
-        if (cycle_elapsed >= MS_PER_CYCLE) {
-            /* Calculate how many cycles we owe; cap to prevent spiral */
-            int cycles = (int)(cycle_elapsed / MS_PER_CYCLE);
-            if (cycles > 20) {
-                cycles = 20;
-            }
+    emu_t emu;
+    memset(&emu, 0, sizeof(emu));
+    emu.audio = have_audio ? &audio : NULL;
+    emu.tel = stats_path || overlay ? &telemetry : NULL;
+    emu.movie = record_path ? &movie : NULL;
+    emu.recording = record_path != NULL;
+    emu.chip = &chip;
+    emu.rom = argv[argi];
+    emu.cpu_hz = cpu_hz;
+    emu.refresh_hz = plat.refresh_hz;
+    emu.frame_event = SDL_RegisterEvents(1);
+    beeper_init(&emu.beeper);
+    emu.state_size = chip8_state_size();
+    /* Rewind entries carry a 64-bit movie frame tag after the state */
+    emu.state = malloc(emu.state_size + sizeof(uint64_t));
+    emu.rewind = rewind_create(emu.state_size + sizeof(uint64_t), REWIND_RING_BYTES,
+                               REWIND_KEYFRAME);
+    bool have_frames = framebuf_init(&emu.frames, sizeof(chip.display));
+    if (!emu.state || !emu.rewind || !have_frames) {
+        fprintf(stderr, "Out of memory for display and rewind buffers\n");
+        if (have_frames)
+            framebuf_destroy(&emu.frames);
+        rewind_destroy(emu.rewind);
+        free(emu.state);
+        if (have_audio)
+            audio_close(&audio);
+        platform_destroy(&plat);
+        return 1;
+    }
 
-            for (int i = 0; i < cycles; i++) {
-                chip8_cycle(&chip);
-            }
+    SDL_Thread *thread = SDL_CreateThread(emu_thread, "emulation", &emu);
+    if (!thread) {
+        fprintf(stderr, "SDL_CreateThread failed: %s\n", SDL_GetError());
+        framebuf_destroy(&emu.frames);
+        rewind_destroy(emu.rewind);
+        free(emu.state);
+        if (have_audio)
+            audio_close(&audio);
+        platform_destroy(&plat);
+        return 1;
+    }
 
-            last_cycle_time += (Uint32)(cycles * MS_PER_CYCLE);
-        }
+    /* The main thread keeps its own scheduler purely to limit presents
+     * to one per display refresh */
+    sched_t pacer;
+    sched_init(&pacer, cpu_hz, plat.refresh_hz);
 
-        /* Tick timers at 60 Hz */
-        double timer_elapsed = (double)(now - last_timer_time);
-        if (timer_elapsed >= MS_PER_TICK) {
-            chip8_tick_timers(&chip);
-            last_timer_time += (Uint32)MS_PER_TICK;
-        }
+    uint8_t keypad[16] = { 0 };
+    unsigned hotkeys;
+    while (platform_handle_input(keypad, &hotkeys)) {
+        uint16_t keys = 0;
+        for (int k = 0; k < 16; k++)
+            keys |= (uint16_t)((keypad[k] != 0) << k);
+        __atomic_store_n(&emu.keys, keys, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&emu.hotkeys, hotkeys & (PLATFORM_HOTKEY_SAVE | PLATFORM_HOTKEY_LOAD),
+                          __ATOMIC_RELEASE);
+        __atomic_store_n(&emu.rewinding, (hotkeys & PLATFORM_HOTKEY_REWIND) != 0,
+                         __ATOMIC_RELAXED);
 
-        /* Render when the draw flag is set */
-        if (chip.draw_flag) {
-            platform_render(&plat, chip.display,
-                            CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT);
-            chip.draw_flag = false;
+        /* A display that arrives too soon stays in the shared slot (or is
+         * replaced by a newer one) until the next refresh */
+        if (sched_can_present(&pacer)) {
+            const uint64_t *display = framebuf_acquire(&emu.frames);
+            if (display) {
+                platform_render(&plat, display, CHIP8_DISPLAY_HEIGHT, emu.tel);
+                sched_presented(&pacer);
+            }
         }
 
-        /* Small sleep to avoid burning 100% CPU */
-        SDL_Delay(1);
+        /* Sleep until input, a new display, or the refresh at which a
+         * held-back one may be shown. Without a frame event, displays
+         * are polled for every millisecond. */
+        int timeout = -1;
+        if (framebuf_pending(&emu.frames))
+            timeout = (int)sched_present_delay_ms(&pacer);
+        else if (emu.frame_event == (Uint32)-1)
+            timeout = 1;
+        if (timeout != 0)
+            SDL_WaitEventTimeout(NULL, timeout);
     }
 
+    __atomic_store_n(&emu.quit, true, __ATOMIC_RELEASE);
+    SDL_WaitThread(thread, NULL);
+
+    if (stats_path && telemetry_write(&telemetry, stats_path))
+        printf("Saved frame times: %s\n", stats_path);
+    if (record_path && movie_save(&movie, record_path))
+        printf("Saved movie: %s (%zu frames)\n", record_path, movie.frames);
+    movie_free(&movie);
+
+    framebuf_destroy(&emu.frames);
+    rewind_destroy(emu.rewind);
+    free(emu.state);
+    if (have_audio)
+        audio_close(&audio);
     platform_destroy(&plat);
     return 0;
 }
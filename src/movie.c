@@ -0,0 +1,230 @@
+#include "movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t movie_magic[4] = {'C', '8', 'M', 'V'};
+
+#define HEADER_V1_BYTES (4 + 1 + 4 + 8 + 4 + 4 + 4)
+#define HEADER_BYTES (HEADER_V1_BYTES + 4 + 4)
+#define RUN_BYTES 4
+#define HASH_BYTES 8
+#define MAX_RUN 0xFFFF
+
+static uint8_t *put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        *p++ = (uint8_t)(v >> (8 * i));
+    return p;
+}
+
+static uint64_t get_le(const uint8_t **p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v |= (uint64_t)(*p)[i] << (8 * i);
+    *p += bytes;
+    return v;
+}
+
+uint32_t movie_rom_hash(const chip8_t *chip) {
+    uint32_t h = 2166136261u;
+    for (int i = CHIP8_PROGRAM_START; i < CHIP8_MEMORY_SIZE; i++) {
+        h ^= chip->memory[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint64_t movie_display_hash(const chip8_t *chip) {
+    uint64_t h = 0xCBF29CE484222325ULL;   /* FNV-1a 64-bit offset basis */
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+        for (int i = 0; i < 8; i++) {
+            h ^= (uint8_t)(chip->display[y] >> (56 - 8 * i));
+            h *= 0x100000001B3ULL;
+        }
+    }
+    return h;
+}
+
+void movie_init(movie_t *m, const chip8_t *chip, long cpu_hz, uint64_t seed) {
+    memset(m, 0, sizeof(*m));
+    m->cpu_hz = cpu_hz;
+    m->seed = seed;
+    m->rom_hash = chip ? movie_rom_hash(chip) : 0;
+    m->interval = MOVIE_INTERVAL;
+}
+
+void movie_free(movie_t *m) {
+    free(m->keys);
+    free(m->hashes);
+    memset(m, 0, sizeof(*m));
+}
+
+bool movie_record(movie_t *m, uint16_t keys) {
+    if (m->frames == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 3600;   /* a minute, then doubling */
+        uint16_t *p = realloc(m->keys, cap * sizeof(*p));
+        if (!p) {
+            fprintf(stderr, "movie_record: out of memory\n");
+            return false;
+        }
+        m->keys = p;
+        m->cap = cap;
+    }
+    m->keys[m->frames++] = keys;
+    return true;
+}
+
+bool movie_checkpoint(movie_t *m, const chip8_t *chip) {
+    if (!m->interval || m->frames % m->interval != 0)
+        return true;
+    if (m->hash_count == m->hash_cap) {
+        size_t cap = m->hash_cap ? m->hash_cap * 2 : 64;
+        uint64_t *p = realloc(m->hashes, cap * sizeof(*p));
+        if (!p) {
+            fprintf(stderr, "movie_checkpoint: out of memory\n");
+            return false;
+        }
+        m->hashes = p;
+        m->hash_cap = cap;
+    }
+    m->hashes[m->hash_count++] = movie_display_hash(chip);
+    return true;
+}
+
+bool movie_hash_at(const movie_t *m, size_t frames, uint64_t *hash) {
+    if (!m->interval || frames == 0 || frames % m->interval != 0)
+        return false;
+    size_t i = frames / m->interval - 1;
+    if (i >= m->hash_count)
+        return false;
+    *hash = m->hashes[i];
+    return true;
+}
+
+void movie_truncate(movie_t *m, size_t frames) {
+    if (frames < m->frames)
+        m->frames = frames;
+    size_t hashes = m->interval ? frames / m->interval : 0;
+    if (hashes < m->hash_count)
+        m->hash_count = hashes;
+}
+
+/* End of the run of equal frames starting at f, at most MAX_RUN long */
+static size_t run_end(const movie_t *m, size_t f) {
+    size_t end = f + 1;
+    while (end < m->frames && end - f < MAX_RUN && m->keys[end] == m->keys[f])
+        end++;
+    return end;
+}
+
+bool movie_save(const movie_t *m, const char *path) {
+    size_t runs = 0;
+    for (size_t f = 0; f < m->frames; f = run_end(m, f))
+        runs++;
+
+    size_t len = HEADER_BYTES + runs * RUN_BYTES + m->hash_count * HASH_BYTES;
+    uint8_t *buf = malloc(len);
+    if (!buf) {
+        fprintf(stderr, "movie_save: out of memory\n");
+        return false;
+    }
+    uint8_t *p = buf;
+    memcpy(p, movie_magic, sizeof(movie_magic));
+    p += sizeof(movie_magic);
+    *p++ = MOVIE_VERSION;
+    p = put_le(p, (uint64_t)m->cpu_hz, 4);
+    p = put_le(p, m->seed, 8);
+    p = put_le(p, m->rom_hash, 4);
+    p = put_le(p, m->frames, 4);
+    p = put_le(p, runs, 4);
+    p = put_le(p, m->interval, 4);
+    p = put_le(p, m->hash_count, 4);
+    for (size_t f = 0, end; f < m->frames; f = end) {
+        end = run_end(m, f);
+        p = put_le(p, m->keys[f], 2);
+        p = put_le(p, end - f, 2);
+    }
+    for (size_t i = 0; i < m->hash_count; i++)
+        p = put_le(p, m->hashes[i], 8);
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(buf, 1, len, f) == len;
+    if (f && fclose(f) != 0)
+        ok = false;
+    free(buf);
+    if (!ok)
+        fprintf(stderr, "Failed to write movie: %s\n", path);
+    return ok;
+}
+
+bool movie_load(movie_t *m, const char *path) {
+    movie_init(m, NULL, 0, 0);
+    m->interval = 0;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open movie: %s\n", path);
+        return false;
+    }
+
+    /* Version 1 stops after the run count */
+    uint8_t head[HEADER_BYTES];
+    bool ok = fread(head, 1, HEADER_V1_BYTES, f) == HEADER_V1_BYTES &&
+              memcmp(head, movie_magic, sizeof(movie_magic)) == 0 &&
+              (head[4] == 1 || head[4] == MOVIE_VERSION);
+    uint32_t frames = 0, runs = 0, hashes = 0;
+    if (ok) {
+        const uint8_t *p = head + 5;
+        m->cpu_hz = (long)get_le(&p, 4);
+        m->seed = get_le(&p, 8);
+        m->rom_hash = (uint32_t)get_le(&p, 4);
+        frames = (uint32_t)get_le(&p, 4);
+        runs = (uint32_t)get_le(&p, 4);
+        ok = m->cpu_hz > 0;
+        if (ok && head[4] == MOVIE_VERSION) {
+            ok = fread(head, 1, HEADER_BYTES - HEADER_V1_BYTES, f) == HEADER_BYTES - HEADER_V1_BYTES;
+            p = head;
+            m->interval = (uint32_t)get_le(&p, 4);
+            hashes = (uint32_t)get_le(&p, 4);
+            ok = ok && (m->interval ? hashes <= frames / m->interval : hashes == 0);
+        }
+    }
+
+    uint8_t *body = NULL;
+    size_t len = (size_t)runs * RUN_BYTES + (size_t)hashes * HASH_BYTES;
+    if (ok) {
+        body = malloc(len + 1);
+        m->keys = malloc(((size_t)frames + 1) * sizeof(*m->keys));
+        m->cap = (size_t)frames + 1;
+        m->hashes = malloc(((size_t)hashes + 1) * sizeof(*m->hashes));
+        m->hash_cap = (size_t)hashes + 1;
+        ok = body && m->keys && m->hashes && fread(body, 1, len, f) == len;
+    }
+    fclose(f);
+
+    const uint8_t *p = body;
+    for (uint32_t i = 0; ok && i < runs; i++) {
+        uint16_t keys = (uint16_t)get_le(&p, 2);
+        size_t n = (size_t)get_le(&p, 2);
+        ok = n > 0 && n <= frames - m->frames;
+        for (size_t k = 0; ok && k < n; k++)
+            m->keys[m->frames++] = keys;
+    }
+    ok = ok && m->frames == frames;
+    while (ok && m->hash_count < hashes)
+        m->hashes[m->hash_count++] = get_le(&p, 8);
+    free(body);
+
+    if (!ok) {
+        fprintf(stderr, "Not a valid movie: %s\n", path);
+        movie_free(m);
+        return false;
+    }
+    return true;
+}
+
+void movie_apply(const movie_t *m, size_t frame, chip8_t *chip) {
+    uint16_t keys = frame < m->frames ? m->keys[frame] : 0;
+    for (int k = 0; k < CHIP8_KEYPAD_SIZE; k++)
+        chip->keypad[k] = (keys >> k) & 1;
+}
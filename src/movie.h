@@ -0,0 +1,70 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "chip8.h"
+
+/* Input movies: the keypad for every 60 Hz frame since power-on.
+ *
+ * A frame is the window of cpu_hz / 60 cycles (fractions carried) that the
+ * frontend runs between timer ticks, and keys are read once per frame, so
+ * the ROM, the CPU speed, the CXNN seed and the per-frame keypad bitmasks
+ * reproduce a session exactly. The frontend records one (-record) and
+ * chip8_headless replays it (-m). Every `interval` frames the recorder
+ * also stores the display hash, which the player checks, so a replay
+ * that drifts is caught at the first frame that differs. On disk, equal
+ * frames are run-length encoded:
+ *
+ *   "C8MV", u8 version, u32 cpu_hz, u64 seed, u32 rom hash, u32 frames,
+ *   u32 runs, u32 interval, u32 hashes, runs x { u16 keys, u16 frames },
+ *   hashes x u64                                   (little-endian)
+ *
+ * Version 1 movies have no interval, hashes or hash list.
+ */
+#define MOVIE_VERSION 2
+#define MOVIE_INTERVAL 60   /* frames between recorded hashes */
+
+typedef struct {
+    long cpu_hz;
+    uint64_t seed;
+    uint32_t rom_hash;   /* movie_rom_hash of the machine after loading the ROM */
+    uint16_t *keys;      /* one bitmask per frame, bit k = key k */
+    size_t frames;
+    size_t cap;
+    uint32_t interval;   /* frames per display hash; 0 = none */
+    uint64_t *hashes;    /* movie_display_hash after frame (i + 1) * interval */
+    size_t hash_count;
+    size_t hash_cap;
+} movie_t;
+
+/* FNV-1a over program memory; identifies the ROM a movie belongs to */
+uint32_t movie_rom_hash(const chip8_t *chip);
+
+/* FNV-1a over the display, packed 8 pixels per byte with the leftmost in
+ * the top bit, as chip8_headless prints it */
+uint64_t movie_display_hash(const chip8_t *chip);
+
+/* Start an empty movie for a machine that has just loaded its ROM, with
+ * a display hash every MOVIE_INTERVAL frames */
+void movie_init(movie_t *m, const chip8_t *chip, long cpu_hz, uint64_t seed);
+void movie_free(movie_t *m);
+
+/* Append the next frame's keys; false if out of memory */
+bool movie_record(movie_t *m, uint16_t keys);
+
+/* Call once the frame just recorded has run: stores the display hash if
+ * the frame ends an interval. False if out of memory. */
+bool movie_checkpoint(movie_t *m, const chip8_t *chip);
+
+/* Display hash recorded after `frames` frames, or false if there is none */
+bool movie_hash_at(const movie_t *m, size_t frames, uint64_t *hash);
+
+/* Drop frames from `frames` on, and their hashes, e.g. after rewinding */
+void movie_truncate(movie_t *m, size_t frames);
+
+bool movie_save(const movie_t *m, const char *path);
+bool movie_load(movie_t *m, const char *path);
+
+/* Set the keypad for `frame`; no keys once the movie has ended */
+void movie_apply(const movie_t *m, size_t frame, chip8_t *chip);
+
+#endif
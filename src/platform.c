@@ -1,6 +1,14 @@
 #include "platform.h"
 #include <string.h>
 
+const tel_metric_desc_t platform_metrics[TEL_COUNT] = {
+    { "period",  "PER" },
+    { "emulate", "EMU" },
+    { "sleep",   "SLP" },
+    { "upload",  "UPL" },
+    { "present", "PRS" },
+};
+
 bool platform_init(platform_t *plat, const char *title, int scale) {
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
@@ -24,8 +32,10 @@ bool platform_init(platform_t *plat, const char *title, int scale) {
         return false;
     }
 
+    /* No PRESENTVSYNC: a blocking present would delay input polling on
+     * the main thread. Its pacer limits presents to refresh_hz instead. */
     plat->renderer = SDL_CreateRenderer(plat->window, -1,
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        SDL_RENDERER_ACCELERATED);
     if (!plat->renderer) {
         fprintf(stderr, "SDL_CreateRenderer failed: %s\n", SDL_GetError());
         SDL_DestroyWindow(plat->window);
@@ -45,6 +55,15 @@ bool platform_init(platform_t *plat, const char *title, int scale) {
         return false;
     }
 
+    SDL_DisplayMode mode;
+    int display_index = SDL_GetWindowDisplayIndex(plat->window);
+    if (display_index >= 0 && SDL_GetCurrentDisplayMode(display_index, &mode) == 0 &&
+        mode.refresh_rate > 0)
+        plat->refresh_hz = mode.refresh_rate;
+    else
+        plat->refresh_hz = 60;
+
+    plat->shown_valid = false;
     return true;
 }
 
@@ -55,27 +74,64 @@ void platform_destroy(platform_t *plat) {
     SDL_Quit();
 }
 
-void platform_render(platform_t *plat, const uint8_t *display, int width, int height) {
-    /* Convert the 1-bit-per-byte display buffer into RGBA8888 pixels.
+void platform_render(platform_t *plat, const uint64_t *display, int height, telemetry_t *tel) {
+    Uint64 t0 = tel ? SDL_GetPerformanceCounter() : 0;
+    bool overlay = tel && tel->overlay;
+
+    /* Find the span of rows that differ from what the texture already
+     * holds; only that span is locked and rewritten. The overlay needs
+     * the whole display redrawn under it every time. */
+    int first = -1, last = -1;
+    for (int y = 0; y < height; y++) {
+        if (overlay || !plat->shown_valid || display[y] != plat->shown[y]) {
+            if (first < 0) first = y;
+            last = y;
+        }
+    }
+
+    /* Unpack each 64-bit row straight into the locked texture memory.
      * Pixel on  (1) = white (0xFFFFFFFF)
      * Pixel off (0) = black (0x000000FF)
      *
      * RGBA8888 byte order in a uint32: 0xRRGGBBAA
      */
-    uint32_t pixels[64 * 32];
-    for (int i = 0; i < width * height; i++) {
-        pixels[i] = display[i] ? 0xFFFFFFFF : 0x000000FF;
+    if (first >= 0) {
+        SDL_Rect rect = { 0, first, 64, last - first + 1 };
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(plat->texture, &rect, &pixels, &pitch) == 0) {
+            for (int y = first; y <= last; y++) {
+                uint32_t *dst = (uint32_t *)((uint8_t *)pixels + (y - first) * pitch);
+                uint64_t row = display[y];
+                for (int x = 0; x < 64; x++)
+                    dst[x] = ((row >> (63 - x)) & 1) ? 0xFFFFFFFF : 0x000000FF;
+                plat->shown[y] = row;
+            }
+            if (overlay)
+                telemetry_draw(tel, pixels, pitch / (int)sizeof(uint32_t), 64, height,
+                               0xFFFF00FF, 0x000000FF);
+            SDL_UnlockTexture(plat->texture);
+            /* Under the overlay the texture no longer matches shown[] */
+            plat->shown_valid = !overlay;
+        }
     }
 
-    SDL_UpdateTexture(plat->texture, NULL, pixels, (int)(width * sizeof(uint32_t)));
+    Uint64 t1 = tel ? SDL_GetPerformanceCounter() : 0;
     SDL_RenderClear(plat->renderer);
     SDL_RenderCopy(plat->renderer, plat->texture, NULL, NULL);
     SDL_RenderPresent(plat->renderer);
+
+    if (tel) {
+        telemetry_add(tel, TEL_UPLOAD, t1 - t0);
+        telemetry_add(tel, TEL_PRESENT, SDL_GetPerformanceCounter() - t1);
+    }
 }
 
-bool platform_handle_input(uint8_t *keypad) {
+bool platform_handle_input(uint8_t *keypad, unsigned *hotkeys) {
     SDL_Event event;
 
+    *hotkeys = 0;
+
     while (SDL_PollEvent(&event)) {
         if (event.type == SDL_QUIT) {
             return false;
@@ -114,6 +170,13 @@ bool platform_handle_input(uint8_t *keypad) {
                 case SDLK_c: keypad[0xB] = value; break;
                 case SDLK_v: keypad[0xF] = value; break;
 
+                case SDLK_F5:
+                    if (value) *hotkeys |= PLATFORM_HOTKEY_SAVE;
+                    break;
+                case SDLK_F7:
+                    if (value) *hotkeys |= PLATFORM_HOTKEY_LOAD;
+                    break;
+
                 case SDLK_ESCAPE:
                     return false;
 
@@ -123,5 +186,8 @@ bool platform_handle_input(uint8_t *keypad) {
         }
     }
 
+    if (SDL_GetKeyboardState(NULL)[SDL_SCANCODE_BACKSPACE])
+        *hotkeys |= PLATFORM_HOTKEY_REWIND;
+
     return true;
 }
@@ -1,6 +1,7 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include "telemetry.h"
 #include <SDL.h>
 #include <stdbool.h>
 
@@ -8,11 +9,41 @@ typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+
+    /* Rows currently in the texture, so render can skip unchanged ones */
+    uint64_t shown[32];
+    bool shown_valid;
+
+    /* Refresh rate of the window's display, for pacing presents */
+    int refresh_hz;
 } platform_t;
 
+/* Frame-time metrics, numbered for telemetry_add and described in
+ * platform_metrics for telemetry_init */
+typedef enum {
+    /* Emulation thread, once per loop iteration */
+    TEL_PERIOD,     /* start of one iteration to the next */
+    TEL_EMULATE,    /* the iteration without its sleep */
+    TEL_SLEEP,      /* audio_wait or sched_wait */
+    /* Main thread, once per presented display */
+    TEL_UPLOAD,     /* display (and overlay) into the texture */
+    TEL_PRESENT,    /* RenderCopy and RenderPresent */
+    TEL_COUNT
+} tel_metric_t;
+
+extern const tel_metric_desc_t platform_metrics[TEL_COUNT];
+
 bool platform_init(platform_t *plat, const char *title, int scale);
 void platform_destroy(platform_t *plat);
-void platform_render(platform_t *plat, const uint8_t *display, int width, int height);
-bool platform_handle_input(uint8_t *keypad);
+/* Show a display. With telemetry (tel non-NULL) the upload and present
+ * are recorded, and the overlay is drawn over the display if it is on. */
+void platform_render(platform_t *plat, const uint64_t *display, int height, telemetry_t *tel);
+/* Frontend hotkeys reported by platform_handle_input (on key press,
+ * except rewind, which is reported for as long as it is held) */
+#define PLATFORM_HOTKEY_SAVE   0x01   /* F5: save state */
+#define PLATFORM_HOTKEY_LOAD   0x02   /* F7: load state */
+#define PLATFORM_HOTKEY_REWIND 0x04   /* Backspace held: rewind */
+
+bool platform_handle_input(uint8_t *keypad, unsigned *hotkeys);
 
 #endif
@@ -0,0 +1,111 @@
+#include "sched.h"
+#include <SDL.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FRAME_HZ    60
+#define MAX_CATCHUP 4   /* frames run back-to-back before the rest is dropped */
+
+const sched_profile_t sched_profiles[] = {
+    { "classic", 500  },   /* this emulator's historical speed */
+    { "modern",  700  },   /* what most current CHIP-8 ROMs are tuned for */
+    { "schip",   1000 },
+    { "turbo",   2000 },
+    { NULL, 0 },
+};
+
+long sched_profile_hz(const char *name) {
+    for (const sched_profile_t *p = sched_profiles; p->name; p++) {
+        if (strcmp(p->name, name) == 0)
+            return p->cpu_hz;
+    }
+    return 0;
+}
+
+/* Counter value at which frame `k` is due */
+static uint64_t deadline(const sched_t *s, uint64_t k) {
+    return s->origin + k * s->freq / FRAME_HZ;
+}
+
+void sched_init(sched_t *s, long cpu_hz, int refresh_hz) {
+    memset(s, 0, sizeof(*s));
+    s->freq = SDL_GetPerformanceFrequency();
+    s->origin = SDL_GetPerformanceCounter();
+    s->cpu_hz = cpu_hz;
+    if (refresh_hz <= 0)
+        refresh_hz = FRAME_HZ;
+    s->present_interval = s->freq / (uint64_t)refresh_hz;
+    s->report_at = s->origin + s->freq;
+}
+
+int sched_frames_due(sched_t *s) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t target = (now - s->origin) * FRAME_HZ / s->freq + 1;
+    if (target <= s->frame)
+        return 0;
+
+    uint64_t due = target - s->frame;
+    if (due > MAX_CATCHUP) {
+        /* Too far behind to catch up without a visible burst: skip the
+         * backlog so emulated time resumes from now. */
+        s->dropped += due - MAX_CATCHUP;
+        due = MAX_CATCHUP;
+    }
+    s->frame = target;
+
+    if (s->dropped && now >= s->report_at) {
+        fprintf(stderr, "Scheduler: fell behind, dropped %llu frame(s)\n",
+                (unsigned long long)s->dropped);
+        s->dropped = 0;
+        s->report_at = now + s->freq;
+    }
+    return (int)due;
+}
+
+long sched_frame_cycles(sched_t *s) {
+    s->cycle_acc += s->cpu_hz;
+    long n = s->cycle_acc / FRAME_HZ;
+    s->cycle_acc %= FRAME_HZ;
+    return n;
+}
+
+/* Counter ticks after a present before the next one is allowed. A
+ * quarter interval of jitter is allowed so a present that lands just
+ * early does not halve the frame rate. */
+static uint64_t present_gap(const sched_t *s) {
+    return s->present_interval - s->present_interval / 4;
+}
+
+bool sched_can_present(const sched_t *s) {
+    if (!s->presented)
+        return true;
+    uint64_t now = SDL_GetPerformanceCounter();
+    return now - s->last_present >= present_gap(s);
+}
+
+void sched_presented(sched_t *s) {
+    s->last_present = SDL_GetPerformanceCounter();
+    s->presented = true;
+}
+
+uint32_t sched_present_delay_ms(const sched_t *s) {
+    if (!s->presented)
+        return 0;
+    uint64_t elapsed = SDL_GetPerformanceCounter() - s->last_present;
+    if (elapsed >= present_gap(s))
+        return 0;
+    uint64_t wait = present_gap(s) - elapsed;
+    return (uint32_t)((wait * 1000 + s->freq - 1) / s->freq);
+}
+
+void sched_wait(const sched_t *s) {
+    uint64_t next = deadline(s, s->frame);
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (now >= next)
+        return;
+
+    /* Round up: waking a fraction of a millisecond late is harmless since
+     * deadlines are absolute, and it saves a second wakeup per frame. */
+    uint64_t ms = ((next - now) * 1000 + s->freq - 1) / s->freq;
+    SDL_Delay((Uint32)ms);
+}
@@ -0,0 +1,64 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Frame scheduler for the SDL frontend.
+ *
+ * Emulated time advances in 60 Hz frames: each frame runs cpu_hz / 60
+ * CPU cycles (fractions carried, no drift) and then ticks the timers.
+ * Frame deadlines are computed from a high-resolution counter relative to
+ * a fixed origin, so rounding never accumulates. Presents are limited to
+ * one per display refresh. If the host falls more than a few frames
+ * behind, the backlog is dropped and reported instead of being raced
+ * through. */
+typedef struct {
+    uint64_t freq;            /* counter ticks per second */
+    uint64_t origin;          /* counter value of frame 0 */
+    uint64_t frame;           /* next frame to emulate */
+    long cpu_hz;
+    long cycle_acc;           /* fractional cycles, in 1/60ths */
+
+    uint64_t present_interval;  /* counter ticks per display refresh */
+    uint64_t last_present;
+    bool presented;
+
+    /* Falling-behind bookkeeping, reported at most once per second */
+    uint64_t dropped;
+    uint64_t report_at;
+} sched_t;
+
+typedef struct {
+    const char *name;
+    long cpu_hz;
+} sched_profile_t;
+
+/* Named CPU speeds; NULL-terminated */
+extern const sched_profile_t sched_profiles[];
+
+/* Look up a profile by name; returns its Hz or 0 if unknown */
+long sched_profile_hz(const char *name);
+
+void sched_init(sched_t *s, long cpu_hz, int refresh_hz);
+
+/* Number of frames whose deadline has passed. Call once per loop
+ * iteration and emulate that many frames. */
+int sched_frames_due(sched_t *s);
+
+/* CPU cycles to run for the next emulated frame */
+long sched_frame_cycles(sched_t *s);
+
+/* True if a present now would not exceed the display refresh rate.
+ * Call sched_presented after actually presenting. */
+bool sched_can_present(const sched_t *s);
+void sched_presented(sched_t *s);
+
+/* Milliseconds until sched_can_present turns true, rounded up; 0 if it
+ * already is */
+uint32_t sched_present_delay_ms(const sched_t *s);
+
+/* Sleep until the next frame is due */
+void sched_wait(const sched_t *s);
+
+#endif